@@ -0,0 +1,801 @@
+﻿// -----------------------------------------------------------------------------------------
+// QSVEnc/NVEnc by rigaya
+// -----------------------------------------------------------------------------------------
+// The MIT License
+//
+// Copyright (c) 2011-2016 rigaya
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// ------------------------------------------------------------------------------------------
+
+// CPUで処理するホットなカーネルのマイクロベンチマーク
+// 各カーネルを利用可能なSIMDごとに実行し、スループットを表示・JSONに出力する
+// JSONはコミット間で比較できるよう、計測値以外は常に同じ順序で出力する
+// 色空間変換はポータブルなSIMD版(aarch64ではNEON)の出力がC版と一致するかも確認する
+
+#include <vector>
+#include <string>
+#include <chrono>
+#include <thread>
+#include <fstream>
+#include <algorithm>
+#include <functional>
+#include <cstdio>
+#include <cstring>
+#include "rgy_version.h"
+#include "rgy_util.h"
+#include "rgy_simd.h"
+#include "rgy_prm.h"
+#include "rgy_frame.h"
+#include "rgy_queue.h"
+#include "rgy_thread_pool.h"
+#include "rgy_memmem.h"
+#include "rgy_bitstream.h"
+#include "rgy_faw.h"
+#include "convert_csp.h"
+#include "cpu_info.h"
+
+struct BenchResult {
+    std::string group;   //カーネルの種類
+    std::string name;    //カーネル名
+    std::string simd;    //使用したSIMD
+    std::string size;    //入力サイズ
+    int64_t iterations;  //計測に使った実行回数
+    double sec;          //1回あたりの処理時間(秒)
+    double bytes;        //1回あたりの処理バイト数 (0ならGB/sは出力しない)
+    double ops;          //1回あたりの処理数 (0ならops/sは出力しない)
+};
+
+struct BenchParam {
+    double minSec;               //1回の計測の最短時間
+    int repeat;                  //計測の繰り返し回数 (最速の値を採用)
+    std::vector<tstring> filter; //group/nameにいずれかを含むもののみ実行
+    tstring output;              //JSONの出力先
+    bool checkOnly;              //計測せず、ポータブルなSIMD版とC版の出力の比較のみ行う
+};
+
+class BenchRunner {
+public:
+    BenchRunner(const BenchParam& prm) : m_prm(prm), m_results(), m_checkFailed(0) {};
+
+    bool enabled(const std::string& group, const std::string& name) const {
+        if (m_prm.filter.size() == 0) {
+            return true;
+        }
+        const auto key = group + "/" + name;
+        for (const auto& f : m_prm.filter) {
+            if (key.find(tchar_to_string(f)) != std::string::npos) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    //minSec以上かかる実行回数を求めてから、repeat回計測して最速の値を採用する
+    void run(const std::string& group, const std::string& name, const std::string& simd, const std::string& size,
+        double bytes, double ops, std::function<void()> func) {
+        if (!enabled(group, name) || m_prm.checkOnly) {
+            return;
+        }
+        func(); //ウォームアップ
+        int64_t iterations = 1;
+        for (;;) {
+            const double sec = measure(func, iterations);
+            if (sec >= m_prm.minSec || iterations >= ((int64_t)1 << 30)) {
+                break;
+            }
+            const double scale = (sec > 0.0) ? m_prm.minSec * 1.2 / sec : 16.0;
+            iterations = std::max(iterations * 2, (int64_t)(iterations * std::min(scale, 16.0)));
+        }
+        double best = std::numeric_limits<double>::max();
+        for (int i = 0; i < m_prm.repeat; i++) {
+            best = std::min(best, measure(func, iterations));
+        }
+        add(group, name, simd, size, iterations, best / iterations, bytes, ops);
+    }
+
+    //スレッド間の処理など、1回の実行の中で時間を計測する場合
+    void add(const std::string& group, const std::string& name, const std::string& simd, const std::string& size,
+        int64_t iterations, double sec, double bytes, double ops) {
+        BenchResult result = { group, name, simd, size, iterations, sec, bytes, ops };
+        print(result);
+        m_results.push_back(result);
+    }
+
+    //ポータブルなSIMD版の出力をC版と比較した結果を表示する
+    void check(const std::string& group, const std::string& name, const std::string& simd, const std::string& size, bool ok) {
+        _ftprintf(stdout, _T("%-10s %-24s %-8s %-10s %s\n"),
+            char_to_tstring(group).c_str(), char_to_tstring(name).c_str(), char_to_tstring(simd).c_str(), char_to_tstring(size).c_str(),
+            (ok) ? _T("check OK") : _T("check NG (output differs from c)"));
+        fflush(stdout);
+        if (!ok) {
+            m_checkFailed++;
+        }
+    }
+    int checkFailed() const { return m_checkFailed; }
+    bool checkOnly() const { return m_prm.checkOnly; }
+
+    RGY_ERR writeJson() const;
+private:
+    double measure(const std::function<void()>& func, int64_t iterations) const {
+        const auto start = std::chrono::steady_clock::now();
+        for (int64_t i = 0; i < iterations; i++) {
+            func();
+        }
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+    void print(const BenchResult& r) const {
+        tstring str = strsprintf(_T("%-10s %-24s %-8s %-10s"),
+            char_to_tstring(r.group).c_str(), char_to_tstring(r.name).c_str(), char_to_tstring(r.simd).c_str(), char_to_tstring(r.size).c_str());
+        if (r.bytes > 0.0) {
+            str += strsprintf(_T(" %9.3f GB/s"), r.bytes / r.sec * 1e-9);
+        }
+        if (r.ops > 0.0) {
+            str += strsprintf(_T(" %14.1f ops/s"), r.ops / r.sec);
+        }
+        _ftprintf(stdout, _T("%s\n"), str.c_str());
+        fflush(stdout);
+    }
+
+    BenchParam m_prm;
+    std::vector<BenchResult> m_results;
+    int m_checkFailed; //C版と出力が一致しなかった数
+};
+
+static std::string json_escape(const std::string& s) {
+    std::string out;
+    for (unsigned char c : s) {
+        switch (c) {
+        case '"':  out += "\\\""; break;
+        case '\\': out += "\\\\"; break;
+        default:
+            if (c < 0x20) {
+                out += strsprintf("\\u%04x", (unsigned)c);
+            } else {
+                out += (char)c;
+            }
+            break;
+        }
+    }
+    return out;
+}
+
+RGY_ERR BenchRunner::writeJson() const {
+    if (m_prm.output.length() == 0) {
+        return RGY_ERR_NONE;
+    }
+    std::ofstream ofs(m_prm.output);
+    if (!ofs) {
+        return RGY_ERR_FILE_OPEN;
+    }
+    TCHAR cpuInfo[256] = { 0 };
+    getCPUInfo(cpuInfo, _countof(cpuInfo));
+    ofs << "{\n";
+    ofs << "  \"version\": \"" << json_escape(tchar_to_string(get_encoder_version())) << "\",\n";
+    ofs << "  \"cpu\": \"" << json_escape(tchar_to_string(cpuInfo)) << "\",\n";
+    ofs << "  \"simd\": \"" << json_escape(tchar_to_string(get_simd_str(get_availableSIMD()))) << "\",\n";
+    ofs << "  \"results\": [\n";
+    for (size_t i = 0; i < m_results.size(); i++) {
+        const auto& r = m_results[i];
+        ofs << "    {";
+        ofs << "\"group\": \"" << json_escape(r.group) << "\"";
+        ofs << ", \"name\": \"" << json_escape(r.name) << "\"";
+        ofs << ", \"simd\": \"" << json_escape(r.simd) << "\"";
+        ofs << ", \"size\": \"" << json_escape(r.size) << "\"";
+        ofs << ", \"iterations\": " << r.iterations;
+        ofs << strsprintf(", \"ns_per_iter\": %.1f", r.sec * 1e9);
+        if (r.bytes > 0.0) {
+            ofs << strsprintf(", \"gbps\": %.4f", r.bytes / r.sec * 1e-9);
+        }
+        if (r.ops > 0.0) {
+            ofs << strsprintf(", \"ops_per_sec\": %.1f", r.ops / r.sec);
+        }
+        ofs << "}" << ((i + 1 < m_results.size()) ? "," : "") << "\n";
+    }
+    ofs << "  ]\n";
+    ofs << "}\n";
+    return ofs.good() ? RGY_ERR_NONE : RGY_ERR_UNKNOWN;
+}
+
+//再現性のため、乱数は固定のシードで生成する
+class BenchRandom {
+public:
+    BenchRandom(uint32_t seed) : m_state(seed) {};
+    uint32_t next() {
+        m_state ^= m_state << 13;
+        m_state ^= m_state >> 17;
+        m_state ^= m_state << 5;
+        return m_state;
+    }
+    void fill(uint8_t *ptr, size_t size) {
+        for (size_t i = 0; i < size; i++) {
+            ptr[i] = (uint8_t)(next() >> 24);
+        }
+    }
+private:
+    uint32_t m_state;
+};
+
+//各カーネルのSIMD版
+template<typename Func>
+struct BenchKernel {
+    const char *simd;
+    RGY_SIMD required;
+    Func *func;
+};
+
+template<typename Func>
+static std::vector<BenchKernel<Func>> kernels_available(std::initializer_list<BenchKernel<Func>> list) {
+    const auto simd = get_availableSIMD();
+    std::vector<BenchKernel<Func>> available;
+    for (const auto& k : list) {
+        if (k.func && (simd & k.required) == k.required) {
+            available.push_back(k);
+        }
+    }
+    return available;
+}
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__x86_64)
+#define BENCH_KERNEL_AVX2(func)     { "avx2",     RGY_SIMD::AVX2,     func },
+#else
+#define BENCH_KERNEL_AVX2(func)
+#endif
+#if defined(_M_X64) || defined(__x86_64)
+#define BENCH_KERNEL_AVX512BW(func) { "avx512bw", RGY_SIMD::AVX512BW, func },
+#else
+#define BENCH_KERNEL_AVX512BW(func)
+#endif
+
+static std::string size_str(size_t size) {
+    return (size >= 1024 * 1024) ? strsprintf("%zuMB", size >> 20) : strsprintf("%zuKB", size >> 10);
+}
+
+//yuy2->nv12などの一部の関数は色差が輝度の直後にあることを前提とするので、
+//全プレーンを連続した1つのバッファに確保する
+class BenchFrame {
+public:
+    BenchFrame() : m_info(), m_buf(), m_size(0) {};
+    RGY_ERR allocate(int width, int height, RGY_CSP csp) {
+        //pitchはRGYSysFrameと同じにする
+        RGYSysFrame sysFrame;
+        auto err = sysFrame.allocate(width, height, csp, RGY_CSP_BIT_DEPTH[csp]);
+        if (err != RGY_ERR_NONE) {
+            return err;
+        }
+        m_info = sysFrame.frameInfo();
+        sysFrame.deallocate();
+        size_t size = 0;
+        for (int i = 0; i < RGY_CSP_PLANES[csp]; i++) {
+            size += (size_t)m_info.pitch[i] * getPlane(&m_info, (RGY_PLANE)i).height;
+        }
+        m_buf.reset((uint8_t *)_aligned_malloc(size, 64));
+        if (!m_buf) {
+            return RGY_ERR_NULL_PTR;
+        }
+        m_size = size;
+        uint8_t *ptr = m_buf.get();
+        for (int i = 0; i < RGY_CSP_PLANES[csp]; i++) {
+            m_info.ptr[i] = ptr;
+            ptr += (size_t)m_info.pitch[i] * getPlane(&m_info, (RGY_PLANE)i).height;
+        }
+        return RGY_ERR_NONE;
+    }
+    RGYFrameInfo plane(int i) const { return getPlane(&m_info, (RGY_PLANE)i); }
+    RGY_CSP csp() const { return m_info.csp; }
+    void fill(uint8_t value) { memset(m_buf.get(), value, m_size); }
+    int pitch(RGY_PLANE plane) const { return getPlane(&m_info, plane).pitch[0]; }
+    void ptrArray(void *array[RGY_MAX_PLANES]) const {
+        for (int i = 0; i < RGY_MAX_PLANES; i++) {
+            array[i] = (void *)getPlane(&m_info, (RGY_PLANE)i).ptr[0];
+        }
+    }
+private:
+    RGYFrameInfo m_info;
+    std::unique_ptr<uint8_t, aligned_malloc_deleter> m_buf;
+    size_t m_size;
+};
+
+//pitchの余白を除いた有効な領域が一致するかを返す
+static bool frame_equal(const BenchFrame& a, const BenchFrame& b) {
+    for (int i = 0; i < RGY_CSP_PLANES[a.csp()]; i++) {
+        const auto pa = a.plane(i);
+        const auto pb = b.plane(i);
+        const size_t widthByte = (size_t)pa.width * bytesPerPix(a.csp());
+        for (int y = 0; y < pa.height; y++) {
+            if (memcmp(pa.ptr[0] + (size_t)pa.pitch[0] * y, pb.ptr[0] + (size_t)pb.pitch[0] * y, widthByte) != 0) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+static void fill_convert_csp_src(BenchFrame& src, BenchRandom& rnd) {
+    const auto csp = src.csp();
+    for (int iplane = 0; iplane < RGY_CSP_PLANES[csp]; iplane++) {
+        const auto plane = src.plane(iplane);
+        rnd.fill(plane.ptr[0], (size_t)plane.pitch[0] * plane.height);
+        if (RGY_CSP_BIT_DEPTH[csp] > 8) {
+            //上位ビットに有効な値が入るようにする
+            const int shift = (csp == RGY_CSP_P010) ? 0 : 16 - RGY_CSP_BIT_DEPTH[csp];
+            auto ptr = (uint16_t *)plane.ptr[0];
+            for (size_t j = 0; j < (size_t)plane.pitch[0] * plane.height / sizeof(uint16_t); j++) {
+                ptr[j] = (csp == RGY_CSP_P010) ? (ptr[j] & 0xffc0) : (ptr[j] >> shift);
+            }
+        }
+    }
+}
+
+static std::string convert_csp_simd_str(const ConvertCSP *convert) {
+    return (convert->simd == RGY_SIMD::NONE) ? "c" : tchar_to_string(get_simd_str(convert->simd));
+}
+
+//ポータブルなSIMD版(convert_csp_vec.cpp)の出力がC版と一致するかを確認する
+//x86のSSE/AVX版は一部の変換で丸めがC版と異なるため、対象としない
+//幅がSIMDのベクトル長の倍数でない場合の端数処理も確認できるよう、半端な解像度でも確認する
+static void check_convert_csp(BenchRunner& runner, const std::pair<RGY_CSP, RGY_CSP>& csp, const std::string& name,
+    const std::vector<const ConvertCSP *>& funcs, int width, int height) {
+    const auto ref = get_convert_csp_func(csp.first, csp.second, false, RGY_SIMD::NONE);
+    if (!ref) {
+        return;
+    }
+    BenchFrame src, dstRef, dst;
+    if (src.allocate(width, height, csp.first) != RGY_ERR_NONE
+        || dstRef.allocate(width, height, csp.second) != RGY_ERR_NONE
+        || dst.allocate(width, height, csp.second) != RGY_ERR_NONE) {
+        return;
+    }
+    BenchRandom rnd(24680);
+    fill_convert_csp_src(src, rnd);
+    void *srcArray[RGY_MAX_PLANES];
+    void *dstRefArray[RGY_MAX_PLANES];
+    void *dstArray[RGY_MAX_PLANES];
+    src.ptrArray(srcArray);
+    dstRef.ptrArray(dstRefArray);
+    dst.ptrArray(dstArray);
+    const int srcPitchY = src.pitch(RGY_PLANE_Y);
+    const int srcPitchUV = (RGY_CSP_PLANES[csp.first] > 1) ? src.pitch(RGY_PLANE_U) : srcPitchY;
+    const int dstPitchY = dst.pitch(RGY_PLANE_Y);
+    const int dstPitchUV = (RGY_CSP_PLANES[csp.second] > 1) ? dst.pitch(RGY_PLANE_U) : dstPitchY;
+    for (const auto& convert : funcs) {
+        if (convert == ref || (convert->simd & RGY_SIMD::VEC128) != RGY_SIMD::VEC128) {
+            continue;
+        }
+        bool ok = true;
+        for (int interlaced = 0; interlaced < 2; interlaced++) {
+            if (!convert->func[interlaced] || !ref->func[interlaced]) {
+                continue;
+            }
+            //書き込まれない画素があれば不一致となるよう、異なる値で初期化しておく
+            dstRef.fill(0x00);
+            dst.fill(0xff);
+            int crop[4] = { 0 };
+            ref->func[interlaced](dstRefArray, (const void **)srcArray, width, srcPitchY, srcPitchUV, dstPitchY, dstPitchUV, height, height, 0, 1, crop);
+            convert->func[interlaced](dstArray, (const void **)srcArray, width, srcPitchY, srcPitchUV, dstPitchY, dstPitchUV, height, height, 0, 1, crop);
+            ok &= frame_equal(dstRef, dst);
+        }
+        runner.check("csp", name, convert_csp_simd_str(convert), strsprintf("%dx%d", width, height), ok);
+    }
+}
+
+static void bench_convert_csp(BenchRunner& runner) {
+    static const std::pair<RGY_CSP, RGY_CSP> cspList[] = {
+        { RGY_CSP_NV12,   RGY_CSP_NV12 },
+        { RGY_CSP_P010,   RGY_CSP_P010 },
+        { RGY_CSP_NV12,   RGY_CSP_P010 },
+        { RGY_CSP_P010,   RGY_CSP_NV12 },
+        { RGY_CSP_NV12,   RGY_CSP_YV12 },
+        { RGY_CSP_P010,   RGY_CSP_YV12 },
+        { RGY_CSP_YV12,   RGY_CSP_NV12 },
+        { RGY_CSP_YV12_10, RGY_CSP_P010 },
+        { RGY_CSP_YUY2,   RGY_CSP_NV12 },
+        { RGY_CSP_YUV444, RGY_CSP_NV12 },
+        { RGY_CSP_YUV444, RGY_CSP_P010 },
+        { RGY_CSP_RGB24,  RGY_CSP_RGB32 },
+    };
+    static const std::pair<int, int> resList[] = {
+        { 1920, 1080 }, { 3840, 2160 }
+    };
+    static const std::pair<int, int> checkResList[] = {
+        { 1920, 1080 }, { 1282, 724 } //インタレ処理のため高さは4の倍数とする
+    };
+    const auto availableSIMD = get_availableSIMD();
+    for (const auto& csp : cspList) {
+        const auto name = tchar_to_string(RGY_CSP_NAMES[csp.first]) + "->" + tchar_to_string(RGY_CSP_NAMES[csp.second]);
+        if (!runner.enabled("csp", name)) {
+            continue;
+        }
+        //--simd-cspの各レベルで選択される関数のうち、重複しないものを計測する
+        std::vector<const ConvertCSP *> funcs;
+        for (int i = 0; list_simd[i].desc; i++) {
+            const auto simd = (RGY_SIMD)list_simd[i].value;
+            if ((simd & availableSIMD) != simd && simd != RGY_SIMD::SIMD_ALL) {
+                continue;
+            }
+            auto convert = get_convert_csp_func(csp.first, csp.second, false, simd);
+            if (convert && std::find(funcs.begin(), funcs.end(), convert) == funcs.end()) {
+                funcs.push_back(convert);
+            }
+        }
+        std::sort(funcs.begin(), funcs.end(), [](const ConvertCSP *a, const ConvertCSP *b) {
+            return (uint64_t)a->simd < (uint64_t)b->simd;
+        });
+        for (const auto& res : checkResList) {
+            check_convert_csp(runner, csp, name, funcs, res.first, res.second);
+        }
+        if (runner.checkOnly()) {
+            continue;
+        }
+        for (const auto& res : resList) {
+            BenchFrame src, dst;
+            if (src.allocate(res.first, res.second, csp.first) != RGY_ERR_NONE
+                || dst.allocate(res.first, res.second, csp.second) != RGY_ERR_NONE) {
+                continue;
+            }
+            BenchRandom rnd(12345);
+            fill_convert_csp_src(src, rnd);
+            void *dstArray[RGY_MAX_PLANES];
+            void *srcArray[RGY_MAX_PLANES];
+            dst.ptrArray(dstArray);
+            src.ptrArray(srcArray);
+            const int srcPitchY = src.pitch(RGY_PLANE_Y);
+            const int srcPitchUV = (RGY_CSP_PLANES[csp.first] > 1) ? src.pitch(RGY_PLANE_U) : srcPitchY;
+            const int dstPitchY = dst.pitch(RGY_PLANE_Y);
+            const int dstPitchUV = (RGY_CSP_PLANES[csp.second] > 1) ? dst.pitch(RGY_PLANE_U) : dstPitchY;
+            const double bytes = (double)res.first * res.second * RGY_CSP_BIT_PER_PIXEL[csp.first] / 8;
+            for (const auto& convert : funcs) {
+                int crop[4] = { 0 };
+                runner.run("csp", name, convert_csp_simd_str(convert), strsprintf("%dx%d", res.first, res.second), bytes, 1.0, [&]() {
+                    convert->func[0](dstArray, (const void **)srcArray, res.first, srcPitchY, srcPitchUV, dstPitchY, dstPitchUV, res.second, res.second, 0, 1, crop);
+                });
+            }
+        }
+    }
+}
+
+//映像のビットストリームを模擬したデータ (平均avgNalSizeごとにstart codeを挿入する)
+static std::vector<uint8_t> gen_annexb(size_t size, size_t avgNalSize, bool hevc, BenchRandom& rnd) {
+    std::vector<uint8_t> data(size);
+    rnd.fill(data.data(), data.size());
+    //emulation prevention済みのデータを模擬するため、0x00の連続を避ける
+    for (auto& b : data) {
+        if (b == 0x00) b = 0x80;
+    }
+    for (size_t pos = 0; pos + 6 < size; ) {
+        data[pos + 0] = 0x00;
+        data[pos + 1] = 0x00;
+        data[pos + 2] = 0x00;
+        data[pos + 3] = 0x01;
+        if (hevc) {
+            data[pos + 4] = (uint8_t)((rnd.next() % 2) << 1); //TRAIL_N / TRAIL_R
+            data[pos + 5] = 0x01;
+        } else {
+            data[pos + 4] = 0x41;
+        }
+        pos += avgNalSize / 2 + rnd.next() % avgNalSize;
+    }
+    return data;
+}
+
+static std::vector<uint8_t> gen_av1(size_t size, size_t avgObuSize, BenchRandom& rnd) {
+    std::vector<uint8_t> data;
+    data.reserve(size + avgObuSize * 2);
+    while (data.size() < size) {
+        const size_t obuSize = avgObuSize / 2 + rnd.next() % avgObuSize;
+        data.push_back((uint8_t)((6 /*OBU_FRAME*/ << 3) | 0x02));
+        for (size_t value = obuSize; ; ) {
+            const uint8_t byte = value & 0x7f;
+            value >>= 7;
+            data.push_back(byte | (value ? 0x80 : 0x00));
+            if (!value) break;
+        }
+        const auto offset = data.size();
+        data.resize(offset + obuSize);
+        rnd.fill(data.data() + offset, obuSize);
+    }
+    return data;
+}
+
+static void bench_bitstream(BenchRunner& runner) {
+    static const size_t sizeList[] = { 1 << 20, 16 << 20 };
+    for (const auto size : sizeList) {
+        BenchRandom rnd(54321);
+        const auto h264 = gen_annexb(size, 4096, false, rnd);
+        const auto hevc = gen_annexb(size, 4096, true, rnd);
+        const auto av1 = gen_av1(size, 4096, rnd);
+        const auto h264nals = (double)parse_nal_unit_h264_c(h264.data(), h264.size()).size();
+        const auto hevcnals = (double)parse_nal_unit_hevc_c(hevc.data(), hevc.size()).size();
+
+        for (const auto& k : kernels_available<decltype(parse_nal_unit_h264_c)>({
+            { "c", RGY_SIMD::NONE, parse_nal_unit_h264_c },
+            BENCH_KERNEL_AVX2(parse_nal_unit_h264_avx2)
+            BENCH_KERNEL_AVX512BW(parse_nal_unit_h264_avx512bw) })) {
+            runner.run("bitstream", "parse_nal_unit_h264", k.simd, size_str(size), (double)h264.size(), h264nals, [&]() {
+                k.func(h264.data(), h264.size());
+            });
+        }
+        for (const auto& k : kernels_available<decltype(parse_nal_unit_hevc_c)>({
+            { "c", RGY_SIMD::NONE, parse_nal_unit_hevc_c },
+            BENCH_KERNEL_AVX2(parse_nal_unit_hevc_avx2)
+            BENCH_KERNEL_AVX512BW(parse_nal_unit_hevc_avx512bw) })) {
+            runner.run("bitstream", "parse_nal_unit_hevc", k.simd, size_str(size), (double)hevc.size(), hevcnals, [&]() {
+                k.func(hevc.data(), hevc.size());
+            });
+        }
+        for (const auto& k : kernels_available<decltype(find_header_c)>({
+            { "c", RGY_SIMD::NONE, find_header_c },
+            BENCH_KERNEL_AVX2(find_header_avx2)
+            BENCH_KERNEL_AVX512BW(find_header_avx512bw) })) {
+            //バッファ全体のstart codeを順に探索する
+            runner.run("bitstream", "find_header", k.simd, size_str(size), (double)h264.size(), h264nals, [&]() {
+                for (size_t pos = 0; pos < h264.size(); ) {
+                    const auto ret = k.func(h264.data() + pos, h264.size() - pos);
+                    if (ret == RGY_MEMMEM_NOT_FOUND) break;
+                    pos += ret + 4;
+                }
+            });
+        }
+        const auto av1units = (double)parse_unit_av1(av1.data(), av1.size()).size();
+        runner.run("bitstream", "parse_unit_av1", "c", size_str(size), (double)av1.size(), av1units, [&]() {
+            parse_unit_av1(av1.data(), av1.size());
+        });
+    }
+}
+
+static void bench_memmem(BenchRunner& runner) {
+    static const size_t sizeList[] = { 64 << 10, 16 << 20 };
+    for (const auto size : sizeList) {
+        BenchRandom rnd(6789);
+        std::vector<uint8_t> data(size);
+        rnd.fill(data.data(), data.size());
+        //見つからないtargetを探索し、全体を走査させる
+        static const uint8_t target[16] = { 0x00, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77, 0x88, 0x99, 0xaa, 0xbb, 0xcc, 0xdd, 0xee, 0xff };
+        for (const auto& k : kernels_available<decltype(rgy_memmem_c)>({
+            { "c", RGY_SIMD::NONE, rgy_memmem_c },
+            BENCH_KERNEL_AVX2(rgy_memmem_avx2)
+            BENCH_KERNEL_AVX512BW(rgy_memmem_avx512bw) })) {
+            runner.run("memmem", "rgy_memmem", k.simd, size_str(size), (double)size, 0.0, [&]() {
+                k.func(data.data(), data.size(), target, sizeof(target));
+            });
+        }
+    }
+}
+
+static void bench_faw(BenchRunner& runner) {
+    static const size_t sizeList[] = { 64 << 10, 16 << 20 };
+    for (const auto size : sizeList) {
+        BenchRandom rnd(2468);
+        std::vector<uint8_t> data(size);
+        rnd.fill(data.data(), data.size());
+        for (const auto& k : kernels_available<decltype(rgy_memmem_fawstart1_c)>({
+            { "c", RGY_SIMD::NONE, rgy_memmem_fawstart1_c },
+            BENCH_KERNEL_AVX2(rgy_memmem_fawstart1_avx2)
+            BENCH_KERNEL_AVX512BW(rgy_memmem_fawstart1_avx512bw) })) {
+            runner.run("faw", "rgy_memmem_fawstart1", k.simd, size_str(size), (double)size, 0.0, [&]() {
+                k.func(data.data(), data.size());
+            });
+        }
+        const size_t samples = size / sizeof(short);
+        std::vector<uint8_t> dst0(samples), dst1(samples);
+        for (const auto& k : kernels_available<decltype(rgy_convert_audio_16to8)>({
+            { "c", RGY_SIMD::NONE, rgy_convert_audio_16to8 },
+            BENCH_KERNEL_AVX2(rgy_convert_audio_16to8_avx2) })) {
+            runner.run("faw", "rgy_convert_audio_16to8", k.simd, size_str(size), (double)size, 0.0, [&]() {
+                k.func(dst0.data(), (const short *)data.data(), samples);
+            });
+        }
+        for (const auto& k : kernels_available<decltype(rgy_split_audio_16to8x2)>({
+            { "c", RGY_SIMD::NONE, rgy_split_audio_16to8x2 },
+            BENCH_KERNEL_AVX2(rgy_split_audio_16to8x2_avx2) })) {
+            runner.run("faw", "rgy_split_audio_16to8x2", k.simd, size_str(size), (double)size, 0.0, [&]() {
+                k.func(dst0.data(), dst1.data(), (const short *)data.data(), samples / 2);
+            });
+        }
+    }
+}
+
+//producers個のスレッドから押し込み、このスレッドで取り出す (パイプラインのスレッド間の受け渡し)
+template<typename Queue>
+static void bench_queue_transfer(BenchRunner& runner, const char *name, Queue& queue, const int producers, const size_t capacity) {
+    static const int64_t count = 1 << 20;
+    const int64_t countPerThread = count / producers;
+    const auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> threads;
+    for (int ith = 0; ith < producers; ith++) {
+        threads.push_back(std::thread([&]() {
+            for (int64_t i = 0; i < countPerThread; i++) {
+                queue.push(i);
+            }
+        }));
+    }
+    const int64_t total = countPerThread * producers;
+    int64_t received = 0, value = 0;
+    while (received < total) {
+        if (queue.front_copy_and_pop_no_lock(&value)) {
+            received++;
+        } else {
+            queue.wait_for_push();
+        }
+    }
+    for (auto& th : threads) {
+        th.join();
+    }
+    const double sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    runner.add("queue", name, "-", strsprintf("p%d_cap%zu", producers, capacity), total, sec / total, 0.0, 1.0);
+}
+
+static void bench_queue(BenchRunner& runner) {
+    if (!runner.enabled("queue", "RGYQueue")) {
+        return;
+    }
+    {
+        //同一スレッドでpush/popを交互に行う (ロック・アトミック操作のコスト)
+        RGYQueueMPMP<int64_t> queue;
+        queue.init(1024);
+        runner.run("queue", "RGYQueueMPMP_push_pop", "-", "1thread", 0.0, 1.0, [&]() {
+            int64_t value = 0;
+            queue.push(value);
+            queue.front_copy_and_pop_no_lock(&value);
+        });
+    }
+    {
+        RGYQueueSPSC<int64_t> queue;
+        queue.init(1024);
+        runner.run("queue", "RGYQueueSPSC_push_pop", "-", "1thread", 0.0, 1.0, [&]() {
+            int64_t value = 0;
+            queue.push(value);
+            queue.front_copy_and_pop_no_lock(&value);
+        });
+    }
+    //押し込み側のスレッド数による競合の影響
+    static const size_t capacityList[] = { 16, 1024 };
+    static const int producersList[] = { 1, 2, 4, 8 };
+    for (const auto capacity : capacityList) {
+        {
+            RGYQueueSPSC<int64_t> queue;
+            queue.init(1024, capacity);
+            bench_queue_transfer(runner, "RGYQueueSPSC", queue, 1, capacity);
+        }
+        for (const auto producers : producersList) {
+            RGYQueueMPMP<int64_t> queue;
+            queue.init(1024, capacity);
+            bench_queue_transfer(runner, "RGYQueueMPMP", queue, producers, capacity);
+        }
+        for (const auto producers : producersList) {
+            RGYQueueMPSC<int64_t> queue;
+            queue.init(1024, capacity);
+            bench_queue_transfer(runner, "RGYQueueMPSC", queue, producers, capacity);
+        }
+    }
+}
+
+static void bench_thread_pool(BenchRunner& runner) {
+    if (!runner.enabled("threadpool", "RGYThreadPool")) {
+        return;
+    }
+    RGYThreadPool pool;
+    {
+        //1タスクの投入から完了待ちまで (タスクの受け渡しとワーカーの起床のコスト)
+        runner.run("threadpool", "RGYThreadPool_run_wait", "-", strsprintf("w%d", pool.size()), 0.0, 1.0, [&]() {
+            RGYThreadTaskGroup group;
+            int value = 0;
+            pool.run(group, [&value]() { value++; });
+            group.wait();
+        });
+    }
+    //CSP変換のようにフレームごとに行単位で分割する場合の分割・同期のコスト
+    static const int chunksList[] = { 2, 4, 8 };
+    for (const auto chunks : chunksList) {
+        std::vector<int> rows(1080);
+        runner.run("threadpool", "RGYThreadPool_parallel_for", "-", strsprintf("w%d_c%d", pool.size(), chunks), 0.0, 1.0, [&]() {
+            pool.parallel_for(0, (int)rows.size(), chunks, [&](int start, int end) {
+                for (int i = start; i < end; i++) rows[i]++;
+            }, 0);
+        });
+        //比較用: 毎回スレッドを起動する場合
+        runner.run("threadpool", "std_thread_spawn_join", "-", strsprintf("c%d", chunks), 0.0, 1.0, [&]() {
+            std::vector<std::thread> threads;
+            for (int ith = 1; ith < chunks; ith++) {
+                threads.push_back(std::thread([&, ith]() {
+                    for (int i = (int)rows.size() * ith / chunks; i < (int)rows.size() * (ith + 1) / chunks; i++) rows[i]++;
+                }));
+            }
+            for (int i = 0; i < (int)rows.size() / chunks; i++) rows[i]++;
+            for (auto& th : threads) th.join();
+        });
+    }
+}
+
+static void show_help() {
+    _ftprintf(stdout,
+        _T("rkmppbench - CPU kernel microbenchmark\n")
+        _T("\n")
+        _T("Usage: rkmppbench [options]\n")
+        _T("  -o, --output <string>   write results to json file\n")
+        _T("  --filter <string>       run only benchmarks whose group/name contains\n")
+        _T("                           the given string (can be set multiple times)\n")
+        _T("  --time <float>          minimum time to measure each benchmark [sec]\n")
+        _T("                           (default: 0.2)\n")
+        _T("  --repeat <int>          number of measurements, the fastest is used\n")
+        _T("                           (default: 3)\n")
+        _T("  --check                 only check that the portable simd (neon) color space\n")
+        _T("                           conversions give the same output as c, without measuring\n"));
+}
+
+int _tmain(int argc, TCHAR **argv) {
+    BenchParam prm;
+    prm.minSec = 0.2;
+    prm.repeat = 3;
+    prm.checkOnly = false;
+    for (int iarg = 1; iarg < argc; iarg++) {
+        const tstring arg = argv[iarg];
+        const bool hasValue = iarg + 1 < argc;
+        if ((arg == _T("-o") || arg == _T("--output")) && hasValue) {
+            prm.output = argv[++iarg];
+        } else if (arg == _T("--filter") && hasValue) {
+            prm.filter.push_back(argv[++iarg]);
+        } else if (arg == _T("--time") && hasValue) {
+            double value = 0.0;
+            if (1 != _stscanf_s(argv[++iarg], _T("%lf"), &value)) {
+                _ftprintf(stderr, _T("Invalid value for --time: %s\n"), argv[iarg]);
+                return 1;
+            }
+            prm.minSec = std::max(0.001, value);
+        } else if (arg == _T("--repeat") && hasValue) {
+            prm.repeat = std::max(1, (int)_tcstol(argv[++iarg], nullptr, 10));
+        } else if (arg == _T("--check")) {
+            prm.checkOnly = true;
+        } else if (arg == _T("-h") || arg == _T("--help")) {
+            show_help();
+            return 0;
+        } else {
+            _ftprintf(stderr, _T("Unknown option or missing value: %s\n"), arg.c_str());
+            show_help();
+            return 1;
+        }
+    }
+    TCHAR cpuInfo[256] = { 0 };
+    getCPUInfo(cpuInfo, _countof(cpuInfo));
+    _ftprintf(stdout, _T("%s\n"), get_encoder_version());
+    _ftprintf(stdout, _T("CPU : %s\n"), cpuInfo);
+    _ftprintf(stdout, _T("SIMD: %s\n\n"), get_simd_str(get_availableSIMD()));
+
+    BenchRunner runner(prm);
+    bench_convert_csp(runner);
+    if (!prm.checkOnly) {
+        bench_bitstream(runner);
+        bench_memmem(runner);
+        bench_faw(runner);
+        bench_queue(runner);
+        bench_thread_pool(runner);
+
+        const auto err = runner.writeJson();
+        if (err != RGY_ERR_NONE) {
+            _ftprintf(stderr, _T("Failed to write %s: %s\n"), prm.output.c_str(), get_err_mes(err));
+            return 1;
+        }
+    }
+    if (runner.checkFailed() > 0) {
+        _ftprintf(stderr, _T("%d portable simd color space conversion(s) gave different output from c.\n"), runner.checkFailed());
+        return 1;
+    }
+    return 0;
+}
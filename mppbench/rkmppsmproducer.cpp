@@ -0,0 +1,324 @@
+﻿// -----------------------------------------------------------------------------------------
+// QSVEnc/NVEnc by rigaya
+// -----------------------------------------------------------------------------------------
+// The MIT License
+//
+// Copyright (c) 2011-2016 rigaya
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// --------------------------------------------------------------------------------------------
+
+// 共有メモリ入力(rkmppenc --sm)にフレームを渡す、参考用の生産者
+// rkmppenc --sm -i <name> ... と組み合わせて使用する
+// 生の動画ファイル(または標準入力)か、テストパターンをリングに書き込む
+
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include "rgy_version.h"
+#include "rgy_util.h"
+#include "rgy_event.h"
+#include "rgy_input_sm_ring.h"
+
+#if defined(_WIN32) || defined(_WIN64)
+
+int _tmain(int argc, TCHAR **argv) {
+    UNREFERENCED_PARAMETER(argc);
+    UNREFERENCED_PARAMETER(argv);
+    _ftprintf(stderr, _T("rkmppsmproducer is supported only on Linux.\n"));
+    return 1;
+}
+
+#else
+
+#include <signal.h>
+#include "rgy_shared_mem.h"
+
+struct ProducerParam {
+    tstring name;
+    tstring input;     //"-"なら標準入力、空ならテストパターン
+    int width;
+    int height;
+    int fpsN;
+    int fpsD;
+    RGY_CSP csp;
+    int slots;
+    int frames;        //テストパターンのフレーム数
+};
+
+static volatile sig_atomic_t g_abort = 0;
+
+static void sig_handler(int) {
+    g_abort = 1;
+}
+
+static void show_help() {
+    _ftprintf(stdout,
+        _T("rkmppsmproducer - reference producer for shared memory input (--sm)\n")
+        _T("\n")
+        _T("Usage: rkmppsmproducer [options] --name <string>\n")
+        _T("  then run: rkmppenc --sm -i <string> -o <output> ...\n")
+        _T("\n")
+        _T("  --name <string>         name of the shared memory (/dev/shm/<string>)\n")
+        _T("  -i, --input <string>    raw input file (\"-\" for stdin)\n")
+        _T("                           if not set, a test pattern is written\n")
+        _T("  --input-res <int>x<int> resolution (default: 1920x1080)\n")
+        _T("  --fps <int>/<int>       frame rate (default: 30/1)\n")
+        _T("  --input-csp <string>    nv12, yv12, p010 (default: nv12)\n")
+        _T("  --slots <int>           number of frames in the ring (default: 4)\n")
+        _T("  --frames <int>          number of frames of the test pattern\n")
+        _T("                           (default: 300)\n"));
+}
+
+//1行あたりのバイト数と、行数 (平面ごと)
+struct PlaneLayout {
+    int rowBytes;
+    int rows;
+    int pitch;
+    int offset;
+};
+
+static std::vector<PlaneLayout> plane_layout(const RGY_CSP csp, const int width, const int height, const int pitch) {
+    const int pixsize = (RGY_CSP_BIT_DEPTH[csp] > 8) ? 2 : 1;
+    const void *ptr[RGY_MAX_PLANES];
+    rgy_input_sm_plane_ptr(ptr, nullptr, csp, pitch, height);
+    const int pitchUV = rgy_input_sm_pitch_uv(csp, pitch);
+    std::vector<PlaneLayout> planes;
+    planes.push_back({ width * pixsize, height, pitch, 0 });
+    if (RGY_CSP_PLANES[csp] == 2) {
+        planes.push_back({ width * pixsize, height / 2, pitch, (int)(size_t)ptr[1] });
+    } else {
+        planes.push_back({ width / 2 * pixsize, height / 2, pitchUV, (int)(size_t)ptr[1] });
+        planes.push_back({ width / 2 * pixsize, height / 2, pitchUV, (int)(size_t)ptr[2] });
+    }
+    return planes;
+}
+
+//動くグラデーション
+static void write_test_pattern(uint8_t *dst, const std::vector<PlaneLayout>& planes, const RGY_CSP csp, const int frame) {
+    const bool highbit = RGY_CSP_BIT_DEPTH[csp] > 8;
+    for (size_t iplane = 0; iplane < planes.size(); iplane++) {
+        const auto& plane = planes[iplane];
+        for (int y = 0; y < plane.rows; y++) {
+            uint8_t *line = dst + plane.offset + (size_t)plane.pitch * y;
+            if (highbit) {
+                uint16_t *line16 = (uint16_t *)line;
+                for (int x = 0; x < plane.rowBytes / 2; x++) {
+                    const int v = (iplane == 0) ? ((x + y + frame * 4) & 1023) : 512;
+                    line16[x] = (uint16_t)(v << 6); //P010はMSB詰め
+                }
+            } else {
+                for (int x = 0; x < plane.rowBytes; x++) {
+                    line[x] = (uint8_t)((iplane == 0) ? (x + y + frame * 4) : 128);
+                }
+            }
+        }
+    }
+}
+
+static bool read_frame(uint8_t *dst, const std::vector<PlaneLayout>& planes, FILE *fp) {
+    for (const auto& plane : planes) {
+        for (int y = 0; y < plane.rows; y++) {
+            if (fread(dst + plane.offset + (size_t)plane.pitch * y, 1, plane.rowBytes, fp) != (size_t)plane.rowBytes) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+static bool process_alive(const int pid) {
+    return pid <= 0 || kill(pid, 0) == 0 || errno != ESRCH;
+}
+
+//空きスロットができるまで待つ (消費者が終了した場合はfalse)
+static bool wait_slot(RGYInputSMRing *ring, const uint32_t filled) {
+    for (;;) {
+        const uint32_t consumed = ring->consumed.load(std::memory_order_acquire);
+        if (filled - consumed < ring->slotCount) {
+            return true;
+        }
+        if (g_abort || ring->consumerClosed.load(std::memory_order_acquire)) {
+            return false;
+        }
+        if (rgy_wait_on_address_shared(&ring->consumed, consumed, 1000) == WAIT_TIMEOUT
+            && !process_alive(ring->consumerPid)) {
+            _ftprintf(stderr, _T("consumer process has terminated.\n"));
+            return false;
+        }
+    }
+}
+
+int _tmain(int argc, TCHAR **argv) {
+    ProducerParam prm;
+    prm.width = 1920;
+    prm.height = 1080;
+    prm.fpsN = 30;
+    prm.fpsD = 1;
+    prm.csp = RGY_CSP_NV12;
+    prm.slots = 4;
+    prm.frames = 300;
+    for (int iarg = 1; iarg < argc; iarg++) {
+        const tstring arg = argv[iarg];
+        const bool hasValue = iarg + 1 < argc;
+        if (arg == _T("--name") && hasValue) {
+            prm.name = argv[++iarg];
+        } else if ((arg == _T("-i") || arg == _T("--input")) && hasValue) {
+            prm.input = argv[++iarg];
+        } else if (arg == _T("--input-res") && hasValue) {
+            if (2 != _stscanf_s(argv[++iarg], _T("%dx%d"), &prm.width, &prm.height)
+                || prm.width <= 0 || prm.height <= 0 || (prm.width & 1) || (prm.height & 1)) {
+                _ftprintf(stderr, _T("Invalid value for --input-res: %s\n"), argv[iarg]);
+                return 1;
+            }
+        } else if (arg == _T("--fps") && hasValue) {
+            if (2 != _stscanf_s(argv[++iarg], _T("%d/%d"), &prm.fpsN, &prm.fpsD)
+                || prm.fpsN <= 0 || prm.fpsD <= 0) {
+                _ftprintf(stderr, _T("Invalid value for --fps: %s\n"), argv[iarg]);
+                return 1;
+            }
+        } else if (arg == _T("--input-csp") && hasValue) {
+            const tstring csp = argv[++iarg];
+            if (csp == _T("nv12")) {
+                prm.csp = RGY_CSP_NV12;
+            } else if (csp == _T("yv12")) {
+                prm.csp = RGY_CSP_YV12;
+            } else if (csp == _T("p010")) {
+                prm.csp = RGY_CSP_P010;
+            } else {
+                _ftprintf(stderr, _T("Invalid value for --input-csp: %s\n"), csp.c_str());
+                return 1;
+            }
+        } else if (arg == _T("--slots") && hasValue) {
+            const int slots = (int)_tcstol(argv[++iarg], nullptr, 10);
+            prm.slots = clamp(slots, 2, (int)RGY_INPUT_SM_RING_MAX_SLOTS);
+        } else if (arg == _T("--frames") && hasValue) {
+            prm.frames = std::max(1, (int)_tcstol(argv[++iarg], nullptr, 10));
+        } else if (arg == _T("-h") || arg == _T("--help")) {
+            show_help();
+            return 0;
+        } else {
+            _ftprintf(stderr, _T("Unknown option or missing value: %s\n"), arg.c_str());
+            show_help();
+            return 1;
+        }
+    }
+    if (prm.name.length() == 0) {
+        _ftprintf(stderr, _T("--name must be set.\n"));
+        show_help();
+        return 1;
+    }
+
+    std::unique_ptr<FILE, fp_deleter> fpInput;
+    FILE *fp = nullptr;
+    if (prm.input == _T("-")) {
+        fp = stdin;
+    } else if (prm.input.length() > 0) {
+        fpInput.reset(_tfopen(prm.input.c_str(), _T("rb")));
+        if (!fpInput) {
+            _ftprintf(stderr, _T("Failed to open %s.\n"), prm.input.c_str());
+            return 1;
+        }
+        fp = fpInput.get();
+    }
+
+    const int pitch = ALIGN(prm.width, 128) * ((RGY_CSP_BIT_DEPTH[prm.csp] > 8) ? 2 : 1);
+    const uint32_t frameSize = rgy_input_sm_frame_size(prm.csp, pitch, prm.height);
+    uint64_t slotOffset = 0, slotStride = 0;
+    const uint64_t totalSize = rgy_input_sm_ring_size(prm.slots, frameSize, &slotOffset, &slotStride);
+
+    RGYSharedMemLinux mem;
+    if (mem.openNamed(tchar_to_string(prm.name).c_str(), totalSize, true) != 0) {
+        _ftprintf(stderr, _T("Failed to create shared memory /dev/shm/%s: %s\n"), prm.name.c_str(), char_to_tstring(strerror(errno)).c_str());
+        return 1;
+    }
+    signal(SIGINT, sig_handler);
+    signal(SIGTERM, sig_handler);
+
+    //ftruncateした領域は0で初期化されているので、atomicはそのまま0として使用できる
+    RGYInputSMRing *ring = (RGYInputSMRing *)mem.ptr();
+    ring->version = RGY_INPUT_SM_RING_VERSION;
+    ring->slotCount = prm.slots;
+    ring->headerSize = sizeof(RGYInputSMRing);
+    ring->slotOffset = slotOffset;
+    ring->slotStride = slotStride;
+    ring->producerPid = (int32_t)getpid();
+    ring->prm.w = prm.width;
+    ring->prm.h = prm.height;
+    ring->prm.fpsN = prm.fpsN;
+    ring->prm.fpsD = prm.fpsD;
+    ring->prm.pitch = pitch;
+    ring->prm.csp = prm.csp;
+    ring->prm.picstruct = RGY_PICSTRUCT_FRAME;
+    ring->prm.frames = (fp) ? 0 : prm.frames;
+    ring->prm.bufSize = frameSize;
+    //magicは最後に書き込む (消費者はmagicを見てから他の値を読む)
+    std::atomic_thread_fence(std::memory_order_release);
+    ring->magic = RGY_INPUT_SM_RING_MAGIC;
+
+    _ftprintf(stderr, _T("shared memory: /dev/shm/%s, %dx%d %s, %d slots.\n"),
+        prm.name.c_str(), prm.width, prm.height, RGY_CSP_NAMES[prm.csp], prm.slots);
+    _ftprintf(stderr, _T("run: rkmppenc --sm -i %s -o <output> ...\n"), prm.name.c_str());
+
+    const auto planes = plane_layout(prm.csp, prm.width, prm.height, pitch);
+    uint32_t filled = 0;
+    for (;; filled++) {
+        if (!fp && (int)filled >= prm.frames) {
+            break;
+        }
+        if (!wait_slot(ring, filled)) {
+            break;
+        }
+        uint8_t *dst = ring->slotPtr(filled);
+        if (fp) {
+            if (!read_frame(dst, planes, fp)) {
+                break;
+            }
+        } else {
+            write_test_pattern(dst, planes, prm.csp, (int)filled);
+        }
+        auto slotInfo = ring->slotInfo(filled);
+        slotInfo->timestamp = (int64_t)filled * 4;
+        slotInfo->duration = 4;
+        slotInfo->dropped = 0;
+        ring->filled.store(filled + 1, std::memory_order_release);
+        rgy_wake_by_address_all_shared(&ring->filled);
+    }
+    ring->eof.store(1, std::memory_order_release);
+    rgy_wake_by_address_all_shared(&ring->filled);
+    _ftprintf(stderr, _T("wrote %u frames.\n"), filled);
+
+    //消費者が読み終えるまで共有メモリを残しておく
+    while (!g_abort
+        && ring->consumed.load(std::memory_order_acquire) != filled
+        && !ring->consumerClosed.load(std::memory_order_acquire)) {
+        const uint32_t consumed = ring->consumed.load(std::memory_order_acquire);
+        if (rgy_wait_on_address_shared(&ring->consumed, consumed, 1000) == WAIT_TIMEOUT
+            && !process_alive(ring->consumerPid)) {
+            break;
+        }
+    }
+    mem.close();
+    return 0;
+}
+
+#endif //#if defined(_WIN32) || defined(_WIN64)
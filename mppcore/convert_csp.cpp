@@ -35,6 +35,7 @@
 #include "convert_csp.h"
 #include "rgy_frame_info.h"
 #include "rgy_osdep.h"
+#include "rgy_simd_vec.h"
 
 void copy_nv12_to_nv12_sse2(void **dst, const void **src, int width, int src_y_pitch_byte, int src_uv_pitch_byte, int dst_y_pitch_byte, int dst_uv_pitch_byte, int height, int dst_height, int thread_id, int thread_n, int *crop);
 void copy_p010_to_p010_sse2(void **dst, const void **src, int width, int src_y_pitch_byte, int src_uv_pitch_byte, int dst_y_pitch_byte, int dst_uv_pitch_byte, int height, int dst_height, int thread_id, int thread_n, int *crop);
@@ -44,6 +45,18 @@ void copy_p010_to_p010_avx2(void **dst, const void **src, int width, int src_y_p
 void copy_p010_to_nv12_avx2(void **dst, const void **src, int width, int src_y_pitch_byte, int src_uv_pitch_byte, int dst_y_pitch_byte, int dst_uv_pitch_byte, int height, int dst_height, int thread_id, int thread_n, int *crop);
 void copy_nv12_to_p010_avx2(void **dst, const void **src, int width, int src_y_pitch_byte, int src_uv_pitch_byte, int dst_y_pitch_byte, int dst_uv_pitch_byte, int height, int dst_height, int thread_id, int thread_n, int *crop);
 
+#if ENABLE_RGY_SIMD_VEC
+void copy_nv12_to_p010_vec(void **dst, const void **src, int width, int src_y_pitch_byte, int src_uv_pitch_byte, int dst_y_pitch_byte, int dst_uv_pitch_byte, int height, int dst_height, int thread_id, int thread_n, int *crop);
+void copy_p010_to_nv12_vec(void **dst, const void **src, int width, int src_y_pitch_byte, int src_uv_pitch_byte, int dst_y_pitch_byte, int dst_uv_pitch_byte, int height, int dst_height, int thread_id, int thread_n, int *crop);
+void convert_nv12_to_yv12_vec(void **dst, const void **src, int width, int src_y_pitch_byte, int src_uv_pitch_byte, int dst_y_pitch_byte, int dst_uv_pitch_byte, int height, int dst_height, int thread_id, int thread_n, int *crop);
+void convert_p010_to_yv12_vec(void **dst, const void **src, int width, int src_y_pitch_byte, int src_uv_pitch_byte, int dst_y_pitch_byte, int dst_uv_pitch_byte, int height, int dst_height, int thread_id, int thread_n, int *crop);
+void convert_yv12_to_nv12_vec(void **dst, const void **src, int width, int src_y_pitch_byte, int src_uv_pitch_byte, int dst_y_pitch_byte, int dst_uv_pitch_byte, int height, int dst_height, int thread_id, int thread_n, int *crop);
+void convert_yuv444_to_nv12_p_vec(void **dst, const void **src, int width, int src_y_pitch_byte, int src_uv_pitch_byte, int dst_y_pitch_byte, int dst_uv_pitch_byte, int height, int dst_height, int thread_id, int thread_n, int *crop);
+void convert_yuv444_to_nv12_i_vec(void **dst, const void **src, int width, int src_y_pitch_byte, int src_uv_pitch_byte, int dst_y_pitch_byte, int dst_uv_pitch_byte, int height, int dst_height, int thread_id, int thread_n, int *crop);
+void convert_yuv444_to_p010_p_vec(void **dst, const void **src, int width, int src_y_pitch_byte, int src_uv_pitch_byte, int dst_y_pitch_byte, int dst_uv_pitch_byte, int height, int dst_height, int thread_id, int thread_n, int *crop);
+void convert_yuv444_to_p010_i_vec(void **dst, const void **src, int width, int src_y_pitch_byte, int src_uv_pitch_byte, int dst_y_pitch_byte, int dst_uv_pitch_byte, int height, int dst_height, int thread_id, int thread_n, int *crop);
+#endif //#if ENABLE_RGY_SIMD_VEC
+
 void convert_yuy2_to_nv12(void **dst, const void **src, int width, int src_y_pitch_byte, int src_uv_pitch_byte, int dst_y_pitch_byte, int dst_uv_pitch_byte, int height, int dst_height, int thread_id, int thread_n, int *crop);
 void convert_yuy2_to_nv12_sse2(void **dst, const void **src, int width, int src_y_pitch_byte, int src_uv_pitch_byte, int dst_y_pitch_byte, int dst_uv_pitch_byte, int height, int dst_height, int thread_id, int thread_n, int *crop);
 void convert_yuy2_to_nv12_avx(void **dst, const void **src, int width, int src_y_pitch_byte, int src_uv_pitch_byte, int dst_y_pitch_byte, int dst_uv_pitch_byte, int height, int dst_height, int thread_id, int thread_n, int *crop);
@@ -368,7 +381,7 @@ void copy_nv12p010_to_nv12p010_c_internal(void **dst, const void **src, int widt
     const int crop_bottom = crop[3];
     for (int i = 0; i < 2; i++) {
         const auto y_range = thread_y_range(crop_up >> i, (height - crop_bottom) >> i, thread_id, thread_n);
-        const uint8_t *srcYLine = ((const uint8_t *)src[i] + src_y_pitch_byte * y_range.start_src + crop_left * sizeof(uint16_t));
+        const uint8_t *srcYLine = ((const uint8_t *)src[i] + src_y_pitch_byte * y_range.start_src + crop_left * sizeof(Tin));
         uint8_t *dstLine = (uint8_t *)dst[i] + dst_y_pitch_byte * y_range.start_dst;
         for (int y = 0; y < y_range.len; y++, srcYLine += src_y_pitch_byte, dstLine += dst_y_pitch_byte) {
             const int x_fin = width - crop_right - crop_left;
@@ -382,11 +395,11 @@ void copy_nv12p010_to_nv12p010_c_internal(void **dst, const void **src, int widt
 }
 
 void copy_p010_to_nv12_c(void **dst, const void **src, int width, int src_y_pitch_byte, int src_uv_pitch_byte, int dst_y_pitch_byte, int dst_uv_pitch_byte, int height, int dst_height, int thread_id, int thread_n, int *crop) {
-    return copy_nv12p010_to_nv12p010_c_internal<uint8_t, 8, uint16_t, 16>(dst, src, width, src_y_pitch_byte, src_uv_pitch_byte, dst_y_pitch_byte, dst_uv_pitch_byte, height, dst_height, thread_id, thread_n, crop);
+    return copy_nv12p010_to_nv12p010_c_internal<uint16_t, 16, uint8_t, 8>(dst, src, width, src_y_pitch_byte, src_uv_pitch_byte, dst_y_pitch_byte, dst_uv_pitch_byte, height, dst_height, thread_id, thread_n, crop);
 }
 
 void copy_nv12_to_p010_c(void **dst, const void **src, int width, int src_y_pitch_byte, int src_uv_pitch_byte, int dst_y_pitch_byte, int dst_uv_pitch_byte, int height, int dst_height, int thread_id, int thread_n, int *crop) {
-    return copy_nv12p010_to_nv12p010_c_internal<uint16_t, 16, uint8_t, 8>(dst, src, width, src_y_pitch_byte, src_uv_pitch_byte, dst_y_pitch_byte, dst_uv_pitch_byte, height, dst_height, thread_id, thread_n, crop);
+    return copy_nv12p010_to_nv12p010_c_internal<uint8_t, 8, uint16_t, 16>(dst, src, width, src_y_pitch_byte, src_uv_pitch_byte, dst_y_pitch_byte, dst_uv_pitch_byte, height, dst_height, thread_id, thread_n, crop);
 }
 
 template<typename Tin, int in_bit_depth, typename Tout, int out_bit_depth, bool uv_only>
@@ -401,7 +414,7 @@ static void RGY_FORCEINLINE convert_nv12_to_yv12_c_base(void **dst, const void *
     // Y plane
     if (!uv_only) {
         const auto y_range = thread_y_range(crop_up, height - crop_bottom, thread_id, thread_n);
-        const char *srcYLine = (const char *)src[0] + src_y_pitch_byte * y_range.start_src + crop_left;
+        const char *srcYLine = (const char *)src[0] + src_y_pitch_byte * y_range.start_src + crop_left * sizeof(Tin);
         char *dstLine = (char *)dst[0] + dst_y_pitch_byte * y_range.start_dst;
         for (int y = 0; y < y_range.len; y++, srcYLine += src_y_pitch_byte, dstLine += dst_y_pitch_byte) {
             if (in_bit_depth == out_bit_depth && sizeof(Tin) == sizeof(Tout)) {
@@ -418,7 +431,7 @@ static void RGY_FORCEINLINE convert_nv12_to_yv12_c_base(void **dst, const void *
 
     // UV planes
     const auto uv_range = thread_y_range(crop_up >> 1, (height - crop_bottom) >> 1, thread_id, thread_n);
-    const char *srcUVLine = (const char *)src[1] + src_uv_pitch_byte * uv_range.start_src + crop_left;
+    const char *srcUVLine = (const char *)src[1] + src_uv_pitch_byte * uv_range.start_src + crop_left * sizeof(Tin);
     char *dstUline = (char *)dst[1] + dst_uv_pitch_byte * uv_range.start_dst;
     char *dstVline = (char *)dst[2] + dst_uv_pitch_byte * uv_range.start_dst;
     for (int y = 0; y < uv_range.len; y++, srcUVLine += src_uv_pitch_byte, dstUline += dst_uv_pitch_byte, dstVline += dst_uv_pitch_byte) {
@@ -2426,6 +2439,11 @@ void convert_rgb_to_gbr32_c(void **dst, const void **src, int width, int src_y_p
 #define FUNC_AVX(from, to, uv_only, funcp, funci, simd)
 #define FUNC_SSE(from, to, uv_only, funcp, funci, simd)
 #endif
+#if ENABLE_RGY_SIMD_VEC
+#define FUNC_VEC(from, to, uv_only, funcp, funci, simd) { from, to, uv_only, { funcp, funci }, simd },
+#else
+#define FUNC_VEC(from, to, uv_only, funcp, funci, simd)
+#endif
 #define FUNC__C_(from, to, uv_only, funcp, funci, simd) { from, to, uv_only, { funcp, funci }, simd },
 
 // テーブル作成の簡略化のため
@@ -2436,6 +2454,12 @@ void convert_rgb_to_gbr32_c(void **dst, const void **src, int width, int src_y_p
 #define SSSE3 (RGY_SIMD::SSSE3)
 #define SSE2  (RGY_SIMD::SSE2)
 #define NONE  (RGY_SIMD::NONE)
+// ポータブルなSIMD実装 (aarch64ではNEONとして扱う)
+#if defined(__aarch64__)
+#define VEC   (RGY_SIMD::NEON|RGY_SIMD::VEC128)
+#else
+#define VEC   (RGY_SIMD::VEC128)
+#endif
 
 static const ConvertCSP funcList[] = {
 #if !FOR_AUO
@@ -2446,8 +2470,10 @@ static const ConvertCSP funcList[] = {
     FUNC_SSE(  RGY_CSP_P010,      RGY_CSP_P010,      false,  copy_p010_to_p010_sse2,              copy_p010_to_p010_sse2,              SSE2 )
     FUNC__C_(  RGY_CSP_P010,      RGY_CSP_P010,      false,  copy_p010_to_p010_c,                 copy_p010_to_p010_c,                 NONE)
     FUNC_AVX2( RGY_CSP_NV12,      RGY_CSP_P010,      false,  copy_nv12_to_p010_avx2,              copy_nv12_to_p010_avx2,              AVX2|AVX)
+    FUNC_VEC(  RGY_CSP_NV12,      RGY_CSP_P010,      false,  copy_nv12_to_p010_vec,               copy_nv12_to_p010_vec,               VEC )
     FUNC__C_(  RGY_CSP_NV12,      RGY_CSP_P010,      false,  copy_nv12_to_p010_c,                 copy_nv12_to_p010_c,                 NONE)
     FUNC_AVX2( RGY_CSP_P010,      RGY_CSP_NV12,      false,  copy_p010_to_nv12_avx2,              copy_p010_to_nv12_avx2,              AVX2|AVX)
+    FUNC_VEC(  RGY_CSP_P010,      RGY_CSP_NV12,      false,  copy_p010_to_nv12_vec,               copy_p010_to_nv12_vec,               VEC )
     FUNC__C_(  RGY_CSP_P010,      RGY_CSP_NV12,      false,  copy_p010_to_nv12_c,                 copy_p010_to_nv12_c,                 NONE)
 #endif
 #if !CLFILTERS_AUF
@@ -2487,6 +2513,7 @@ static const ConvertCSP funcList[] = {
     FUNC_AVX2( RGY_CSP_YV12, RGY_CSP_NV12, false, convert_yv12_to_nv12_avx2,     convert_yv12_to_nv12_avx2,     AVX2|AVX)
     FUNC_AVX(  RGY_CSP_YV12, RGY_CSP_NV12, false, convert_yv12_to_nv12_avx,      convert_yv12_to_nv12_avx,      AVX )
     FUNC_SSE(  RGY_CSP_YV12, RGY_CSP_NV12, false, convert_yv12_to_nv12_sse2,     convert_yv12_to_nv12_sse2,     SSE2 )
+    FUNC_VEC(  RGY_CSP_YV12, RGY_CSP_NV12, false, convert_yv12_to_nv12_vec,      convert_yv12_to_nv12_vec,      VEC )
     FUNC__C_(  RGY_CSP_YV12, RGY_CSP_NV12, false, convert_yv12_to_nv12_c,        convert_yv12_to_nv12_c,        NONE )
     FUNC__C_(  RGY_CSP_YV12, RGY_CSP_YUV444, false, convert_yv12_p_to_yuv444,    convert_yv12_i_to_yuv444,      NONE )
     FUNC_AVX2( RGY_CSP_YV12, RGY_CSP_NV12, true,  convert_uv_yv12_to_nv12_avx2,  convert_uv_yv12_to_nv12_avx2,  AVX2|AVX )
@@ -2618,6 +2645,7 @@ static const ConvertCSP funcList[] = {
     FUNC__C_(  RGY_CSP_YV12_09,   RGY_CSP_P010,      false, convert_yv12_09_to_p010_c,           convert_yv12_09_to_p010_c,    NONE )
 
     FUNC_AVX2( RGY_CSP_NV12,      RGY_CSP_YV12,      false, convert_nv12_to_yv12_avx2,      convert_nv12_to_yv12_avx2,      AVX2|AVX )
+    FUNC_VEC(  RGY_CSP_NV12,      RGY_CSP_YV12,      false, convert_nv12_to_yv12_vec,       convert_nv12_to_yv12_vec,       VEC )
     FUNC__C_(  RGY_CSP_NV12,      RGY_CSP_YV12,      false, convert_nv12_to_yv12_c,         convert_nv12_to_yv12_c,         NONE )
     FUNC_AVX2( RGY_CSP_NV12,      RGY_CSP_YV12_16,   false, convert_nv12_to_yuv420_16_avx2, convert_nv12_to_yuv420_16_avx2, AVX2|AVX )
     FUNC__C_(  RGY_CSP_NV12,      RGY_CSP_YV12_16,   false, convert_nv12_to_yuv420_16_c,    convert_nv12_to_yuv420_16_c,    NONE )
@@ -2628,6 +2656,7 @@ static const ConvertCSP funcList[] = {
     FUNC_AVX2( RGY_CSP_NV12,      RGY_CSP_YV12_10,   false, convert_nv12_to_yuv420_10_avx2, convert_nv12_to_yuv420_10_avx2, AVX2|AVX )
     FUNC__C_(  RGY_CSP_NV12,      RGY_CSP_YV12_10,   false, convert_nv12_to_yuv420_10_c,    convert_nv12_to_yuv420_10_c,    NONE )
     FUNC_AVX2( RGY_CSP_P010,      RGY_CSP_YV12,      false, convert_p010_to_yv12_avx2,      convert_p010_to_yv12_avx2,      AVX2|AVX ) 
+    FUNC_VEC(  RGY_CSP_P010,      RGY_CSP_YV12,      false, convert_p010_to_yv12_vec,       convert_p010_to_yv12_vec,       VEC )
     FUNC__C_(  RGY_CSP_P010,      RGY_CSP_YV12,      false, convert_p010_to_yv12_c,         convert_p010_to_yv12_c,         NONE )
     FUNC_AVX2( RGY_CSP_P010,      RGY_CSP_YV12_16,   false, convert_p010_to_yuv420_16_avx2, convert_p010_to_yuv420_16_avx2, AVX2|AVX )
     FUNC__C_(  RGY_CSP_P010,      RGY_CSP_YV12_16,   false, convert_p010_to_yuv420_16_c,    convert_p010_to_yuv420_16_c,    NONE )
@@ -2751,8 +2780,10 @@ static const ConvertCSP funcList[] = {
     FUNC__C_(  RGY_CSP_NV24,      RGY_CSP_YUV444_12, false, convert_nv24_to_yuv444_12,           convert_nv24_to_yuv444_12,   NONE )
     FUNC__C_(  RGY_CSP_NV24,      RGY_CSP_YUV444_10, false, convert_nv24_to_yuv444_10,           convert_nv24_to_yuv444_10,   NONE )
     FUNC_AVX2( RGY_CSP_YUV444,    RGY_CSP_NV12,      false, convert_yuv444_to_nv12_p_avx2,       convert_yuv444_to_nv12_i,    AVX2|AVX )
+    FUNC_VEC(  RGY_CSP_YUV444,    RGY_CSP_NV12,      false, convert_yuv444_to_nv12_p_vec,        convert_yuv444_to_nv12_i_vec, VEC )
     FUNC__C_(  RGY_CSP_YUV444,    RGY_CSP_NV12,      false, convert_yuv444_to_nv12_p,            convert_yuv444_to_nv12_i,    NONE )
     FUNC_AVX2( RGY_CSP_YUV444,    RGY_CSP_P010,      false, convert_yuv444_to_p010_p_avx2,       convert_yuv444_to_p010_i,    AVX2|AVX )
+    FUNC_VEC(  RGY_CSP_YUV444,    RGY_CSP_P010,      false, convert_yuv444_to_p010_p_vec,        convert_yuv444_to_p010_i_vec, VEC )
     FUNC__C_(  RGY_CSP_YUV444,    RGY_CSP_P010,      false, convert_yuv444_to_p010_p,            convert_yuv444_to_p010_i,    NONE )
     FUNC_AVX2( RGY_CSP_YUV444_16, RGY_CSP_NV12,      false, convert_yuv444_16_to_nv12_p_avx2,    convert_yuv444_16_to_nv12_i, AVX2|AVX )
     FUNC__C_(  RGY_CSP_YUV444_16, RGY_CSP_NV12,      false, convert_yuv444_16_to_nv12_p,         convert_yuv444_16_to_nv12_i, NONE )
@@ -2970,7 +3001,9 @@ const TCHAR *get_simd_str(RGY_SIMD simd) {
         { SSE42, _T("SSE4.2") },
         { SSE41, _T("SSE4.1") },
         { SSSE3, _T("SSSE3")  },
-        { SSE2,  _T("SSE2")   }
+        { SSE2,  _T("SSE2")   },
+        { RGY_SIMD::NEON,   _T("NEON")   },
+        { RGY_SIMD::VEC128, _T("VEC128") }
     };
     for (const auto& simd_str : simd_str_list) {
         if ((simd & simd_str.first) == simd_str.first) {
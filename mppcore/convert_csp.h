@@ -874,6 +874,7 @@ enum RGY_FRAME_FLAGS : uint32_t {
     RGY_FRAME_FLAG_RFF_COPY = 0x02u,
     RGY_FRAME_FLAG_RFF_TFF  = 0x04u,
     RGY_FRAME_FLAG_RFF_BFF  = 0x08u,
+    RGY_FRAME_FLAG_BITSTREAM_COPY = 0x10u, //再エンコードせず入力からコピーしたbitstream
 };
 
 static RGY_FRAME_FLAGS operator|(RGY_FRAME_FLAGS a, RGY_FRAME_FLAGS b) {
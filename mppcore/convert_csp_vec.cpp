@@ -0,0 +1,309 @@
+﻿// -----------------------------------------------------------------------------------------
+// QSVEnc/NVEnc by rigaya
+// -----------------------------------------------------------------------------------------
+// The MIT License
+//
+// Copyright (c) 2011-2016 rigaya
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// ------------------------------------------------------------------------------------------
+
+#include <cstring>
+#include "convert_csp.h"
+#include "rgy_simd_vec.h"
+
+#if ENABLE_RGY_SIMD_VEC
+
+// rgy_simd_vec.h のポータブルなSIMDによる実装 (aarch64ではNEON)
+// 端数や丸めの処理はC版(convert_csp.cpp)と同じ結果となるようにする
+
+#pragma warning (push)
+#pragma warning (disable: 4100)
+
+// u16の各要素をconv_bit_depth_と同様に変換する
+template<int out_bit_depth, int in_bit_depth, int shift_offset>
+static inline rgy_u16x8 conv_bit_depth_vec(const rgy_u16x8& c) {
+    if (out_bit_depth > in_bit_depth + shift_offset) {
+        return c << conv_bit_depth_lsft_<out_bit_depth, in_bit_depth, shift_offset>();
+    } else if (out_bit_depth < in_bit_depth + shift_offset) {
+        const rgy_u16x8 add = rgy_vec_set1_u16((uint16_t)conv_bit_depth_rsft_add_<out_bit_depth, in_bit_depth, shift_offset>());
+        const rgy_u16x8 x = rgy_vec_adds_u16(c, add) >> conv_bit_depth_rsft_<out_bit_depth, in_bit_depth, shift_offset>();
+        return rgy_vec_min_u16(x, rgy_vec_set1_u16((uint16_t)((1 << out_bit_depth) - 1)));
+    } else {
+        return c;
+    }
+}
+
+template<typename T>
+static inline rgy_u16x8 load_u16x8(const T *ptr) {
+    if (sizeof(T) == 1) {
+        return rgy_vec_widen_u8(rgy_vec_load<rgy_u8x8>(ptr));
+    }
+    return rgy_vec_load<rgy_u16x8>(ptr);
+}
+
+template<typename T>
+static inline void store_u16x8(T *ptr, const rgy_u16x8& v) {
+    if (sizeof(T) == 1) {
+        rgy_vec_store(ptr, rgy_vec_narrow_sat_u16(v));
+    } else {
+        rgy_vec_store(ptr, v);
+    }
+}
+
+template<typename Tin, int in_bit_depth, typename Tout, int out_bit_depth>
+static inline void copy_line_vec(Tout *dst, const Tin *src, const int width) {
+    if (in_bit_depth == out_bit_depth && sizeof(Tin) == sizeof(Tout)) {
+        memcpy(dst, src, width * sizeof(Tin));
+        return;
+    }
+    int x = 0;
+    for (; x + 8 <= width; x += 8) {
+        store_u16x8(dst + x, conv_bit_depth_vec<out_bit_depth, in_bit_depth, 0>(load_u16x8(src + x)));
+    }
+    for (; x < width; x++) {
+        dst[x] = (Tout)conv_bit_depth_<out_bit_depth, in_bit_depth, 0>(src[x]);
+    }
+}
+
+template<typename Tin, int in_bit_depth, typename Tout, int out_bit_depth>
+static void copy_nv12p010_to_nv12p010_vec(void **dst, const void **src, int width, int src_y_pitch_byte, int src_uv_pitch_byte, int dst_y_pitch_byte, int dst_uv_pitch_byte, int height, int dst_height, int thread_id, int thread_n, int *crop) {
+    const int crop_left = crop[0];
+    const int crop_up = crop[1];
+    const int crop_right = crop[2];
+    const int crop_bottom = crop[3];
+    const int x_fin = width - crop_right - crop_left;
+    for (int i = 0; i < 2; i++) {
+        const auto y_range = thread_y_range(crop_up >> i, (height - crop_bottom) >> i, thread_id, thread_n);
+        const uint8_t *srcYLine = (const uint8_t *)src[i] + src_y_pitch_byte * y_range.start_src + crop_left * sizeof(Tin);
+        uint8_t *dstLine = (uint8_t *)dst[i] + dst_y_pitch_byte * y_range.start_dst;
+        for (int y = 0; y < y_range.len; y++, srcYLine += src_y_pitch_byte, dstLine += dst_y_pitch_byte) {
+            copy_line_vec<Tin, in_bit_depth, Tout, out_bit_depth>((Tout *)dstLine, (const Tin *)srcYLine, x_fin);
+        }
+    }
+}
+
+template<typename Tin, int in_bit_depth, typename Tout, int out_bit_depth>
+static void convert_nv12_to_yv12_vec(void **dst, const void **src, int width, int src_y_pitch_byte, int src_uv_pitch_byte, int dst_y_pitch_byte, int dst_uv_pitch_byte, int height, int dst_height, int thread_id, int thread_n, int *crop) {
+    const int crop_left   = crop[0];
+    const int crop_up     = crop[1];
+    const int crop_right  = crop[2];
+    const int crop_bottom = crop[3];
+    const int y_width = width - crop_right - crop_left;
+    const int uv_width = y_width >> 1;
+    {
+        const auto y_range = thread_y_range(crop_up, height - crop_bottom, thread_id, thread_n);
+        const uint8_t *srcYLine = (const uint8_t *)src[0] + src_y_pitch_byte * y_range.start_src + crop_left * sizeof(Tin);
+        uint8_t *dstLine = (uint8_t *)dst[0] + dst_y_pitch_byte * y_range.start_dst;
+        for (int y = 0; y < y_range.len; y++, srcYLine += src_y_pitch_byte, dstLine += dst_y_pitch_byte) {
+            copy_line_vec<Tin, in_bit_depth, Tout, out_bit_depth>((Tout *)dstLine, (const Tin *)srcYLine, y_width);
+        }
+    }
+    const auto uv_range = thread_y_range(crop_up >> 1, (height - crop_bottom) >> 1, thread_id, thread_n);
+    const uint8_t *srcUVLine = (const uint8_t *)src[1] + src_uv_pitch_byte * uv_range.start_src + crop_left * sizeof(Tin);
+    uint8_t *dstULine = (uint8_t *)dst[1] + dst_uv_pitch_byte * uv_range.start_dst;
+    uint8_t *dstVLine = (uint8_t *)dst[2] + dst_uv_pitch_byte * uv_range.start_dst;
+    for (int y = 0; y < uv_range.len; y++, srcUVLine += src_uv_pitch_byte, dstULine += dst_uv_pitch_byte, dstVLine += dst_uv_pitch_byte) {
+        const Tin *srcUV = (const Tin *)srcUVLine;
+        Tout *dstU = (Tout *)dstULine;
+        Tout *dstV = (Tout *)dstVLine;
+        int x = 0;
+        for (; x + 8 <= uv_width; x += 8) {
+            rgy_u16x8 u, v;
+            if (sizeof(Tin) == 1) {
+                const auto uv = rgy_vec_load<rgy_u16x8>(srcUV + 2 * x);
+                u = uv & rgy_vec_set1_u16(0xff);
+                v = uv >> 8;
+            } else {
+                rgy_vec_unzip_u16(u, v, rgy_vec_load<rgy_u16x8>(srcUV + 2 * x), rgy_vec_load<rgy_u16x8>(srcUV + 2 * x + 8));
+            }
+            store_u16x8(dstU + x, conv_bit_depth_vec<out_bit_depth, in_bit_depth, 0>(u));
+            store_u16x8(dstV + x, conv_bit_depth_vec<out_bit_depth, in_bit_depth, 0>(v));
+        }
+        for (; x < uv_width; x++) {
+            dstU[x] = (Tout)conv_bit_depth_<out_bit_depth, in_bit_depth, 0>(srcUV[2 * x + 0]);
+            dstV[x] = (Tout)conv_bit_depth_<out_bit_depth, in_bit_depth, 0>(srcUV[2 * x + 1]);
+        }
+    }
+}
+
+static void convert_yv12_to_nv12_vec_base(void **dst, const void **src, int width, int src_y_pitch_byte, int src_uv_pitch_byte, int dst_y_pitch_byte, int dst_uv_pitch_byte, int height, int dst_height, int thread_id, int thread_n, int *crop) {
+    const int crop_left = crop[0];
+    const int crop_up = crop[1];
+    const int crop_right = crop[2];
+    const int crop_bottom = crop[3];
+    {
+        const auto y_range = thread_y_range(crop_up, height - crop_bottom, thread_id, thread_n);
+        const uint8_t *srcYLine = (const uint8_t *)src[0] + src_y_pitch_byte * y_range.start_src + crop_left;
+        uint8_t *dstLine = (uint8_t *)dst[0] + dst_y_pitch_byte * y_range.start_dst;
+        const int y_width = width - crop_right - crop_left;
+        for (int y = 0; y < y_range.len; y++, srcYLine += src_y_pitch_byte, dstLine += dst_y_pitch_byte) {
+            memcpy(dstLine, srcYLine, y_width);
+        }
+    }
+    const auto uv_range = thread_y_range(crop_up >> 1, (height - crop_bottom) >> 1, thread_id, thread_n);
+    const uint8_t *srcULine = (const uint8_t *)src[1] + ((src_uv_pitch_byte * uv_range.start_src) + (crop_left >> 1));
+    const uint8_t *srcVLine = (const uint8_t *)src[2] + ((src_uv_pitch_byte * uv_range.start_src) + (crop_left >> 1));
+    uint8_t *dstLine = (uint8_t *)dst[1] + dst_y_pitch_byte * uv_range.start_dst;
+    const int x_fin = (width - crop_right - crop_left) >> 1;
+    for (int y = 0; y < uv_range.len; y++, srcULine += src_uv_pitch_byte, srcVLine += src_uv_pitch_byte, dstLine += dst_y_pitch_byte) {
+        int x = 0;
+        for (; x + 8 <= x_fin; x += 8) {
+            const auto u = rgy_vec_widen_u8(rgy_vec_load<rgy_u8x8>(srcULine + x));
+            const auto v = rgy_vec_widen_u8(rgy_vec_load<rgy_u8x8>(srcVLine + x));
+            rgy_vec_store(dstLine + 2 * x, u | (v << 8));
+        }
+        for (; x < x_fin; x++) {
+            dstLine[2 * x + 0] = srcULine[x];
+            dstLine[2 * x + 1] = srcVLine[x];
+        }
+    }
+}
+
+// 出力のUVを並べて書き込む (cu, cvは出力のbit深度に変換済み)
+template<typename Tout>
+static inline void store_uv_interleave(Tout *dst, const rgy_u16x8& cu, const rgy_u16x8& cv) {
+    if (sizeof(Tout) == 1) {
+        rgy_vec_store(dst, cu | (cv << 8));
+    } else {
+        rgy_u16x8 lo, hi;
+        rgy_vec_zip_u16(lo, hi, cu, cv);
+        rgy_vec_store(dst + 0, lo);
+        rgy_vec_store(dst + 8, hi);
+    }
+}
+
+template<typename Tout, int out_bit_depth, bool interlaced>
+static void convert_yuv444_to_nv12_vec_base(void **dst, const void **src, int width, int src_y_pitch_byte, int src_uv_pitch_byte, int dst_y_pitch_byte, int dst_uv_pitch_byte, int height, int dst_height, int thread_id, int thread_n, int *crop) {
+    typedef uint8_t Tin;
+    const int in_bit_depth = 8;
+    const int crop_left   = crop[0];
+    const int crop_up     = crop[1];
+    const int crop_right  = crop[2];
+    const int crop_bottom = crop[3];
+    const int src_y_pitch = src_y_pitch_byte / sizeof(Tin);
+    const int dst_y_pitch = dst_y_pitch_byte / sizeof(Tout);
+    const int x_fin = width - crop_right - crop_left;
+    const auto y_range = thread_y_range(crop_up, height - crop_bottom, thread_id, thread_n);
+    {
+        const Tin *srcYLine = (const Tin *)src[0] + src_y_pitch * y_range.start_src + crop_left;
+        Tout *dstLine = (Tout *)dst[0] + dst_y_pitch * y_range.start_dst;
+        for (int y = 0; y < y_range.len; y++, srcYLine += src_y_pitch, dstLine += dst_y_pitch) {
+            copy_line_vec<Tin, in_bit_depth, Tout, out_bit_depth>(dstLine, srcYLine, x_fin);
+        }
+    }
+    // 入力の偶数列のみを使用するので、u16として読み込んで下位8bitを取り出す
+    const rgy_u16x8 mask = rgy_vec_set1_u16(0xff);
+    const int src_uv_pitch = src_uv_pitch_byte / sizeof(Tin);
+    const Tin *srcULine = (const Tin *)src[1] + ((src_uv_pitch * y_range.start_src) + crop_left);
+    const Tin *srcVLine = (const Tin *)src[2] + ((src_uv_pitch * y_range.start_src) + crop_left);
+    Tout *dstLine = (Tout *)dst[1] + (dst_y_pitch >> 1) * y_range.start_dst;
+    if (!interlaced) {
+        for (int y = 0; y < y_range.len; y += 2, srcULine += src_uv_pitch * 2, srcVLine += src_uv_pitch * 2, dstLine += dst_y_pitch) {
+            int x = 0;
+            for (; x + 16 <= x_fin; x += 16) {
+                const auto cu = rgy_vec_load<rgy_u16x8>(srcULine + x) & mask;
+                const auto cv = rgy_vec_load<rgy_u16x8>(srcVLine + x) & mask;
+                const auto cu1 = rgy_vec_load<rgy_u16x8>(srcULine + src_uv_pitch + x) & mask;
+                const auto cv1 = rgy_vec_load<rgy_u16x8>(srcVLine + src_uv_pitch + x) & mask;
+                store_uv_interleave(dstLine + x,
+                    conv_bit_depth_vec<out_bit_depth, in_bit_depth, 1>(cu + cu1),
+                    conv_bit_depth_vec<out_bit_depth, in_bit_depth, 1>(cv + cv1));
+            }
+            for (; x < x_fin; x += 2) {
+                const int cu = srcULine[x] + srcULine[src_uv_pitch + x];
+                const int cv = srcVLine[x] + srcVLine[src_uv_pitch + x];
+                dstLine[x + 0] = (Tout)conv_bit_depth_<out_bit_depth, in_bit_depth, 1>(cu);
+                dstLine[x + 1] = (Tout)conv_bit_depth_<out_bit_depth, in_bit_depth, 1>(cv);
+            }
+        }
+    } else {
+        const rgy_u16x8 three = rgy_vec_set1_u16(3);
+        for (int y = 0; y < y_range.len; y += 4, srcULine += src_uv_pitch * 4, srcVLine += src_uv_pitch * 4, dstLine += dst_y_pitch * 2) {
+            int x = 0;
+            for (; x + 16 <= x_fin; x += 16) {
+                const auto u0 = rgy_vec_load<rgy_u16x8>(srcULine + 0 * src_uv_pitch + x) & mask;
+                const auto u1 = rgy_vec_load<rgy_u16x8>(srcULine + 1 * src_uv_pitch + x) & mask;
+                const auto u2 = rgy_vec_load<rgy_u16x8>(srcULine + 2 * src_uv_pitch + x) & mask;
+                const auto u3 = rgy_vec_load<rgy_u16x8>(srcULine + 3 * src_uv_pitch + x) & mask;
+                const auto v0 = rgy_vec_load<rgy_u16x8>(srcVLine + 0 * src_uv_pitch + x) & mask;
+                const auto v1 = rgy_vec_load<rgy_u16x8>(srcVLine + 1 * src_uv_pitch + x) & mask;
+                const auto v2 = rgy_vec_load<rgy_u16x8>(srcVLine + 2 * src_uv_pitch + x) & mask;
+                const auto v3 = rgy_vec_load<rgy_u16x8>(srcVLine + 3 * src_uv_pitch + x) & mask;
+                store_uv_interleave(dstLine + x,
+                    conv_bit_depth_vec<out_bit_depth, in_bit_depth, 2>(u0 * three + u2),
+                    conv_bit_depth_vec<out_bit_depth, in_bit_depth, 2>(v0 * three + v2));
+                store_uv_interleave(dstLine + dst_y_pitch + x,
+                    conv_bit_depth_vec<out_bit_depth, in_bit_depth, 2>(u1 + u3 * three),
+                    conv_bit_depth_vec<out_bit_depth, in_bit_depth, 2>(v1 + v3 * three));
+            }
+            for (; x < x_fin; x += 2) {
+                const int cu_y0 = srcULine[0 * src_uv_pitch + x] * 3 + srcULine[2 * src_uv_pitch + x];
+                const int cu_y1 = srcULine[1 * src_uv_pitch + x] + srcULine[3 * src_uv_pitch + x] * 3;
+                const int cv_y0 = srcVLine[0 * src_uv_pitch + x] * 3 + srcVLine[2 * src_uv_pitch + x];
+                const int cv_y1 = srcVLine[1 * src_uv_pitch + x] + srcVLine[3 * src_uv_pitch + x] * 3;
+                dstLine[0 * dst_y_pitch + x + 0] = (Tout)conv_bit_depth_<out_bit_depth, in_bit_depth, 2>(cu_y0);
+                dstLine[0 * dst_y_pitch + x + 1] = (Tout)conv_bit_depth_<out_bit_depth, in_bit_depth, 2>(cv_y0);
+                dstLine[1 * dst_y_pitch + x + 0] = (Tout)conv_bit_depth_<out_bit_depth, in_bit_depth, 2>(cu_y1);
+                dstLine[1 * dst_y_pitch + x + 1] = (Tout)conv_bit_depth_<out_bit_depth, in_bit_depth, 2>(cv_y1);
+            }
+        }
+    }
+}
+
+void copy_nv12_to_p010_vec(void **dst, const void **src, int width, int src_y_pitch_byte, int src_uv_pitch_byte, int dst_y_pitch_byte, int dst_uv_pitch_byte, int height, int dst_height, int thread_id, int thread_n, int *crop) {
+    copy_nv12p010_to_nv12p010_vec<uint8_t, 8, uint16_t, 16>(dst, src, width, src_y_pitch_byte, src_uv_pitch_byte, dst_y_pitch_byte, dst_uv_pitch_byte, height, dst_height, thread_id, thread_n, crop);
+}
+
+void copy_p010_to_nv12_vec(void **dst, const void **src, int width, int src_y_pitch_byte, int src_uv_pitch_byte, int dst_y_pitch_byte, int dst_uv_pitch_byte, int height, int dst_height, int thread_id, int thread_n, int *crop) {
+    copy_nv12p010_to_nv12p010_vec<uint16_t, 16, uint8_t, 8>(dst, src, width, src_y_pitch_byte, src_uv_pitch_byte, dst_y_pitch_byte, dst_uv_pitch_byte, height, dst_height, thread_id, thread_n, crop);
+}
+
+void convert_nv12_to_yv12_vec(void **dst, const void **src, int width, int src_y_pitch_byte, int src_uv_pitch_byte, int dst_y_pitch_byte, int dst_uv_pitch_byte, int height, int dst_height, int thread_id, int thread_n, int *crop) {
+    convert_nv12_to_yv12_vec<uint8_t, 8, uint8_t, 8>(dst, src, width, src_y_pitch_byte, src_uv_pitch_byte, dst_y_pitch_byte, dst_uv_pitch_byte, height, dst_height, thread_id, thread_n, crop);
+}
+
+void convert_p010_to_yv12_vec(void **dst, const void **src, int width, int src_y_pitch_byte, int src_uv_pitch_byte, int dst_y_pitch_byte, int dst_uv_pitch_byte, int height, int dst_height, int thread_id, int thread_n, int *crop) {
+    convert_nv12_to_yv12_vec<uint16_t, 16, uint8_t, 8>(dst, src, width, src_y_pitch_byte, src_uv_pitch_byte, dst_y_pitch_byte, dst_uv_pitch_byte, height, dst_height, thread_id, thread_n, crop);
+}
+
+void convert_yv12_to_nv12_vec(void **dst, const void **src, int width, int src_y_pitch_byte, int src_uv_pitch_byte, int dst_y_pitch_byte, int dst_uv_pitch_byte, int height, int dst_height, int thread_id, int thread_n, int *crop) {
+    convert_yv12_to_nv12_vec_base(dst, src, width, src_y_pitch_byte, src_uv_pitch_byte, dst_y_pitch_byte, dst_uv_pitch_byte, height, dst_height, thread_id, thread_n, crop);
+}
+
+void convert_yuv444_to_nv12_p_vec(void **dst, const void **src, int width, int src_y_pitch_byte, int src_uv_pitch_byte, int dst_y_pitch_byte, int dst_uv_pitch_byte, int height, int dst_height, int thread_id, int thread_n, int *crop) {
+    convert_yuv444_to_nv12_vec_base<uint8_t, 8, false>(dst, src, width, src_y_pitch_byte, src_uv_pitch_byte, dst_y_pitch_byte, dst_uv_pitch_byte, height, dst_height, thread_id, thread_n, crop);
+}
+
+void convert_yuv444_to_nv12_i_vec(void **dst, const void **src, int width, int src_y_pitch_byte, int src_uv_pitch_byte, int dst_y_pitch_byte, int dst_uv_pitch_byte, int height, int dst_height, int thread_id, int thread_n, int *crop) {
+    convert_yuv444_to_nv12_vec_base<uint8_t, 8, true>(dst, src, width, src_y_pitch_byte, src_uv_pitch_byte, dst_y_pitch_byte, dst_uv_pitch_byte, height, dst_height, thread_id, thread_n, crop);
+}
+
+void convert_yuv444_to_p010_p_vec(void **dst, const void **src, int width, int src_y_pitch_byte, int src_uv_pitch_byte, int dst_y_pitch_byte, int dst_uv_pitch_byte, int height, int dst_height, int thread_id, int thread_n, int *crop) {
+    convert_yuv444_to_nv12_vec_base<uint16_t, 16, false>(dst, src, width, src_y_pitch_byte, src_uv_pitch_byte, dst_y_pitch_byte, dst_uv_pitch_byte, height, dst_height, thread_id, thread_n, crop);
+}
+
+void convert_yuv444_to_p010_i_vec(void **dst, const void **src, int width, int src_y_pitch_byte, int src_uv_pitch_byte, int dst_y_pitch_byte, int dst_uv_pitch_byte, int height, int dst_height, int thread_id, int thread_n, int *crop) {
+    convert_yuv444_to_nv12_vec_base<uint16_t, 16, true>(dst, src, width, src_y_pitch_byte, src_uv_pitch_byte, dst_y_pitch_byte, dst_uv_pitch_byte, height, dst_height, thread_id, thread_n, crop);
+}
+
+#pragma warning (pop)
+
+#endif //#if ENABLE_RGY_SIMD_VEC
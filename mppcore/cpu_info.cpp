@@ -342,6 +342,9 @@ bool getCPUHybridMasks(cpu_info_t *info) {
     info->maskSystem = maskSysAff;
     const auto threadCount = CountSetBits(info->maskSystem);
 #else
+    for (int i = 0; i < info->physical_cores; i++) {
+        info->maskSystem |= info->proc_list[i].mask;
+    }
     const auto threadCount = info->physical_cores;
 #endif
 #if defined(__x86__) || defined(__x86_64__) || defined(_M_X86) || defined(_M_IX86) || defined(_M_X64)
@@ -142,6 +142,12 @@ tstring encoder_help() {
         _T("   --check-avdevices            show in/out avdvices available\n")
         _T("   --check-filters              show filters available\n")
         _T("   --option-list                show option list\n")
+#endif
+#if !(defined(_WIN32) || defined(_WIN64))
+        _T("\n")
+        _T("   --server <string>            run as resident job server on the unix socket.\n")
+        _T("                                 each connection sends one command line and\n")
+        _T("                                 receives its log and \"RESULT <exit code>\".\n")
 #endif
         _T("\n"));
     str += strsprintf(_T("\n")
@@ -198,6 +204,34 @@ tstring encoder_help() {
         });
     str += _T("\n");
     str += gen_cmd_help_ctrl();
+    str += PrintMultipleListOptions(_T("--pipeline-mode <string>"), _T("set pipeline execution mode"),
+        { { _T(""), list_pipeline_mode,   0 },
+        });
+    str += _T("")
+        _T("   --cl-persistent-map          keep OpenCL filter output buffers mapped to host\n")
+        _T("                                  and skip map/unmap when passing frames to encoder.\n")
+        _T("                                  requires fine-grain SVM support of the device.\n");
+    str += _T("")
+        _T("   --trim-smart                 copy GOPs which lie fully inside the --trim ranges\n")
+        _T("                                  without re-encoding, and re-encode only the GOPs\n")
+        _T("                                  around the cut points. (H.264/HEVC, no filters)\n");
+    str += _T("\n")
+        _T("   --rendition <param1>=<value1>[,<param2>=<value2>][...]\n")
+        _T("     add an output which encodes the filtered frames at another resolution,\n")
+        _T("     sharing decode and filtering with the main output. can be specified\n")
+        _T("     multiple times. audio/subtitles/chapters are written to the main output only.\n")
+        _T("     requires OpenCL.\n")
+        _T("    params\n")
+        _T("      output=<string>           output filename (required).\n")
+        _T("      res=<int>x<int>           output resolution (required).\n")
+        _T("      codec=<string>            codec (default: same as main output).\n")
+        _T("      cqp=<int> or <int>:<int>:<int>\n")
+        _T("      cbr=<int>, vbr=<int>, avbr=<int>\n")
+        _T("                                rate control (default: same as main output).\n")
+        _T("      max-bitrate=<int>         max bitrate (kbps).\n")
+        _T("      profile=<string>          codec profile (default: same as main output).\n")
+        _T("      level=<string>            codec level (default: same as main output).\n")
+        _T("    example: --rendition output=720p.mp4,res=1280x720,vbr=3000\n");
     return str;
 }
 
@@ -447,6 +481,14 @@ int parse_one_option(const TCHAR *option_name, const TCHAR* strInput[], int& i,
         pParams->aud = true;
         return 0;
     }
+    if (IS_OPTION("trim-smart")) {
+        pParams->trimSmart = true;
+        return 0;
+    }
+    if (IS_OPTION("no-trim-smart")) {
+        pParams->trimSmart = false;
+        return 0;
+    }
     if (IS_OPTION("no-aud")) {
         pParams->aud = false;
         return 0;
@@ -583,6 +625,109 @@ int parse_one_option(const TCHAR *option_name, const TCHAR* strInput[], int& i,
         pParams->deint = (IEPDeinterlaceMode)value;
         return 0;
     }
+    if (IS_OPTION("pipeline-mode")) {
+        i++;
+        int value = 0;
+        if (PARSE_ERROR_FLAG == (value = get_value_from_chr(list_pipeline_mode, strInput[i]))) {
+            print_cmd_error_invalid_value(option_name, strInput[i], list_pipeline_mode);
+            return 1;
+        }
+        pParams->pipelineMode = (MPPPipelineMode)value;
+        return 0;
+    }
+    if (IS_OPTION("cl-persistent-map")) {
+        pParams->clPersistentMap = true;
+        return 0;
+    }
+    if (IS_OPTION("no-cl-persistent-map")) {
+        pParams->clPersistentMap = false;
+        return 0;
+    }
+    if (IS_OPTION("rendition")) {
+        i++;
+        const auto paramList = std::vector<std::string>{ "output", "res", "codec", "cqp", "vbr", "cbr", "avbr", "max-bitrate", "profile", "level" };
+        MPPRenditionParam rendition;
+        for (const auto& param : split(strInput[i], _T(","))) {
+            auto pos = param.find_first_of(_T("="));
+            if (pos != std::string::npos) {
+                auto param_arg = param.substr(0, pos);
+                auto param_val = param.substr(pos + 1);
+                param_arg = tolowercase(param_arg);
+                if (param_arg == _T("output")) {
+                    rendition.outputFilename = param_val;
+                    continue;
+                }
+                if (param_arg == _T("res")) {
+                    int value[2] = { 0 };
+                    if (   2 != _stscanf_s(param_val.c_str(), _T("%dx%d"), &value[0], &value[1])
+                        && 2 != _stscanf_s(param_val.c_str(), _T("%d:%d"), &value[0], &value[1])) {
+                        print_cmd_error_invalid_value(tstring(option_name) + _T(" ") + param_arg + _T("="), param_val);
+                        return 1;
+                    }
+                    if (value[0] <= 0 || value[1] <= 0 || (value[0] & 1) || (value[1] & 1)) {
+                        print_cmd_error_invalid_value(tstring(option_name) + _T(" ") + param_arg + _T("="), param_val, _T("resolution should be positive even value."));
+                        return 1;
+                    }
+                    rendition.width = value[0];
+                    rendition.height = value[1];
+                    continue;
+                }
+                if (param_arg == _T("codec")) {
+                    int value = 0;
+                    if (PARSE_ERROR_FLAG == (value = get_value_from_chr(list_codec_all, param_val.c_str()))) {
+                        print_cmd_error_invalid_value(tstring(option_name) + _T(" ") + param_arg + _T("="), param_val, list_codec_all);
+                        return 1;
+                    }
+                    rendition.codec = (RGY_CODEC)value;
+                    continue;
+                }
+                if (param_arg == _T("cqp")) {
+                    if (rendition.qp.parse(param_val.c_str()) != 0) {
+                        print_cmd_error_invalid_value(tstring(option_name) + _T(" ") + param_arg + _T("="), param_val);
+                        return 1;
+                    }
+                    rendition.rateControl = MPP_ENC_RC_MODE_FIXQP;
+                    continue;
+                }
+                if (param_arg == _T("vbr") || param_arg == _T("cbr") || param_arg == _T("avbr") || param_arg == _T("max-bitrate")) {
+                    int value = 0;
+                    if (1 != _stscanf_s(param_val.c_str(), _T("%d"), &value)) {
+                        print_cmd_error_invalid_value(tstring(option_name) + _T(" ") + param_arg + _T("="), param_val);
+                        return 1;
+                    } else if (value < 0) {
+                        print_cmd_error_invalid_value(tstring(option_name) + _T(" ") + param_arg + _T("="), param_val, _T("bitrate should be positive value."));
+                        return 1;
+                    }
+                    if (param_arg == _T("max-bitrate")) {
+                        rendition.maxBitrate = value;
+                    } else {
+                        rendition.rateControl = (param_arg == _T("vbr")) ? MPP_ENC_RC_MODE_VBR : ((param_arg == _T("cbr")) ? MPP_ENC_RC_MODE_CBR : MPP_ENC_RC_MODE_AVBR);
+                        rendition.bitrate = value;
+                    }
+                    continue;
+                }
+                if (param_arg == _T("profile")) {
+                    rendition.profile = param_val;
+                    continue;
+                }
+                if (param_arg == _T("level")) {
+                    rendition.level = param_val;
+                    continue;
+                }
+                print_cmd_error_unknown_opt_param(option_name, param_arg, paramList);
+                return 1;
+            } else {
+                print_cmd_error_unknown_opt_param(option_name, param, paramList);
+                return 1;
+            }
+        }
+        if (rendition.outputFilename.length() == 0 || rendition.width <= 0 || rendition.height <= 0) {
+            print_cmd_error_invalid_value(option_name, strInput[i], _T("output and res must be specified."));
+            return 1;
+        }
+        pParams->renditions.push_back(rendition);
+        return 0;
+    }
 
     print_cmd_error_unknown_opt(strInput[i]);
     return 1;
@@ -718,6 +863,20 @@ int parse_cmd(MPPParam *pParams, int nArgNum, const TCHAR **strInput, bool ignor
             return 1;
         }
     }
+    //renditionのprofile/levelはcodecが確定してからチェックする
+    for (const auto& rendition : pParams->renditions) {
+        const auto codec = (rendition.codec != RGY_CODEC_UNKNOWN) ? rendition.codec : pParams->codec;
+        if (rendition.profile.length() > 0
+            && (is_list_empty(get_profile_list(codec)) || PARSE_ERROR_FLAG == get_value_from_chr(get_profile_list(codec), rendition.profile.c_str()))) {
+            print_cmd_error_invalid_value(_T("rendition profile="), rendition.profile, get_profile_list(codec));
+            return 1;
+        }
+        if (rendition.level.length() > 0
+            && (is_list_empty(get_level_list(codec)) || PARSE_ERROR_FLAG == get_value_from_chr(get_level_list(codec), rendition.level.c_str()))) {
+            print_cmd_error_invalid_value(_T("rendition level="), rendition.level, get_level_list(codec));
+            return 1;
+        }
+    }
     return 0;
 }
 
@@ -867,6 +1026,7 @@ tstring gen_cmd(const MPPParam *pParams, bool save_disabled_prm, RGYDisableGenCm
     //}
     OPT_BOOL(_T("--repeat-headers"), _T("--no-repeat-headers"), repeatHeaders);
     OPT_BOOL(_T("--aud"), _T("--no-aud"), aud);
+    OPT_BOOL(_T("--trim-smart"), _T("--no-trim-smart"), trimSmart);
 
     OPT_NUM(_T("--chroma-qp-offset"), chromaQPOffset);
     OPT_BOOL(_T("--no-deblock"), _T(""), disableDeblock);
@@ -883,6 +1043,35 @@ tstring gen_cmd(const MPPParam *pParams, bool save_disabled_prm, RGYDisableGenCm
     cmd << gen_cmd(&pParams->vpp, &encPrmDefault.vpp, save_disabled_prm, disable_flags);
 
     OPT_LST(_T("--vpp-deinterlace"), deint, list_iep_deinterlace);
+    OPT_LST(_T("--pipeline-mode"), pipelineMode, list_pipeline_mode);
+    OPT_BOOL(_T("--cl-persistent-map"), _T("--no-cl-persistent-map"), clPersistentMap);
+    for (const auto& rendition : pParams->renditions) {
+        tmp.str(tstring());
+        tmp << _T(",output=") << rendition.outputFilename;
+        tmp << _T(",res=") << rendition.width << _T("x") << rendition.height;
+        if (rendition.codec != RGY_CODEC_UNKNOWN) {
+            tmp << _T(",codec=") << get_chr_from_value(list_codec_all, rendition.codec);
+        }
+        if (rendition.rateControl == MPP_ENC_RC_MODE_CBR) {
+            tmp << _T(",cbr=") << rendition.bitrate;
+        } else if (rendition.rateControl == MPP_ENC_RC_MODE_VBR) {
+            tmp << _T(",vbr=") << rendition.bitrate;
+        } else if (rendition.rateControl == MPP_ENC_RC_MODE_AVBR) {
+            tmp << _T(",avbr=") << rendition.bitrate;
+        } else if (rendition.rateControl == MPP_ENC_RC_MODE_FIXQP) {
+            tmp << _T(",cqp=") << rendition.qp.qpI << _T(":") << rendition.qp.qpP << _T(":") << rendition.qp.qpB;
+        }
+        if (rendition.maxBitrate > 0) {
+            tmp << _T(",max-bitrate=") << rendition.maxBitrate;
+        }
+        if (rendition.profile.length() > 0) {
+            tmp << _T(",profile=") << rendition.profile;
+        }
+        if (rendition.level.length() > 0) {
+            tmp << _T(",level=") << rendition.level;
+        }
+        cmd << _T(" --rendition \"") << tmp.str().substr(1) << _T("\"");
+    }
 
     return cmd.str();
 }
@@ -109,6 +109,7 @@
 #include "rgy_filter_overlay.h"
 #include "rgy_filter_deband.h"
 #include "rgy_filesystem.h"
+#include "rgy_task_graph.h"
 #include "rgy_version.h"
 #include "rgy_bitstream.h"
 #include "rgy_chapter.h"
@@ -116,6 +117,7 @@
 #include "rgy_timecode.h"
 #include "rgy_aspect_ratio.h"
 #include "rgy_opencl_perf.h"
+#include "rgy_opencl_cache.h"
 #include "cpu_info.h"
 #include "gpu_info.h"
 
@@ -241,18 +243,25 @@ MPPCore::MPPCore() :
     m_picStruct(RGY_PICSTRUCT_UNKNOWN),
     m_encVUI(),
     m_cl(),
+    m_sharedCL(nullptr),
     m_enccfg(),
     m_encoder(),
     m_decoder(),
     m_vpFilters(),
+    m_vppMemPlanner(),
     m_canFollowResolutionChange(false),
     m_pLastFilterParam(),
     m_videoQualityMetric(),
+    m_renditions(),
+    m_smartCut(),
     m_state(RGY_STATE_STOPPED),
     m_pTrimParam(nullptr),
     m_thDecoder(),
     m_thOutput(),
     m_pipelineTasks(),
+    m_pipelineMode(MPPPipelineMode::SERIAL),
+    m_pipelineThreadParam(),
+    m_clPersistentMap(false),
     m_pAbortByUser(nullptr) {
 }
 
@@ -276,8 +285,15 @@ void MPPCore::Terminate() {
     m_pTrimParam = nullptr;
 
     m_pipelineTasks.clear();
+    // OpenCLを使用しない場合にも --pipeline-trace の結果を書き出す
+    if (RGYOpenCLPerfCollector::instance().isPipelineTraceEnabled()) {
+        RGYOpenCLPerfCollector::instance().flush();
+    }
 
     m_vpFilters.clear();
+    m_vppMemPlanner.reset();
+    m_renditions.clear();
+    m_smartCut.reset();
     m_pLastFilterParam.reset();
     m_timecode.reset();
 
@@ -316,10 +332,14 @@ void MPPCore::PrintMes(RGYLogLevel log_level, const TCHAR *format, ...) {
     m_pLog->write(log_level, RGY_LOGT_CORE, buffer.data());
 }
 
-void MPPCore::SetAbortFlagPointer(bool *abortFlag) {
+void MPPCore::SetAbortFlagPointer(std::atomic<bool> *abortFlag) {
     m_pAbortByUser = abortFlag;
 }
 
+void MPPCore::SetSharedOpenCLContext(std::shared_ptr<RGYOpenCLContext> *sharedCL) {
+    m_sharedCL = sharedCL;
+}
+
 RGY_ERR MPPCore::readChapterFile(tstring chapfile) {
 #if ENABLE_AVSW_READER
     ChapterRW chapter;
@@ -431,6 +451,31 @@ RGY_ERR MPPCore::initPowerThrottoling(MPPParam *prm) {
     return RGY_ERR_NONE;
 }
 
+//--thread-affinity autoの指定されたスレッドを、big.LITTLE構成に応じて割り当てる
+//処理速度に影響するスレッドは性能の高いコアに、音声・性能監視などは性能の低いコアに割り当てる
+RGY_ERR MPPCore::initThreadAffinity(MPPParam *prm) {
+    bool autoAffinity = false;
+    for (int i = (int)RGYThreadType::ALL + 1; i < (int)RGYThreadType::END; i++) {
+        autoAffinity |= prm->ctrl.threadParams.get((RGYThreadType)i).affinity.mode == RGYThreadAffinityMode::AUTO;
+    }
+    if (!autoAffinity) {
+        return RGY_ERR_NONE;
+    }
+    const auto topology = rgy_get_cpu_topology();
+    for (const auto& core : topology.cores) {
+        PrintMes(RGY_LOG_DEBUG, _T("cpu%d: capacity %d, cluster %d.\n"), core.cpu, core.capacity, core.cluster);
+    }
+    PrintMes(RGY_LOG_INFO, _T("Thread affinity auto: %s.\n"), topology.print().c_str());
+    tstring placement;
+    for (const auto& [type, desc] : prm->ctrl.threadParams.resolve_auto_affinity(topology)) {
+        placement += strsprintf(_T(", %s=%s"), rgy_thread_type_to_str(type), desc.c_str());
+    }
+    if (placement.length() > 0) {
+        PrintMes(RGY_LOG_INFO, _T("Thread affinity auto: %s.\n"), placement.substr(2).c_str());
+    }
+    return RGY_ERR_NONE;
+}
+
 RGY_ERR MPPCore::initPerfMonitor(MPPParam *prm) {
     const bool bLogOutput = prm->ctrl.perfMonitorSelect || prm->ctrl.perfMonitorSelectMatplot;
     tstring perfMonLog;
@@ -528,7 +573,7 @@ RGY_ERR MPPCore::initInput(MPPParam *inputParam) {
     const bool vpp_ivtc_expand_active = inputParam->vpp.ivtc.enable && inputParam->vpp.ivtc.expand != 0;
     auto err = initReaders(m_pFileReader, m_AudioReaders, &inputParam->input,  &inputParam->inprm, inputCspOfRawReader,
         m_pStatus, &inputParam->common, &inputParam->ctrl, HWDecCodecCsp, subburnTrackId,
-        inputParam->vpp.afs.enable, inputParam->vpp.rff.enable, inputParam->vpp.libplacebo_tonemapping.enable, vpp_ivtc_expand_active,
+        inputParam->vpp.afs.enable, inputParam->vpp.rff.enable, inputParam->vpp.libplacebo_tonemapping.enable, vpp_ivtc_expand_active, inputParam->trimSmart,
         m_poolPkt.get(), m_poolFrame.get(), nullptr, m_pPerfMonitor.get(), m_pLog);
     if (err != RGY_ERR_NONE) {
         PrintMes(RGY_LOG_ERROR, _T("failed to initialize file reader(s).\n"));
@@ -745,12 +790,16 @@ RGY_ERR MPPCore::initOutput(MPPParam *inputParams) {
         PrintMes(RGY_LOG_ERROR, _T("Failed to parse HEVC HDR10 metadata.\n"));
         return RGY_ERR_INVALID_PARAM;
     }
-    const auto outputVideoInfo = videooutputinfo(
+    auto outputVideoInfo = videooutputinfo(
         m_enccfg,
         m_sar,
         m_picStruct,
         m_encVUI
     );
+    if (m_smartCut) {
+        //コピーするGOPにはBフレームが含まれうるので、dtsの生成に必要な遅延を設定する
+        outputVideoInfo.videoDelay = m_smartCut->videoDelay();
+    }
 
     auto insertHeader = inputParams->aud ? INSERT_HEADER_AUD : INSERT_HEADER_NONE;
     auto muxerCmdline = tstring();
@@ -1058,6 +1107,7 @@ RGY_ERR MPPCore::initFilters(MPPParam *inputParam) {
     m_encVUI.setDescriptPreset();
 
     m_vpFilters.clear();
+    m_vppMemPlanner.reset();
     m_canFollowResolutionChange = false;
 
     std::vector<VppType> filterPipeline = InitFiltersCreateVppList(inputParam, cspConvRequired, cropRequired, resizeRequired);
@@ -1196,6 +1246,26 @@ RGY_ERR MPPCore::initFilters(MPPParam *inputParam) {
         }
     }
 
+    //OpenCLフィルタの出力バッファのうち、生存期間の重ならないものを共通の領域に割り当てる
+    if (m_cl) {
+        m_vppMemPlanner = std::make_unique<RGYFilterMemoryPlanner>(m_cl, m_pLog);
+        for (auto& block : m_vpFilters) {
+            if (block.type == VppFilterType::FILTER_OPENCL) {
+                auto err = m_vppMemPlanner->plan(block.vppcl);
+                if (err != RGY_ERR_NONE) {
+                    PrintMes(RGY_LOG_ERROR, _T("Failed to plan vpp memory: %s.\n"), get_err_mes(err));
+                    return err;
+                }
+            }
+        }
+        if (m_vppMemPlanner->bytesBefore() > 0) {
+            PrintMes((m_vppMemPlanner->aliasedFilters() > 0) ? RGY_LOG_INFO : RGY_LOG_DEBUG,
+                _T("vpp frame buffers: %.1f MB -> %.1f MB (%d filter(s) aliased).\n"),
+                m_vppMemPlanner->bytesBefore() / (double)(1024 * 1024), m_vppMemPlanner->bytesAfter() / (double)(1024 * 1024),
+                m_vppMemPlanner->aliasedFilters());
+        }
+    }
+
     if (inputParam->vpp.checkPerformance) {
         for (auto& block : m_vpFilters) {
             if (block.type == VppFilterType::FILTER_OPENCL) {
@@ -2859,23 +2929,23 @@ RGY_ERR MPPCore::AddFilterOpenCL(std::vector<std::unique_ptr<RGYFilter>>&clfilte
     return RGY_ERR_UNSUPPORTED;
 }
 
-RGY_ERR MPPCore::initEncoderPrep(const MPPParam *prm) {
-    m_enccfg.prep.change        = MPP_ENC_PREP_CFG_CHANGE_INPUT |
-                                  MPP_ENC_PREP_CFG_CHANGE_ROTATION |
-                                  MPP_ENC_PREP_CFG_CHANGE_FORMAT;
-    m_enccfg.prep.width         = m_encWidth;
-    m_enccfg.prep.height        = m_encHeight;
-    m_enccfg.prep.hor_stride    = mpp_frame_pitch(GetEncoderCSP(prm), m_encWidth);
-    m_enccfg.prep.ver_stride    = m_encHeight;
-    m_enccfg.prep.format        = csp_rgy_to_enc(GetEncoderCSP(prm));
-    m_enccfg.prep.rotation      = MPP_ENC_ROT_0;
-
-    m_enccfg.prep.color         = (MppFrameColorSpace)m_encVUI.matrix;
-    m_enccfg.prep.colorprim     = (MppFrameColorPrimaries)m_encVUI.colorprim;
-    m_enccfg.prep.colortrc      = (MppFrameColorTransferCharacteristic)m_encVUI.transfer;
-    m_enccfg.prep.range         = (MppFrameColorRange)m_encVUI.colorrange;
-
-    auto ret = err_to_rgy(m_encoder->mpi->control(m_encoder->ctx, MPP_ENC_SET_PREP_CFG, &m_enccfg.prep));
+RGY_ERR MPPCore::initEncoderPrep(MPPContext *encoder, MPPCfg& enccfg, const MPPParam *prm, const int width, const int height) {
+    enccfg.prep.change        = MPP_ENC_PREP_CFG_CHANGE_INPUT |
+                                MPP_ENC_PREP_CFG_CHANGE_ROTATION |
+                                MPP_ENC_PREP_CFG_CHANGE_FORMAT;
+    enccfg.prep.width         = width;
+    enccfg.prep.height        = height;
+    enccfg.prep.hor_stride    = mpp_frame_pitch(GetEncoderCSP(prm), width);
+    enccfg.prep.ver_stride    = height;
+    enccfg.prep.format        = csp_rgy_to_enc(GetEncoderCSP(prm));
+    enccfg.prep.rotation      = MPP_ENC_ROT_0;
+
+    enccfg.prep.color         = (MppFrameColorSpace)m_encVUI.matrix;
+    enccfg.prep.colorprim     = (MppFrameColorPrimaries)m_encVUI.colorprim;
+    enccfg.prep.colortrc      = (MppFrameColorTransferCharacteristic)m_encVUI.transfer;
+    enccfg.prep.range         = (MppFrameColorRange)m_encVUI.colorrange;
+
+    auto ret = err_to_rgy(encoder->mpi->control(encoder->ctx, MPP_ENC_SET_PREP_CFG, &enccfg.prep));
     if (ret != RGY_ERR_NONE) {
         PrintMes(RGY_LOG_ERROR, _T("Failed to set prep cfg to encoder: %s.\n"), get_err_mes(ret));
         return ret;
@@ -2885,19 +2955,19 @@ RGY_ERR MPPCore::initEncoderPrep(const MPPParam *prm) {
     return RGY_ERR_NONE;
 }
 
-RGY_ERR MPPCore::checkRCParam(MPPParam *prm) {
+RGY_ERR MPPCore::checkRCParam(MPPParam *prm, const int width, const int height) {
     const bool hevc_high_tier = prm->codec == RGY_CODEC_HEVC && prm->codecParam[prm->codec].tier == 1;
     auto codecLevel = createCodecLevel(prm->codec);
     const int codecProfile = prm->codecParam[prm->codec].profile;
     if (prm->codecParam[prm->codec].level != codecLevel->level_auto()) {
         auto& level = prm->codecParam[prm->codec].level;
-        const int required_level = codecLevel->calc_auto_level(m_encWidth, m_encHeight, 0, false,
+        const int required_level = codecLevel->calc_auto_level(width, height, 0, false,
             m_encFps.n(), m_encFps.d(), codecProfile, hevc_high_tier, 0, 0, 1, 1);
         if (level < required_level) {
             PrintMes(RGY_LOG_WARN, _T("Level %s does not support the current settings (%s @ %s, %dx%d, %d/%d fps), switching level selection to auto.\n"),
                 get_cx_desc(get_level_list(prm->codec), level),
                 CodecToStr(prm->codec).c_str(), get_cx_desc(get_profile_list(prm->codec), codecProfile),
-                m_encWidth, m_encHeight, m_encFps.n(), m_encFps.d());
+                width, height, m_encFps.n(), m_encFps.d());
             level = codecLevel->level_auto();
         } else {
             // refはrkmppencでは設定がない
@@ -2928,7 +2998,7 @@ RGY_ERR MPPCore::checkRCParam(MPPParam *prm) {
         const int prefered_bitrate_kbps = prm->bitrate * 5 / 4;
         int level = prm->codecParam[prm->codec].level;
         if (level == codecLevel->level_auto()) {
-            level = codecLevel->calc_auto_level(m_encWidth, m_encHeight, 0, false,
+            level = codecLevel->calc_auto_level(width, height, 0, false,
                 m_encFps.n(), m_encFps.d(), codecProfile, hevc_high_tier, prefered_bitrate_kbps, 0, 1, 1);
         }
         // rkmppencではあまり最大ビットレートを大きくすると、ビットレートが指定値から上振れしやすくなるので、
@@ -2938,69 +3008,69 @@ RGY_ERR MPPCore::checkRCParam(MPPParam *prm) {
     return RGY_ERR_NONE;
 }
 
-RGY_ERR MPPCore::initEncoderRC(const MPPParam *prm) {
-    m_enccfg.rc.change  = MPP_ENC_RC_CFG_CHANGE_RC_MODE |
-                          MPP_ENC_RC_CFG_CHANGE_QUALITY |
-                          MPP_ENC_RC_CFG_CHANGE_BPS |
-                          MPP_ENC_RC_CFG_CHANGE_FPS_IN |
-                          MPP_ENC_RC_CFG_CHANGE_FPS_OUT |
-                          MPP_ENC_RC_CFG_CHANGE_GOP |
-                          MPP_ENC_RC_CFG_CHANGE_SKIP_CNT |
-                          MPP_ENC_RC_CFG_CHANGE_QP_INIT |
-                          MPP_ENC_RC_CFG_CHANGE_QP_RANGE |
-                          MPP_ENC_RC_CFG_CHANGE_QP_RANGE_I |
-                          MPP_ENC_RC_CFG_CHANGE_QP_MAX_STEP |
-                          MPP_ENC_RC_CFG_CHANGE_DROP_FRM;
-    m_enccfg.rc.rc_mode = (MppEncRcMode)prm->rateControl;
-    m_enccfg.rc.quality = (MppEncRcQuality)prm->qualityPreset;
-    m_enccfg.rc.bps_target  = prm->bitrate * 1000;
+RGY_ERR MPPCore::initEncoderRC(MPPContext *encoder, MPPCfg& enccfg, const MPPParam *prm) {
+    enccfg.rc.change  = MPP_ENC_RC_CFG_CHANGE_RC_MODE |
+                        MPP_ENC_RC_CFG_CHANGE_QUALITY |
+                        MPP_ENC_RC_CFG_CHANGE_BPS |
+                        MPP_ENC_RC_CFG_CHANGE_FPS_IN |
+                        MPP_ENC_RC_CFG_CHANGE_FPS_OUT |
+                        MPP_ENC_RC_CFG_CHANGE_GOP |
+                        MPP_ENC_RC_CFG_CHANGE_SKIP_CNT |
+                        MPP_ENC_RC_CFG_CHANGE_QP_INIT |
+                        MPP_ENC_RC_CFG_CHANGE_QP_RANGE |
+                        MPP_ENC_RC_CFG_CHANGE_QP_RANGE_I |
+                        MPP_ENC_RC_CFG_CHANGE_QP_MAX_STEP |
+                        MPP_ENC_RC_CFG_CHANGE_DROP_FRM;
+    enccfg.rc.rc_mode = (MppEncRcMode)prm->rateControl;
+    enccfg.rc.quality = (MppEncRcQuality)prm->qualityPreset;
+    enccfg.rc.bps_target  = prm->bitrate * 1000;
 
     if (prm->rateControl == MPP_ENC_RC_MODE_FIXQP) {
-        m_enccfg.rc.qp_init     = prm->qp.qpI;
-        m_enccfg.rc.qp_max      = std::max(prm->qp.qpI, prm->qp.qpP);
-        m_enccfg.rc.qp_min      = std::min(prm->qp.qpI, prm->qp.qpP);
-        m_enccfg.rc.qp_max_i    = std::max(prm->qp.qpI, prm->qp.qpP);
-        m_enccfg.rc.qp_min_i    = std::min(prm->qp.qpI, prm->qp.qpP);
-        m_enccfg.rc.qp_delta_ip = prm->qp.qpP - prm->qp.qpI;
-        m_enccfg.rc.qp_delta_vi = prm->qp.qpP - prm->qp.qpI;
-        m_enccfg.rc.quality     = MPP_ENC_RC_QUALITY_CQP;
+        enccfg.rc.qp_init     = prm->qp.qpI;
+        enccfg.rc.qp_max      = std::max(prm->qp.qpI, prm->qp.qpP);
+        enccfg.rc.qp_min      = std::min(prm->qp.qpI, prm->qp.qpP);
+        enccfg.rc.qp_max_i    = std::max(prm->qp.qpI, prm->qp.qpP);
+        enccfg.rc.qp_min_i    = std::min(prm->qp.qpI, prm->qp.qpP);
+        enccfg.rc.qp_delta_ip = prm->qp.qpP - prm->qp.qpI;
+        enccfg.rc.qp_delta_vi = prm->qp.qpP - prm->qp.qpI;
+        enccfg.rc.quality     = MPP_ENC_RC_QUALITY_CQP;
     } else {
-        if (prm->rateControl == MPP_ENC_RC_MODE_VBR && m_enccfg.rc.quality == MPP_ENC_RC_QUALITY_CQP) {
-            m_enccfg.rc.bps_target  = -1;
-            m_enccfg.rc.bps_max     = -1;
-            m_enccfg.rc.bps_min     = -1;
+        if (prm->rateControl == MPP_ENC_RC_MODE_VBR && enccfg.rc.quality == MPP_ENC_RC_QUALITY_CQP) {
+            enccfg.rc.bps_target  = -1;
+            enccfg.rc.bps_max     = -1;
+            enccfg.rc.bps_min     = -1;
         } else {
             if (prm->rateControl == MPP_ENC_RC_MODE_CBR) {
-                m_enccfg.rc.bps_max     = m_enccfg.rc.bps_target * 17 / 16;
-                m_enccfg.rc.bps_min     = m_enccfg.rc.bps_target * 15 / 16;
+                enccfg.rc.bps_max     = enccfg.rc.bps_target * 17 / 16;
+                enccfg.rc.bps_min     = enccfg.rc.bps_target * 15 / 16;
             } else {
                 if (prm->maxBitrate == 0) { // 自動で適当な値を入れておかないとエラーになる
-                    m_enccfg.rc.bps_max = m_enccfg.rc.bps_target * 3 / 2;
+                    enccfg.rc.bps_max = enccfg.rc.bps_target * 3 / 2;
                 } else {
-                    m_enccfg.rc.bps_max = std::max(prm->maxBitrate * 1000, m_enccfg.rc.bps_target);
+                    enccfg.rc.bps_max = std::max(prm->maxBitrate * 1000, enccfg.rc.bps_target);
                 }
-                m_enccfg.rc.bps_min     = m_enccfg.rc.bps_target * 1 / 16;
+                enccfg.rc.bps_min     = enccfg.rc.bps_target * 1 / 16;
             }
-            m_enccfg.rc.qp_init     = -1;
-            m_enccfg.rc.qp_max      = prm->qpMax;
-            m_enccfg.rc.qp_min      = prm->qpMin;
-            m_enccfg.rc.qp_max_i    = prm->qpMax;
-            m_enccfg.rc.qp_min_i    = prm->qpMin;
-            m_enccfg.rc.qp_max_step = 16;
-            m_enccfg.rc.qp_delta_ip = 3;
+            enccfg.rc.qp_init     = -1;
+            enccfg.rc.qp_max      = prm->qpMax;
+            enccfg.rc.qp_min      = prm->qpMin;
+            enccfg.rc.qp_max_i    = prm->qpMax;
+            enccfg.rc.qp_min_i    = prm->qpMin;
+            enccfg.rc.qp_max_step = 16;
+            enccfg.rc.qp_delta_ip = 3;
         }
     }
 
-    m_enccfg.rc.fps_in_num     = m_encFps.n();
-    m_enccfg.rc.fps_in_denom   = m_encFps.d();
-    m_enccfg.rc.fps_out_num    = m_encFps.n();
-    m_enccfg.rc.fps_out_denom  = m_encFps.d();
+    enccfg.rc.fps_in_num     = m_encFps.n();
+    enccfg.rc.fps_in_denom   = m_encFps.d();
+    enccfg.rc.fps_out_num    = m_encFps.n();
+    enccfg.rc.fps_out_denom  = m_encFps.d();
 
-    m_enccfg.rc.gop             = prm->gopLen;
-    m_enccfg.rc.skip_cnt        = 0;
-    m_enccfg.rc.drop_mode       = MPP_ENC_RC_DROP_FRM_DISABLED;
+    enccfg.rc.gop             = prm->gopLen;
+    enccfg.rc.skip_cnt        = 0;
+    enccfg.rc.drop_mode       = MPP_ENC_RC_DROP_FRM_DISABLED;
 
-    auto ret = err_to_rgy(m_encoder->mpi->control(m_encoder->ctx, MPP_ENC_SET_RC_CFG, &m_enccfg.rc));
+    auto ret = err_to_rgy(encoder->mpi->control(encoder->ctx, MPP_ENC_SET_RC_CFG, &enccfg.rc));
     if (ret != RGY_ERR_NONE) {
         PrintMes(RGY_LOG_ERROR, _T("Failed to set rc config to encoder: %s.\n"), get_err_mes(ret));
         return ret;
@@ -3009,27 +3079,26 @@ RGY_ERR MPPCore::initEncoderRC(const MPPParam *prm) {
     return RGY_ERR_NONE;
 }
 
-RGY_ERR MPPCore::initEncoderCodec(const MPPParam *prm) {
-    m_encCodec = prm->codec;
-    m_enccfg.codec.coding = codec_rgy_to_enc(prm->codec);
+RGY_ERR MPPCore::initEncoderCodec(MPPContext *encoder, MPPCfg& enccfg, const MPPParam *prm) {
+    enccfg.codec.coding = codec_rgy_to_enc(prm->codec);
     switch (prm->codec) {
     case RGY_CODEC_H264: {
-        m_enccfg.codec.h264.change = MPP_ENC_H264_CFG_CHANGE_PROFILE |
-                                     MPP_ENC_H264_CFG_CHANGE_ENTROPY |
-                                     MPP_ENC_H264_CFG_CHANGE_TRANS_8x8 |
-                                     MPP_ENC_H264_CFG_CHANGE_CHROMA_QP |
-                                     MPP_ENC_H264_CFG_CHANGE_DEBLOCKING;
-        m_enccfg.codec.h264.profile = prm->codecParam[RGY_CODEC_H264].profile;
-        m_enccfg.codec.h264.level   = prm->codecParam[RGY_CODEC_H264].level;
-        m_enccfg.codec.h264.entropy_coding_mode    = (m_enccfg.codec.h264.profile == get_cx_value(list_avc_profile, _T("baseline"))) ? 0 : 1;
-        m_enccfg.codec.h264.entropy_coding_mode_ex = m_enccfg.codec.h264.entropy_coding_mode; // 実質的には ex のほうが効いている
-        m_enccfg.codec.h264.cabac_init_idc         = 0;
-        m_enccfg.codec.h264.transform8x8_mode      = (m_enccfg.codec.h264.profile == get_cx_value(list_avc_profile, _T("high"))) ? 1 : 0;
+        enccfg.codec.h264.change = MPP_ENC_H264_CFG_CHANGE_PROFILE |
+                                   MPP_ENC_H264_CFG_CHANGE_ENTROPY |
+                                   MPP_ENC_H264_CFG_CHANGE_TRANS_8x8 |
+                                   MPP_ENC_H264_CFG_CHANGE_CHROMA_QP |
+                                   MPP_ENC_H264_CFG_CHANGE_DEBLOCKING;
+        enccfg.codec.h264.profile = prm->codecParam[RGY_CODEC_H264].profile;
+        enccfg.codec.h264.level   = prm->codecParam[RGY_CODEC_H264].level;
+        enccfg.codec.h264.entropy_coding_mode    = (enccfg.codec.h264.profile == get_cx_value(list_avc_profile, _T("baseline"))) ? 0 : 1;
+        enccfg.codec.h264.entropy_coding_mode_ex = enccfg.codec.h264.entropy_coding_mode; // 実質的には ex のほうが効いている
+        enccfg.codec.h264.cabac_init_idc         = 0;
+        enccfg.codec.h264.transform8x8_mode      = (enccfg.codec.h264.profile == get_cx_value(list_avc_profile, _T("high"))) ? 1 : 0;
         // high profile は デフォルトで constraint_set3 = 1 となぜかなってしまうので、これを上書きする
         // https://github.com/rockchip-linux/mpp/blob/develop/mpp/codec/enc/h264/h264e_sps.c#L99
-        if (m_enccfg.codec.h264.profile == get_cx_value(list_avc_profile, _T("high"))) {
-            m_enccfg.codec.h264.change |= MPP_ENC_H264_CFG_CHANGE_CONSTRAINT_SET;
-            m_enccfg.codec.h264.constraint_set = setMppH264ForceConstraintFlags(
+        if (enccfg.codec.h264.profile == get_cx_value(list_avc_profile, _T("high"))) {
+            enccfg.codec.h264.change |= MPP_ENC_H264_CFG_CHANGE_CONSTRAINT_SET;
+            enccfg.codec.h264.constraint_set = setMppH264ForceConstraintFlags(
                 std::array<std::pair<bool, bool>, 6>
                 {std::pair<bool, bool>{ true, false },  // constraint_set0
                  std::pair<bool, bool>{ true, false },  // constraint_set1
@@ -3039,27 +3108,27 @@ RGY_ERR MPPCore::initEncoderCodec(const MPPParam *prm) {
                  std::pair<bool, bool>{ true, false }}  // constraint_set5
             );
         }
-        m_enccfg.codec.h264.chroma_cb_qp_offset  = prm->chromaQPOffset;
-        m_enccfg.codec.h264.chroma_cr_qp_offset  = prm->chromaQPOffset;
-        m_enccfg.codec.h264.deblock_disable      = prm->disableDeblock ? 1 : 0;
-        m_enccfg.codec.h264.deblock_offset_alpha = prm->deblockAlpha;
-        m_enccfg.codec.h264.deblock_offset_beta  = prm->deblockBeta;
+        enccfg.codec.h264.chroma_cb_qp_offset  = prm->chromaQPOffset;
+        enccfg.codec.h264.chroma_cr_qp_offset  = prm->chromaQPOffset;
+        enccfg.codec.h264.deblock_disable      = prm->disableDeblock ? 1 : 0;
+        enccfg.codec.h264.deblock_offset_alpha = prm->deblockAlpha;
+        enccfg.codec.h264.deblock_offset_beta  = prm->deblockBeta;
     } break;
     case RGY_CODEC_HEVC: {
-        m_enccfg.codec.h265.change = MPP_ENC_H265_CFG_PROFILE_LEVEL_TILER_CHANGE |
-                                     MPP_ENC_H265_CFG_TRANS_CHANGE;
-        m_enccfg.codec.h265.profile = prm->codecParam[RGY_CODEC_HEVC].profile;
-        m_enccfg.codec.h265.level   = prm->codecParam[RGY_CODEC_HEVC].level;
-        m_enccfg.codec.h265.tier    = prm->codecParam[RGY_CODEC_HEVC].tier;
-        m_enccfg.codec.h265.trans_cfg.cb_qp_offset = prm->chromaQPOffset;
-        m_enccfg.codec.h265.trans_cfg.cr_qp_offset = prm->chromaQPOffset;
+        enccfg.codec.h265.change = MPP_ENC_H265_CFG_PROFILE_LEVEL_TILER_CHANGE |
+                                   MPP_ENC_H265_CFG_TRANS_CHANGE;
+        enccfg.codec.h265.profile = prm->codecParam[RGY_CODEC_HEVC].profile;
+        enccfg.codec.h265.level   = prm->codecParam[RGY_CODEC_HEVC].level;
+        enccfg.codec.h265.tier    = prm->codecParam[RGY_CODEC_HEVC].tier;
+        enccfg.codec.h265.trans_cfg.cb_qp_offset = prm->chromaQPOffset;
+        enccfg.codec.h265.trans_cfg.cr_qp_offset = prm->chromaQPOffset;
     } break;
     default:
         PrintMes(RGY_LOG_DEBUG, _T("Unknown codec %s.\n"), CodecToStr(prm->codec).c_str());
         return RGY_ERR_UNSUPPORTED;
     }
 
-    auto ret = err_to_rgy(m_encoder->mpi->control(m_encoder->ctx, MPP_ENC_SET_CODEC_CFG, &m_enccfg.codec));
+    auto ret = err_to_rgy(encoder->mpi->control(encoder->ctx, MPP_ENC_SET_CODEC_CFG, &enccfg.codec));
     if (ret != RGY_ERR_NONE) {
         PrintMes(RGY_LOG_ERROR, _T("Failed to set codec config to encoder : %s.\n"), get_err_mes(ret));
         return ret;
@@ -3068,75 +3137,70 @@ RGY_ERR MPPCore::initEncoderCodec(const MPPParam *prm) {
     return RGY_ERR_NONE;
 }
 
-RGY_ERR MPPCore::initEncoder(MPPParam *prm) {
+//エンコーダのcontextの作成 (出力コーデックのみに依存するので、フィルタ等の初期化と並行して行う)
+RGY_ERR MPPCore::initEncoderOpen(std::unique_ptr<MPPContext>& encoder, const MPPParam *prm) {
     auto ret = err_to_rgy(mpp_check_support_format(MPP_CTX_ENC, codec_rgy_to_enc(prm->codec)));
     if (ret != RGY_ERR_NONE) {
         PrintMes(RGY_LOG_ERROR, _T("Codec type (%s) unsupported by MPP\n"), CodecToStr(prm->codec).c_str());
         return ret;
     }
-    m_encoder = std::make_unique<MPPContext>();
+    encoder = std::make_unique<MPPContext>();
 
-    ret = m_encoder->create();
+    ret = encoder->create();
     if (ret != RGY_ERR_NONE) {
         PrintMes(RGY_LOG_ERROR, _T("Failed to create encoder: %s.\n"), get_err_mes(ret));
         return ret;
     }
 
-    auto par = std::make_pair(prm->par[0], prm->par[1]);
-    if ((!prm->par[0] || !prm->par[1]) //SAR比の指定がない
-        && prm->input.sar[0] && prm->input.sar[1] //入力側からSAR比を取得ずみ
-        && (prm->input.dstWidth == prm->input.srcWidth && prm->input.dstHeight == prm->input.srcHeight)) {//リサイズは行われない
-        par = std::make_pair(prm->input.sar[0], prm->input.sar[1]);
-    }
-    adjust_sar(&par.first, &par.second, prm->input.dstWidth, prm->input.dstHeight);
-    m_sar = rgy_rational<int>(par.first, par.second);
-    PrintMes(RGY_LOG_DEBUG, _T("output res %dx%d, sar: %d:%d.\n"), prm->input.dstWidth, prm->input.dstHeight, m_sar.n(), m_sar.d());
-
     //MPP_POLL_NON_BLOCKを設定してから、initを呼ぶ必要があると思われる
     MppPollType timeout_in  = MPP_POLL_NON_BLOCK;
     MppPollType timeout_out = MPP_POLL_NON_BLOCK;
     
-    ret = err_to_rgy(m_encoder->mpi->control(m_encoder->ctx, MPP_SET_INPUT_TIMEOUT, &timeout_in));
+    ret = err_to_rgy(encoder->mpi->control(encoder->ctx, MPP_SET_INPUT_TIMEOUT, &timeout_in));
     if (ret != RGY_ERR_NONE) {
         PrintMes(RGY_LOG_ERROR, _T("Failed to set encoder input timeout %d : %s\n"), timeout_in, get_err_mes(ret));
         return ret;
     }
 
-    ret = err_to_rgy(m_encoder->mpi->control(m_encoder->ctx, MPP_SET_OUTPUT_TIMEOUT, &timeout_out));
+    ret = err_to_rgy(encoder->mpi->control(encoder->ctx, MPP_SET_OUTPUT_TIMEOUT, &timeout_out));
     if (ret != RGY_ERR_NONE) {
         PrintMes(RGY_LOG_ERROR, _T("Failed to set encoder output timeout %d : %s\n"), timeout_out, get_err_mes(ret));
         return ret;
     }
 
-    ret = m_encoder->init(MPP_CTX_ENC, codec_rgy_to_enc(prm->codec));
+    ret = encoder->init(MPP_CTX_ENC, codec_rgy_to_enc(prm->codec));
     if (ret != RGY_ERR_NONE) {
         PrintMes(RGY_LOG_ERROR, _T("Failed to initalized encoder: %s.\n"), get_err_mes(ret));
         return ret;
     }
+    return RGY_ERR_NONE;
+}
 
-    ret = initEncoderPrep(prm);
+//作成済みのエンコーダに設定を反映する (--renditionの追加出力でも共通)
+RGY_ERR MPPCore::initEncoderConfig(MPPContext *encoder, MPPCfg& enccfg, MPPParam *prm, const int width, const int height) {
+    auto ret = initEncoderPrep(encoder, enccfg, prm, width, height);
     if (ret != RGY_ERR_NONE) {
         return ret;
     }
 
-    ret = checkRCParam(prm);
+    ret = checkRCParam(prm, width, height);
     if (ret != RGY_ERR_NONE) {
         return ret;
     }
 
-    ret = initEncoderRC(prm);
+    ret = initEncoderRC(encoder, enccfg, prm);
     if (ret != RGY_ERR_NONE) {
         return ret;
     }
 
-    ret = initEncoderCodec(prm);
+    ret = initEncoderCodec(encoder, enccfg, prm);
     if (ret != RGY_ERR_NONE) {
         return ret;
     }
 
     {
         auto sei_mode = MPP_ENC_SEI_MODE_DISABLE;
-        ret = err_to_rgy(m_encoder->mpi->control(m_encoder->ctx, MPP_ENC_SET_SEI_CFG, &sei_mode));
+        ret = err_to_rgy(encoder->mpi->control(encoder->ctx, MPP_ENC_SET_SEI_CFG, &sei_mode));
         if (ret != RGY_ERR_NONE) {
             PrintMes(RGY_LOG_ERROR, _T("Failed to set sei cfg on MPI: %s.\n"), get_err_mes(ret));
             return ret;
@@ -3145,13 +3209,284 @@ RGY_ERR MPPCore::initEncoder(MPPParam *prm) {
 
     if (prm->codec == RGY_CODEC_H264 || prm->codec == RGY_CODEC_HEVC) {
         auto header_mode = (prm->repeatHeaders) ? MPP_ENC_HEADER_MODE_EACH_IDR : MPP_ENC_HEADER_MODE_DEFAULT;
-        ret = err_to_rgy(m_encoder->mpi->control(m_encoder->ctx, MPP_ENC_SET_HEADER_MODE, &header_mode));
+        ret = err_to_rgy(encoder->mpi->control(encoder->ctx, MPP_ENC_SET_HEADER_MODE, &header_mode));
         if (ret != RGY_ERR_NONE) {
             PrintMes(RGY_LOG_ERROR, _T("Failed to set header mode failed ret: %s\n"), get_err_mes(ret));
             return ret;
         }
     }
+    return RGY_ERR_NONE;
+}
+
+RGY_ERR MPPCore::initEncoder(MPPParam *prm) {
+    if (!m_encoder) {
+        auto ret = initEncoderOpen(m_encoder, prm);
+        if (ret != RGY_ERR_NONE) {
+            return ret;
+        }
+    }
+
+    auto par = std::make_pair(prm->par[0], prm->par[1]);
+    if ((!prm->par[0] || !prm->par[1]) //SAR比の指定がない
+        && prm->input.sar[0] && prm->input.sar[1] //入力側からSAR比を取得ずみ
+        && (prm->input.dstWidth == prm->input.srcWidth && prm->input.dstHeight == prm->input.srcHeight)) {//リサイズは行われない
+        par = std::make_pair(prm->input.sar[0], prm->input.sar[1]);
+    }
+    adjust_sar(&par.first, &par.second, prm->input.dstWidth, prm->input.dstHeight);
+    m_sar = rgy_rational<int>(par.first, par.second);
+    PrintMes(RGY_LOG_DEBUG, _T("output res %dx%d, sar: %d:%d.\n"), prm->input.dstWidth, prm->input.dstHeight, m_sar.n(), m_sar.d());
+
+    m_encCodec = prm->codec;
+    return initEncoderConfig(m_encoder.get(), m_enccfg, prm, m_encWidth, m_encHeight);
+}
+
+//--trim-smartの初期化
+//trim範囲に完全に含まれるIDR始まりのGOPはデコード・エンコードせずにコピーする
+RGY_ERR MPPCore::initSmartCut(MPPParam *prm) {
+    m_smartCut.reset();
+    if (!prm->trimSmart) {
+        return RGY_ERR_NONE;
+    }
+#if ENABLE_AVSW_READER
+    auto pAVCodecReader = std::dynamic_pointer_cast<RGYInputAvcodec>(m_pFileReader);
+    if (m_trimParam.list.size() == 0) {
+        PrintMes(RGY_LOG_ERROR, _T("--trim-smart requires --trim.\n"));
+        return RGY_ERR_INVALID_PARAM;
+    }
+    if (!pAVCodecReader || !m_decoder || !m_encoder) {
+        PrintMes(RGY_LOG_ERROR, _T("--trim-smart requires avhw/avsw reader with hw decoder.\n"));
+        return RGY_ERR_UNSUPPORTED;
+    }
+    const auto inputCodec = m_pFileReader->getInputCodec();
+    if (inputCodec != prm->codec || (inputCodec != RGY_CODEC_H264 && inputCodec != RGY_CODEC_HEVC)) {
+        PrintMes(RGY_LOG_ERROR, _T("--trim-smart requires the same codec for input and output (H.264/HEVC): input %s, output %s.\n"),
+            CodecToStr(inputCodec).c_str(), CodecToStr(prm->codec).c_str());
+        return RGY_ERR_UNSUPPORTED;
+    }
+    tstring err_target;
+    if (m_vpFilters.size() > 0)                                         err_target += _T("filters, ");
+    if (prm->common.AVSyncMode & (RGY_AVSYNC_VFR | RGY_AVSYNC_FORCE_CFR)) err_target += _T("--avsync vfr/forcecfr, ");
+    if (prm->common.timestampPassThrough)                               err_target += _T("--timestamp-passthrough, ");
+    if (prm->common.tcfileIn.length() > 0)                              err_target += _T("--tcfile-in, ");
+    if (prm->common.seekSec > 0.0f || prm->common.seekToSec > 0.0f)     err_target += _T("--seek/--seekto, ");
+    if (prm->renditions.size() > 0)                                     err_target += _T("--rendition, ");
+    if (prm->common.dynamicHdr10plusJson.length() > 0)                  err_target += _T("--dhdr10-info, ");
+    if (prm->common.doviRpuFile.length() > 0)                           err_target += _T("--dolby-vision-rpu, ");
+    if (prm->common.metric.enabled())                                   err_target += _T("--ssim/--psnr, ");
+    if (m_pFileReader->GetInputFrameInfo().picstruct & RGY_PICSTRUCT_INTERLACED) err_target += _T("interlaced input, ");
+    if (err_target.length() > 0) {
+        err_target = err_target.substr(0, err_target.length()-2);
+        PrintMes(RGY_LOG_ERROR, _T("--trim-smart cannot be used with %s.\n"), err_target.c_str());
+        return RGY_ERR_UNSUPPORTED;
+    }
+    //コピーするGOPのフレーム位置はptsの順序から決めるので、ptsが正常に取得できている必要がある
+    const auto timestamp_status = pAVCodecReader->GetFramePosList()->getStreamPtsStatus();
+    if ((timestamp_status & (~RGY_PTS_NORMAL)) != 0) {
+        PrintMes(RGY_LOG_ERROR, _T("--trim-smart cannot be used, as timestamp was not properly got from input file: 0x%x.\n"), (uint32_t)timestamp_status);
+        return RGY_ERR_UNSUPPORTED;
+    }
+    //出力のptsはフレーム位置から決めるので、自動で有効にしたvfrモードは解除する
+    m_nAVSyncMode &= ~RGY_AVSYNC_VFR;
+    //再エンコードした部分はエンコーダのSPS/PPSを使用するので、IDRごとにヘッダを出力する
+    prm->repeatHeaders = true;
+    const auto& fmt = prm->common.muxOutputFormat;
+    const bool outputTsOrRaw = (fmt.length() > 0) ? (fmt == _T("mpegts") || fmt == _T("raw"))
+        : check_ext(prm->common.outputFilename, { ".ts", ".m2ts", ".264", ".h264", ".avc", ".265", ".h265", ".hevc" });
+    if (!outputTsOrRaw) {
+        PrintMes(RGY_LOG_WARN, _T("--trim-smart: copied and re-encoded GOPs have different SPS/PPS, mpegts or raw output is recommended.\n"));
+    }
+    const int videoDelay = clamp(pAVCodecReader->GetInputVideoStream()->codecpar->video_delay, 4, 7);
+    m_smartCut = std::make_shared<RGYSmartCut>(m_trimParam, inputCodec, videoDelay);
+    pAVCodecReader->setSmartCut(m_smartCut);
+    PrintMes(RGY_LOG_DEBUG, _T("--trim-smart enabled, video delay %d.\n"), videoDelay);
+    return RGY_ERR_NONE;
+#else
+    PrintMes(RGY_LOG_ERROR, _T("--trim-smart requires avhw/avsw reader.\n"));
+    return RGY_ERR_UNSUPPORTED;
+#endif //#if ENABLE_AVSW_READER
+}
+
+//--renditionの追加出力の初期化
+//メインのフィルタ後のフレームを分岐し、出力ごとにリサイズ→エンコード→出力を行う
+RGY_ERR MPPCore::initRenditions(MPPParam *prm) {
+    m_renditions.clear();
+    if (prm->renditions.size() == 0) {
+        return RGY_ERR_NONE;
+    }
+    if (!m_cl) {
+        PrintMes(RGY_LOG_ERROR, _T("--rendition requires OpenCL.\n"));
+        return RGY_ERR_UNSUPPORTED;
+    }
+    if (!m_encoder) {
+        PrintMes(RGY_LOG_ERROR, _T("--rendition cannot be used without encoding.\n"));
+        return RGY_ERR_UNSUPPORTED;
+    }
+    if (prm->common.adaptResolution.first > 0 && prm->common.adaptResolution.second > 0) {
+        PrintMes(RGY_LOG_ERROR, _T("--rendition is not supported with --adapt-resolution.\n"));
+        return RGY_ERR_UNSUPPORTED;
+    }
+    const auto encCsp = GetEncoderCSP(prm);
+    const auto encBitdepth = GetEncoderBitdepth(prm);
+    // 表示アスペクト比はメイン出力に合わせる
+    int darW = m_encWidth, darH = m_encHeight;
+    if (m_sar.n() > 0 && m_sar.d() > 0) {
+        darW *= m_sar.n();
+        darH *= m_sar.d();
+    }
+    const int darGcd = std::gcd(darW, darH);
+    darW /= darGcd;
+    darH /= darGcd;
+
+    for (size_t irendition = 0; irendition < prm->renditions.size(); irendition++) {
+        const auto& renditionPrm = prm->renditions[irendition];
+        if (renditionPrm.outputFilename == prm->common.outputFilename) {
+            PrintMes(RGY_LOG_ERROR, _T("--rendition output must be different from the main output: %s.\n"), renditionPrm.outputFilename.c_str());
+            return RGY_ERR_INVALID_PARAM;
+        }
+        auto rendition = std::make_unique<MPPRendition>();
+        rendition->outputFilename = renditionPrm.outputFilename;
+        rendition->width = renditionPrm.width;
+        rendition->height = renditionPrm.height;
+
+        // メインの設定を引き継ぎ、指定されたものだけ上書きする
+        MPPParam encPrm = *prm;
+        encPrm.renditions.clear();
+        if (renditionPrm.codec != RGY_CODEC_UNKNOWN) {
+            encPrm.codec = renditionPrm.codec;
+        }
+        if (renditionPrm.rateControl >= 0) {
+            encPrm.rateControl = renditionPrm.rateControl;
+            encPrm.bitrate = renditionPrm.bitrate;
+            encPrm.qp = renditionPrm.qp;
+            encPrm.maxBitrate = 0;
+        }
+        if (renditionPrm.maxBitrate > 0) {
+            encPrm.maxBitrate = renditionPrm.maxBitrate;
+        }
+        if (renditionPrm.profile.length() > 0) {
+            const int value = get_value_from_chr(get_profile_list(encPrm.codec), renditionPrm.profile.c_str());
+            if (value == PARSE_ERROR_FLAG) {
+                PrintMes(RGY_LOG_ERROR, _T("Invalid profile for rendition #%d: %s.\n"), (int)irendition, renditionPrm.profile.c_str());
+                return RGY_ERR_INVALID_PARAM;
+            }
+            encPrm.codecParam[encPrm.codec].profile = value;
+        }
+        if (renditionPrm.level.length() > 0) {
+            const int value = get_value_from_chr(get_level_list(encPrm.codec), renditionPrm.level.c_str());
+            if (value == PARSE_ERROR_FLAG) {
+                PrintMes(RGY_LOG_ERROR, _T("Invalid level for rendition #%d: %s.\n"), (int)irendition, renditionPrm.level.c_str());
+                return RGY_ERR_INVALID_PARAM;
+            }
+            encPrm.codecParam[encPrm.codec].level = value;
+        }
+        rendition->codec = encPrm.codec;
+        int sarW = -darW, sarH = -darH;
+        adjust_sar(&sarW, &sarH, rendition->width, rendition->height);
+        rendition->sar = rgy_rational<int>(sarW, sarH);
+
+        // フィルタ: OpenCLのフィルタ用のcspに変換→リサイズ→エンコーダの入力のcspに変換
+        RGYFrameInfo inputFrame(m_encWidth, m_encHeight, encCsp, encBitdepth, m_picStruct, RGY_MEM_TYPE_GPU);
+        auto addCspCrop = [&](const RGY_CSP csp, const int bitdepth) -> RGY_ERR {
+            auto filterCrop = std::make_unique<RGYFilterCspCrop>(m_cl);
+            auto param = std::make_shared<RGYFilterParamCrop>();
+            param->frameIn = inputFrame;
+            param->frameOut = inputFrame;
+            param->frameOut.csp = csp;
+            param->frameOut.bitdepth = bitdepth;
+            param->baseFps = m_encFps;
+            param->bOutOverwrite = false;
+            auto sts = filterCrop->init(param, m_pLog);
+            if (sts != RGY_ERR_NONE) {
+                return sts;
+            }
+            inputFrame = param->frameOut;
+            rendition->vppcl.push_back(std::move(filterCrop));
+            return RGY_ERR_NONE;
+        };
+        const auto openclCsp = getOpenCLFilterCsp(encCsp);
+        auto err = addCspCrop(openclCsp, RGY_CSP_BIT_DEPTH[openclCsp]);
+        if (err != RGY_ERR_NONE) {
+            PrintMes(RGY_LOG_ERROR, _T("Failed to initialize csp conversion for rendition #%d: %s.\n"), (int)irendition, get_err_mes(err));
+            return err;
+        }
+        {
+            auto filterResize = std::make_unique<RGYFilterResize>(m_cl);
+            auto param = std::make_shared<RGYFilterParamResize>();
+            param->interp = (getVppResizeType(prm->vpp.resize_algo) == RGY_VPP_RESIZE_TYPE_OPENCL) ? prm->vpp.resize_algo : RGY_VPP_RESIZE_SPLINE36;
+            param->frameIn = inputFrame;
+            param->frameOut = inputFrame;
+            param->frameOut.width = rendition->width;
+            param->frameOut.height = rendition->height;
+            param->baseFps = m_encFps;
+            param->bOutOverwrite = false;
+            param->fsr1 = prm->vpp.resize_fsr1;
+            param->nis = prm->vpp.resize_nis;
+            param->bicubic = prm->vpp.resize_bicubic;
+            param->vui = m_encVUI;
+            err = filterResize->init(param, m_pLog);
+            if (err != RGY_ERR_NONE) {
+                PrintMes(RGY_LOG_ERROR, _T("Failed to initialize resize for rendition #%d: %s.\n"), (int)irendition, get_err_mes(err));
+                return err;
+            }
+            inputFrame = param->frameOut;
+            rendition->vppcl.push_back(std::move(filterResize));
+        }
+        err = addCspCrop(encCsp, encBitdepth);
+        if (err != RGY_ERR_NONE) {
+            PrintMes(RGY_LOG_ERROR, _T("Failed to initialize csp conversion for rendition #%d: %s.\n"), (int)irendition, get_err_mes(err));
+            return err;
+        }
 
+        // エンコーダ
+        err = initEncoderOpen(rendition->encoder, &encPrm);
+        if (err != RGY_ERR_NONE) {
+            return err;
+        }
+        err = initEncoderConfig(rendition->encoder.get(), rendition->enccfg, &encPrm, rendition->width, rendition->height);
+        if (err != RGY_ERR_NONE) {
+            return err;
+        }
+
+        // 出力 (音声・字幕・チャプター等はメインの出力のみに出力する)
+        auto common = prm->common;
+        common.outputFilename = renditionPrm.outputFilename;
+        common.AVMuxTarget = RGY_MUX_NONE;
+        common.audioSource.clear();
+        common.subSource.clear();
+        common.attachmentSource.clear();
+        common.nAudioSelectCount = 0;
+        common.ppAudioSelectList = nullptr;
+        common.nSubtitleSelectCount = 0;
+        common.ppSubtitleSelectList = nullptr;
+        common.nDataSelectCount = 0;
+        common.ppDataSelectList = nullptr;
+        common.nAttachmentSelectCount = 0;
+        common.ppAttachmentSelectList = nullptr;
+        common.copyChapter = false;
+        common.chapterFile.clear();
+        common.outReplayCodec = RGY_CODEC_UNKNOWN;
+        common.outReplayFile.clear();
+        auto ctrl = prm->ctrl;
+        ctrl.perfMonitorSelect = 0;
+        ctrl.perfMonitorSelectMatplot = 0;
+        const vector<unique_ptr<AVChapter>> chapters;
+        vector<shared_ptr<RGYOutput>> writerListAudio;
+        vector<shared_ptr<RGYInput>> audioReaders;
+        rendition->timestamp = std::make_unique<RGYTimestamp>(prm->common.timestampPassThrough, false);
+        rendition->status = std::make_shared<EncodeStatus>();
+        err = initWriters(rendition->writer, writerListAudio, m_pFileReader, audioReaders,
+            &common, &prm->input, &ctrl, videooutputinfo(rendition->enccfg, rendition->sar, m_picStruct, m_encVUI),
+            m_trimParam, m_outputTimebase, chapters, m_hdrsei.get(), nullptr, nullptr, rendition->timestamp.get(), false, false, false, 0,
+            encPrm.aud ? INSERT_HEADER_AUD : INSERT_HEADER_NONE, tstring(), m_poolPkt.get(), m_poolFrame.get(), rendition->status, m_pPerfMonitor, m_pLog);
+        if (err != RGY_ERR_NONE) {
+            PrintMes(RGY_LOG_ERROR, _T("failed to initialize writer for rendition #%d.\n"), (int)irendition);
+            return err;
+        }
+        PrintMes(RGY_LOG_DEBUG, _T("rendition #%d: %s %dx%d, sar %d:%d, %s.\n"), (int)irendition,
+            CodecToStr(rendition->codec).c_str(), rendition->width, rendition->height, rendition->sar.n(), rendition->sar.d(),
+            renditionPrm.outputFilename.c_str());
+        m_renditions.push_back(std::move(rendition));
+    }
     return RGY_ERR_NONE;
 }
 
@@ -3160,6 +3495,15 @@ RGY_ERR MPPCore::initDevice(const bool enableOpenCL, const int openCLBuildThread
         PrintMes(RGY_LOG_DEBUG, _T("OpenCL disabled.\n"));
         return RGY_ERR_NONE;
     }
+    const bool enableProfiling = checkVppPerformance || !clPerfDumpDir.empty();
+    // プロファイルを行う場合はキューの設定が異なるので、共有せず個別に作成する
+    const bool shareContext = m_sharedCL != nullptr && !enableProfiling;
+    if (shareContext && *m_sharedCL) {
+        m_cl = *m_sharedCL;
+        m_cl->setLog(m_pLog);
+        PrintMes(RGY_LOG_DEBUG, _T("Reuse shared OpenCL context.\n"));
+        return RGY_ERR_NONE;
+    }
 
     RGYOpenCL cl(m_pLog);
     if (!RGYOpenCL::openCLloaded()) {
@@ -3197,12 +3541,16 @@ RGY_ERR MPPCore::initDevice(const bool enableOpenCL, const int openCLBuildThread
     selectedPlatform->setDev(devices[0]);
 
     m_cl = std::make_shared<RGYOpenCLContext>(selectedPlatform, openCLBuildThreads, m_pLog);
-    const bool enableProfiling = checkVppPerformance || !clPerfDumpDir.empty();
     if (m_cl->createContext(enableProfiling ? CL_QUEUE_PROFILING_ENABLE : 0) != CL_SUCCESS) {
         PrintMes(RGY_LOG_WARN, _T("Failed to create OpenCL context, OpenCL disabled.\n"));
         m_cl.reset();
         return RGY_ERR_NONE;
     }
+    if (shareContext) {
+        m_cl->enableProgramReuse();
+        *m_sharedCL = m_cl;
+        PrintMes(RGY_LOG_DEBUG, _T("Created shared OpenCL context.\n"));
+    }
     if (!clPerfDumpDir.empty()) {
         RGYOpenCLPerfCollector::instance().enable(clPerfDumpDir);
         PrintMes(RGY_LOG_DEBUG, _T("OpenCL perf collector enabled: %s\n"), clPerfDumpDir.c_str());
@@ -3273,9 +3621,16 @@ RGY_ERR MPPCore::initPipeline(MPPParam *prm) {
     m_pipelineTasks.clear();
 
     if (m_decoder) {
+        //trimの範囲外をseekで飛ばす場合も、フレーム番号はbitstreamから受け取る
+        auto pAVCodecReader = dynamic_cast<RGYInputAvcodec *>(m_pFileReader.get());
+        const bool trimSeek = !m_smartCut && pAVCodecReader && pAVCodecReader->trimSeekAvailable();
+        if (trimSeek) {
+            pAVCodecReader->enableTrimSeek();
+        }
         auto taskDecode = std::make_unique<PipelineTaskMPPDecode>(m_decoder.get(), 1, m_pFileReader.get(),
             m_pFileReader->getInputCodec() == RGY_CODEC_MPEG2, m_pLog);
         taskDecode->setCanFollowResolutionChange(m_canFollowResolutionChange);
+        taskDecode->setFrameIdFromBitstream(m_smartCut != nullptr || trimSeek);
         m_pipelineTasks.push_back(std::move(taskDecode));
     } else {
         m_pipelineTasks.push_back(std::make_unique<PipelineTaskInput>(0, m_pFileReader.get(), m_cl, m_pLog));
@@ -3292,7 +3647,11 @@ RGY_ERR MPPCore::initPipeline(MPPParam *prm) {
         if (m_trimParam.list.size() > 0 || prm->common.seekToSec > 0.0f) {
             m_pipelineTasks.push_back(std::make_unique<PipelineTaskTrim>(m_trimParam, m_pFileReader.get(), srcTimebase, 0, m_pLog));
         }
-        m_pipelineTasks.push_back(std::make_unique<PipelineTaskCheckPTS>(srcTimebase, srcTimebase, m_outputTimebase, outFrameDuration, m_nAVSyncMode, m_timestampPassThrough, VppAfsRffAware() && m_pFileReader->rffAware(), (pReader) ? pReader->GetFramePosList() : nullptr, m_pLog));
+        auto taskCheckPts = std::make_unique<PipelineTaskCheckPTS>(srcTimebase, srcTimebase, m_outputTimebase, outFrameDuration, m_nAVSyncMode, m_timestampPassThrough, VppAfsRffAware() && m_pFileReader->rffAware(), (pReader) ? pReader->GetFramePosList() : nullptr, m_pLog);
+        if (m_smartCut) {
+            taskCheckPts->setSmartCut(m_smartCut);
+        }
+        m_pipelineTasks.push_back(std::move(taskCheckPts));
     }
 
     for (auto& filterBlock : m_vpFilters) {
@@ -3345,10 +3704,29 @@ RGY_ERR MPPCore::initPipeline(MPPParam *prm) {
             m_pipelineTasks.push_back(std::make_unique<PipelineTaskVideoQualityMetric>(m_videoQualityMetric.get(), m_cl, 0, m_pLog));
         }
     }
+    if (m_renditions.size() > 0) {
+        // メインのエンコーダの直前で分岐し、--renditionの出力ごとにリサイズ・エンコード・出力を行う
+        std::vector<PipelineRenditionBranch> branches;
+        for (auto& rendition : m_renditions) {
+            PipelineRenditionBranch branch;
+            branch.vpp = std::make_unique<PipelineTaskOpenCL>(rendition->vppcl, nullptr, m_cl, 0, m_pLog);
+            branch.enc = std::make_unique<PipelineTaskMPPEncode>(rendition->encoder.get(), rendition->codec, rendition->enccfg, 0,
+                nullptr, rendition->timestamp.get(), m_outputTimebase, nullptr, nullptr,
+                prm->ctrl.threadCsp, prm->ctrl.threadParams.get(RGYThreadType::CSP), m_pLog);
+            branch.writer = rendition->writer.get();
+            branches.push_back(std::move(branch));
+        }
+        m_pipelineTasks.push_back(std::make_unique<PipelineTaskRenditions>(branches, m_cl, 0, m_pLog));
+    }
     if (m_encoder) {
-        m_pipelineTasks.push_back(std::make_unique<PipelineTaskMPPEncode>(m_encoder.get(), m_encCodec, m_enccfg, 1,
+        auto taskEncode = std::make_unique<PipelineTaskMPPEncode>(m_encoder.get(), m_encCodec, m_enccfg, 1,
             m_timecode.get(), m_encTimestamp.get(), m_outputTimebase, m_hdr10plus.get(), m_dovirpu.get(),
-            prm->ctrl.threadCsp, prm->ctrl.threadParams.get(RGYThreadType::CSP), m_pLog));
+            prm->ctrl.threadCsp, prm->ctrl.threadParams.get(RGYThreadType::CSP), m_pLog);
+        if (m_smartCut) {
+            const int64_t outFrameDuration = std::max<int64_t>(1, rational_rescale(1, m_inputFps.inv(), m_outputTimebase));
+            taskEncode->setSmartCut(m_smartCut, outFrameDuration);
+        }
+        m_pipelineTasks.push_back(std::move(taskEncode));
     }
 
     if (m_pipelineTasks.size() == 0) {
@@ -3366,6 +3744,23 @@ RGY_ERR MPPCore::initPipeline(MPPParam *prm) {
     }
     PrintMes(RGY_LOG_DEBUG, _T("Maximum work surface resolution: %dx%d.\n"), maxWidth, maxHeight);
 
+    m_pipelineMode = prm->pipelineMode;
+    m_clPersistentMap = prm->clPersistentMap;
+    m_pipelineThreadParam = prm->ctrl.threadParams.get(RGYThreadType::MAIN);
+    if (m_pipelineMode == MPPPipelineMode::THREAD) {
+        // 音声の書き出しは先頭のstage、映像の書き出しは最後のstageから行われるため、
+        // 同じwriterを使う場合は出力スレッドによってキューイングされている必要がある
+        const bool audioMuxedWithVideo = std::find(m_pFileWriterListAudio.begin(), m_pFileWriterListAudio.end(), m_pFileWriter) != m_pFileWriterListAudio.end();
+        if (audioMuxedWithVideo && (prm->ctrl.threadOutput == 0 || prm->ctrl.lowLatency)) {
+            PrintMes(RGY_LOG_WARN, _T("--pipeline-mode thread requires output thread when muxing audio, switching to --pipeline-mode serial.\n"));
+            m_pipelineMode = MPPPipelineMode::SERIAL;
+        } else if (hasFilterForStreams(m_vpFilters)) {
+            PrintMes(RGY_LOG_WARN, _T("--pipeline-mode thread does not support filters using audio/subtitle streams, switching to --pipeline-mode serial.\n"));
+            m_pipelineMode = MPPPipelineMode::SERIAL;
+        }
+    }
+    PrintMes(RGY_LOG_DEBUG, _T("Pipeline mode: %s.\n"), get_chr_from_value(list_pipeline_mode, (int)m_pipelineMode));
+
     PrintMes(RGY_LOG_DEBUG, _T("Created pipeline.\n"));
     for (auto& p : m_pipelineTasks) {
         PrintMes(RGY_LOG_DEBUG, _T("  %s\n"), p->print().c_str());
@@ -3440,12 +3835,20 @@ RGY_ERR MPPCore::allocatePiplelineFrames() {
             t0RequestNumFrame += 4; // 内部でフレームが増える場合に備えて
         }
         if (allocateOpenCLFrame) {
-            const int requestNumFrames = std::max(1, t0RequestNumFrame + t1RequestNumFrame + t0->additionalOutputSurfaces() + asyncdepth + 1);
+            // スレッド実行時はstage間のキューに入っている分も必要
+            const int threadQueueFrames = (m_pipelineMode == MPPPipelineMode::THREAD) ? PIPELINE_THREAD_QUEUE_SIZE : 0;
+            const int requestNumFrames = std::max(1, t0RequestNumFrame + t1RequestNumFrame + t0->additionalOutputSurfaces() + asyncdepth + threadQueueFrames + 1);
             PrintMes(RGY_LOG_DEBUG, _T("AllocFrames: %s-%s, type: CL, %s %dx%d, request %d frames (%d+%d+%d+1)\n"),
                 t0->print().c_str(), t1->print().c_str(), RGY_CSP_NAMES[allocateFrameInfo.csp],
                 allocateFrameInfo.width, allocateFrameInfo.height, requestNumFrames,
                 t0RequestNumFrame, t1RequestNumFrame, asyncdepth, 1);
-            auto sts = t0->workSurfacesAllocCL(requestNumFrames, allocateFrameInfo, m_cl.get());
+            // OpenCLの出力をCPUで受け渡す場合、--cl-persistent-mapなら常時mapされたバッファで確保する
+            const bool persistentMap = m_clPersistentMap && t0->taskType() == PipelineTaskType::OPENCL;
+            // エンコーダに渡す場合は、エンコーダの入力と同じpitchで確保し、受け渡しを単純なコピーにする
+            const int pitch = (t0->taskType() == PipelineTaskType::OPENCL && t1->taskType() == PipelineTaskType::MPPENC
+                && allocateFrameInfo.csp == csp_enc_to_rgy(m_enccfg.prep.format)
+                && allocateFrameInfo.width == m_enccfg.prep.width && allocateFrameInfo.height == m_enccfg.prep.height) ? m_enccfg.prep.hor_stride : 0;
+            auto sts = t0->workSurfacesAllocCL(requestNumFrames, allocateFrameInfo, m_cl.get(), pitch, persistentMap);
             if (sts != RGY_ERR_NONE) {
                 PrintMes(RGY_LOG_ERROR, _T("AllocFrames:   Failed to allocate frames for %s-%s: %s."), t0->print().c_str(), t1->print().c_str(), get_err_mes(sts));
                 return sts;
@@ -3466,6 +3869,34 @@ RGY_ERR MPPCore::allocatePiplelineFrames() {
 #endif
         t0 = t1;
     }
+    for (auto& task : m_pipelineTasks) {
+        auto taskRenditions = dynamic_cast<PipelineTaskRenditions *>(task.get());
+        if (taskRenditions == nullptr) {
+            continue;
+        }
+        // MPPのフレームをOpenCLに転送するためのバッファ
+        const int threadQueueFrames = (m_pipelineMode == MPPPipelineMode::THREAD) ? PIPELINE_THREAD_QUEUE_SIZE : 0;
+        auto sts = taskRenditions->workSurfacesAllocCL(asyncdepth + threadQueueFrames + 1, m_enccfg.frameinfo(), m_cl.get());
+        if (sts != RGY_ERR_NONE) {
+            PrintMes(RGY_LOG_ERROR, _T("AllocFrames:   Failed to allocate frames for %s: %s."), task->print().c_str(), get_err_mes(sts));
+            return sts;
+        }
+        auto& branches = taskRenditions->branches();
+        for (size_t ibranch = 0; ibranch < branches.size() && ibranch < m_renditions.size(); ibranch++) {
+            auto& branch = branches[ibranch];
+            const auto& rendition = m_renditions[ibranch];
+            // 分岐内ではOpenCLの出力をそのままエンコーダに渡すので、エンコーダの入力と同じpitchで確保する
+            const int requestNumFrames = 8 + 4 + branch.vpp->additionalOutputSurfaces() + asyncdepth + 1;
+            PrintMes(RGY_LOG_DEBUG, _T("AllocFrames: rendition #%d, type: CL, %s %dx%d, request %d frames\n"),
+                (int)ibranch, RGY_CSP_NAMES[rendition->enccfg.frameinfo().csp],
+                rendition->enccfg.prep.width, rendition->enccfg.prep.height, requestNumFrames);
+            sts = branch.vpp->workSurfacesAllocCL(requestNumFrames, rendition->enccfg.frameinfo(), m_cl.get(), rendition->enccfg.prep.hor_stride, m_clPersistentMap);
+            if (sts != RGY_ERR_NONE) {
+                PrintMes(RGY_LOG_ERROR, _T("AllocFrames:   Failed to allocate frames for rendition #%d: %s."), (int)ibranch, get_err_mes(sts));
+                return sts;
+            }
+        }
+    }
     return RGY_ERR_NONE;
 }
 
@@ -3476,6 +3907,9 @@ RGY_ERR MPPCore::init(MPPParam *prm) {
         return ret;
     }
 
+    if (RGY_ERR_NONE != (ret = initThreadAffinity(prm))) {
+        return ret;
+    }
     if (const auto affinity = prm->ctrl.threadParams.get(RGYThreadType::PROCESS).affinity; affinity.mode != RGYThreadAffinityMode::ALL) {
         SetProcessAffinityMask(GetCurrentProcess(), affinity.getMask());
         PrintMes(RGY_LOG_DEBUG, _T("Set Process Affinity Mask: %s (0x%llx).\n"), affinity.to_string().c_str(), affinity.getMask());
@@ -3501,67 +3935,358 @@ RGY_ERR MPPCore::init(MPPParam *prm) {
 
     m_nAVSyncMode = prm->common.AVSyncMode;
 
-    if (RGY_ERR_NONE != (ret = initInput(prm))) {
-        return ret;
+    if (!prm->ctrl.clCacheDir.empty()) {
+        // --serverの各ジョブもプロセス内の同じキャッシュを共有する
+        RGYOpenCLProgramCache::instance().enable(prm->ctrl.clCacheDir, (uint64_t)prm->ctrl.clCacheSizeMB * 1024 * 1024);
+        PrintMes(RGY_LOG_DEBUG, _T("OpenCL program cache enabled: %s (max %d MB)\n"), prm->ctrl.clCacheDir.c_str(), prm->ctrl.clCacheSizeMB);
     }
+    m_encTimestamp = std::make_unique<RGYTimestamp>(prm->common.timestampPassThrough, false);
 
-    if (RGY_ERR_NONE != (ret = checkParam(prm))) {
+    // 初期化処理を依存関係に従って並列に実行する
+    //   decoder, encoder open, chapters <- input(+checkParam)
+    //   filters      <- input, device, decoder
+    //   smart cut    <- input, decoder, filters
+    //   encoder      <- encoder open, filters, smart cut
+    //   perf monitor <- throttling <- filters
+    //   output       <- encoder, chapters, perf monitor
+    //   renditions   <- output
+    //   ssim         <- device, filters, encoder, throttling
+    // throttlingはスレッドの設定を変更するので、スレッドを起動するperf monitor/output/ssimより前に行う
+    RGYTaskGraph initGraph(_T("init"), m_pLog);
+    const auto taskInput = initGraph.add(_T("input"), [&]() {
+        auto err = initInput(prm);
+        return (err != RGY_ERR_NONE) ? err : checkParam(prm);
+    });
+    const auto taskDevice = initGraph.add(_T("device"), [&]() {
+        // --pipeline-trace は timeline の一部として記録する
+        const double timelineSec = (prm->ctrl.clPerfTimelineSec != 0.0) ? prm->ctrl.clPerfTimelineSec : prm->ctrl.pipelineTraceSec;
+        auto err = initDevice(prm->ctrl.enableOpenCL, prm->ctrl.parallelEnc.isParent() ? 1 : prm->ctrl.openclBuildThreads, prm->vpp.checkPerformance, prm->ctrl.clPerfDumpDir, timelineSec);
+        if (err != RGY_ERR_NONE) {
+            return err;
+        }
+        if (prm->ctrl.pipelineTraceSec != 0.0) {
+            if (prm->ctrl.clPerfDumpDir.empty()) {
+                PrintMes(RGY_LOG_ERROR, _T("--pipeline-trace requires --cl-perf-dump.\n"));
+                return RGY_ERR_INVALID_PARAM;
+            }
+            auto& perf = RGYOpenCLPerfCollector::instance();
+            if (!perf.isEnabled()) { // OpenCLが使用できない場合
+                perf.enable(prm->ctrl.clPerfDumpDir);
+            }
+            if (!perf.isTimelineEnabled()) {
+                perf.enableTimeline((timelineSec < 0.0) ? 0 : (uint64_t)(timelineSec * 1e9), nullptr);
+            }
+            perf.enablePipelineTrace();
+            PrintMes(RGY_LOG_DEBUG, _T("Pipeline trace enabled: %s\n"), prm->ctrl.clPerfDumpDir.c_str());
+        }
+        return RGY_ERR_NONE;
+    });
+    const auto taskDecoder     = initGraph.add(_T("decoder"),      [&]() { return initDecoder(prm); },          { taskInput });
+    const auto taskEncoderOpen = initGraph.add(_T("encoder open"), [&]() { return initEncoderOpen(m_encoder, prm); },      { taskInput });
+    const auto taskChapters    = initGraph.add(_T("chapters"),     [&]() { return initChapters(prm); },         { taskInput });
+    const auto taskFilters     = initGraph.add(_T("filters"),      [&]() { return initFilters(prm); },          { taskInput, taskDevice, taskDecoder });
+    const auto taskSmartCut    = initGraph.add(_T("smart cut"),    [&]() { return initSmartCut(prm); },         { taskInput, taskDecoder, taskFilters });
+    const auto taskEncoder     = initGraph.add(_T("encoder"),      [&]() { return initEncoder(prm); },          { taskEncoderOpen, taskFilters, taskSmartCut });
+    const auto taskThrottling  = initGraph.add(_T("throttling"),   [&]() { return initPowerThrottoling(prm); }, { taskFilters });
+    const auto taskPerfMonitor = initGraph.add(_T("perf monitor"), [&]() { return initPerfMonitor(prm); },      { taskThrottling });
+    const auto taskOutput      = initGraph.add(_T("output"),       [&]() { return initOutput(prm); },           { taskEncoder, taskChapters, taskPerfMonitor });
+    initGraph.add(_T("renditions"), [&]() { return initRenditions(prm); }, { taskOutput });
+    initGraph.add(_T("ssim"),       [&]() { return initSSIMCalc(prm); },   { taskDevice, taskFilters, taskEncoder, taskThrottling });
+    if (RGY_ERR_NONE != (ret = initGraph.run())) {
         return ret;
     }
 
-    if (RGY_ERR_NONE != (ret = initDevice(prm->ctrl.enableOpenCL, prm->ctrl.parallelEnc.isParent() ? 1 : prm->ctrl.openclBuildThreads, prm->vpp.checkPerformance, prm->ctrl.clPerfDumpDir, prm->ctrl.clPerfTimelineSec))) {
+    if (RGY_ERR_NONE != (ret = initPipeline(prm))) {
         return ret;
     }
 
-    if (RGY_ERR_NONE != (ret = initDecoder(prm))) {
+    if (RGY_ERR_NONE != (ret = allocatePiplelineFrames())) {
         return ret;
     }
 
-    if (RGY_ERR_NONE != (ret = initFilters(prm))) {
-        return ret;
+    {
+        const auto& threadParam = prm->ctrl.threadParams.get(RGYThreadType::MAIN);
+        threadParam.apply(GetCurrentThread());
+        PrintMes(RGY_LOG_DEBUG, _T("Set main thread param: %s.\n"), threadParam.desc().c_str());
     }
 
-    if (RGY_ERR_NONE != (ret = initEncoder(prm))) {
-        return ret;
-    }
+    return ret;
+}
 
-    if (RGY_ERR_NONE != (ret = initPowerThrottoling(prm))) {
-        return ret;
+RGY_ERR MPPCore::runPipelineThread(std::function<bool()> checkAbort) {
+    // パイプラインをstageに分割し、stageごとに別スレッドで実行する
+    // - passthroughでないタスクごとに新しいstageとする
+    // - passthroughのタスクは前のタスクと同じstageで実行する
+    // - ただしcheckptsは出力したフレームが後続のタスクに渡されるまで次の出力ができないので、
+    //   次のpassthroughでないタスクと同じstageで実行する
+    std::vector<std::pair<size_t, size_t>> stages; // [taskBegin, taskEnd)
+    {
+        size_t taskBegin = 0;
+        bool stageHasTask = false; // stageにpassthroughでないタスクが含まれるか
+        for (size_t itask = 0; itask < m_pipelineTasks.size(); itask++) {
+            const auto& task = m_pipelineTasks[itask];
+            if (stageHasTask && (!task->isPassThrough() || task->taskType() == PipelineTaskType::CHECKPTS)) {
+                stages.push_back(std::make_pair(taskBegin, itask));
+                taskBegin = itask;
+                stageHasTask = false;
+            }
+            if (!task->isPassThrough()) {
+                stageHasTask = true;
+            }
+        }
+        stages.push_back(std::make_pair(taskBegin, m_pipelineTasks.size()));
     }
-
-    if (RGY_ERR_NONE != (ret = initChapters(prm))) {
-        return ret;
+    PrintMes(RGY_LOG_DEBUG, _T("Run pipeline in %d threads.\n"), (int)stages.size());
+    std::vector<tstring> stageNames;
+    for (size_t istage = 0; istage < stages.size(); istage++) {
+        tstring str;
+        for (size_t itask = stages[istage].first; itask < stages[istage].second; itask++) {
+            str += ((str.length() > 0) ? _T(", ") : _T("")) + m_pipelineTasks[itask]->print();
+        }
+        PrintMes(RGY_LOG_DEBUG, _T("  stage %d: %s\n"), (int)istage, str.c_str());
+        stageNames.push_back(str);
     }
 
-    if (RGY_ERR_NONE != (ret = initPerfMonitor(prm))) {
-        return ret;
+    std::atomic<bool> pipelineStop(false);   // エラーあるいは強制中断で全stageを停止する
+    std::atomic<bool> abortRequested(false); // 中断指示
+    std::mutex mtxErr;
+    RGY_ERR pipelineErr = RGY_ERR_NONE;
+    std::vector<std::unique_ptr<PipelineTaskOutputQueue>> stageQueues; // stage[i] -> stage[i+1]
+    for (size_t istage = 0; istage + 1 < stages.size(); istage++) {
+        stageQueues.push_back(std::make_unique<PipelineTaskOutputQueue>(PIPELINE_THREAD_QUEUE_SIZE));
     }
-
-    m_encTimestamp = std::make_unique<RGYTimestamp>(prm->common.timestampPassThrough, false);
-
-    if (RGY_ERR_NONE != (ret = initOutput(prm))) {
-        return ret;
+    for (auto& task : m_pipelineTasks) {
+        task->setPipelineStopFlag(&pipelineStop);
     }
+    auto stopPipeline = [&](RGY_ERR err) {
+        {
+            std::lock_guard<std::mutex> lock(mtxErr);
+            if (pipelineErr == RGY_ERR_NONE) {
+                pipelineErr = err;
+            }
+        }
+        pipelineStop = true;
+        for (auto& q : stageQueues) {
+            q->abort();
+        }
+    };
+    auto isPipelineError = [](const RGY_ERR err) {
+        return err < RGY_ERR_NONE && err != RGY_ERR_MORE_DATA && err != RGY_ERR_MORE_SURFACE && err != RGY_ERR_MORE_BITSTREAM;
+    };
+    auto setloglevel = [](RGY_ERR err) {
+        if (err == RGY_ERR_NONE || err == RGY_ERR_MORE_DATA || err == RGY_ERR_MORE_SURFACE || err == RGY_ERR_MORE_BITSTREAM) return RGY_LOG_DEBUG;
+        if (err > RGY_ERR_NONE) return RGY_LOG_WARN;
+        return RGY_LOG_ERROR;
+    };
+    auto requireSync = [this](const size_t itask) {
+        for (size_t nexttask = itask + 1; nexttask < m_pipelineTasks.size(); nexttask++) {
+            if (!m_pipelineTasks[nexttask]->isPassThrough()) {
+                return m_pipelineTasks[itask]->requireSync(m_pipelineTasks[nexttask]->taskType());
+            }
+        }
+        return true; // 次が最後のタスクの時
+    };
 
-    if (RGY_ERR_NONE != (ret = initSSIMCalc(prm))) {
-        return ret;
-    }
+    auto runStage = [&](const size_t istage) {
+        m_pipelineThreadParam.apply(GetCurrentThread());
+        RGYOpenCLPerfCollector::instance().setTraceThreadName(strsprintf("stage %d: %s", (int)istage, tchar_to_string(stageNames[istage]).c_str()));
+        const size_t taskBegin = stages[istage].first;
+        const size_t taskEnd   = stages[istage].second;
+        PipelineTaskOutputQueue *queueIn  = (istage > 0)                 ? stageQueues[istage - 1].get() : nullptr;
+        PipelineTaskOutputQueue *queueOut = (istage + 1 < stages.size()) ? stageQueues[istage].get()     : nullptr;
+        PrintMes(RGY_LOG_DEBUG, _T("Start pipeline stage %d.\n"), (int)istage);
+
+        struct PipelineTaskData {
+            size_t task;
+            std::unique_ptr<PipelineTaskOutput> data;
+            PipelineTaskData(size_t t) : task(t), data() {};
+            PipelineTaskData(size_t t, std::unique_ptr<PipelineTaskOutput>& d) : task(t), data(std::move(d)) {};
+        };
+        std::deque<PipelineTaskData> dataqueue;
+        // stageの最後のタスクの出力は次のstageに渡す、最後のstageならファイルに出力する
+        auto sendNextStage = [&](std::unique_ptr<PipelineTaskOutput>& data) {
+            if (queueOut) {
+                PipelineTraceScope trace("queue push", data->inputFrameId());
+                return (queueOut->push(data)) ? RGY_ERR_NONE : RGY_ERR_ABORTED;
+            }
+            auto err = data->write(m_pFileWriter.get(), (m_cl) ? &m_cl->queue() : nullptr, m_videoQualityMetric.get());
+            if (err != RGY_ERR_NONE) {
+                PrintMes(RGY_LOG_ERROR, _T("failed to write output: %s.\n"), get_err_mes(err));
+            }
+            return err;
+        };
+        CProcSpeedControl speedCtrl(m_nProcSpeedLimit);
+        bool abortSent = false;
 
-    if (RGY_ERR_NONE != (ret = initPipeline(prm))) {
-        return ret;
-    }
+        RGY_ERR err = RGY_ERR_NONE;
+        auto checkContinue = [](RGY_ERR& err) {
+            return err >= RGY_ERR_NONE || err == RGY_ERR_MORE_DATA || err == RGY_ERR_MORE_SURFACE;
+        };
+        while (checkContinue(err)) {
+            if (pipelineStop) {
+                err = RGY_ERR_ABORTED;
+                break;
+            }
+            if (queueIn == nullptr && abortRequested && !abortSent) {
+                abortSent = true;
+                // 先頭のタスクに中断指示を送る
+                if (!m_pipelineTasks.front()->abort()) { // 中断指示を受け取ってくれなかったら強制break
+                    PrintMes(setloglevel(err), _T("Break in task %s: %s.\n"),
+                        m_pipelineTasks.front()->print().c_str(), get_err_mes(err));
+                    err = RGY_ERR_ABORTED;
+                    break;
+                }
+            }
+            if (dataqueue.empty()) {
+                if (queueIn == nullptr) {
+                    speedCtrl.wait(m_pipelineTasks[taskBegin]->outputFrames());
+                    dataqueue.push_back(PipelineTaskData(taskBegin)); // デコード実行用
+                } else {
+                    std::unique_ptr<PipelineTaskOutput> data;
+                    const auto popStart = RGYOpenCLPerfCollector::instance().isPipelineTraceEnabled() ? rgy_perf_trace_now_ns() : 0;
+                    err = queueIn->pop(data, PIPELINE_THREAD_QUEUE_WAIT_MS);
+                    if (err == RGY_ERR_NONE) {
+                        if (popStart) {
+                            RGYOpenCLPerfCollector::instance().recordPipelineEvent("queue pop", popStart, rgy_perf_trace_now_ns(), data->inputFrameId());
+                        }
+                        dataqueue.push_back(PipelineTaskData(taskBegin, data));
+                    } else if (err == RGY_ERR_MORE_DATA) { // タイムアウト
+                        err = RGY_ERR_NONE;
+                    } else { // 前段のstageのflush完了 (RGY_ERR_MORE_BITSTREAM) あるいは中断
+                        break;
+                    }
+                }
+            }
+            while (!dataqueue.empty()) {
+                auto d = std::move(dataqueue.front());
+                dataqueue.pop_front();
+                if (d.task < taskEnd) {
+                    auto& task = m_pipelineTasks[d.task];
+                    err = task->sendFrameTraced(d.data);
+                    if (!checkContinue(err)) {
+                        PrintMes(setloglevel(err), _T("Break in task %s: %s.\n"), task->print().c_str(), get_err_mes(err));
+                        break;
+                    }
+                    if (err == RGY_ERR_NONE) {
+                        auto output = task->getOutputTraced(requireSync(d.task));
+                        if (output.size() == 0) break;
+                        //出てきたものは先頭に追加していく
+                        std::for_each(output.rbegin(), output.rend(), [itask = d.task, &dataqueue](auto&& o) {
+                            dataqueue.push_front(PipelineTaskData(itask + 1, o));
+                            });
+                    }
+                } else if ((err = sendNextStage(d.data)) != RGY_ERR_NONE) {
+                    break;
+                }
+            }
+            if (dataqueue.empty()) {
+                // taskを前方からひとつづつ出力が残っていないかチェック(主にcheckptsの処理のため)
+                for (size_t itask = taskBegin; itask < taskEnd; itask++) {
+                    auto& task = m_pipelineTasks[itask];
+                    auto output = task->getOutputTraced(requireSync(itask));
+                    if (output.size() > 0) {
+                        //出てきたものは先頭に追加していく
+                        std::for_each(output.rbegin(), output.rend(), [itask, &dataqueue](auto&& o) {
+                            dataqueue.push_front(PipelineTaskData(itask + 1, o));
+                            });
+                        //checkptsの処理上、でてきたフレームはすぐに後続処理に渡したいのでbreak
+                        break;
+                    }
+                }
+            }
+        }
+        // flush
+        if (err == RGY_ERR_MORE_BITSTREAM) { // 読み込みの完了、あるいは前段のstageのflush完了を示すフラグ
+            err = RGY_ERR_NONE;
+            for (size_t itask = taskBegin; itask < taskEnd; itask++) {
+                m_pipelineTasks[itask]->setOutputMaxQueueSize(0); //flushのため
+            }
+            auto checkContinueFlush = [](RGY_ERR& err) {
+                return err >= RGY_ERR_NONE || err == RGY_ERR_MORE_SURFACE;
+            };
+            for (size_t flushedTaskSend = taskBegin, flushedTaskGet = taskBegin; flushedTaskGet < taskEnd; ) { // taskを前方からひとつづつflushしていく
+                if (pipelineStop) {
+                    err = RGY_ERR_ABORTED;
+                    break;
+                }
+                err = RGY_ERR_NONE;
+                if (flushedTaskSend == flushedTaskGet) {
+                    dataqueue.push_back(PipelineTaskData(flushedTaskSend)); //flush用
+                }
+                while (!dataqueue.empty() && checkContinueFlush(err)) {
+                    auto d = std::move(dataqueue.front());
+                    dataqueue.pop_front();
+                    if (d.task < taskEnd) {
+                        auto& task = m_pipelineTasks[d.task];
+                        err = task->sendFrameTraced(d.data);
+                        if (!checkContinueFlush(err)) {
+                            if (d.task == flushedTaskSend) flushedTaskSend++;
+                            break;
+                        }
+                        auto output = task->getOutputTraced(requireSync(d.task));
+                        if (output.size() == 0) break;
+                        //出てきたものは先頭に追加していく
+                        std::for_each(output.rbegin(), output.rend(), [itask = d.task, &dataqueue](auto&& o) {
+                            dataqueue.push_front(PipelineTaskData(itask + 1, o));
+                            });
+                    } else if ((err = sendNextStage(d.data)) != RGY_ERR_NONE) {
+                        break;
+                    }
+                }
+                if (isPipelineError(err)) {
+                    break;
+                }
+                if (dataqueue.empty()) {
+                    // taskを前方からひとつづつ出力が残っていないかチェック(主にcheckptsの処理のため)
+                    for (size_t itask = flushedTaskGet; itask < taskEnd; itask++) {
+                        auto& task = m_pipelineTasks[itask];
+                        auto output = task->getOutputTraced(requireSync(itask));
+                        if (output.size() > 0) {
+                            //出てきたものは先頭に追加していく
+                            std::for_each(output.rbegin(), output.rend(), [itask, &dataqueue](auto&& o) {
+                                dataqueue.push_front(PipelineTaskData(itask + 1, o));
+                                });
+                            //checkptsの処理上、でてきたフレームはすぐに後続処理に渡したいのでbreak
+                            break;
+                        } else if (itask == flushedTaskGet && flushedTaskGet < flushedTaskSend) {
+                            PrintMes(RGY_LOG_DEBUG, _T("Flush task %s.\n"), task->print().c_str());
+                            flushedTaskGet++;
+                        }
+                    }
+                }
+            }
+            if (!isPipelineError(err) && queueOut) {
+                queueOut->setEOF(); // 後段のstageにflushを指示する
+            }
+        }
+        // エラー終了の場合も含めキューをすべて開放する (m_pipelineTasksを解放する前に行う)
+        dataqueue.clear();
+        if (isPipelineError(err)) {
+            stopPipeline(err);
+        }
+        PrintMes(RGY_LOG_DEBUG, _T("Finish pipeline stage %d: %s.\n"), (int)istage, get_err_mes(err));
+        return err;
+    };
 
-    if (RGY_ERR_NONE != (ret = allocatePiplelineFrames())) {
-        return ret;
+    std::vector<std::future<RGY_ERR>> stageThreads;
+    for (size_t istage = 0; istage < stages.size(); istage++) {
+        stageThreads.push_back(std::async(std::launch::async, runStage, istage));
     }
-
-    {
-        const auto& threadParam = prm->ctrl.threadParams.get(RGYThreadType::MAIN);
-        threadParam.apply(GetCurrentThread());
-        PrintMes(RGY_LOG_DEBUG, _T("Set main thread param: %s.\n"), threadParam.desc().c_str());
+    // 各stageの終了を待ちつつ、中断指示を監視する
+    for (auto& th : stageThreads) {
+        while (th.wait_for(std::chrono::milliseconds(PIPELINE_THREAD_QUEUE_WAIT_MS)) != std::future_status::ready) {
+            if (!abortRequested && (checkAbort() || stdInAbort())) {
+                PrintMes(RGY_LOG_ERROR, _T("\nEncoding aborted.\n"));
+                abortRequested = true;
+            }
+        }
+        th.get();
     }
-
-    return ret;
+    stageQueues.clear();
+    for (auto& task : m_pipelineTasks) {
+        task->setPipelineStopFlag(nullptr);
+    }
+    return pipelineErr;
 }
 
 RGY_ERR MPPCore::run2() {
@@ -3580,6 +4305,17 @@ RGY_ERR MPPCore::run2() {
     auto checkAbort = [pabort = m_pAbortByUser]() { return  (pabort != nullptr && *pabort); };
 #endif
     m_pStatus->SetStart();
+    for (auto& rendition : m_renditions) {
+        rendition->status->SetStart();
+    }
+
+    if (m_pipelineMode == MPPPipelineMode::THREAD) {
+        auto err = runPipelineThread(checkAbort);
+        if (checkAbort() || stdInAbort()) {
+            err = RGY_ERR_ABORTED;
+        }
+        return finishPipeline(err);
+    }
 
     CProcSpeedControl speedCtrl(m_nProcSpeedLimit);
 
@@ -3617,6 +4353,7 @@ RGY_ERR MPPCore::run2() {
     };
     std::deque<PipelineTaskData> dataqueue;
     std::vector<char> firstSendFrame(m_pipelineTasks.size(), false);
+    RGYOpenCLPerfCollector::instance().setTraceThreadName("pipeline");
     {
         auto checkContinue = [&checkAbort](RGY_ERR& err) {
             //if (checkAbort() || stdInAbort()) { err = RGY_ERR_ABORTED; return false; }
@@ -3652,13 +4389,13 @@ RGY_ERR MPPCore::run2() {
                     } else {
                         PrintMes(RGY_LOG_TRACE, _T("Send task %s: %d.\n"), task->print().c_str());
                     }
-                    err = task->sendFrame(d.data);
+                    err = task->sendFrameTraced(d.data);
                     if (!checkContinue(err)) {
                         PrintMes(setloglevel(err), _T("Break in task %s: %s.\n"), task->print().c_str(), get_err_mes(err));
                         break;
                     }
                     if (err == RGY_ERR_NONE) {
-                        auto output = task->getOutput(requireSync(d.task));
+                        auto output = task->getOutputTraced(requireSync(d.task));
                         if (output.size() == 0) break;
                         PrintMes(RGY_LOG_TRACE, _T("Get task output %s: %d.\n"), task->print().c_str(), output.size());
                         //出てきたものは先頭に追加していく
@@ -3677,7 +4414,7 @@ RGY_ERR MPPCore::run2() {
                 // taskを前方からひとつづつ出力が残っていないかチェック(主にcheckptsの処理のため)
                 for (size_t itask = 0; itask < m_pipelineTasks.size(); itask++) {
                     auto& task = m_pipelineTasks[itask];
-                    auto output = task->getOutput(requireSync(itask));
+                    auto output = task->getOutputTraced(requireSync(itask));
                     if (output.size() > 0) {
                         //出てきたものは先頭に追加していく
                         std::for_each(output.rbegin(), output.rend(), [itask, &dataqueue](auto&& o) {
@@ -3711,12 +4448,12 @@ RGY_ERR MPPCore::run2() {
                 if (d.task < m_pipelineTasks.size()) {
                     err = RGY_ERR_NONE;
                     auto& task = m_pipelineTasks[d.task];
-                    err = task->sendFrame(d.data);
+                    err = task->sendFrameTraced(d.data);
                     if (!checkContinue(err)) {
                         if (d.task == flushedTaskSend) flushedTaskSend++;
                         break;
                     }
-                    auto output = task->getOutput(requireSync(d.task));
+                    auto output = task->getOutputTraced(requireSync(d.task));
                     if (output.size() == 0) break;
                     //出てきたものは先頭に追加していく
                     std::for_each(output.rbegin(), output.rend(), [itask = d.task, &dataqueue](auto&& o) {
@@ -3734,7 +4471,7 @@ RGY_ERR MPPCore::run2() {
                 // taskを前方からひとつづつ出力が残っていないかチェック(主にcheckptsの処理のため)
                 for (size_t itask = flushedTaskGet; itask < m_pipelineTasks.size(); itask++) {
                     auto& task = m_pipelineTasks[itask];
-                    auto output = task->getOutput(requireSync(itask));
+                    auto output = task->getOutputTraced(requireSync(itask));
                     if (output.size() > 0) {
                         //出てきたものは先頭に追加していく
                         std::for_each(output.rbegin(), output.rend(), [itask, &dataqueue](auto&& o) {
@@ -3757,7 +4494,10 @@ RGY_ERR MPPCore::run2() {
 
     // エラー終了の場合も含めキューをすべて開放する (m_pipelineTasksを解放する前に行う)
     dataqueue.clear();
+    return finishPipeline(err);
+}
 
+RGY_ERR MPPCore::finishPipeline(RGY_ERR err) {
     if (m_videoQualityMetric) {
         PrintMes(RGY_LOG_DEBUG, _T("Flushing video quality metric calc.\n"));
         m_videoQualityMetric->addBitstream(nullptr);
@@ -3778,6 +4518,7 @@ RGY_ERR MPPCore::run2() {
     // MFXのコンポーネントをm_pipelineTasksの解放(フレームの解放)前に実施する
     PrintMes(RGY_LOG_DEBUG, _T("Clear vpp filters...\n"));
     m_vpFilters.clear();
+    m_vppMemPlanner.reset();
     PrintMes(RGY_LOG_DEBUG, _T("Closing m_pmfxDEC/ENC/VPP...\n"));
 
     if (m_encoder != nullptr) {
@@ -3785,12 +4526,19 @@ RGY_ERR MPPCore::run2() {
         m_encoder.reset();
         PrintMes(RGY_LOG_DEBUG, _T("Closed Encoder.\n"));
     }
+    for (auto& rendition : m_renditions) {
+        rendition->vppcl.clear();
+        rendition->encoder.reset();
+    }
 
     if (m_decoder != nullptr) {
         PrintMes(RGY_LOG_DEBUG, _T("Closing Decoder...\n"));
         m_decoder.reset();
         PrintMes(RGY_LOG_DEBUG, _T("Closed Decoder.\n"));
     }
+    for (auto& task : m_pipelineTasks) {
+        task->printWorkSurfacesStats();
+    }
     //この中でフレームの解放がなされる
     PrintMes(RGY_LOG_DEBUG, _T("Clear pipeline tasks and allocated frames...\n"));
     // 依存関係があるため、m_pipelineTasksを後ろから解放する
@@ -3800,12 +4548,22 @@ RGY_ERR MPPCore::run2() {
     m_pipelineTasks.clear();
     PrintMes(RGY_LOG_DEBUG, _T("Waiting for writer to finish...\n"));
     m_pFileWriter->WaitFin();
+    for (auto& rendition : m_renditions) {
+        rendition->writer->WaitFin();
+    }
     PrintMes(RGY_LOG_DEBUG, _T("Write results...\n"));
     if (m_videoQualityMetric) {
         PrintMes(RGY_LOG_DEBUG, _T("Write video quality metric results...\n"));
         m_videoQualityMetric->showResult();
     }
     m_pStatus->WriteResults();
+    if (m_smartCut) {
+        PrintMes(RGY_LOG_INFO, _T("smart cut: copied %d frames in %d GOPs.\n"), m_smartCut->copiedFrames(), m_smartCut->copiedGops());
+    }
+    for (size_t i = 0; i < m_renditions.size(); i++) {
+        PrintMes(RGY_LOG_INFO, _T("\nrendition #%d: %s\n"), (int)i, m_renditions[i]->outputFilename.c_str());
+        m_renditions[i]->status->WriteResults();
+    }
     if (filter_result.size()) {
         PrintMes(RGY_LOG_INFO, _T("\nVpp Filter Performance\n"));
         const auto max_len = std::accumulate(filter_result.begin(), filter_result.end(), 0u, [](uint32_t max_length, std::pair<tstring, double> info) {
@@ -44,6 +44,7 @@
 #include "mpp_pipeline.h"
 #include "rgy_filter.h"
 #include "rgy_filter_ssim.h"
+#include "rgy_filter_mem_plan.h"
 #include "rk_mpi.h"
 
 #pragma warning(pop)
@@ -78,6 +79,23 @@ protected:
 };
 #endif
 
+//--renditionで追加する出力ごとの、フィルタ・エンコーダ・出力
+struct MPPRendition {
+    tstring outputFilename;
+    int width;
+    int height;
+    rgy_rational<int> sar;
+    RGY_CODEC codec;
+    MPPCfg enccfg;
+    std::unique_ptr<MPPContext> encoder;
+    std::unique_ptr<RGYTimestamp> timestamp;
+    std::vector<std::unique_ptr<RGYFilter>> vppcl;
+    shared_ptr<RGYOutput> writer;
+    shared_ptr<EncodeStatus> status;
+
+    MPPRendition() : outputFilename(), width(0), height(0), sar(), codec(RGY_CODEC_UNKNOWN), enccfg(), encoder(), timestamp(), vppcl(), writer(), status() {};
+};
+
 class MPPCore {
 public:
     MPPCore();
@@ -97,7 +115,9 @@ public:
     
     void PrintMes(RGYLogLevel log_level, const TCHAR *format, ...);
 
-    void SetAbortFlagPointer(bool *abortFlag);
+    void SetAbortFlagPointer(std::atomic<bool> *abortFlag);
+    //OpenCLのコンテキストを複数のエンコードで共有する (--server)
+    void SetSharedOpenCLContext(std::shared_ptr<RGYOpenCLContext> *sharedCL);
 protected:
     virtual RGY_ERR readChapterFile(tstring chapfile);
 
@@ -115,17 +135,24 @@ protected:
         RGYFrameInfo & inputFrame, const VppType vppType, const MPPParam *prm, const sInputCrop * crop, const std::pair<int, int> resize, VideoVUIInfo& vuiInfo);
     virtual RGY_ERR createOpenCLCopyFilterForPreVideoMetric(const MPPParam *inputParam);
     virtual RGY_ERR initChapters(MPPParam *prm);
-    virtual RGY_ERR initEncoderPrep(const MPPParam *prm);
-    virtual RGY_ERR initEncoderRC(const MPPParam *prm);
-    virtual RGY_ERR initEncoderCodec(const MPPParam *prm);
+    virtual RGY_ERR initEncoderOpen(std::unique_ptr<MPPContext>& encoder, const MPPParam *prm);
+    virtual RGY_ERR initEncoderPrep(MPPContext *encoder, MPPCfg& enccfg, const MPPParam *prm, const int width, const int height);
+    virtual RGY_ERR initEncoderRC(MPPContext *encoder, MPPCfg& enccfg, const MPPParam *prm);
+    virtual RGY_ERR initEncoderCodec(MPPContext *encoder, MPPCfg& enccfg, const MPPParam *prm);
+    virtual RGY_ERR initEncoderConfig(MPPContext *encoder, MPPCfg& enccfg, MPPParam *prm, const int width, const int height);
     virtual RGY_ERR initEncoder(MPPParam *prm);
+    virtual RGY_ERR initSmartCut(MPPParam *prm);
+    virtual RGY_ERR initRenditions(MPPParam *prm);
     virtual RGY_ERR initPowerThrottoling(MPPParam *prm);
+    virtual RGY_ERR initThreadAffinity(MPPParam *prm);
     virtual RGY_ERR initSSIMCalc(MPPParam *prm);
     virtual RGY_ERR initPipeline(MPPParam *prm);
-    virtual RGY_ERR checkRCParam(MPPParam *prm);
+    virtual RGY_ERR checkRCParam(MPPParam *prm, const int width, const int height);
 
     bool VppAfsRffAware() const;
     virtual RGY_ERR allocatePiplelineFrames();
+    virtual RGY_ERR runPipelineThread(std::function<bool()> checkAbort);
+    virtual RGY_ERR finishPipeline(RGY_ERR err);
 
     std::shared_ptr<RGYLog> m_pLog;
     RGY_CODEC          m_encCodec;
@@ -168,15 +195,19 @@ protected:
     VideoVUIInfo       m_encVUI;
 
     std::shared_ptr<RGYOpenCLContext> m_cl;
+    std::shared_ptr<RGYOpenCLContext> *m_sharedCL; // 複数のエンコードで共有するOpenCLのコンテキスト (未作成ならinitDeviceで作成して設定)
 
     MPPCfg             m_enccfg;
     std::unique_ptr<MPPContext> m_encoder;
     std::unique_ptr<MPPContext> m_decoder;
 
     vector<VppVilterBlock>        m_vpFilters;
+    unique_ptr<RGYFilterMemoryPlanner> m_vppMemPlanner; // OpenCLフィルタの出力バッファの共有
     bool                          m_canFollowResolutionChange; // 正規化resizeより上流の構成が解像度変更を扱えるか
     shared_ptr<RGYFilterParam>    m_pLastFilterParam;
     unique_ptr<RGYFilterSsim>     m_videoQualityMetric;
+    std::vector<std::unique_ptr<MPPRendition>> m_renditions; // --renditionの追加出力
+    std::shared_ptr<RGYSmartCut>  m_smartCut; // --trim-smart
 
     RGYRunState m_state;
 
@@ -190,6 +221,9 @@ protected:
     std::future<RGY_ERR> m_thOutput;
 
     std::vector<std::unique_ptr<PipelineTask>> m_pipelineTasks;
+    MPPPipelineMode                            m_pipelineMode;
+    RGYParamThread                             m_pipelineThreadParam; // --pipeline-mode thread 時の各stageのスレッド設定
+    bool                                       m_clPersistentMap; // --cl-persistent-map: OpenCLの出力を常時mapされたバッファで受け渡す
 
-    bool *m_pAbortByUser;
+    std::atomic<bool> *m_pAbortByUser;
 };
@@ -40,6 +40,20 @@ MPPParamDec::MPPParamDec() :
 
 }
 
+MPPRenditionParam::MPPRenditionParam() :
+    outputFilename(),
+    width(0),
+    height(0),
+    codec(RGY_CODEC_UNKNOWN),
+    rateControl(-1),
+    bitrate(0),
+    maxBitrate(0),
+    qp(MPP_DEFAULT_QP_I, MPP_DEFAULT_QP_P, MPP_DEFAULT_QP_B),
+    profile(),
+    level() {
+
+}
+
 MPPParam::MPPParam() :
     input(),
     inprm(),
@@ -48,6 +62,8 @@ MPPParam::MPPParam() :
     vpp(),
     hwdec(),
     deint(IEPDeinterlaceMode::DISABLED),
+    pipelineMode(MPPPipelineMode::SERIAL),
+    clPersistentMap(false),
     codec(RGY_CODEC_H264),
     codecParam(),
     outputDepth(8),
@@ -66,7 +82,9 @@ MPPParam::MPPParam() :
     par(),
     disableDeblock(false),
     deblockAlpha(0),
-    deblockBeta(0) {
+    deblockBeta(0),
+    trimSmart(false),
+    renditions() {
     codecParam[RGY_CODEC_H264].level   = 51;
     codecParam[RGY_CODEC_H264].profile = list_avc_profile[mpp_avc_profile_default_idx].value;
 
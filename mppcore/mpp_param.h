@@ -238,6 +238,17 @@ const CX_DESC list_iep_deinterlace[] = {
     { NULL, 0 }
 };
 
+enum class MPPPipelineMode {
+    SERIAL,
+    THREAD,
+};
+
+const CX_DESC list_pipeline_mode[] = {
+    { _T("serial"), (int)MPPPipelineMode::SERIAL },
+    { _T("thread"), (int)MPPPipelineMode::THREAD },
+    { NULL, 0 }
+};
+
 struct VCECodecParam {
     int profile;
     int tier;
@@ -255,6 +266,22 @@ struct MPPParamDec {
     MPPParamDec();
 };
 
+//--renditionで指定する追加出力 (メインのフィルタ後のフレームをリサイズしてエンコード)
+struct MPPRenditionParam {
+    tstring outputFilename;
+    int width;
+    int height;
+    RGY_CODEC codec;  //RGY_CODEC_UNKNOWNならメイン出力と同じ
+    int rateControl;  //-1ならメイン出力と同じ
+    int bitrate;
+    int maxBitrate;
+    RGYQPSet qp;
+    tstring profile;  //空ならメイン出力と同じ
+    tstring level;    //空ならメイン出力と同じ
+
+    MPPRenditionParam();
+};
+
 struct MPPParam {
     VideoInfo input;              //入力する動画の情報
     RGYParamInput inprm;
@@ -264,6 +291,8 @@ struct MPPParam {
 
     MPPParamDec hwdec;
     IEPDeinterlaceMode deint;
+    MPPPipelineMode pipelineMode;
+    bool clPersistentMap; //OpenCLフィルタの出力を常時mapされたバッファで受け渡す
 
     RGY_CODEC codec;
     VCECodecParam codecParam[RGY_CODEC_NUM];
@@ -290,6 +319,10 @@ struct MPPParam {
     int     deblockAlpha;
     int     deblockBeta;
 
+    bool    trimSmart; //--trimの範囲内のGOPは再エンコードせずにコピーする
+
+    std::vector<MPPRenditionParam> renditions;
+
     MPPParam();
     ~MPPParam();
 };
@@ -32,6 +32,8 @@
 #include <thread>
 #include <future>
 #include <atomic>
+#include <mutex>
+#include <condition_variable>
 #include <deque>
 #include <set>
 #include <unordered_map>
@@ -46,6 +48,7 @@
 #include "rgy_output.h"
 #include "rgy_output_avcodec.h"
 #include "rgy_opencl.h"
+#include "rgy_opencl_perf.h"
 #include "rgy_filter.h"
 #include "rgy_filter_resize.h"
 #include "rgy_filter_ssim.h"
@@ -58,6 +61,8 @@
 #include "rk_mpi.h"
 
 static const int RGY_WAIT_INTERVAL = 60000;
+static const int PIPELINE_THREAD_QUEUE_SIZE = 4; // --pipeline-mode thread 時のstage間キューの上限
+static const int PIPELINE_THREAD_QUEUE_WAIT_MS = 16;
 
 struct MPPContext {
     MppCtx ctx;
@@ -110,25 +115,27 @@ enum class PipelineTaskSurfaceType {
     MPP
 };
 
+class PipelineTaskSurfaces;
+class PipelineTaskSurfacesPair;
+
 class PipelineTaskSurface {
 private:
     RGYFrame *surf;
-    std::atomic<int> *ref;
+    PipelineTaskSurfacesPair *ref;
 public:
     PipelineTaskSurface() : surf(nullptr), ref(nullptr) {};
-    PipelineTaskSurface(std::pair<RGYFrame *, std::atomic<int> *> surf_) : PipelineTaskSurface(surf_.first, surf_.second) {};
-    PipelineTaskSurface(RGYFrame *surf_, std::atomic<int> *ref_) : surf(surf_), ref(ref_) { if (surf) (*ref)++; };
-    PipelineTaskSurface(const PipelineTaskSurface& obj) : surf(obj.surf), ref(obj.ref) { if (surf) (*ref)++; }
+    PipelineTaskSurface(PipelineTaskSurfacesPair *ref_);
+    PipelineTaskSurface(const PipelineTaskSurface& obj);
     PipelineTaskSurface &operator=(const PipelineTaskSurface &obj) {
         if (this != &obj) { // 自身の代入チェック
-            surf = obj.surf;
-            ref = obj.ref;
-            if (surf) (*ref)++;
+            PipelineTaskSurface tmp(obj);
+            std::swap(surf, tmp.surf);
+            std::swap(ref, tmp.ref);
         }
         return *this;
     }
     ~PipelineTaskSurface() { reset(); }
-    void reset() { if (surf) (*ref)--; surf = nullptr; ref = nullptr; }
+    void reset();
     bool operator !() const {
         return frame() == nullptr;
     }
@@ -144,119 +151,218 @@ public:
     RGYFrame *frame() { return surf; }
 };
 
-// アプリ用の独自参照カウンタと組み合わせたクラス
-class PipelineTaskSurfaces {
+// フレームとアプリ用の独自参照カウンタの組
+// 最後の参照が解放されると、所属するPipelineTaskSurfacesの空きリストに戻る
+class PipelineTaskSurfacesPair {
 private:
-    class PipelineTaskSurfacesPair {
-    private:
-        std::unique_ptr<RGYFrame> surf_;
-        std::atomic<int> ref;
-        uint64_t generation_;
-    public:
-        PipelineTaskSurfacesPair(std::unique_ptr<RGYFrame> s, const uint64_t generation) : surf_(std::move(s)), ref(0), generation_(generation) {};
-        
-        bool isFree() const { return ref == 0; } // 使用されていないフレームかを返す
-        PipelineTaskSurface getRef() { return PipelineTaskSurface(surf_.get(), &ref); };
-        const RGYFrame *surf() const { return surf_.get(); }
-        RGYFrame *surf() { return surf_.get(); }
-        uint64_t generation() const { return generation_; }
-        PipelineTaskSurfaceType type() const {
-            if (!surf_) return PipelineTaskSurfaceType::UNKNOWN;
-            if (dynamic_cast<const RGYCLFrame*>(surf_.get())) return PipelineTaskSurfaceType::CL;
-            if (dynamic_cast<const RGYFrameMpp*>(surf_.get())) return PipelineTaskSurfaceType::MPP;
-            return PipelineTaskSurfaceType::UNKNOWN;
-        }
+    std::unique_ptr<RGYFrame> surf_;
+    std::atomic<int> ref;
+    uint64_t generation_;
+    PipelineTaskSurfaceType type_;
+    PipelineTaskSurfaces *pool_;
+    bool inFreeList_; // pool_のm_mtxで保護
+    friend class PipelineTaskSurfaces;
+public:
+    PipelineTaskSurfacesPair(std::unique_ptr<RGYFrame> s, const uint64_t generation, PipelineTaskSurfaces *pool) :
+        surf_(std::move(s)), ref(0), generation_(generation), type_(PipelineTaskSurfaceType::UNKNOWN), pool_(pool), inFreeList_(false) {
+        if (dynamic_cast<const RGYCLFrame*>(surf_.get())) type_ = PipelineTaskSurfaceType::CL;
+        else if (dynamic_cast<const RGYFrameMpp*>(surf_.get())) type_ = PipelineTaskSurfaceType::MPP;
     };
+
+    bool isFree() const { return ref == 0; } // 使用されていないフレームかを返す
+    const RGYFrame *surf() const { return surf_.get(); }
+    RGYFrame *surf() { return surf_.get(); }
+    uint64_t generation() const { return generation_; }
+    PipelineTaskSurfaceType type() const { return type_; }
+    void addRef() { ref++; }
+    void release();
+};
+
+struct PipelineTaskSurfacesStats {
+    uint64_t getCount;       // 空きフレームの取得回数
+    uint64_t exhaustedCount; // 空きがなく待機した回数
+    uint64_t timeoutCount;   // 待機しても空きが得られなかった回数
+    uint64_t waitTimeNs;     // 待機時間の合計
+    uint64_t waitTimeMaxNs;  // 待機時間の最大
+
+    PipelineTaskSurfacesStats() : getCount(0), exhaustedCount(0), timeoutCount(0), waitTimeNs(0), waitTimeMaxNs(0) {};
+};
+
+// 作業用フレームのプール
+// 空きフレームはm_freeに積まれ、O(1)で取得できる
+// 空きがない場合はwaitFreeSurfで他スレッドからの解放を待つ
+class PipelineTaskSurfaces {
+private:
     std::vector<std::unique_ptr<PipelineTaskSurfacesPair>> m_surfaces; // フレームと参照カウンタ
+    std::vector<PipelineTaskSurfacesPair *> m_free; // 空きフレーム (m_mtxで保護)
     uint64_t m_generation;
+    size_t m_currentCount; // 現世代のフレーム数
+    PipelineTaskSurfaceType m_type; // 現世代のフレームの種類
+    mutable std::mutex m_mtx;
+    std::condition_variable m_cvFree;
+    PipelineTaskSurfacesStats m_stats;
+    friend class PipelineTaskSurfacesPair;
 public:
-    PipelineTaskSurfaces() : m_surfaces(), m_generation(0) {};
+    PipelineTaskSurfaces() : m_surfaces(), m_free(), m_generation(0), m_currentCount(0), m_type(PipelineTaskSurfaceType::UNKNOWN), m_mtx(), m_cvFree(), m_stats() {};
+    PipelineTaskSurfaces(const PipelineTaskSurfaces&) = delete;
+    PipelineTaskSurfaces &operator=(const PipelineTaskSurfaces&) = delete;
     ~PipelineTaskSurfaces() {}
 
     void clear() {
+        std::lock_guard<std::mutex> lock(m_mtx);
+        m_free.clear();
         m_surfaces.clear();
+        m_currentCount = 0;
+        m_type = PipelineTaskSurfaceType::UNKNOWN;
     }
     void setSurfaces(std::vector<std::unique_ptr<RGYFrame>>& surfs) {
         clear();
+        std::lock_guard<std::mutex> lock(m_mtx);
         m_generation++;
-        m_surfaces.resize(surfs.size());
-        for (size_t i = 0; i < m_surfaces.size(); i++) {
-            m_surfaces[i] = std::make_unique<PipelineTaskSurfacesPair>(std::move(surfs[i]), m_generation);
+        for (auto& surf : surfs) {
+            addPair(std::move(surf), true);
         }
     }
     // 旧世代を参照中の出力を保持したまま、新しい寸法のプールへ切り替える。
     void replaceSurfaces(std::vector<std::unique_ptr<RGYFrame>>& surfs) {
+        std::lock_guard<std::mutex> lock(m_mtx);
         m_generation++;
-        deleteFreedRetiredSurfaces();
+        m_currentCount = 0;
+        deleteFreedSurface();
         for (auto& surf : surfs) {
-            m_surfaces.push_back(std::make_unique<PipelineTaskSurfacesPair>(std::move(surf), m_generation));
+            addPair(std::move(surf), true);
         }
     }
     PipelineTaskSurface addSurface(std::unique_ptr<RGYFrame>& surf) {
+        std::lock_guard<std::mutex> lock(m_mtx);
         deleteFreedSurface();
-        m_surfaces.push_back(std::make_unique<PipelineTaskSurfacesPair>(std::move(surf), m_generation));
-        return m_surfaces.back()->getRef();
+        return PipelineTaskSurface(addPair(std::move(surf), false));
     }
     PipelineTaskSurface addSurface(std::unique_ptr<RGYFrameMpp>& surf) {
+        std::lock_guard<std::mutex> lock(m_mtx);
         deleteFreedSurface();
-        m_surfaces.push_back(std::make_unique<PipelineTaskSurfacesPair>(std::move(surf), m_generation));
-        return m_surfaces.back()->getRef();
+        return PipelineTaskSurface(addPair(std::move(surf), false));
     }
 
     PipelineTaskSurface getFreeSurf() {
-        deleteFreedRetiredSurfaces();
-        for (auto& s : m_surfaces) {
-            if (s->generation() == m_generation && s->isFree()) {
-                return s->getRef();
+        std::lock_guard<std::mutex> lock(m_mtx);
+        return popFreeSurf();
+    }
+    // 空きフレームが得られるまで最大timeoutMs待機する
+    // 空きの確認と待機は同じロック内で行い、その間の解放通知を取りこぼさないようにする
+    // stopがtrueになった場合は待機を中断する
+    PipelineTaskSurface waitFreeSurf(const int timeoutMs, const std::atomic<bool> *stop, bool *waited = nullptr) {
+        std::unique_lock<std::mutex> lock(m_mtx);
+        auto s = popFreeSurf();
+        if (waited) *waited = (s == nullptr);
+        if (s != nullptr) {
+            return s;
+        }
+        m_stats.exhaustedCount++;
+        const auto start = std::chrono::steady_clock::now();
+        const auto deadline = start + std::chrono::milliseconds(timeoutMs);
+        for (auto now = start; now < deadline && !(stop && *stop); now = std::chrono::steady_clock::now()) {
+            // stopはcondition_variableで通知されないため、スレッド実行時のみ一定間隔で確認する
+            m_cvFree.wait_until(lock, (stop) ? std::min(deadline, now + std::chrono::milliseconds(PIPELINE_THREAD_QUEUE_WAIT_MS)) : deadline);
+            if ((s = popFreeSurf()) != nullptr) {
+                break;
             }
         }
-        return PipelineTaskSurface();
+        const auto waitNs = (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+        m_stats.waitTimeNs += waitNs;
+        m_stats.waitTimeMaxNs = std::max(m_stats.waitTimeMaxNs, waitNs);
+        if (s == nullptr) {
+            m_stats.timeoutCount++;
+        }
+        return s;
     }
     PipelineTaskSurface get(RGYFrame *surf) {
+        std::lock_guard<std::mutex> lock(m_mtx);
         auto s = findSurf(surf);
-        if (s != nullptr) {
-            return s->getRef();
+        if (s == nullptr) {
+            return PipelineTaskSurface();
         }
-        return PipelineTaskSurface();
+        if (s->inFreeList_) {
+            m_free.erase(std::find(m_free.begin(), m_free.end(), s));
+            s->inFreeList_ = false;
+        }
+        return PipelineTaskSurface(s);
     }
     size_t bufCount() const {
-        return std::count_if(m_surfaces.begin(), m_surfaces.end(), [this](const auto& surf) {
-            return surf->generation() == m_generation;
-        });
+        return m_currentCount;
     }
 
+    // 解放処理中のものを除くため、参照カウンタではなく空きリストに戻ったかで判定する
     bool isAllFree() const {
-        for (const auto& s : m_surfaces) {
-            if (!s->isFree()) {
-                return false;
-            }
-        }
-        return true;
+        std::lock_guard<std::mutex> lock(m_mtx);
+        return m_free.size() == m_surfaces.size();
     }
     PipelineTaskSurfaceType type() const {
-        const auto current = std::find_if(m_surfaces.begin(), m_surfaces.end(), [this](const auto& surf) {
-            return surf->generation() == m_generation;
-        });
-        return (current == m_surfaces.end()) ? PipelineTaskSurfaceType::UNKNOWN : (*current)->type();
+        return m_type;
+    }
+    PipelineTaskSurfacesStats stats() {
+        std::lock_guard<std::mutex> lock(m_mtx);
+        return m_stats;
     }
 protected:
-    void deleteFreedRetiredSurfaces() {
-        for (auto it = m_surfaces.begin(); it != m_surfaces.end();) {
-            if ((*it)->generation() != m_generation && (*it)->isFree()) {
-                it = m_surfaces.erase(it);
-            } else {
-                it++;
+    // 以下、m_mtx保持下で呼ぶこと
+    PipelineTaskSurfacesPair *addPair(std::unique_ptr<RGYFrame> surf, const bool pushFree) {
+        m_surfaces.push_back(std::make_unique<PipelineTaskSurfacesPair>(std::move(surf), m_generation, this));
+        auto pair = m_surfaces.back().get();
+        m_currentCount++;
+        m_type = pair->type();
+        if (pushFree) {
+            pair->inFreeList_ = true;
+            m_free.push_back(pair);
+        }
+        return pair;
+    }
+    PipelineTaskSurface popFreeSurf() {
+        while (!m_free.empty()) {
+            auto pair = m_free.back();
+            m_free.pop_back();
+            pair->inFreeList_ = false;
+            if (pair->generation() == m_generation) {
+                m_stats.getCount++;
+                return PipelineTaskSurface(pair);
+            }
+            // 解放済みの旧世代のフレームは破棄する
+            deleteSurf(pair);
+        }
+        return PipelineTaskSurface();
+    }
+    void deleteSurf(PipelineTaskSurfacesPair *pair) {
+        auto it = std::find_if(m_surfaces.begin(), m_surfaces.end(), [pair](const auto& s) { return s.get() == pair; });
+        if (it != m_surfaces.end()) {
+            if ((*it)->generation() == m_generation) {
+                m_currentCount--;
             }
+            m_surfaces.erase(it);
         }
     }
+    // 空きリストにあるフレームをすべて破棄する
+    // (参照カウンタが0でも空きリストに戻る前のものは、解放処理中の可能性があるので残す)
     void deleteFreedSurface() {
         for (auto it = m_surfaces.begin(); it != m_surfaces.end();) {
-            if ((*it)->isFree()) {
+            if ((*it)->inFreeList_) {
+                if ((*it)->generation() == m_generation) {
+                    m_currentCount--;
+                }
                 it = m_surfaces.erase(it);
             } else {
                 it++;
             }
         }
+        m_free.clear();
+    }
+    // PipelineTaskSurfacesPair::releaseから呼ばれる
+    void pushFree(PipelineTaskSurfacesPair *pair) {
+        {
+            std::lock_guard<std::mutex> lock(m_mtx);
+            pair->inFreeList_ = true;
+            m_free.push_back(pair);
+        }
+        m_cvFree.notify_one();
     }
 
     PipelineTaskSurfacesPair *findSurf(RGYFrame *surf) {
@@ -269,6 +375,16 @@ protected:
     }
 };
 
+inline PipelineTaskSurface::PipelineTaskSurface(PipelineTaskSurfacesPair *ref_) : surf(ref_ ? ref_->surf() : nullptr), ref(ref_) { if (surf) ref->addRef(); }
+inline PipelineTaskSurface::PipelineTaskSurface(const PipelineTaskSurface& obj) : surf(obj.surf), ref(obj.ref) { if (surf) ref->addRef(); }
+inline void PipelineTaskSurface::reset() { if (surf) ref->release(); surf = nullptr; ref = nullptr; }
+
+inline void PipelineTaskSurfacesPair::release() {
+    if (ref.fetch_sub(1) == 1) {
+        pool_->pushFree(this);
+    }
+}
+
 class PipelineTaskOutputDataCustom {
     int type;
 public:
@@ -286,6 +402,23 @@ public:
     int64_t timestampOverride() const { return timestamp; }
 };
 
+// --pipeline-trace 指定時に、スコープの開始から終了までを trace に記録する
+class PipelineTraceScope {
+private:
+    const char *m_name;
+    int64_t m_frameId;
+    uint64_t m_start;
+public:
+    PipelineTraceScope(const char *name, const int64_t frameId) :
+        m_name(name), m_frameId(frameId),
+        m_start(RGYOpenCLPerfCollector::instance().isPipelineTraceEnabled() ? rgy_perf_trace_now_ns() : 0) {};
+    ~PipelineTraceScope() {
+        if (m_start) {
+            RGYOpenCLPerfCollector::instance().recordPipelineEvent(m_name, m_start, rgy_perf_trace_now_ns(), m_frameId);
+        }
+    }
+};
+
 class PipelineTaskOutput {
 protected:
     PipelineTaskOutputType m_type;
@@ -303,6 +436,7 @@ public:
     const PipelineTaskOutputDataCustom *customdata() const { return m_customData.get(); }
     bool resolutionChanged() const { return m_resolutionChanged; }
     void setResolutionChanged(const bool changed) { m_resolutionChanged = changed; }
+    virtual int64_t inputFrameId() { return -1; } // --pipeline-trace 用 (-1 = 不明)
     virtual RGY_ERR write([[maybe_unused]] RGYOutput *writer, [[maybe_unused]] RGYOpenCLQueue *clqueue, [[maybe_unused]] RGYFilterSsim *videoQualityMetric) {
         return RGY_ERR_UNSUPPORTED;
     }
@@ -339,6 +473,10 @@ public:
 
     PipelineTaskSurface& surf() { return m_surf; }
 
+    virtual int64_t inputFrameId() override {
+        return (m_surf.frame()) ? m_surf.frame()->inputFrameId() : -1;
+    }
+
     void addEvent(unique_event& event) {
         m_event = std::move(event);
     }
@@ -366,6 +504,7 @@ public:
     }
 
     RGY_ERR writeSys(RGYOutput *writer) {
+        PipelineTraceScope trace("WriteNextFrame", inputFrameId());
         auto err = writer->WriteNextFrame(m_surf.frame());
         return err;
     }
@@ -380,6 +519,7 @@ public:
             return err;
         }
         clframe->mapWait();
+        PipelineTraceScope trace("WriteNextFrame", inputFrameId());
         err = writer->WriteNextFrame(clframe->mappedHost());
         clframe->unmapBuffer();
         return err;
@@ -400,11 +540,13 @@ public:
 class PipelineTaskOutputBitstream : public PipelineTaskOutput {
 protected:
     std::shared_ptr<RGYBitstream> m_bs;
+    int64_t m_inputFrameId;
 public:
-    PipelineTaskOutputBitstream(std::shared_ptr<RGYBitstream> bs) : PipelineTaskOutput(PipelineTaskOutputType::BITSTREAM), m_bs(bs) {};
+    PipelineTaskOutputBitstream(std::shared_ptr<RGYBitstream> bs, const int64_t inputFrameId = -1) : PipelineTaskOutput(PipelineTaskOutputType::BITSTREAM), m_bs(bs), m_inputFrameId(inputFrameId) {};
     virtual ~PipelineTaskOutputBitstream() {};
 
     std::shared_ptr<RGYBitstream>& bitstream() { return m_bs; }
+    virtual int64_t inputFrameId() override { return m_inputFrameId; }
 
     virtual RGY_ERR write([[maybe_unused]] RGYOutput *writer, [[maybe_unused]] RGYOpenCLQueue *clqueue, [[maybe_unused]] RGYFilterSsim *videoQualityMetric) override {
         if (!writer || writer->getOutType() == OUT_TYPE_NONE) {
@@ -419,10 +561,75 @@ public:
             }
             videoQualityMetric->addBitstream(m_bs.get());
         }
+        PipelineTraceScope trace("WriteNextFrame", m_inputFrameId);
         return writer->WriteNextFrame(m_bs.get());
     }
 };
 
+// --pipeline-mode thread 時に、stage間でタスクの出力を受け渡すためのキュー
+class PipelineTaskOutputQueue {
+private:
+    std::mutex m_mtx;
+    std::condition_variable m_cvPush;
+    std::condition_variable m_cvPop;
+    std::deque<std::unique_ptr<PipelineTaskOutput>> m_queue;
+    size_t m_maxSize;
+    bool m_eof;
+    bool m_abort;
+public:
+    PipelineTaskOutputQueue(size_t maxSize) : m_mtx(), m_cvPush(), m_cvPop(), m_queue(), m_maxSize(std::max<size_t>(maxSize, 1)), m_eof(false), m_abort(false) {};
+    ~PipelineTaskOutputQueue() { m_queue.clear(); };
+
+    // キューに空きができるまで待機してから追加する、中断された場合はfalseを返す
+    bool push(std::unique_ptr<PipelineTaskOutput>& data) {
+        std::unique_lock<std::mutex> lock(m_mtx);
+        m_cvPush.wait(lock, [this]() { return m_abort || m_queue.size() < m_maxSize; });
+        if (m_abort) {
+            return false;
+        }
+        m_queue.push_back(std::move(data));
+        m_cvPop.notify_one();
+        return true;
+    }
+    // 取り出し
+    // RGY_ERR_NONE: 取り出し成功, RGY_ERR_MORE_DATA: タイムアウト,
+    // RGY_ERR_MORE_BITSTREAM: 前段のflushが完了, RGY_ERR_ABORTED: 中断
+    RGY_ERR pop(std::unique_ptr<PipelineTaskOutput>& data, const uint32_t timeoutMs) {
+        std::unique_lock<std::mutex> lock(m_mtx);
+        if (!m_cvPop.wait_for(lock, std::chrono::milliseconds(timeoutMs), [this]() { return m_abort || m_eof || !m_queue.empty(); })) {
+            return RGY_ERR_MORE_DATA;
+        }
+        if (m_abort) {
+            return RGY_ERR_ABORTED;
+        }
+        if (m_queue.empty()) { // m_eof
+            return RGY_ERR_MORE_BITSTREAM;
+        }
+        data = std::move(m_queue.front());
+        m_queue.pop_front();
+        m_cvPush.notify_one();
+        return RGY_ERR_NONE;
+    }
+    // 前段のflushが完了し、これ以上追加されないことを通知する
+    void setEOF() {
+        std::lock_guard<std::mutex> lock(m_mtx);
+        m_eof = true;
+        m_cvPop.notify_all();
+    }
+    // 待機中のstageをすべて起こし、キューに残っているフレームを解放する
+    void abort() {
+        std::lock_guard<std::mutex> lock(m_mtx);
+        m_abort = true;
+        m_queue.clear();
+        m_cvPush.notify_all();
+        m_cvPop.notify_all();
+    }
+    size_t size() {
+        std::lock_guard<std::mutex> lock(m_mtx);
+        return m_queue.size();
+    }
+};
+
 enum class PipelineTaskType {
     UNKNOWN,
     MPPDEC,
@@ -437,6 +644,7 @@ enum class PipelineTaskType {
     OUTPUTRAW,
     OPENCL,
     VIDEOMETRIC,
+    RENDITIONS,
 };
 
 static const TCHAR *getPipelineTaskTypeName(PipelineTaskType type) {
@@ -453,6 +661,7 @@ static const TCHAR *getPipelineTaskTypeName(PipelineTaskType type) {
     case PipelineTaskType::AUDIO:       return _T("AUDIO");
     case PipelineTaskType::VIDEOMETRIC: return _T("VIDEOMETRIC");
     case PipelineTaskType::OUTPUTRAW:   return _T("OUTRAW");
+    case PipelineTaskType::RENDITIONS:  return _T("RENDITIONS");
     default: return _T("UNKNOWN");
     }
 }
@@ -472,6 +681,7 @@ static const int getPipelineTaskAllocPriority(PipelineTaskType type) {
     case PipelineTaskType::AUDIO:
     case PipelineTaskType::OUTPUTRAW:
     case PipelineTaskType::VIDEOMETRIC:
+    case PipelineTaskType::RENDITIONS:
     default: return 0;
     }
 }
@@ -487,11 +697,13 @@ protected:
     MppBufferGroup m_frameGrp;
     int m_maxWorkSurfWidth;
     int m_maxWorkSurfHeight;
+    bool m_workSurfsPersistentMap; // --cl-persistent-map: OpenCLの作業サーフェスを常時mapされたバッファで確保する
+    const std::atomic<bool> *m_pipelineStop; // --pipeline-mode thread 時の停止フラグ (serial時はnullptr)
     std::shared_ptr<RGYLog> m_log;
 public:
-    PipelineTask() : m_type(PipelineTaskType::UNKNOWN), m_outQeueue(), m_workSurfs(), m_inFrames(0), m_outFrames(0), m_outMaxQueueSize(0), m_frameGrp(nullptr), m_maxWorkSurfWidth(0), m_maxWorkSurfHeight(0), m_log() {};
+    PipelineTask() : m_type(PipelineTaskType::UNKNOWN), m_outQeueue(), m_workSurfs(), m_inFrames(0), m_outFrames(0), m_outMaxQueueSize(0), m_frameGrp(nullptr), m_maxWorkSurfWidth(0), m_maxWorkSurfHeight(0), m_workSurfsPersistentMap(false), m_pipelineStop(nullptr), m_log() {};
     PipelineTask(PipelineTaskType type, int outMaxQueueSize, std::shared_ptr<RGYLog> log) :
-        m_type(type), m_outQeueue(), m_workSurfs(), m_inFrames(0), m_outFrames(0), m_outMaxQueueSize(outMaxQueueSize), m_frameGrp(nullptr), m_maxWorkSurfWidth(0), m_maxWorkSurfHeight(0), m_log(log) {
+        m_type(type), m_outQeueue(), m_workSurfs(), m_inFrames(0), m_outFrames(0), m_outMaxQueueSize(outMaxQueueSize), m_frameGrp(nullptr), m_maxWorkSurfWidth(0), m_maxWorkSurfHeight(0), m_workSurfsPersistentMap(false), m_pipelineStop(nullptr), m_log(log) {
     };
     virtual ~PipelineTask() {
         m_outQeueue.clear();
@@ -523,6 +735,30 @@ public:
         }
         return output;
     }
+    // --pipeline-trace 指定時は所要時間を記録しつつ sendFrame / getOutput を呼ぶ
+    RGY_ERR sendFrameTraced(std::unique_ptr<PipelineTaskOutput>& frame) {
+        auto& perf = RGYOpenCLPerfCollector::instance();
+        if (!perf.isPipelineTraceEnabled()) {
+            return sendFrame(frame);
+        }
+        const int64_t frameId = (frame) ? frame->inputFrameId() : -1;
+        const auto start = rgy_perf_trace_now_ns();
+        auto err = sendFrame(frame);
+        perf.recordPipelineEvent((tchar_to_string(print()) + " sendFrame").c_str(), start, rgy_perf_trace_now_ns(), frameId);
+        return err;
+    }
+    std::vector<std::unique_ptr<PipelineTaskOutput>> getOutputTraced(const bool sync) {
+        auto& perf = RGYOpenCLPerfCollector::instance();
+        if (!perf.isPipelineTraceEnabled()) {
+            return getOutput(sync);
+        }
+        const auto start = rgy_perf_trace_now_ns();
+        auto output = getOutput(sync);
+        if (output.size() > 0) { // 何も出てこなかった場合は記録しない (ポーリングでtraceが埋まるため)
+            perf.recordPipelineEvent((tchar_to_string(print()) + " getOutput").c_str(), start, rgy_perf_trace_now_ns(), output.front()->inputFrameId());
+        }
+        return output;
+    }
     bool isAMFTask() const { return isAMFTask(m_type); }
     bool isAMFTask(const PipelineTaskType task) const {
         return task == PipelineTaskType::MPPDEC
@@ -539,6 +775,15 @@ public:
     size_t workSurfacesCount() const {
         return m_workSurfs.bufCount();
     }
+    void printWorkSurfacesStats() {
+        const auto stats = m_workSurfs.stats();
+        if (stats.getCount == 0) {
+            return;
+        }
+        PrintMes(RGY_LOG_DEBUG, _T("work surfaces: %d frames, get %llu, exhausted %llu, timeout %llu, wait total %.3f ms, max %.3f ms.\n"),
+            (int)m_workSurfs.bufCount(), (unsigned long long)stats.getCount, (unsigned long long)stats.exhaustedCount, (unsigned long long)stats.timeoutCount,
+            stats.waitTimeNs * 1e-6, stats.waitTimeMaxNs * 1e-6);
+    }
 
     void PrintMes(RGYLogLevel log_level, const TCHAR *format, ...) {
         if (m_log.get() == nullptr) {
@@ -576,7 +821,9 @@ protected:
         return RGY_ERR_NONE;
     }
 public:
-    RGY_ERR workSurfacesAllocCL(const int numFrames, const RGYFrameInfo &frame, RGYOpenCLContext *cl) {
+    //pitch: 0以外なら後段のバッファと同じpitchで確保し、CPUでの受け渡しを単純なコピーにする
+    //persistentMap: 常時mapされたバッファで確保し、受け渡しのたびのmap/unmapを行わない
+    RGY_ERR workSurfacesAllocCL(const int numFrames, const RGYFrameInfo &frame, RGYOpenCLContext *cl, const int pitch = 0, const bool persistentMap = false) {
         auto sts = workSurfacesClear();
         if (sts != RGY_ERR_NONE) {
             PrintMes(RGY_LOG_ERROR, _T("allocWorkSurfaces:   Failed to clear old surfaces: %s.\n"), get_err_mes(sts));
@@ -589,9 +836,15 @@ public:
         for (size_t i = 0; i < frames.size(); i++) {
             //CPUとのやり取りが効率化できるよう、CL_MEM_ALLOC_HOST_PTR を指定する
             //これでmap/unmapで可能な場合コピーが発生しない
-            frames[i] = cl->createFrameBuffer(frame, CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR);
+            frames[i] = cl->createFrameBuffer(frame, CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR, pitch, persistentMap);
         }
+        m_workSurfsPersistentMap = persistentMap;
         PrintMes(RGY_LOG_DEBUG, _T("allocWorkSurfaces:   allocated %d frames.\n"), numFrames);
+        if (persistentMap && frames.size() > 0 && frames[0]) {
+            const bool persistent = dynamic_cast<RGYCLFrame *>(frames[0].get())->isPersistentMapped();
+            PrintMes((persistent) ? RGY_LOG_DEBUG : RGY_LOG_WARN, _T("allocWorkSurfaces:   persistent map %s.\n"),
+                (persistent) ? _T("enabled") : _T("not supported, fallback to map/unmap"));
+        }
         m_workSurfs.setSurfaces(frames);
         return RGY_ERR_NONE;
     }
@@ -599,7 +852,8 @@ protected:
     RGY_ERR workSurfacesReplaceCL(const int numFrames, const RGYFrameInfo& frame, RGYOpenCLContext *cl) {
         std::vector<std::unique_ptr<RGYFrame>> frames(numFrames);
         for (auto& workFrame : frames) {
-            workFrame = cl->createFrameBuffer(frame, CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR);
+            // 解像度変更後は後段とのpitchが一致しないので、pitchの指定はしない
+            workFrame = cl->createFrameBuffer(frame, CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR, 0, m_workSurfsPersistentMap);
             if (!workFrame) {
                 PrintMes(RGY_LOG_ERROR, _T("解像度変更後のOpenCL作業サーフェスを確保できませんでした。\n"));
                 return RGY_ERR_MEMORY_ALLOC;
@@ -652,12 +906,16 @@ public:
             PrintMes(RGY_LOG_ERROR, _T("getWorkSurf:   No buffer allocated!\n"));
             return PipelineTaskSurface();
         }
-        for (int i = 0; i < RGY_WAIT_INTERVAL; i++) {
-            PipelineTaskSurface s = m_workSurfs.getFreeSurf();
-            if (s != nullptr) {
-                return s;
-            }
-            sleep_hybrid(i);
+        // 空きがない場合は、フレームが解放されるのを待つ
+        // スレッド実行時は停止フラグを一定間隔で確認しながら待機する
+        const uint64_t waitStart = RGYOpenCLPerfCollector::instance().isPipelineTraceEnabled() ? rgy_perf_trace_now_ns() : 0;
+        bool waited = false;
+        PipelineTaskSurface s = m_workSurfs.waitFreeSurf(RGY_WAIT_INTERVAL, m_pipelineStop, &waited);
+        if (waitStart && waited) { // 空きを待った場合のみ記録する
+            RGYOpenCLPerfCollector::instance().recordPipelineEvent((tchar_to_string(print()) + " getWorkSurf wait").c_str(), waitStart, rgy_perf_trace_now_ns(), -1);
+        }
+        if (s != nullptr) {
+            return s;
         }
         PrintMes(RGY_LOG_ERROR, _T("getWorkSurf:   Failed to get work surface, all %d frames used.\n"), m_workSurfs.bufCount());
         return PipelineTaskSurface();
@@ -711,6 +969,7 @@ public:
     }
 
     void setOutputMaxQueueSize(int size) { m_outMaxQueueSize = size; }
+    void setPipelineStopFlag(const std::atomic<bool> *stop) { m_pipelineStop = stop; }
     void setMaxWorkSurfaceSize(const RGYFrameInfo& maxFrame) {
         m_maxWorkSurfWidth = maxFrame.width;
         m_maxWorkSurfHeight = maxFrame.height;
@@ -904,12 +1163,15 @@ protected:
     bool m_decOutFrameEOS;    // デコーダからの出力Frame側でEOSを検知
     bool m_abort;
     int m_decOutFrames;
+    bool m_frameIdFromBitstream; // --trim-smart, --trimでのseek: リーダーの設定したフレーム番号を使用する
+    std::unordered_map<int64_t, int> m_frameIdMap; // pts -> フレーム番号
+    int m_frameIdUnknownDropped; // m_frameIdMapにないptsのため破棄したフレーム数
 public:
     PipelineTaskMPPDecode(MPPContext *dec, int outMaxQueueSize, RGYInput *input, bool adjustTimestamp, std::shared_ptr<RGYLog> log)
         : PipelineTask(PipelineTaskType::MPPDEC, outMaxQueueSize, log), m_dec(dec), m_input(input),
         m_decInputBitstream(RGYBitstreamInit()), m_frameGrp(), m_initialWidth(0), m_initialHeight(0), m_canFollowResolutionChange(false), m_adjustTimestamp(adjustTimestamp),
         m_firstBitstreamTimestamp(AV_NOPTS_VALUE), m_firstFrameTimestamp(AV_NOPTS_VALUE), m_queueTimestamp(), m_queueTimestampWrap(), m_queueHDR10plusMetadata(), m_dataFlag(),
-        m_decInBitStreamEOS(false), m_decOutFrameEOS(false), m_abort(false), m_decOutFrames(0) {
+        m_decInBitStreamEOS(false), m_decOutFrameEOS(false), m_abort(false), m_decOutFrames(0), m_frameIdFromBitstream(false), m_frameIdMap(), m_frameIdUnknownDropped(0) {
         m_queueHDR10plusMetadata.init(256);
         m_dataFlag.init();
     };
@@ -923,6 +1185,7 @@ public:
     };
     void setDec(MPPContext *dec) { m_dec = dec; };
     void setCanFollowResolutionChange(bool enable) { m_canFollowResolutionChange = enable; };
+    void setFrameIdFromBitstream(bool enable) { m_frameIdFromBitstream = enable; };
     virtual bool abort() { m_abort = true; return true; }; // 中断指示を受け取ったらtrueを返す
 
     virtual std::optional<std::pair<RGYFrameInfo, int>> requiredSurfIn() override { return std::nullopt; };
@@ -1086,6 +1349,9 @@ public:
             if (eos || ret == RGY_ERR_MORE_BITSTREAM) {
                 PrintMes(RGY_LOG_DEBUG, _T("Received a eos frame.\n"));
                 m_decOutFrameEOS = true;
+                if (m_frameIdUnknownDropped > 0) {
+                    PrintMes(RGY_LOG_WARN, _T("%d decoded frames were dropped, as their pts did not match any input packet.\n"), m_frameIdUnknownDropped);
+                }
                 ret = RGY_ERR_MORE_BITSTREAM; // EOS
             }
         }
@@ -1118,6 +1384,12 @@ public:
             PrintMes(RGY_LOG_ERROR, _T("Error on getting video bitstream: %s.\n"), get_err_mes(ret));
             return ret;
         } else {
+            if (m_frameIdFromBitstream) {
+                if (m_decInputBitstream.size() == 0) {
+                    return RGY_ERR_NONE; // コピーに回したGOPのみで、デコードするものはなかった
+                }
+                m_frameIdMap[m_decInputBitstream.pts()] = m_decInputBitstream.frameIdx();
+            }
             for (auto& frameData : m_decInputBitstream.getFrameDataList()) {
                 if (frameData->dataType() == RGY_FRAME_DATA_HDR10PLUS) {
                     auto ptr = dynamic_cast<RGYFrameDataHDR10plus*>(frameData);
@@ -1225,10 +1497,25 @@ protected:
             flags |= RGY_FRAME_FLAG_RFF_BFF;
         }
 
+        int inputFrameId = m_decOutFrames;
+        if (m_frameIdFromBitstream) {
+            // --trim-smart: コピーしたGOPの分、--trimでのseek: seekで飛ばした分、フレーム番号は飛ぶ
+            auto it = m_frameIdMap.find(timestamp);
+            if (it == m_frameIdMap.end()) {
+                //デコーダが入力と異なるptsを返すと、すべてのフレームが破棄されてしまうので、警告を出す
+                PrintMes(RGY_LOG_WARN, _T("setOutputSurf: unknown pts %lld, dropping frame.\n"), timestamp);
+                m_frameIdUnknownDropped++;
+                return RGY_ERR_NONE;
+            }
+            inputFrameId = it->second;
+            m_frameIdMap.erase(it);
+        }
+        m_decOutFrames++;
+
         std::unique_ptr<RGYFrame> outSurf = std::make_unique<RGYFrameMpp>(mppframe, duration, flags);
         mppframe = nullptr;
         outSurf->setTimestamp(timestamp);
-        outSurf->setInputFrameId(m_decOutFrames++);
+        outSurf->setInputFrameId(inputFrameId);
 
         //mppframeのインタレはちゃんと設定されてない場合があるので、auto以外の時は入力設定で上書きする
         const auto inputFrameInfo = m_input->GetInputFrameInfo();
@@ -1320,15 +1607,21 @@ protected:
     int64_t m_tsPrev;         //(m_outputTimebase基準)
     uint32_t m_inputFramePosIdx;
     FramePosList *m_framePosList;
+    std::shared_ptr<RGYSmartCut> m_smartCut; // --trim-smart
     static const int64_t INVALID_PTS = AV_NOPTS_VALUE;
 public:
     PipelineTaskCheckPTS(rgy_rational<int> srcTimebase, rgy_rational<int> streamTimebase, rgy_rational<int> outputTimebase, int64_t outFrameDuration, RGYAVSync avsync, bool timestampPassThrough, bool vpp_afs_rff_aware, FramePosList *framePosList, std::shared_ptr<RGYLog> log) :
         PipelineTask(PipelineTaskType::CHECKPTS, /*outMaxQueueSize = */ 0 /*常に0である必要がある*/, log),
         m_srcTimebase(srcTimebase), m_streamTimebase(streamTimebase), m_outputTimebase(outputTimebase), m_avsync(avsync), m_timestampPassThrough(timestampPassThrough), m_vpp_rff(false), m_vpp_afs_rff_aware(vpp_afs_rff_aware), m_outFrameDuration(outFrameDuration),
-        m_tsOutFirst(INVALID_PTS), m_tsOutEstimated(0), m_tsPrev(-1), m_inputFramePosIdx(std::numeric_limits<decltype(m_inputFramePosIdx)>::max()), m_framePosList(framePosList) {
+        m_tsOutFirst(INVALID_PTS), m_tsOutEstimated(0), m_tsPrev(-1), m_inputFramePosIdx(std::numeric_limits<decltype(m_inputFramePosIdx)>::max()), m_framePosList(framePosList), m_smartCut() {
     };
     virtual ~PipelineTaskCheckPTS() {};
 
+    void setSmartCut(std::shared_ptr<RGYSmartCut> smartCut) {
+        m_smartCut = smartCut;
+        m_tsOutFirst = 0; // 出力でのフレーム位置からptsを決めるので、先頭のptsによる補正は行わない
+    }
+
     virtual bool isPassThrough() const override {
         // そのまま渡すのでpaththrough
         return true;
@@ -1352,6 +1645,11 @@ public:
             PrintMes(RGY_LOG_ERROR, _T("Invalid frame type: failed to cast to PipelineTaskOutputSurf.\n"));
             return RGY_ERR_UNSUPPORTED;
         }
+        if (m_smartCut) {
+            // --trim-smart: コピーしたGOPのフレームも含めた、出力でのフレーム位置からptsを決める
+            m_tsOutEstimated = m_smartCut->outputFrameIndex(taskSurf->surf().frame()->inputFrameId()) * m_outFrameDuration;
+            outPtsSource = m_tsOutEstimated;
+        }
 
         if ((m_srcTimebase.n() > 0 && m_srcTimebase.is_valid())
             && ((m_avsync & (RGY_AVSYNC_VFR | RGY_AVSYNC_FORCE_CFR)) || m_vpp_rff || m_vpp_afs_rff_aware || m_timestampPassThrough)) {
@@ -1785,6 +2083,23 @@ protected:
     const RGYHDR10Plus *m_hdr10plus;
     const DOVIRpu *m_doviRpu;
     std::unique_ptr<RGYConvertCSP> m_convert;
+    std::shared_ptr<RGYSmartCut> m_smartCut; // --trim-smart
+    int64_t m_smartCutFrameDuration;  // (m_outputTimebase基準)
+    int64_t m_smartCutLastFrameId;    // 直前にエンコーダに投入したフレーム番号
+    int m_smartCutEncodedFrames;      // エンコーダから出力したフレーム数
+
+    // 色空間・解像度・各planeのpitchが一致していれば、変換なしにそのままコピーできる
+    static bool sameFrameLayout(const RGYFrameInfo& src, const RGYFrameInfo& dst) {
+        if (src.csp != dst.csp || src.width != dst.width || src.height != dst.height) {
+            return false;
+        }
+        for (int iplane = 0; iplane < RGY_CSP_PLANES[src.csp]; iplane++) {
+            if (getPlane(&src, (RGY_PLANE)iplane).pitch[0] != getPlane(&dst, (RGY_PLANE)iplane).pitch[0]) {
+                return false;
+            }
+        }
+        return true;
+    }
 public:
     PipelineTaskMPPEncode(
         MPPContext *enc, RGY_CODEC encCodec, MPPCfg& encParams, int outMaxQueueSize,
@@ -1793,7 +2108,8 @@ public:
         : PipelineTask(PipelineTaskType::MPPENC, outMaxQueueSize, log),
         m_encoder(enc), m_encCodec(encCodec), m_encParams(encParams), m_timecode(timecode), m_encTimestamp(encTimestamp), m_outputTimebase(outputTimebase),
         m_sentEOSFrame(false), m_frameGrp(nullptr), m_buffer(), m_queueFrameList(),
-        m_bitStreamOut(), m_hdr10plus(hdr10plus), m_doviRpu(doviRpu), m_convert(std::make_unique<RGYConvertCSP>(threadCsp, threadParamCsp)) {
+        m_bitStreamOut(), m_hdr10plus(hdr10plus), m_doviRpu(doviRpu), m_convert(std::make_unique<RGYConvertCSP>(threadCsp, threadParamCsp)),
+        m_smartCut(), m_smartCutFrameDuration(0), m_smartCutLastFrameId(-1), m_smartCutEncodedFrames(0) {
         for (auto& buf : m_buffer) {
             buf.frame = nullptr;
             buf.pkt = nullptr;
@@ -1819,10 +2135,56 @@ public:
         }
     };
     void setEnc(MPPContext *encode) { m_encoder = encode; };
+    void setSmartCut(std::shared_ptr<RGYSmartCut> smartCut, int64_t frameDuration) {
+        m_smartCut = smartCut;
+        m_smartCutFrameDuration = frameDuration;
+    }
 
     virtual std::optional<std::pair<RGYFrameInfo, int>> requiredSurfIn() override {
         return std::make_pair(m_encParams.frameinfo(), 8);
     }
+
+    virtual std::vector<std::unique_ptr<PipelineTaskOutput>> getOutput(const bool sync) override {
+        if (m_smartCut) {
+            // エンコーダへの入力がなくても、出力可能になったコピーするGOPを出力する
+            auto err = pushSmartCutCopyGops(-1, false);
+            if (err != RGY_ERR_NONE) {
+                PrintMes(RGY_LOG_ERROR, _T("Failed to output copied gop: %s.\n"), get_err_mes(err));
+            }
+        }
+        return PipelineTask::getOutput(sync);
+    }
+
+    // --trim-smart: 出力可能になったコピーするGOPを、エンコード結果の間に表示順で入るよう出力キューに追加する
+    RGY_ERR pushSmartCutCopyGops(const int64_t nextFrameId, const bool flush) {
+        while (auto gop = m_smartCut->popCopyGop(m_smartCutEncodedFrames, nextFrameId, flush)) {
+            int maxFrameIdx = -1;
+            for (size_t i = 0; i < gop->pkts.size(); i++) {
+                const auto& pkt = gop->pkts[i];
+                const int frameIdx = gop->pktFrameIdx[i];
+                auto output = m_bitStreamOut.get([](RGYBitstream *bs) {
+                    *bs = RGYBitstreamInit();
+                    return 0;
+                });
+                if (!output) {
+                    return RGY_ERR_NULL_PTR;
+                }
+                const auto pts = m_smartCut->outputFrameIndex(frameIdx) * m_smartCutFrameDuration;
+                auto err = output->copy(pkt->data, pkt->size, pts, 0, m_smartCutFrameDuration);
+                if (err != RGY_ERR_NONE) {
+                    return err;
+                }
+                // 表示順で前のフレームより前に来るものはBフレームとみなす (統計表示用)
+                output->setFrametype((i == 0) ? (RGY_FRAMETYPE_IDR | RGY_FRAMETYPE_I) : ((frameIdx < maxFrameIdx) ? RGY_FRAMETYPE_B : RGY_FRAMETYPE_P));
+                output->setDataflag(RGY_FRAME_FLAG_BITSTREAM_COPY);
+                output->setFrameIdx(frameIdx);
+                maxFrameIdx = std::max(maxFrameIdx, frameIdx);
+                m_outQeueue.push_back(std::make_unique<PipelineTaskOutputBitstream>(output, frameIdx));
+            }
+            PrintMes(RGY_LOG_DEBUG, _T("Copied gop %d-%d.\n"), gop->frameStart, gop->frameStart + gop->frames - 1);
+        }
+        return RGY_ERR_NONE;
+    }
     virtual std::optional<std::pair<RGYFrameInfo, int>> requiredSurfOut() override { return std::nullopt; };
 
     RGY_ERR allocateMppBuffer() {
@@ -1860,16 +2222,16 @@ public:
         return RGY_ERR_NONE;
     }
 
-    std::tuple<RGY_ERR, std::shared_ptr<RGYBitstream>> getOutputBitstream() {
+    std::tuple<RGY_ERR, std::shared_ptr<RGYBitstream>, int64_t> getOutputBitstream() {
         MppPacket packet = nullptr;
         auto err = err_to_rgy(m_encoder->mpi->encode_get_packet(m_encoder->ctx, &packet));
         PrintMes(m_sentEOSFrame ? RGY_LOG_DEBUG : RGY_LOG_TRACE, _T("encode_get_packet: %s, %s.\n"), packet ? _T("yes") : _T("null"), get_err_mes(err));
         if (err == RGY_ERR_MPP_ERR_TIMEOUT || !packet) {
             std::this_thread::sleep_for(std::chrono::milliseconds(1));
-            return { RGY_ERR_MORE_SURFACE, nullptr };
+            return { RGY_ERR_MORE_SURFACE, nullptr, -1 };
         } else if (err != RGY_ERR_NONE) {
             PrintMes(RGY_LOG_ERROR, _T("Failed to get packet from encoder: %s\n"), get_err_mes(err));
-            return { err, nullptr };
+            return { err, nullptr, -1 };
         }
 
         auto output = m_bitStreamOut.get([](RGYBitstream *bs) {
@@ -1877,7 +2239,7 @@ public:
             return 0;
         });
         if (!output) {
-            return { RGY_ERR_NULL_PTR, nullptr };
+            return { RGY_ERR_NULL_PTR, nullptr, -1 };
         }
         const bool eos = mpp_packet_get_eos(packet);
         if (eos) {
@@ -1885,7 +2247,7 @@ public:
         }
         const auto pktLength = mpp_packet_get_length(packet);
         if (pktLength == 0) {
-            return { eos ? RGY_ERR_MORE_DATA : RGY_ERR_NONE, nullptr };
+            return { eos ? RGY_ERR_MORE_DATA : RGY_ERR_NONE, nullptr, -1 };
         }
         const auto pts = mpp_packet_get_pts(packet);
         const auto pktval = m_encTimestamp->get(pts);
@@ -1910,7 +2272,7 @@ public:
             }
         }
         mpp_packet_deinit(&packet);
-        return { eos ? RGY_ERR_MORE_DATA : RGY_ERR_NONE, output };
+        return { eos ? RGY_ERR_MORE_DATA : RGY_ERR_NONE, output, pktval.inputFrameId };
     }
 
     virtual RGY_ERR sendFrame(std::unique_ptr<PipelineTaskOutput>& frame) override {
@@ -1971,6 +2333,7 @@ public:
 
         bool mppframeeos = false;
         MppFrame mppframe = nullptr;
+        int64_t inputFrameId = -1;
         if (!frame || !dynamic_cast<PipelineTaskOutputSurf *>(frame.get())->surf()) { // 終了フラグ
             auto err = err_to_rgy(mpp_frame_init(&mppframe));
             if (err != RGY_ERR_NONE) {
@@ -1989,6 +2352,7 @@ public:
         } else {
             auto& surfIn = dynamic_cast<PipelineTaskOutputSurf *>(frame.get())->surf();
             auto surfInFrame = surfIn.frame();
+            inputFrameId = surfInFrame->inputFrameId();
             if (m_timecode) {
                 m_timecode->write(surfInFrame->timestamp(), m_outputTimebase);
             }
@@ -2073,11 +2437,20 @@ public:
                             RGY_CSP_NAMES[func->csp_from], RGY_CSP_NAMES[func->csp_to], get_simd_str(func->simd));
                     }
                 }
-                auto crop = initCrop();
-                m_convert->run((mppinfo.picstruct & RGY_PICSTRUCT_INTERLACED) ? 1 : 0,
-                    (void **)mppinfo.ptr, (const void **)surfEncInInfo.ptr,
-                    surfEncInInfo.width, surfEncInInfo.pitch[0], surfEncInInfo.pitch[1], mppinfo.pitch[0], mppinfo.pitch[1],
-                    surfEncInInfo.height, mppinfo.height, crop.c);
+                if (sameFrameLayout(surfEncInInfo, mppinfo)) {
+                    // OpenCL側をエンコーダの入力と同じpitchで確保している場合、planeごとにまとめてコピーすればよい
+                    for (int iplane = 0; iplane < RGY_CSP_PLANES[surfEncInInfo.csp]; iplane++) {
+                        const auto planeSrc = getPlane(&surfEncInInfo, (RGY_PLANE)iplane);
+                        const auto planeDst = getPlane(&mppinfo, (RGY_PLANE)iplane);
+                        memcpy(planeDst.ptr[0], planeSrc.ptr[0], (size_t)planeSrc.pitch[0] * planeSrc.height);
+                    }
+                } else {
+                    auto crop = initCrop();
+                    m_convert->run((mppinfo.picstruct & RGY_PICSTRUCT_INTERLACED) ? 1 : 0,
+                        (void **)mppinfo.ptr, (const void **)surfEncInInfo.ptr,
+                        surfEncInInfo.width, surfEncInInfo.pitch[0], surfEncInInfo.pitch[1], mppinfo.pitch[0], mppinfo.pitch[1],
+                        surfEncInInfo.height, mppinfo.height, crop.c);
+                }
                     
                 if (auto clframe = dynamic_cast<PipelineTaskOutputSurf *>(frame.get())->surf().cl(); clframe != nullptr) {
                     clframe->unmapBuffer();
@@ -2116,20 +2489,47 @@ public:
                 }
             }
         }
+        // --trim-smart: コピーしたGOPの直後は、前のフレームを参照できないのでIDRとする
+        if (!mppframeeos && m_smartCut) {
+            if (m_smartCut->copiedBetween(m_smartCutLastFrameId, inputFrameId)) {
+                auto idr_ret = err_to_rgy(m_encoder->mpi->control(m_encoder->ctx, MPP_ENC_SET_IDR_FRAME, nullptr));
+                if (idr_ret != RGY_ERR_NONE) {
+                    PrintMes(RGY_LOG_ERROR, _T("Failed to force IDR frame after copied gop at frame %lld: %s.\n"), inputFrameId, get_err_mes(idr_ret));
+                    return idr_ret;
+                }
+                PrintMes(RGY_LOG_DEBUG, _T("Forced IDR frame after copied gop at frame %lld.\n"), inputFrameId);
+            }
+            m_smartCutLastFrameId = inputFrameId;
+        }
 
         auto err = RGY_ERR_NONE;
         bool sendFrame = false;
         do {
             //エンコーダからの取り出し
             PrintMes(RGY_LOG_TRACE, _T("getOutputBitstream %d.\n"), m_inFrames);
-            auto [out_ret, outBs] = getOutputBitstream();
+            auto [out_ret, outBs, outFrameId] = getOutputBitstream();
             if (out_ret == RGY_ERR_MORE_SURFACE) {
                 err = out_ret; // もっとエンコーダへの投入が必要
             } else if (out_ret == RGY_ERR_NONE || out_ret == RGY_ERR_MORE_DATA) {
                 if (outBs && outBs->size() > 0) {
-                    m_outQeueue.push_back(std::make_unique<PipelineTaskOutputBitstream>(outBs));
+                    if (m_smartCut) {
+                        // 表示順でこのフレームより前にあるコピーするGOPを先に出力する
+                        if (auto copy_ret = pushSmartCutCopyGops(outFrameId, false); copy_ret != RGY_ERR_NONE) {
+                            err = copy_ret;
+                            break;
+                        }
+                        outBs->setDuration(m_smartCutFrameDuration);
+                        m_smartCutEncodedFrames++;
+                    }
+                    m_outQeueue.push_back(std::make_unique<PipelineTaskOutputBitstream>(outBs, outFrameId));
                 }
                 if (out_ret == RGY_ERR_MORE_DATA) { //EOF
+                    if (m_smartCut) {
+                        if (auto copy_ret = pushSmartCutCopyGops(-1, true); copy_ret != RGY_ERR_NONE) {
+                            err = copy_ret;
+                            break;
+                        }
+                    }
                     err = RGY_ERR_MORE_DATA;
                     break;
                 }
@@ -2895,5 +3295,142 @@ public:
     }
 };
 
+// --renditionの追加出力ごとの処理 (リサイズ等のOpenCLフィルタ→エンコード→出力)
+struct PipelineRenditionBranch {
+    std::unique_ptr<PipelineTask> vpp;
+    std::unique_ptr<PipelineTask> enc;
+    RGYOutput *writer;
+};
+
+// 入力されたフレームをそのまま後段(メインのエンコーダ)に渡しつつ、各追加出力の処理に分岐させる
+// 分岐側の処理はこのタスクの中で同期的に行い、フレームは全ての分岐で使用し終わってから後段に渡す
+class PipelineTaskRenditions : public PipelineTask {
+protected:
+    std::shared_ptr<RGYOpenCLContext> m_cl;
+    std::vector<PipelineRenditionBranch> m_branches;
+public:
+    PipelineTaskRenditions(std::vector<PipelineRenditionBranch>& branches, std::shared_ptr<RGYOpenCLContext> cl, int outMaxQueueSize, std::shared_ptr<RGYLog> log) :
+        PipelineTask(PipelineTaskType::RENDITIONS, outMaxQueueSize, log), m_cl(cl), m_branches(std::move(branches)) {
+    };
+    virtual ~PipelineTaskRenditions() {
+        // 分岐側がこのタスクの作業サーフェスを参照している場合があるので、先に解放する
+        for (auto& branch : m_branches) {
+            branch.enc.reset();
+            branch.vpp.reset();
+        }
+        m_branches.clear();
+        m_cl.reset();
+    };
+
+    std::vector<PipelineRenditionBranch>& branches() { return m_branches; }
+
+    virtual bool isPassThrough() const override { return true; }
+    virtual std::optional<std::pair<RGYFrameInfo, int>> requiredSurfIn() override { return std::nullopt; };
+    virtual std::optional<std::pair<RGYFrameInfo, int>> requiredSurfOut() override { return std::nullopt; };
+
+    virtual RGY_ERR sendFrame(std::unique_ptr<PipelineTaskOutput>& frame) override {
+        if (!frame) {
+            for (auto& branch : m_branches) {
+                auto err = flushBranch(branch);
+                if (err != RGY_ERR_NONE) {
+                    return err;
+                }
+            }
+            return RGY_ERR_MORE_DATA;
+        }
+        auto taskSurf = dynamic_cast<PipelineTaskOutputSurf *>(frame.get());
+        if (taskSurf == nullptr) {
+            PrintMes(RGY_LOG_ERROR, _T("Invalid task surface.\n"));
+            return RGY_ERR_NULL_PTR;
+        }
+        // 分岐側にはOpenCLのフレームを渡す
+        PipelineTaskSurface surfBranchIn;
+        if (taskSurf->surf().cl() != nullptr) {
+            surfBranchIn = taskSurf->surf();
+        } else if (auto surfInMpp = taskSurf->surf().mpp(); surfInMpp != nullptr) {
+            // MPPのフレームはここで一度だけOpenCLのバッファに転送し、全ての分岐で共有する
+            surfBranchIn = getWorkSurf();
+            if (surfBranchIn == nullptr || !surfBranchIn.cl()) {
+                PrintMes(RGY_LOG_ERROR, _T("failed to get work surface for renditions.\n"));
+                return RGY_ERR_NOT_ENOUGH_BUFFER;
+            }
+            auto mppInInfoCopy = surfInMpp->getInfoCopy();
+            RGYOpenCLEvent clevent;
+            auto err = m_cl->copyFrame(&surfBranchIn.cl()->frame, &mppInInfoCopy, nullptr, m_cl->queue(), &clevent);
+            if (err != RGY_ERR_NONE) {
+                PrintMes(RGY_LOG_ERROR, _T("Failed to copy frame to OpenCL buffer for renditions: %s.\n"), get_err_mes(err));
+                return err;
+            }
+            // メインのエンコーダがMppFrameを引き取る前に、転送の完了を待つようにする
+            taskSurf->addClEvent(clevent);
+        } else {
+            PrintMes(RGY_LOG_ERROR, _T("Invalid task surface (not opencl or mpp).\n"));
+            return RGY_ERR_NULL_PTR;
+        }
+        for (auto& branch : m_branches) {
+            std::unique_ptr<PipelineTaskOutput> branchFrame = std::make_unique<PipelineTaskOutputSurf>(surfBranchIn);
+            auto err = branch.vpp->sendFrame(branchFrame);
+            if (err != RGY_ERR_NONE) {
+                return err;
+            }
+            // 出力を取り出す際に分岐側のOpenCLの処理の完了を待つので、以降はこのフレームを参照しない
+            err = encodeBranchOutput(branch);
+            if (err != RGY_ERR_NONE) {
+                return err;
+            }
+        }
+        m_outQeueue.push_back(std::move(frame));
+        return RGY_ERR_NONE;
+    }
+protected:
+    RGY_ERR writeBranchOutput(PipelineRenditionBranch& branch) {
+        for (auto& bs : branch.enc->getOutput(true)) {
+            auto err = bs->write(branch.writer, nullptr, nullptr);
+            if (err != RGY_ERR_NONE) {
+                PrintMes(RGY_LOG_ERROR, _T("Failed to write rendition output: %s.\n"), get_err_mes(err));
+                return err;
+            }
+        }
+        return RGY_ERR_NONE;
+    }
+    RGY_ERR encodeBranchOutput(PipelineRenditionBranch& branch) {
+        for (auto& surf : branch.vpp->getOutput(true)) {
+            auto err = branch.enc->sendFrame(surf);
+            if (err != RGY_ERR_NONE) {
+                return err;
+            }
+            err = writeBranchOutput(branch);
+            if (err != RGY_ERR_NONE) {
+                return err;
+            }
+        }
+        return RGY_ERR_NONE;
+    }
+    RGY_ERR flushBranch(PipelineRenditionBranch& branch) {
+        auto err = RGY_ERR_NONE;
+        do {
+            std::unique_ptr<PipelineTaskOutput> drain;
+            err = branch.vpp->sendFrame(drain);
+            if (err != RGY_ERR_NONE && err != RGY_ERR_MORE_DATA) {
+                return err;
+            }
+            if (auto sts = encodeBranchOutput(branch); sts != RGY_ERR_NONE) {
+                return sts;
+            }
+        } while (err == RGY_ERR_NONE);
+        do {
+            std::unique_ptr<PipelineTaskOutput> drain;
+            err = branch.enc->sendFrame(drain);
+            if (err != RGY_ERR_NONE && err != RGY_ERR_MORE_DATA) {
+                return err;
+            }
+            if (auto sts = writeBranchOutput(branch); sts != RGY_ERR_NONE) {
+                return sts;
+            }
+        } while (err == RGY_ERR_NONE);
+        return RGY_ERR_NONE;
+    }
+};
+
 #endif //__MPP_PIPELINE_H__
 
@@ -0,0 +1,60 @@
+﻿// -----------------------------------------------------------------------------------------
+//     rkmppenc by rigaya
+// -----------------------------------------------------------------------------------------
+// The MIT License
+//
+// Copyright (c) 2014-2017 rigaya
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// IABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// ------------------------------------------------------------------------------------------
+
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <chrono>
+
+// librockchip_mpp / librga の代わりにリンクするCPU実装 (mpp_sw_mpi.cpp, mpp_sw_rga.cpp)
+// VPUのない環境でパイプライン全体(デコード→フィルタ→エンコード→mux)の処理速度を計測するためのもの
+// meson setup -Dmpp_backend=sw でビルドした場合のみ使用される
+//
+// 以下の環境変数で動作を調整できる
+//   RKMPPENC_SW_MPP_DEC_LATENCY : デコーダの1フレームあたりの処理時間 (ms, 既定 0)
+//   RKMPPENC_SW_MPP_ENC_LATENCY : エンコーダの1フレームあたりの処理時間 (ms, 既定 0)
+//   RKMPPENC_SW_MPP_RGA_LATENCY : RGA/IEPの1回あたりの処理時間 (ms, 既定 0)
+//   RKMPPENC_SW_MPP_DEC_THREADS : デコードに使用するlibavcodecのスレッド数 (既定 0 = 自動)
+//   RKMPPENC_SW_MPP_ENC_MODE    : pcm  ... 全フレームをI_PCMで出力 (既定)
+//                                 skip ... IDRのみI_PCM、それ以外はP_Skipで出力
+// エンコーダはH.264のみ対応。出力はデコード可能だが、圧縮は行わない
+
+struct MPPSwConfig {
+    double decLatencyMs;
+    double encLatencyMs;
+    double rgaLatencyMs;
+    int    decThreads;
+    bool   encSkip;
+};
+
+const MPPSwConfig& mpp_sw_config();
+
+// prevから指定した時間が経過するまで待機する (HWの処理時間の模擬)
+void mpp_sw_wait_latency(const std::chrono::steady_clock::time_point& prev, const double latencyMs);
+
+// mpp_buffer_get で確保したバッファのfdから、CPUでアクセス可能なアドレスを取得する (RGA/IEP用)
+void *mpp_sw_buffer_ptr_from_fd(const int fd, size_t *size);
@@ -0,0 +1,1655 @@
+﻿// -----------------------------------------------------------------------------------------
+//     rkmppenc by rigaya
+// -----------------------------------------------------------------------------------------
+// The MIT License
+//
+// Copyright (c) 2014-2017 rigaya
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// IABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// ------------------------------------------------------------------------------------------
+
+// librockchip_mpp の代わりにリンクするCPU実装
+// - MppBuffer は memfd で確保し、RGA/IEP(mpp_sw_rga.cpp)からfd経由で参照できるようにする
+// - デコーダは libavcodec で復号し、NV12 で出力する
+// - エンコーダは H.264 の I_PCM (+P_Skip) で出力する
+// - デコーダ/エンコーダは専用スレッドで動作し、HWと同様に非同期で入出力を行う
+
+#include <cstring>
+#include <cstdlib>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <deque>
+#include <vector>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "rgy_util.h"
+#include "rgy_avutil.h"
+#include "mpp_util.h"
+#include "mpp_sw_backend.h"
+#include "rk_mpi.h"
+#include "rk_vdec_cfg.h"
+#include "mpp_soc.h"
+#include "mpp_platform.h"
+
+static const size_t MPP_SW_QUEUE_SIZE = 4; // HWに投入可能なフレーム/パケット数
+
+static double mpp_sw_env_ms(const char *name) {
+    const auto value = std::getenv(name);
+    if (value == nullptr || value[0] == '\0') {
+        return 0.0;
+    }
+    return std::max(std::atof(value), 0.0);
+}
+
+const MPPSwConfig& mpp_sw_config() {
+    static const MPPSwConfig config = []() {
+        MPPSwConfig prm;
+        prm.decLatencyMs = mpp_sw_env_ms("RKMPPENC_SW_MPP_DEC_LATENCY");
+        prm.encLatencyMs = mpp_sw_env_ms("RKMPPENC_SW_MPP_ENC_LATENCY");
+        prm.rgaLatencyMs = mpp_sw_env_ms("RKMPPENC_SW_MPP_RGA_LATENCY");
+        const auto threads = std::getenv("RKMPPENC_SW_MPP_DEC_THREADS");
+        prm.decThreads = (threads) ? std::max(std::atoi(threads), 0) : 0;
+        const auto mode = std::getenv("RKMPPENC_SW_MPP_ENC_MODE");
+        prm.encSkip = mode && strcmp(mode, "skip") == 0;
+        return prm;
+    }();
+    return config;
+}
+
+void mpp_sw_wait_latency(const std::chrono::steady_clock::time_point& prev, const double latencyMs) {
+    if (latencyMs > 0.0) {
+        std::this_thread::sleep_until(prev + std::chrono::microseconds((int64_t)(latencyMs * 1000.0)));
+    }
+}
+
+//---------------------------------------------------------------------------------
+// MppBuffer
+//---------------------------------------------------------------------------------
+struct MPPSwBufferGroup;
+
+struct MPPSwBuffer {
+    std::atomic<int> ref;
+    MPPSwBufferGroup *group;
+    int generation; // 確保時のgroupのgeneration (mpp_buffer_group_clear 前のバッファは再利用しない)
+    int fd;
+    void *ptr;
+    size_t size;
+    int index;
+};
+
+struct MPPSwBufferGroup {
+    std::mutex mtx;
+    MppBufferType type;
+    MppBufferMode mode;
+    size_t limitSize;
+    int limitCount;
+    int allocated; // groupから確保されたバッファ数 (使用中 + 未使用)
+    int generation;
+    bool released; // mpp_buffer_group_put 済み
+    std::vector<MPPSwBuffer *> unused;
+};
+
+static std::mutex g_mppSwFdMapMtx;
+static std::unordered_map<int, MPPSwBuffer *> g_mppSwFdMap;
+
+void *mpp_sw_buffer_ptr_from_fd(const int fd, size_t *size) {
+    std::lock_guard<std::mutex> lock(g_mppSwFdMapMtx);
+    auto it = g_mppSwFdMap.find(fd);
+    if (it == g_mppSwFdMap.end()) {
+        return nullptr;
+    }
+    if (size) {
+        *size = it->second->size;
+    }
+    return it->second->ptr;
+}
+
+static MPPSwBuffer *mpp_sw_buffer_alloc(const size_t size) {
+    // RGA/IEPからfdで参照されるので、memfdで確保する
+    const int fd = memfd_create("rkmppenc_sw_mpp", MFD_CLOEXEC);
+    if (fd < 0) {
+        return nullptr;
+    }
+    if (ftruncate(fd, size) != 0) {
+        close(fd);
+        return nullptr;
+    }
+    void *ptr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (ptr == MAP_FAILED) {
+        close(fd);
+        return nullptr;
+    }
+    static std::atomic<int> bufferIndex(0);
+    auto buf = new MPPSwBuffer();
+    buf->ref = 0;
+    buf->group = nullptr;
+    buf->generation = 0;
+    buf->fd = fd;
+    buf->ptr = ptr;
+    buf->size = size;
+    buf->index = bufferIndex++;
+    {
+        std::lock_guard<std::mutex> lock(g_mppSwFdMapMtx);
+        g_mppSwFdMap[fd] = buf;
+    }
+    return buf;
+}
+
+static void mpp_sw_buffer_free(MPPSwBuffer *buf) {
+    {
+        std::lock_guard<std::mutex> lock(g_mppSwFdMapMtx);
+        g_mppSwFdMap.erase(buf->fd);
+    }
+    munmap(buf->ptr, buf->size);
+    close(buf->fd);
+    delete buf;
+}
+
+// 参照カウントが0になったバッファをgroupに返却する
+static void mpp_sw_buffer_release(MPPSwBuffer *buf) {
+    auto group = buf->group;
+    if (group == nullptr) {
+        mpp_sw_buffer_free(buf);
+        return;
+    }
+    std::unique_lock<std::mutex> lock(group->mtx);
+    if (!group->released && buf->generation == group->generation) {
+        group->unused.push_back(buf);
+        return;
+    }
+    group->allocated--;
+    const bool deleteGroup = group->released && group->allocated == 0;
+    lock.unlock();
+    mpp_sw_buffer_free(buf);
+    if (deleteGroup) {
+        delete group;
+    }
+}
+
+MPP_RET mpp_buffer_group_get(MppBufferGroup *group, MppBufferType type, MppBufferMode mode, const char *tag, const char *caller) {
+    if (group == nullptr) {
+        return MPP_ERR_NULL_PTR;
+    }
+    auto grp = new MPPSwBufferGroup();
+    grp->type = type;
+    grp->mode = mode;
+    grp->limitSize = 0;
+    grp->limitCount = 0;
+    grp->allocated = 0;
+    grp->generation = 0;
+    grp->released = false;
+    *group = grp;
+    return MPP_OK;
+}
+
+MPP_RET mpp_buffer_group_put(MppBufferGroup group) {
+    if (group == nullptr) {
+        return MPP_ERR_NULL_PTR;
+    }
+    auto grp = (MPPSwBufferGroup *)group;
+    std::vector<MPPSwBuffer *> unused;
+    bool deleteGroup = false;
+    {
+        std::lock_guard<std::mutex> lock(grp->mtx);
+        grp->released = true;
+        unused.swap(grp->unused);
+        grp->allocated -= (int)unused.size();
+        // 使用中のバッファがあれば、すべて返却されたときに削除する
+        deleteGroup = grp->allocated == 0;
+    }
+    for (auto buf : unused) {
+        mpp_sw_buffer_free(buf);
+    }
+    if (deleteGroup) {
+        delete grp;
+    }
+    return MPP_OK;
+}
+
+MPP_RET mpp_buffer_group_clear(MppBufferGroup group) {
+    if (group == nullptr) {
+        return MPP_ERR_NULL_PTR;
+    }
+    auto grp = (MPPSwBufferGroup *)group;
+    std::vector<MPPSwBuffer *> unused;
+    {
+        std::lock_guard<std::mutex> lock(grp->mtx);
+        unused.swap(grp->unused);
+        grp->allocated -= (int)unused.size();
+        grp->generation++;
+    }
+    for (auto buf : unused) {
+        mpp_sw_buffer_free(buf);
+    }
+    return MPP_OK;
+}
+
+MPP_RET mpp_buffer_group_limit_config(MppBufferGroup group, size_t size, RK_S32 count) {
+    if (group == nullptr) {
+        return MPP_ERR_NULL_PTR;
+    }
+    auto grp = (MPPSwBufferGroup *)group;
+    std::lock_guard<std::mutex> lock(grp->mtx);
+    grp->limitSize = size;
+    grp->limitCount = count;
+    return MPP_OK;
+}
+
+MPP_RET mpp_buffer_get_with_tag(MppBufferGroup group, MppBuffer *buffer, size_t size, const char *tag, const char *caller) {
+    if (group == nullptr || buffer == nullptr || size == 0) {
+        return MPP_ERR_NULL_PTR;
+    }
+    auto grp = (MPPSwBufferGroup *)group;
+    MPPSwBuffer *buf = nullptr;
+    std::vector<MPPSwBuffer *> freeList;
+    {
+        std::lock_guard<std::mutex> lock(grp->mtx);
+        for (auto it = grp->unused.begin(); it != grp->unused.end(); it++) {
+            if ((*it)->size >= size) {
+                buf = *it;
+                grp->unused.erase(it);
+                break;
+            }
+        }
+        if (buf == nullptr) {
+            // 上限に達している場合は、サイズの合わない未使用バッファを解放して確保し直す
+            while (grp->limitCount > 0 && grp->allocated >= grp->limitCount && !grp->unused.empty()) {
+                freeList.push_back(grp->unused.back());
+                grp->unused.pop_back();
+                grp->allocated--;
+            }
+            if (grp->limitCount > 0 && grp->allocated >= grp->limitCount) {
+                return MPP_NOK; // 空きがない
+            }
+            buf = mpp_sw_buffer_alloc(std::max(size, grp->limitSize));
+            if (buf == nullptr) {
+                return MPP_ERR_MALLOC;
+            }
+            buf->group = grp;
+            buf->generation = grp->generation;
+            grp->allocated++;
+        }
+    }
+    for (auto b : freeList) {
+        mpp_sw_buffer_free(b);
+    }
+    buf->ref = 1;
+    *buffer = buf;
+    return MPP_OK;
+}
+
+MPP_RET mpp_buffer_put_with_caller(MppBuffer buffer, const char *caller) {
+    if (buffer == nullptr) {
+        return MPP_ERR_NULL_PTR;
+    }
+    auto buf = (MPPSwBuffer *)buffer;
+    if (--buf->ref == 0) {
+        mpp_sw_buffer_release(buf);
+    }
+    return MPP_OK;
+}
+
+MPP_RET mpp_buffer_inc_ref_with_caller(MppBuffer buffer, const char *caller) {
+    if (buffer == nullptr) {
+        return MPP_ERR_NULL_PTR;
+    }
+    ((MPPSwBuffer *)buffer)->ref++;
+    return MPP_OK;
+}
+
+void *mpp_buffer_get_ptr_with_caller(MppBuffer buffer, const char *caller) {
+    return (buffer) ? ((MPPSwBuffer *)buffer)->ptr : nullptr;
+}
+
+int mpp_buffer_get_fd_with_caller(MppBuffer buffer, const char *caller) {
+    return (buffer) ? ((MPPSwBuffer *)buffer)->fd : -1;
+}
+
+size_t mpp_buffer_get_size_with_caller(MppBuffer buffer, const char *caller) {
+    return (buffer) ? ((MPPSwBuffer *)buffer)->size : 0;
+}
+
+int mpp_buffer_get_index_with_caller(MppBuffer buffer, const char *caller) {
+    return (buffer) ? ((MPPSwBuffer *)buffer)->index : -1;
+}
+
+//---------------------------------------------------------------------------------
+// MppMeta
+//---------------------------------------------------------------------------------
+enum class MPPSwMetaType {
+    S32,
+    S64,
+    PTR,
+    FRAME,
+    PACKET,
+    BUFFER,
+};
+
+struct MPPSwMetaValue {
+    MPPSwMetaType type;
+    RK_S64 val;
+    void *ptr;
+};
+
+struct MPPSwMeta {
+    std::map<int, MPPSwMetaValue> values;
+};
+
+static MPP_RET mpp_sw_meta_set(MppMeta meta, MppMetaKey key, MPPSwMetaType type, RK_S64 val, void *ptr) {
+    if (meta == nullptr) {
+        return MPP_ERR_NULL_PTR;
+    }
+    MPPSwMetaValue value;
+    value.type = type;
+    value.val = val;
+    value.ptr = ptr;
+    ((MPPSwMeta *)meta)->values[(int)key] = value;
+    return MPP_OK;
+}
+
+static MPP_RET mpp_sw_meta_get(MppMeta meta, MppMetaKey key, MPPSwMetaType type, MPPSwMetaValue *value) {
+    if (meta == nullptr || value == nullptr) {
+        return MPP_ERR_NULL_PTR;
+    }
+    auto& values = ((MPPSwMeta *)meta)->values;
+    auto it = values.find((int)key);
+    if (it == values.end() || it->second.type != type) {
+        return MPP_NOK;
+    }
+    *value = it->second;
+    // frame/packet/bufferは取得した側に所有権が移る
+    if (type == MPPSwMetaType::FRAME || type == MPPSwMetaType::PACKET || type == MPPSwMetaType::BUFFER) {
+        values.erase(it);
+    }
+    return MPP_OK;
+}
+
+MPP_RET mpp_meta_get_with_tag(MppMeta *meta, const char *tag, const char *caller) {
+    if (meta == nullptr) {
+        return MPP_ERR_NULL_PTR;
+    }
+    *meta = new MPPSwMeta();
+    return MPP_OK;
+}
+
+MPP_RET mpp_meta_put(MppMeta meta) {
+    if (meta == nullptr) {
+        return MPP_ERR_NULL_PTR;
+    }
+    auto p = (MPPSwMeta *)meta;
+    // 取り出されなかったframe/packet/bufferは、ここで解放する
+    for (auto& [key, value] : p->values) {
+        if (value.type == MPPSwMetaType::FRAME) {
+            MppFrame frame = value.ptr;
+            mpp_frame_deinit(&frame);
+        } else if (value.type == MPPSwMetaType::PACKET) {
+            MppPacket packet = value.ptr;
+            mpp_packet_deinit(&packet);
+        } else if (value.type == MPPSwMetaType::BUFFER) {
+            mpp_buffer_put(value.ptr);
+        }
+    }
+    delete p;
+    return MPP_OK;
+}
+
+RK_S32 mpp_meta_size(MppMeta meta) {
+    return (meta) ? (RK_S32)((MPPSwMeta *)meta)->values.size() : 0;
+}
+
+MPP_RET mpp_meta_set_s32(MppMeta meta, MppMetaKey key, RK_S32 val) {
+    return mpp_sw_meta_set(meta, key, MPPSwMetaType::S32, val, nullptr);
+}
+
+MPP_RET mpp_meta_set_s64(MppMeta meta, MppMetaKey key, RK_S64 val) {
+    return mpp_sw_meta_set(meta, key, MPPSwMetaType::S64, val, nullptr);
+}
+
+MPP_RET mpp_meta_set_ptr(MppMeta meta, MppMetaKey key, void *val) {
+    return mpp_sw_meta_set(meta, key, MPPSwMetaType::PTR, 0, val);
+}
+
+MPP_RET mpp_meta_set_frame(MppMeta meta, MppMetaKey key, MppFrame frame) {
+    return mpp_sw_meta_set(meta, key, MPPSwMetaType::FRAME, 0, frame);
+}
+
+MPP_RET mpp_meta_set_packet(MppMeta meta, MppMetaKey key, MppPacket packet) {
+    return mpp_sw_meta_set(meta, key, MPPSwMetaType::PACKET, 0, packet);
+}
+
+MPP_RET mpp_meta_set_buffer(MppMeta meta, MppMetaKey key, MppBuffer buffer) {
+    return mpp_sw_meta_set(meta, key, MPPSwMetaType::BUFFER, 0, buffer);
+}
+
+MPP_RET mpp_meta_get_s32(MppMeta meta, MppMetaKey key, RK_S32 *val) {
+    MPPSwMetaValue value;
+    auto ret = mpp_sw_meta_get(meta, key, MPPSwMetaType::S32, &value);
+    if (ret == MPP_OK && val) *val = (RK_S32)value.val;
+    return ret;
+}
+
+MPP_RET mpp_meta_get_s64(MppMeta meta, MppMetaKey key, RK_S64 *val) {
+    MPPSwMetaValue value;
+    auto ret = mpp_sw_meta_get(meta, key, MPPSwMetaType::S64, &value);
+    if (ret == MPP_OK && val) *val = value.val;
+    return ret;
+}
+
+MPP_RET mpp_meta_get_ptr(MppMeta meta, MppMetaKey key, void **val) {
+    MPPSwMetaValue value;
+    auto ret = mpp_sw_meta_get(meta, key, MPPSwMetaType::PTR, &value);
+    if (ret == MPP_OK && val) *val = value.ptr;
+    return ret;
+}
+
+MPP_RET mpp_meta_get_frame(MppMeta meta, MppMetaKey key, MppFrame *frame) {
+    MPPSwMetaValue value;
+    auto ret = mpp_sw_meta_get(meta, key, MPPSwMetaType::FRAME, &value);
+    if (ret == MPP_OK && frame) *frame = value.ptr;
+    return ret;
+}
+
+MPP_RET mpp_meta_get_packet(MppMeta meta, MppMetaKey key, MppPacket *packet) {
+    MPPSwMetaValue value;
+    auto ret = mpp_sw_meta_get(meta, key, MPPSwMetaType::PACKET, &value);
+    if (ret == MPP_OK && packet) *packet = value.ptr;
+    return ret;
+}
+
+MPP_RET mpp_meta_get_buffer(MppMeta meta, MppMetaKey key, MppBuffer *buffer) {
+    MPPSwMetaValue value;
+    auto ret = mpp_sw_meta_get(meta, key, MPPSwMetaType::BUFFER, &value);
+    if (ret == MPP_OK && buffer) *buffer = value.ptr;
+    return ret;
+}
+
+//---------------------------------------------------------------------------------
+// MppFrame
+//---------------------------------------------------------------------------------
+struct MPPSwFrame {
+    RK_U32 width;
+    RK_U32 height;
+    RK_U32 hor_stride;
+    RK_U32 ver_stride;
+    RK_U32 offset_x;
+    RK_U32 offset_y;
+    RK_U32 mode;
+    RK_U32 discard;
+    RK_U32 poc;
+    RK_U32 errinfo;
+    RK_U32 eos;
+    RK_U32 info_change;
+    RK_S64 pts;
+    RK_S64 dts;
+    size_t buf_size;
+    MppFrameFormat fmt;
+    MppBuffer buffer;
+    MppMeta meta;
+};
+
+MPP_RET mpp_frame_init(MppFrame *frame) {
+    if (frame == nullptr) {
+        return MPP_ERR_NULL_PTR;
+    }
+    auto p = new MPPSwFrame();
+    memset(p, 0, sizeof(*p));
+    p->mode = MPP_FRAME_FLAG_FRAME;
+    p->fmt = MPP_FMT_YUV420SP;
+    *frame = p;
+    return MPP_OK;
+}
+
+MPP_RET mpp_frame_deinit(MppFrame *frame) {
+    if (frame == nullptr || *frame == nullptr) {
+        return MPP_ERR_NULL_PTR;
+    }
+    auto p = (MPPSwFrame *)*frame;
+    if (p->buffer) {
+        mpp_buffer_put(p->buffer);
+    }
+    if (p->meta) {
+        mpp_meta_put(p->meta);
+    }
+    delete p;
+    *frame = nullptr;
+    return MPP_OK;
+}
+
+#define MPP_SW_FRAME_ACCESSOR(type, name) \
+    type mpp_frame_get_##name(const MppFrame frame) { return ((MPPSwFrame *)frame)->name; } \
+    void mpp_frame_set_##name(MppFrame frame, type name) { ((MPPSwFrame *)frame)->name = name; }
+
+MPP_SW_FRAME_ACCESSOR(RK_U32, width)
+MPP_SW_FRAME_ACCESSOR(RK_U32, height)
+MPP_SW_FRAME_ACCESSOR(RK_U32, hor_stride)
+MPP_SW_FRAME_ACCESSOR(RK_U32, ver_stride)
+MPP_SW_FRAME_ACCESSOR(RK_U32, offset_x)
+MPP_SW_FRAME_ACCESSOR(RK_U32, offset_y)
+MPP_SW_FRAME_ACCESSOR(RK_U32, mode)
+MPP_SW_FRAME_ACCESSOR(RK_U32, discard)
+MPP_SW_FRAME_ACCESSOR(RK_U32, poc)
+MPP_SW_FRAME_ACCESSOR(RK_U32, errinfo)
+MPP_SW_FRAME_ACCESSOR(RK_U32, eos)
+MPP_SW_FRAME_ACCESSOR(RK_U32, info_change)
+MPP_SW_FRAME_ACCESSOR(RK_S64, pts)
+MPP_SW_FRAME_ACCESSOR(RK_S64, dts)
+MPP_SW_FRAME_ACCESSOR(size_t, buf_size)
+
+#undef MPP_SW_FRAME_ACCESSOR
+
+MppFrameFormat mpp_frame_get_fmt(MppFrame frame) {
+    return ((MPPSwFrame *)frame)->fmt;
+}
+
+void mpp_frame_set_fmt(MppFrame frame, MppFrameFormat fmt) {
+    ((MPPSwFrame *)frame)->fmt = fmt;
+}
+
+MppBuffer mpp_frame_get_buffer(const MppFrame frame) {
+    return ((MPPSwFrame *)frame)->buffer;
+}
+
+void mpp_frame_set_buffer(MppFrame frame, MppBuffer buffer) {
+    auto p = (MPPSwFrame *)frame;
+    if (p->buffer == buffer) {
+        return;
+    }
+    if (buffer) {
+        mpp_buffer_inc_ref(buffer);
+    }
+    if (p->buffer) {
+        mpp_buffer_put(p->buffer);
+    }
+    p->buffer = buffer;
+}
+
+RK_S32 mpp_frame_has_meta(const MppFrame frame) {
+    return ((MPPSwFrame *)frame)->meta != nullptr;
+}
+
+MppMeta mpp_frame_get_meta(const MppFrame frame) {
+    auto p = (MPPSwFrame *)frame;
+    if (p->meta == nullptr) {
+        mpp_meta_get(&p->meta);
+    }
+    return p->meta;
+}
+
+void mpp_frame_set_meta(MppFrame frame, MppMeta meta) {
+    auto p = (MPPSwFrame *)frame;
+    if (p->meta && p->meta != meta) {
+        mpp_meta_put(p->meta);
+    }
+    p->meta = meta;
+}
+
+// 情報(バッファの参照を含む)をコピーした新しいフレームを作成する
+static MppFrame mpp_sw_frame_copy(MppFrame src) {
+    MppFrame frame = nullptr;
+    if (mpp_frame_init(&frame) != MPP_OK) {
+        return nullptr;
+    }
+    auto p = (MPPSwFrame *)frame;
+    *p = *(MPPSwFrame *)src;
+    p->meta = nullptr;
+    if (p->buffer) {
+        mpp_buffer_inc_ref(p->buffer);
+    }
+    return frame;
+}
+
+//---------------------------------------------------------------------------------
+// MppPacket
+//---------------------------------------------------------------------------------
+struct MPPSwPacket {
+    void *data;
+    size_t size;
+    void *pos;
+    size_t length;
+    RK_S64 pts;
+    RK_S64 dts;
+    RK_U32 flag;
+    RK_U32 eos;
+    MppBuffer buffer;
+    MppMeta meta;
+    std::vector<uint8_t> owned; // エンコーダの出力など、パケット自身が持つデータ
+};
+
+MPP_RET mpp_packet_new(MppPacket *packet) {
+    if (packet == nullptr) {
+        return MPP_ERR_NULL_PTR;
+    }
+    auto p = new MPPSwPacket();
+    p->data = nullptr;
+    p->size = 0;
+    p->pos = nullptr;
+    p->length = 0;
+    p->pts = 0;
+    p->dts = 0;
+    p->flag = 0;
+    p->eos = 0;
+    p->buffer = nullptr;
+    p->meta = nullptr;
+    *packet = p;
+    return MPP_OK;
+}
+
+MPP_RET mpp_packet_init(MppPacket *packet, void *data, size_t size) {
+    auto ret = mpp_packet_new(packet);
+    if (ret != MPP_OK) {
+        return ret;
+    }
+    auto p = (MPPSwPacket *)*packet;
+    p->data = data;
+    p->pos = data;
+    p->size = size;
+    p->length = size;
+    return MPP_OK;
+}
+
+MPP_RET mpp_packet_init_with_buffer(MppPacket *packet, MppBuffer buffer) {
+    if (buffer == nullptr) {
+        return MPP_ERR_NULL_PTR;
+    }
+    auto ret = mpp_packet_init(packet, mpp_buffer_get_ptr(buffer), mpp_buffer_get_size(buffer));
+    if (ret != MPP_OK) {
+        return ret;
+    }
+    mpp_packet_set_buffer(*packet, buffer);
+    return MPP_OK;
+}
+
+MPP_RET mpp_packet_deinit(MppPacket *packet) {
+    if (packet == nullptr || *packet == nullptr) {
+        return MPP_ERR_NULL_PTR;
+    }
+    auto p = (MPPSwPacket *)*packet;
+    if (p->buffer) {
+        mpp_buffer_put(p->buffer);
+    }
+    if (p->meta) {
+        mpp_meta_put(p->meta);
+    }
+    delete p;
+    *packet = nullptr;
+    return MPP_OK;
+}
+
+#define MPP_SW_PACKET_ACCESSOR(type, name) \
+    type mpp_packet_get_##name(const MppPacket packet) { return ((MPPSwPacket *)packet)->name; } \
+    void mpp_packet_set_##name(MppPacket packet, type name) { ((MPPSwPacket *)packet)->name = name; }
+
+MPP_SW_PACKET_ACCESSOR(void *, data)
+MPP_SW_PACKET_ACCESSOR(size_t, size)
+MPP_SW_PACKET_ACCESSOR(void *, pos)
+MPP_SW_PACKET_ACCESSOR(size_t, length)
+MPP_SW_PACKET_ACCESSOR(RK_S64, pts)
+MPP_SW_PACKET_ACCESSOR(RK_S64, dts)
+MPP_SW_PACKET_ACCESSOR(RK_U32, flag)
+
+#undef MPP_SW_PACKET_ACCESSOR
+
+MPP_RET mpp_packet_set_eos(MppPacket packet) {
+    ((MPPSwPacket *)packet)->eos = 1;
+    return MPP_OK;
+}
+
+MPP_RET mpp_packet_clr_eos(MppPacket packet) {
+    ((MPPSwPacket *)packet)->eos = 0;
+    return MPP_OK;
+}
+
+RK_U32 mpp_packet_get_eos(MppPacket packet) {
+    return ((MPPSwPacket *)packet)->eos;
+}
+
+void mpp_packet_set_buffer(MppPacket packet, MppBuffer buffer) {
+    auto p = (MPPSwPacket *)packet;
+    if (p->buffer == buffer) {
+        return;
+    }
+    if (buffer) {
+        mpp_buffer_inc_ref(buffer);
+    }
+    if (p->buffer) {
+        mpp_buffer_put(p->buffer);
+    }
+    p->buffer = buffer;
+}
+
+MppBuffer mpp_packet_get_buffer(const MppPacket packet) {
+    return ((MPPSwPacket *)packet)->buffer;
+}
+
+RK_S32 mpp_packet_has_meta(const MppPacket packet) {
+    return ((MPPSwPacket *)packet)->meta != nullptr;
+}
+
+MppMeta mpp_packet_get_meta(const MppPacket packet) {
+    auto p = (MPPSwPacket *)packet;
+    if (p->meta == nullptr) {
+        mpp_meta_get(&p->meta);
+    }
+    return p->meta;
+}
+
+//---------------------------------------------------------------------------------
+// MppDecCfg
+//---------------------------------------------------------------------------------
+struct MPPSwDecCfg {
+    std::map<std::string, RK_U64> values;
+};
+
+MPP_RET mpp_dec_cfg_init(MppDecCfg *cfg) {
+    if (cfg == nullptr) {
+        return MPP_ERR_NULL_PTR;
+    }
+    *cfg = new MPPSwDecCfg();
+    return MPP_OK;
+}
+
+MPP_RET mpp_dec_cfg_deinit(MppDecCfg cfg) {
+    if (cfg == nullptr) {
+        return MPP_ERR_NULL_PTR;
+    }
+    delete (MPPSwDecCfg *)cfg;
+    return MPP_OK;
+}
+
+MPP_RET mpp_dec_cfg_set_u32(MppDecCfg cfg, const char *name, RK_U32 val) {
+    if (cfg == nullptr || name == nullptr) {
+        return MPP_ERR_NULL_PTR;
+    }
+    ((MPPSwDecCfg *)cfg)->values[name] = val;
+    return MPP_OK;
+}
+
+MPP_RET mpp_dec_cfg_get_u32(MppDecCfg cfg, const char *name, RK_U32 *val) {
+    if (cfg == nullptr || name == nullptr || val == nullptr) {
+        return MPP_ERR_NULL_PTR;
+    }
+    auto& values = ((MPPSwDecCfg *)cfg)->values;
+    auto it = values.find(name);
+    *val = (it != values.end()) ? (RK_U32)it->second : 0;
+    return MPP_OK;
+}
+
+//---------------------------------------------------------------------------------
+// デコーダ/エンコーダ共通
+//---------------------------------------------------------------------------------
+class MPPSwCodec {
+public:
+    MPPSwCodec() : m_thread(), m_mtx(), m_cv(), m_abort(false), m_lastOutput() {};
+    virtual ~MPPSwCodec() {};
+    virtual MPP_RET init(MppCodingType coding) = 0;
+    virtual void close() = 0;
+    virtual MPP_RET putPacket(MppPacket packet) { return MPP_ERR_PERM; }
+    virtual MPP_RET getFrame(MppFrame *frame) { return MPP_ERR_PERM; }
+    virtual MPP_RET putFrame(MppFrame frame) { return MPP_ERR_PERM; }
+    virtual MPP_RET getPacket(MppPacket *packet) { return MPP_ERR_PERM; }
+    virtual MPP_RET control(MpiCmd cmd, MppParam param) = 0;
+    virtual MPP_RET reset() = 0;
+protected:
+    void startThread() {
+        m_abort = false;
+        m_lastOutput = std::chrono::steady_clock::now();
+        m_thread = std::thread([this]() { run(); });
+    }
+    void stopThread() {
+        {
+            std::lock_guard<std::mutex> lock(m_mtx);
+            m_abort = true;
+        }
+        m_cv.notify_all();
+        if (m_thread.joinable()) {
+            m_thread.join();
+        }
+    }
+    virtual void run() = 0;
+
+    std::thread m_thread;
+    std::mutex m_mtx;
+    std::condition_variable m_cv;
+    bool m_abort;
+    std::chrono::steady_clock::time_point m_lastOutput; // 前回出力した時刻 (HWの処理時間の模擬用)
+};
+
+//---------------------------------------------------------------------------------
+// デコーダ (libavcodec)
+//---------------------------------------------------------------------------------
+class MPPSwDecoder : public MPPSwCodec {
+public:
+    MPPSwDecoder() : MPPSwCodec(), m_codec(nullptr), m_avctx(nullptr), m_frame(nullptr),
+        m_inQueue(), m_outQueue(), m_extGroup(nullptr), m_infoChangeReady(false), m_width(0), m_height(0), m_eosQueued(false) {};
+    virtual ~MPPSwDecoder() { close(); }
+
+    virtual MPP_RET init(MppCodingType coding) override {
+        m_codec = avcodec_find_decoder(getAVCodecId(codec_dec_to_rgy(coding)));
+        if (m_codec == nullptr) {
+            return MPP_ERR_INIT;
+        }
+        auto ret = openDecoder();
+        if (ret != MPP_OK) {
+            return ret;
+        }
+        startThread();
+        return MPP_OK;
+    }
+    virtual void close() override {
+        stopThread();
+        clearQueue();
+        if (m_frame) {
+            av_frame_free(&m_frame);
+        }
+        if (m_avctx) {
+            avcodec_free_context(&m_avctx);
+        }
+    }
+    virtual MPP_RET putPacket(MppPacket packet) override {
+        if (packet == nullptr) {
+            return MPP_ERR_NULL_PTR;
+        }
+        // HWと同様に、投入されたデータはコピーして保持する
+        AVPacket *pkt = nullptr;
+        const auto length = mpp_packet_get_length(packet);
+        if (!mpp_packet_get_eos(packet) || length > 0) {
+            pkt = av_packet_alloc();
+            if (pkt == nullptr || av_new_packet(pkt, (int)length) < 0) {
+                av_packet_free(&pkt);
+                return MPP_ERR_MALLOC;
+            }
+            memcpy(pkt->data, mpp_packet_get_pos(packet), length);
+            pkt->pts = mpp_packet_get_pts(packet);
+        }
+        {
+            std::lock_guard<std::mutex> lock(m_mtx);
+            if (m_inQueue.size() >= MPP_SW_QUEUE_SIZE) {
+                av_packet_free(&pkt);
+                return MPP_ERR_BUFFER_FULL;
+            }
+            m_inQueue.push_back(pkt);
+            if (mpp_packet_get_eos(packet)) {
+                if (pkt) {
+                    m_inQueue.push_back(nullptr); // nullptrはEOS
+                }
+                m_eosQueued = true;
+            }
+        }
+        m_cv.notify_all();
+        return MPP_OK;
+    }
+    virtual MPP_RET getFrame(MppFrame *frame) override {
+        if (frame == nullptr) {
+            return MPP_ERR_NULL_PTR;
+        }
+        *frame = nullptr;
+        std::unique_lock<std::mutex> lock(m_mtx);
+        if (m_outQueue.empty() && m_eosQueued) {
+            // EOS送信後は呼び出し側がフレームを回収し続けるので、少し待機する
+            m_cv.wait_for(lock, std::chrono::milliseconds(1), [this]() { return !m_outQueue.empty(); });
+        }
+        if (!m_outQueue.empty()) {
+            *frame = m_outQueue.front();
+            m_outQueue.pop_front();
+        }
+        return MPP_OK;
+    }
+    virtual MPP_RET control(MpiCmd cmd, MppParam param) override {
+        switch (cmd) {
+        case MPP_DEC_SET_EXT_BUF_GROUP: {
+            std::lock_guard<std::mutex> lock(m_mtx);
+            m_extGroup = (MppBufferGroup)param;
+        } break;
+        case MPP_DEC_SET_INFO_CHANGE_READY: {
+            {
+                std::lock_guard<std::mutex> lock(m_mtx);
+                m_infoChangeReady = true;
+            }
+            m_cv.notify_all();
+        } break;
+        default:
+            break;
+        }
+        return MPP_OK;
+    }
+    virtual MPP_RET reset() override {
+        stopThread();
+        clearQueue();
+        if (m_avctx) {
+            avcodec_flush_buffers(m_avctx);
+        }
+        m_eosQueued = false;
+        startThread();
+        return MPP_OK;
+    }
+protected:
+    MPP_RET openDecoder() {
+        m_avctx = avcodec_alloc_context3(m_codec);
+        m_frame = av_frame_alloc();
+        if (m_avctx == nullptr || m_frame == nullptr) {
+            return MPP_ERR_MALLOC;
+        }
+        m_avctx->thread_count = mpp_sw_config().decThreads;
+        if (avcodec_open2(m_avctx, m_codec, nullptr) < 0) {
+            return MPP_ERR_INIT;
+        }
+        return MPP_OK;
+    }
+    void clearQueue() {
+        for (auto pkt : m_inQueue) {
+            av_packet_free(&pkt);
+        }
+        m_inQueue.clear();
+        for (auto frame : m_outQueue) {
+            mpp_frame_deinit(&frame);
+        }
+        m_outQueue.clear();
+    }
+    void pushOutput(MppFrame frame) {
+        {
+            std::lock_guard<std::mutex> lock(m_mtx);
+            m_outQueue.push_back(frame);
+        }
+        m_cv.notify_all();
+    }
+    virtual void run() override {
+        for (;;) {
+            AVPacket *pkt = nullptr;
+            {
+                std::unique_lock<std::mutex> lock(m_mtx);
+                m_cv.wait(lock, [this]() { return m_abort || !m_inQueue.empty(); });
+                if (m_abort) {
+                    return;
+                }
+                pkt = m_inQueue.front();
+                m_inQueue.pop_front();
+            }
+            const bool eos = pkt == nullptr;
+            int ret = 0;
+            while ((ret = avcodec_send_packet(m_avctx, pkt)) == AVERROR(EAGAIN)) {
+                if (!receiveFrames()) {
+                    av_packet_free(&pkt);
+                    return;
+                }
+            }
+            av_packet_free(&pkt);
+            if (!receiveFrames()) {
+                return;
+            }
+            if (eos) {
+                MppFrame frame = nullptr;
+                mpp_frame_init(&frame);
+                mpp_frame_set_eos(frame, 1);
+                pushOutput(frame);
+            }
+        }
+    }
+    // 復号済みのフレームをすべて取り出す
+    bool receiveFrames() {
+        while (avcodec_receive_frame(m_avctx, m_frame) == 0) {
+            const bool ret = outputFrame(m_frame);
+            av_frame_unref(m_frame);
+            if (!ret) {
+                return false;
+            }
+        }
+        return true;
+    }
+    bool outputFrame(const AVFrame *src) {
+        const bool yuv420p = src->format == AV_PIX_FMT_YUV420P || src->format == AV_PIX_FMT_YUVJ420P;
+        const bool nv12 = src->format == AV_PIX_FMT_NV12;
+        MppFrame frame = nullptr;
+        mpp_frame_init(&frame);
+        if (!yuv420p && !nv12) {
+            // 8bit 4:2:0 以外には対応しない
+            mpp_frame_set_errinfo(frame, 1);
+            pushOutput(frame);
+            return true;
+        }
+        const int hor_stride = ALIGN(src->width, 16);
+        const int ver_stride = ALIGN(src->height, 16);
+        const size_t buf_size = (size_t)hor_stride * ver_stride * 3 / 2;
+        mpp_frame_set_width(frame, src->width);
+        mpp_frame_set_height(frame, src->height);
+        mpp_frame_set_hor_stride(frame, hor_stride);
+        mpp_frame_set_ver_stride(frame, ver_stride);
+        mpp_frame_set_buf_size(frame, buf_size);
+        mpp_frame_set_fmt(frame, MPP_FMT_YUV420SP);
+        if (src->width != m_width || src->height != m_height) {
+            // 解像度が決まった/変わったら、info_changeを通知してバッファの設定を待つ
+            MppFrame infoChange = mpp_sw_frame_copy(frame);
+            mpp_frame_set_info_change(infoChange, 1);
+            std::unique_lock<std::mutex> lock(m_mtx);
+            m_infoChangeReady = false;
+            m_outQueue.push_back(infoChange);
+            m_cv.notify_all();
+            m_cv.wait(lock, [this]() { return m_abort || m_infoChangeReady; });
+            if (m_abort) {
+                lock.unlock();
+                mpp_frame_deinit(&frame);
+                return false;
+            }
+            m_width = src->width;
+            m_height = src->height;
+        }
+        MppBuffer buffer = nullptr;
+        for (;;) {
+            MppBufferGroup group = nullptr;
+            {
+                std::lock_guard<std::mutex> lock(m_mtx);
+                if (m_abort) {
+                    mpp_frame_deinit(&frame);
+                    return false;
+                }
+                group = m_extGroup;
+            }
+            if (group && mpp_buffer_get(group, &buffer, buf_size) == MPP_OK) {
+                break;
+            }
+            // 呼び出し側がフレームを返却するのを待つ
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        uint8_t *dstY = (uint8_t *)mpp_buffer_get_ptr(buffer);
+        uint8_t *dstC = dstY + (size_t)hor_stride * ver_stride;
+        for (int y = 0; y < src->height; y++) {
+            memcpy(dstY + (size_t)y * hor_stride, src->data[0] + (size_t)y * src->linesize[0], src->width);
+        }
+        for (int y = 0; y < (src->height + 1) / 2; y++) {
+            uint8_t *dst = dstC + (size_t)y * hor_stride;
+            if (nv12) {
+                memcpy(dst, src->data[1] + (size_t)y * src->linesize[1], ALIGN(src->width, 2));
+            } else {
+                const uint8_t *srcU = src->data[1] + (size_t)y * src->linesize[1];
+                const uint8_t *srcV = src->data[2] + (size_t)y * src->linesize[2];
+                for (int x = 0; x < (src->width + 1) / 2; x++) {
+                    dst[x * 2 + 0] = srcU[x];
+                    dst[x * 2 + 1] = srcV[x];
+                }
+            }
+        }
+        mpp_frame_set_buffer(frame, buffer);
+        mpp_buffer_put(buffer);
+        mpp_frame_set_pts(frame, (src->pts != AV_NOPTS_VALUE) ? src->pts : src->best_effort_timestamp);
+        mpp_frame_set_mode(frame, picstruct_rgy_to_enc(picstruct_avframe_to_rgy(src)));
+
+        mpp_sw_wait_latency(m_lastOutput, mpp_sw_config().decLatencyMs);
+        m_lastOutput = std::chrono::steady_clock::now();
+        pushOutput(frame);
+        return true;
+    }
+
+    const AVCodec *m_codec;
+    AVCodecContext *m_avctx;
+    AVFrame *m_frame;
+    std::deque<AVPacket *> m_inQueue;
+    std::deque<MppFrame> m_outQueue;
+    MppBufferGroup m_extGroup;
+    bool m_infoChangeReady;
+    int m_width;
+    int m_height;
+    bool m_eosQueued;
+};
+
+//---------------------------------------------------------------------------------
+// エンコーダ (H.264 I_PCM / P_Skip)
+//---------------------------------------------------------------------------------
+class MPPSwBitWriter {
+public:
+    MPPSwBitWriter() : m_buf(), m_cache(0), m_bits(0) {};
+    void put(uint32_t val, int bits) {
+        for (int i = bits - 1; i >= 0; i--) {
+            m_cache = (m_cache << 1) | ((val >> i) & 1);
+            if (++m_bits == 8) {
+                m_buf.push_back((uint8_t)m_cache);
+                m_cache = 0;
+                m_bits = 0;
+            }
+        }
+    }
+    void ue(uint32_t val) {
+        const uint32_t v = val + 1;
+        int len = 0;
+        while ((v >> (len + 1)) != 0) len++;
+        put(0, len);
+        put(v, len + 1);
+    }
+    void se(int32_t val) {
+        ue((val > 0) ? (uint32_t)(val * 2 - 1) : (uint32_t)(-val * 2));
+    }
+    void alignZero() {
+        if (m_bits) put(0, 8 - m_bits);
+    }
+    void trailing() {
+        put(1, 1);
+        alignZero();
+    }
+    // バイト境界にいることが前提
+    uint8_t *reserveBytes(size_t size) {
+        const auto offset = m_buf.size();
+        m_buf.resize(offset + size);
+        return m_buf.data() + offset;
+    }
+    void reserve(size_t size) { m_buf.reserve(size); }
+    const std::vector<uint8_t>& data() const { return m_buf; }
+protected:
+    std::vector<uint8_t> m_buf;
+    uint32_t m_cache;
+    int m_bits;
+};
+
+class MPPSwEncoder : public MPPSwCodec {
+protected:
+    struct InputFrame {
+        MppFrame frame;
+        bool idr;
+    };
+    static const int LOG2_MAX_FRAME_NUM = 4;
+    static const int NAL_SLICE = 1;
+    static const int NAL_IDR = 5;
+    static const int NAL_SPS = 7;
+    static const int NAL_PPS = 8;
+public:
+    MPPSwEncoder() : MPPSwCodec(), m_inQueue(), m_outQueue(), m_prep(), m_gop(0), m_headerMode(MPP_ENC_HEADER_MODE_DEFAULT),
+        m_forceIDR(false), m_encFrames(0), m_framesSinceIDR(0), m_frameNum(0), m_idrPicId(0), m_headerSent(false), m_encWidth(0), m_encHeight(0) {
+        memset(&m_prep, 0, sizeof(m_prep));
+    };
+    virtual ~MPPSwEncoder() { close(); }
+
+    virtual MPP_RET init(MppCodingType coding) override {
+        if (coding != MPP_VIDEO_CodingAVC) {
+            return MPP_ERR_INIT;
+        }
+        startThread();
+        return MPP_OK;
+    }
+    virtual void close() override {
+        stopThread();
+        clearQueue();
+    }
+    virtual MPP_RET putFrame(MppFrame frame) override {
+        if (frame == nullptr) {
+            return MPP_ERR_NULL_PTR;
+        }
+        {
+            std::lock_guard<std::mutex> lock(m_mtx);
+            if (m_inQueue.size() >= MPP_SW_QUEUE_SIZE) {
+                return MPP_ERR_BUFFER_FULL;
+            }
+            InputFrame input;
+            input.frame = mpp_sw_frame_copy(frame);
+            input.idr = m_forceIDR;
+            m_forceIDR = false;
+            m_inQueue.push_back(input);
+        }
+        m_cv.notify_all();
+        return MPP_OK;
+    }
+    virtual MPP_RET getPacket(MppPacket *packet) override {
+        if (packet == nullptr) {
+            return MPP_ERR_NULL_PTR;
+        }
+        *packet = nullptr;
+        std::lock_guard<std::mutex> lock(m_mtx);
+        if (!m_outQueue.empty()) {
+            *packet = m_outQueue.front();
+            m_outQueue.pop_front();
+        }
+        return MPP_OK;
+    }
+    virtual MPP_RET control(MpiCmd cmd, MppParam param) override {
+        std::lock_guard<std::mutex> lock(m_mtx);
+        switch (cmd) {
+        case MPP_ENC_SET_PREP_CFG:
+            if (param == nullptr) return MPP_ERR_NULL_PTR;
+            m_prep = *(MppEncPrepCfg *)param;
+            break;
+        case MPP_ENC_SET_RC_CFG:
+            if (param == nullptr) return MPP_ERR_NULL_PTR;
+            m_gop = ((MppEncRcCfg *)param)->gop;
+            break;
+        case MPP_ENC_SET_HEADER_MODE:
+            if (param == nullptr) return MPP_ERR_NULL_PTR;
+            m_headerMode = *(MppEncHeaderMode *)param;
+            break;
+        case MPP_ENC_SET_IDR_FRAME:
+            m_forceIDR = true;
+            break;
+        case MPP_ENC_GET_HDR_SYNC: {
+            if (param == nullptr) return MPP_ERR_NULL_PTR;
+            std::vector<uint8_t> header;
+            writeHeader(header, m_prep);
+            auto packet = (MppPacket)param;
+            if (mpp_packet_get_size(packet) < header.size()) {
+                return MPP_ERR_BUFFER_FULL;
+            }
+            memcpy(mpp_packet_get_data(packet), header.data(), header.size());
+            mpp_packet_set_pos(packet, mpp_packet_get_data(packet));
+            mpp_packet_set_length(packet, header.size());
+        } break;
+        default:
+            break;
+        }
+        return MPP_OK;
+    }
+    virtual MPP_RET reset() override {
+        stopThread();
+        clearQueue();
+        m_encFrames = 0;
+        m_headerSent = false;
+        startThread();
+        return MPP_OK;
+    }
+protected:
+    void clearQueue() {
+        for (auto& input : m_inQueue) {
+            mpp_frame_deinit(&input.frame);
+        }
+        m_inQueue.clear();
+        for (auto packet : m_outQueue) {
+            mpp_packet_deinit(&packet);
+        }
+        m_outQueue.clear();
+    }
+    virtual void run() override {
+        for (;;) {
+            InputFrame input;
+            MppEncPrepCfg prep;
+            int gop = 0;
+            bool writeHeaders = false;
+            {
+                std::unique_lock<std::mutex> lock(m_mtx);
+                m_cv.wait(lock, [this]() { return m_abort || !m_inQueue.empty(); });
+                if (m_abort) {
+                    return;
+                }
+                input = m_inQueue.front();
+                m_inQueue.pop_front();
+                prep = m_prep;
+                gop = m_gop;
+                writeHeaders = !m_headerSent || m_headerMode == MPP_ENC_HEADER_MODE_EACH_IDR;
+            }
+            const bool eos = mpp_frame_get_eos(input.frame) != 0;
+            MppPacket packet = nullptr;
+            if (mpp_frame_get_buffer(input.frame)) {
+                // 解像度はフレームの設定を使用し、変わった場合はヘッダから出力し直す
+                prep.width  = mpp_frame_get_width(input.frame);
+                prep.height = mpp_frame_get_height(input.frame);
+                const bool sizeChanged = m_encFrames > 0 && (prep.width != m_encWidth || prep.height != m_encHeight);
+                m_encWidth  = prep.width;
+                m_encHeight = prep.height;
+                prep.format = mpp_frame_get_fmt(input.frame);
+                const bool idr = input.idr || sizeChanged || m_encFrames == 0 || (gop > 0 && m_framesSinceIDR >= gop);
+                packet = encode(input.frame, prep, idr, idr && (writeHeaders || sizeChanged));
+                if (idr) {
+                    m_headerSent = true;
+                }
+                // 入力フレームはパケットのmetaで返却する
+                mpp_meta_set_frame(mpp_packet_get_meta(packet), KEY_INPUT_FRAME, input.frame);
+                mpp_sw_wait_latency(m_lastOutput, mpp_sw_config().encLatencyMs);
+                m_lastOutput = std::chrono::steady_clock::now();
+            } else {
+                mpp_frame_deinit(&input.frame);
+            }
+            if (eos) {
+                if (packet == nullptr) {
+                    mpp_packet_new(&packet);
+                }
+                mpp_packet_set_eos(packet);
+            }
+            if (packet) {
+                {
+                    std::lock_guard<std::mutex> lock(m_mtx);
+                    m_outQueue.push_back(packet);
+                }
+                m_cv.notify_all();
+            }
+        }
+    }
+    static void writeNAL(std::vector<uint8_t>& out, const int nalRefIdc, const int nalType, const std::vector<uint8_t>& rbsp) {
+        static const uint8_t startCode[] = { 0x00, 0x00, 0x00, 0x01 };
+        out.insert(out.end(), startCode, startCode + _countof(startCode));
+        out.push_back((uint8_t)((nalRefIdc << 5) | nalType));
+        int zeros = 0;
+        for (const auto b : rbsp) {
+            if (zeros >= 2 && b <= 3) { // emulation prevention
+                out.push_back(0x03);
+                zeros = 0;
+            }
+            out.push_back(b);
+            zeros = (b == 0) ? zeros + 1 : 0;
+        }
+    }
+    static void writeHeader(std::vector<uint8_t>& out, const MppEncPrepCfg& prep) {
+        const int mbWidth  = (prep.width + 15) / 16;
+        const int mbHeight = (prep.height + 15) / 16;
+        {
+            MPPSwBitWriter sps;
+            sps.put(66, 8);   // profile_idc (baseline)
+            sps.put(0xc0, 8); // constraint_set0_flag, constraint_set1_flag
+            sps.put(52, 8);   // level_idc (I_PCMはビットレートが大きいので最大にしておく)
+            sps.ue(0);        // seq_parameter_set_id
+            sps.ue(LOG2_MAX_FRAME_NUM - 4);
+            sps.ue(2);        // pic_order_cnt_type
+            sps.ue(1);        // max_num_ref_frames
+            sps.put(0, 1);    // gaps_in_frame_num_value_allowed_flag
+            sps.ue(mbWidth - 1);
+            sps.ue(mbHeight - 1);
+            sps.put(1, 1);    // frame_mbs_only_flag
+            sps.put(1, 1);    // direct_8x8_inference_flag
+            const int cropRight  = (mbWidth  * 16 - prep.width) / 2;
+            const int cropBottom = (mbHeight * 16 - prep.height) / 2;
+            sps.put((cropRight || cropBottom) ? 1 : 0, 1);
+            if (cropRight || cropBottom) {
+                sps.ue(0);
+                sps.ue(cropRight);
+                sps.ue(0);
+                sps.ue(cropBottom);
+            }
+            sps.put(0, 1);    // vui_parameters_present_flag
+            sps.trailing();
+            writeNAL(out, 3, NAL_SPS, sps.data());
+        }
+        {
+            MPPSwBitWriter pps;
+            pps.ue(0);        // pic_parameter_set_id
+            pps.ue(0);        // seq_parameter_set_id
+            pps.put(0, 1);    // entropy_coding_mode_flag (CAVLC)
+            pps.put(0, 1);    // bottom_field_pic_order_in_frame_present_flag
+            pps.ue(0);        // num_slice_groups_minus1
+            pps.ue(0);        // num_ref_idx_l0_default_active_minus1
+            pps.ue(0);        // num_ref_idx_l1_default_active_minus1
+            pps.put(0, 1);    // weighted_pred_flag
+            pps.put(0, 2);    // weighted_bipred_idc
+            pps.se(0);        // pic_init_qp_minus26
+            pps.se(0);        // pic_init_qs_minus26
+            pps.se(0);        // chroma_qp_index_offset
+            pps.put(1, 1);    // deblocking_filter_control_present_flag
+            pps.put(0, 1);    // constrained_intra_pred_flag
+            pps.put(0, 1);    // redundant_pic_cnt_present_flag
+            pps.trailing();
+            writeNAL(out, 3, NAL_PPS, pps.data());
+        }
+    }
+    MppPacket encode(MppFrame frame, const MppEncPrepCfg& prep, const bool idr, const bool writeHeaders) {
+        const int mbWidth  = (prep.width + 15) / 16;
+        const int mbHeight = (prep.height + 15) / 16;
+        const bool intra = idr || !mpp_sw_config().encSkip;
+        if (idr) {
+            m_frameNum = 0;
+            m_framesSinceIDR = 0;
+        }
+
+        MPPSwBitWriter slice;
+        slice.reserve((intra) ? (size_t)mbWidth * mbHeight * (384 + 2) + 64 : 64);
+        slice.ue(0);                     // first_mb_in_slice
+        slice.ue((intra) ? 7 : 5);       // slice_type (I / P)
+        slice.ue(0);                     // pic_parameter_set_id
+        slice.put(m_frameNum, LOG2_MAX_FRAME_NUM);
+        if (idr) {
+            slice.ue(m_idrPicId);        // idr_pic_id
+        }
+        if (!intra) {
+            slice.put(0, 1);             // num_ref_idx_active_override_flag
+            slice.put(0, 1);             // ref_pic_list_modification_flag_l0
+        }
+        if (idr) {
+            slice.put(0, 1);             // no_output_of_prior_pics_flag
+            slice.put(0, 1);             // long_term_reference_flag
+        } else {
+            slice.put(0, 1);             // adaptive_ref_pic_marking_mode_flag
+        }
+        slice.se(0);                     // slice_qp_delta
+        slice.ue(1);                     // disable_deblocking_filter_idc
+        if (intra) {
+            writePCM(slice, frame, prep, mbWidth, mbHeight);
+        } else {
+            slice.ue(mbWidth * mbHeight); // mb_skip_run
+        }
+        slice.trailing();
+
+        MppPacket packet = nullptr;
+        mpp_packet_new(&packet);
+        auto p = (MPPSwPacket *)packet;
+        p->owned.reserve(slice.data().size() + slice.data().size() / 64 + 256);
+        if (writeHeaders) {
+            writeHeader(p->owned, prep);
+        }
+        writeNAL(p->owned, 3, (idr) ? NAL_IDR : NAL_SLICE, slice.data());
+        p->data = p->owned.data();
+        p->pos = p->owned.data();
+        p->size = p->owned.size();
+        p->length = p->owned.size();
+        p->pts = mpp_frame_get_pts(frame);
+        p->dts = p->pts;
+
+        if (idr) {
+            m_idrPicId = (m_idrPicId + 1) & 0xffff;
+        }
+        m_frameNum = (m_frameNum + 1) & ((1 << LOG2_MAX_FRAME_NUM) - 1);
+        m_framesSinceIDR++;
+        m_encFrames++;
+        return packet;
+    }
+    static void writePCM(MPPSwBitWriter& slice, MppFrame frame, const MppEncPrepCfg& prep, const int mbWidth, const int mbHeight) {
+        const int width  = prep.width;
+        const int height = prep.height;
+        // strideはフレームの設定を優先する
+        const int pitch   = (mpp_frame_get_hor_stride(frame)) ? mpp_frame_get_hor_stride(frame) : ((prep.hor_stride) ? prep.hor_stride : width);
+        const int vstride = (mpp_frame_get_ver_stride(frame)) ? mpp_frame_get_ver_stride(frame) : ((prep.ver_stride) ? prep.ver_stride : height);
+        const bool nv12 = (prep.format & MPP_FRAME_FMT_MASK) == MPP_FMT_YUV420SP;
+        const uint8_t *ptrY = (const uint8_t *)mpp_buffer_get_ptr(mpp_frame_get_buffer(frame));
+        const uint8_t *ptrC = ptrY + (size_t)pitch * vstride;
+        const uint8_t *ptrV = ptrC + (size_t)(pitch / 2) * (vstride / 2); // yuv420pの場合のV
+        const int cwidth  = (width + 1) / 2;
+        const int cheight = (height + 1) / 2;
+        for (int mby = 0; mby < mbHeight; mby++) {
+            for (int mbx = 0; mbx < mbWidth; mbx++) {
+                slice.ue(25); // mb_type = I_PCM
+                slice.alignZero();
+                uint8_t *dst = slice.reserveBytes(384);
+                // 画面外は端の画素で埋める
+                for (int y = 0; y < 16; y++) {
+                    const uint8_t *src = ptrY + (size_t)std::min(mby * 16 + y, height - 1) * pitch;
+                    if (mbx * 16 + 16 <= width) {
+                        memcpy(dst, src + mbx * 16, 16);
+                    } else {
+                        for (int x = 0; x < 16; x++) {
+                            dst[x] = src[std::min(mbx * 16 + x, width - 1)];
+                        }
+                    }
+                    dst += 16;
+                }
+                for (int iplane = 0; iplane < 2; iplane++) {
+                    for (int y = 0; y < 8; y++) {
+                        const int sy = std::min(mby * 8 + y, cheight - 1);
+                        for (int x = 0; x < 8; x++) {
+                            const int sx = std::min(mbx * 8 + x, cwidth - 1);
+                            dst[x] = (nv12) ? ptrC[(size_t)sy * pitch + sx * 2 + iplane]
+                                            : ((iplane) ? ptrV : ptrC)[(size_t)sy * (pitch / 2) + sx];
+                        }
+                        dst += 8;
+                    }
+                }
+            }
+        }
+    }
+
+    std::deque<InputFrame> m_inQueue;
+    std::deque<MppPacket> m_outQueue;
+    MppEncPrepCfg m_prep;
+    RK_S32 m_gop;
+    MppEncHeaderMode m_headerMode;
+    bool m_forceIDR;
+    // 以下はエンコードスレッドのみで使用
+    int64_t m_encFrames;
+    int m_framesSinceIDR;
+    uint32_t m_frameNum;
+    uint32_t m_idrPicId;
+    bool m_headerSent;
+    RK_S32 m_encWidth;
+    RK_S32 m_encHeight;
+};
+
+//---------------------------------------------------------------------------------
+// MppApi
+//---------------------------------------------------------------------------------
+struct MPPSwContext {
+    MppApi api;
+    MppCtxType type;
+    std::unique_ptr<MPPSwCodec> codec;
+};
+
+static MPP_RET mpp_sw_decode_put_packet(MppCtx ctx, MppPacket packet) {
+    auto p = (MPPSwContext *)ctx;
+    return (p && p->codec) ? p->codec->putPacket(packet) : MPP_ERR_INIT;
+}
+
+static MPP_RET mpp_sw_decode_get_frame(MppCtx ctx, MppFrame *frame) {
+    auto p = (MPPSwContext *)ctx;
+    return (p && p->codec) ? p->codec->getFrame(frame) : MPP_ERR_INIT;
+}
+
+static MPP_RET mpp_sw_encode_put_frame(MppCtx ctx, MppFrame frame) {
+    auto p = (MPPSwContext *)ctx;
+    return (p && p->codec) ? p->codec->putFrame(frame) : MPP_ERR_INIT;
+}
+
+static MPP_RET mpp_sw_encode_get_packet(MppCtx ctx, MppPacket *packet) {
+    auto p = (MPPSwContext *)ctx;
+    return (p && p->codec) ? p->codec->getPacket(packet) : MPP_ERR_INIT;
+}
+
+static MPP_RET mpp_sw_reset(MppCtx ctx) {
+    auto p = (MPPSwContext *)ctx;
+    return (p && p->codec) ? p->codec->reset() : MPP_OK;
+}
+
+static MPP_RET mpp_sw_control(MppCtx ctx, MpiCmd cmd, MppParam param) {
+    auto p = (MPPSwContext *)ctx;
+    if (p == nullptr) {
+        return MPP_ERR_NULL_PTR;
+    }
+    switch (cmd) {
+    case MPP_SET_INPUT_TIMEOUT:
+    case MPP_SET_OUTPUT_TIMEOUT:
+        return MPP_OK; // 常に非ブロッキングで動作する
+    default:
+        break;
+    }
+    return (p->codec) ? p->codec->control(cmd, param) : MPP_OK;
+}
+
+MPP_RET mpp_create(MppCtx *ctx, MppApi **mpi) {
+    if (ctx == nullptr || mpi == nullptr) {
+        return MPP_ERR_NULL_PTR;
+    }
+    auto p = new MPPSwContext();
+    memset(&p->api, 0, sizeof(p->api));
+    p->api.size = sizeof(p->api);
+    p->api.decode_put_packet = mpp_sw_decode_put_packet;
+    p->api.decode_get_frame  = mpp_sw_decode_get_frame;
+    p->api.encode_put_frame  = mpp_sw_encode_put_frame;
+    p->api.encode_get_packet = mpp_sw_encode_get_packet;
+    p->api.reset             = mpp_sw_reset;
+    p->api.control           = mpp_sw_control;
+    p->type = MPP_CTX_BUTT;
+    *ctx = p;
+    *mpi = &p->api;
+    return MPP_OK;
+}
+
+MPP_RET mpp_init(MppCtx ctx, MppCtxType type, MppCodingType coding) {
+    auto p = (MPPSwContext *)ctx;
+    if (p == nullptr) {
+        return MPP_ERR_NULL_PTR;
+    }
+    if (mpp_check_support_format(type, coding) != MPP_OK) {
+        return MPP_ERR_INIT;
+    }
+    p->type = type;
+    if (type == MPP_CTX_DEC) {
+        p->codec = std::make_unique<MPPSwDecoder>();
+    } else {
+        p->codec = std::make_unique<MPPSwEncoder>();
+    }
+    auto ret = p->codec->init(coding);
+    if (ret != MPP_OK) {
+        p->codec.reset();
+    }
+    return ret;
+}
+
+MPP_RET mpp_destroy(MppCtx ctx) {
+    auto p = (MPPSwContext *)ctx;
+    if (p == nullptr) {
+        return MPP_ERR_NULL_PTR;
+    }
+    delete p;
+    return MPP_OK;
+}
+
+MPP_RET mpp_check_support_format(MppCtxType type, MppCodingType coding) {
+    if (type == MPP_CTX_ENC) {
+        return (coding == MPP_VIDEO_CodingAVC) ? MPP_OK : MPP_NOK;
+    } else if (type == MPP_CTX_DEC) {
+        const auto codec = codec_dec_to_rgy(coding);
+        if (codec == RGY_CODEC_UNKNOWN) {
+            return MPP_NOK;
+        }
+        return (avcodec_find_decoder(getAVCodecId(codec)) != nullptr) ? MPP_OK : MPP_NOK;
+    }
+    return MPP_NOK;
+}
+
+//---------------------------------------------------------------------------------
+// soc / platform
+//---------------------------------------------------------------------------------
+const char *mpp_get_soc_name(void) {
+    return "rkmppenc software backend";
+}
+
+const MppSocInfo *mpp_get_soc_info(void) {
+    return nullptr; // mpp_check_support_format で判定させる
+}
+
+RK_U32 mpp_check_soc_cap(MppCtxType type, MppCodingType coding) {
+    return (mpp_check_support_format(type, coding) == MPP_OK) ? 1 : 0;
+}
+
+MppIoctlVersion mpp_get_ioctl_version(void) {
+    return IOCTL_MPP_SERVICE_V1;
+}
+
+MppKernelVersion mpp_get_kernel_version(void) {
+    return KERNEL_UNKNOWN;
+}
+
+const char *mpp_ioctl_ver_name(MppIoctlVersion ver) {
+    return (ver == IOCTL_MPP_SERVICE_V1) ? "mpp_service_v1 (software)" : "unknown";
+}
+
+const char *mpp_kernel_ver_name(MppKernelVersion ver) {
+    return "unknown";
+}
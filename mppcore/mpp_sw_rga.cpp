@@ -0,0 +1,385 @@
+﻿// -----------------------------------------------------------------------------------------
+//     rkmppenc by rigaya
+// -----------------------------------------------------------------------------------------
+// The MIT License
+//
+// Copyright (c) 2014-2017 rigaya
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// IABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// ------------------------------------------------------------------------------------------
+
+// librga / IEP の代わりにリンクするCPU実装
+// - NV12 / YUV420P (RK_FORMAT_YCbCr_420_SP / RK_FORMAT_YCbCr_420_P) のcrop/resize/色空間変換のみ対応
+// - IEPは常にbob(ライン補間)で処理する
+// - 処理は同期的に行い、release_fence_fdには-1を返す
+
+#include <cstring>
+#include <mutex>
+#include <unordered_map>
+#include "rgy_util.h"
+#include "mpp_sw_backend.h"
+#include "rk_mpi.h"
+#include "iep2_api.h"
+#include "rga/rga.h"
+#include "rga/im2d.hpp"
+#include "rga/im2d_type.h"
+
+//---------------------------------------------------------------------------------
+// rga_buffer_handle_t
+//---------------------------------------------------------------------------------
+static std::mutex g_rgaSwHandleMtx;
+static std::unordered_map<rga_buffer_handle_t, int> g_rgaSwHandleMap; // handle -> fd
+static rga_buffer_handle_t g_rgaSwHandleNext = 1;
+
+rga_buffer_handle_t importbuffer_fd(int fd, int size) {
+    if (mpp_sw_buffer_ptr_from_fd(fd, nullptr) == nullptr) {
+        return 0;
+    }
+    std::lock_guard<std::mutex> lock(g_rgaSwHandleMtx);
+    const auto handle = g_rgaSwHandleNext++;
+    g_rgaSwHandleMap[handle] = fd;
+    return handle;
+}
+
+IM_STATUS releasebuffer_handle(rga_buffer_handle_t handle) {
+    std::lock_guard<std::mutex> lock(g_rgaSwHandleMtx);
+    return (g_rgaSwHandleMap.erase(handle) > 0) ? IM_STATUS_SUCCESS : IM_STATUS_INVALID_PARAM;
+}
+
+static uint8_t *rga_sw_handle_ptr(rga_buffer_handle_t handle) {
+    int fd = -1;
+    {
+        std::lock_guard<std::mutex> lock(g_rgaSwHandleMtx);
+        auto it = g_rgaSwHandleMap.find(handle);
+        if (it == g_rgaSwHandleMap.end()) {
+            return nullptr;
+        }
+        fd = it->second;
+    }
+    return (uint8_t *)mpp_sw_buffer_ptr_from_fd(fd, nullptr);
+}
+
+rga_buffer_t wrapbuffer_handle_t(rga_buffer_handle_t handle, int width, int height, int wstride, int hstride, int format) {
+    rga_buffer_t buffer;
+    memset(&buffer, 0, sizeof(buffer));
+    buffer.handle = handle;
+    buffer.width = width;
+    buffer.height = height;
+    buffer.wstride = wstride;
+    buffer.hstride = hstride;
+    buffer.format = format;
+    return buffer;
+}
+
+rga_buffer_t wrapbuffer_handle(rga_buffer_handle_t handle, int width, int height, int format, int wstride, int hstride) {
+    return wrapbuffer_handle_t(handle, width, height, (wstride) ? wstride : width, (hstride) ? hstride : height, format);
+}
+
+//---------------------------------------------------------------------------------
+// im2d
+//---------------------------------------------------------------------------------
+const char *querystring(int name) {
+    switch (name) {
+    case RGA_VENDOR:  return "Vendor          : rkmppenc software backend\n";
+    case RGA_VERSION: return "Version         : software\n";
+    default: break;
+    }
+    return "";
+}
+
+IM_STATUS imcheck_t(const rga_buffer_t src, const rga_buffer_t dst, const rga_buffer_t pat,
+    const im_rect src_rect, const im_rect dst_rect, const im_rect pat_rect, const int mode_usage) {
+    return IM_STATUS_NOERROR;
+}
+
+IM_STATUS imsync(int fence_fd) {
+    // 常に同期的に処理しているので、待つ必要はない
+    return IM_STATUS_SUCCESS;
+}
+
+struct RGASwPlanes {
+    uint8_t *y;
+    uint8_t *u;
+    uint8_t *v;
+    int pitchY;
+    int pitchC;
+    int stepC; // 色差の画素間隔 (NV12: 2, YUV420P: 1)
+    int width;
+    int height;
+};
+
+static bool rga_sw_get_planes(const rga_buffer_t& buf, RGASwPlanes& planes) {
+    uint8_t *ptr = rga_sw_handle_ptr(buf.handle);
+    if (ptr == nullptr) {
+        return false;
+    }
+    const int wstride = (buf.wstride) ? buf.wstride : buf.width;
+    const int hstride = (buf.hstride) ? buf.hstride : buf.height;
+    planes.y = ptr;
+    planes.pitchY = wstride;
+    planes.width = buf.width;
+    planes.height = buf.height;
+    if (buf.format == RK_FORMAT_YCbCr_420_SP) {
+        planes.u = ptr + (size_t)wstride * hstride;
+        planes.v = planes.u + 1;
+        planes.pitchC = wstride;
+        planes.stepC = 2;
+    } else if (buf.format == RK_FORMAT_YCbCr_420_P) {
+        planes.u = ptr + (size_t)wstride * hstride;
+        planes.v = planes.u + (size_t)(wstride / 2) * (hstride / 2);
+        planes.pitchC = wstride / 2;
+        planes.stepC = 1;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+static void rga_sw_resize_plane(uint8_t *dst, const int dstPitch, const int dstStep, const int dstWidth, const int dstHeight,
+    const uint8_t *src, const int srcPitch, const int srcStep, const int srcX, const int srcY, const int srcWidth, const int srcHeight) {
+    if (srcWidth == dstWidth && srcHeight == dstHeight) {
+        for (int y = 0; y < dstHeight; y++) {
+            const uint8_t *s = src + (size_t)(srcY + y) * srcPitch + (size_t)srcX * srcStep;
+            uint8_t *d = dst + (size_t)y * dstPitch;
+            if (srcStep == 1 && dstStep == 1) {
+                memcpy(d, s, dstWidth);
+            } else {
+                for (int x = 0; x < dstWidth; x++) {
+                    d[x * dstStep] = s[x * srcStep];
+                }
+            }
+        }
+        return;
+    }
+    // bilinear (16bit固定小数点)
+    const int64_t ratioX = ((int64_t)srcWidth << 16) / dstWidth;
+    const int64_t ratioY = ((int64_t)srcHeight << 16) / dstHeight;
+    for (int y = 0; y < dstHeight; y++) {
+        const int64_t sy = std::max<int64_t>(((2 * y + 1) * ratioY - (1 << 16)) / 2, 0);
+        const int y0 = std::min((int)(sy >> 16), srcHeight - 1);
+        const int y1 = std::min(y0 + 1, srcHeight - 1);
+        const int fy = (int)(sy & 0xffff) >> 8;
+        const uint8_t *s0 = src + (size_t)(srcY + y0) * srcPitch + (size_t)srcX * srcStep;
+        const uint8_t *s1 = src + (size_t)(srcY + y1) * srcPitch + (size_t)srcX * srcStep;
+        uint8_t *d = dst + (size_t)y * dstPitch;
+        for (int x = 0; x < dstWidth; x++) {
+            const int64_t sx = std::max<int64_t>(((2 * x + 1) * ratioX - (1 << 16)) / 2, 0);
+            const int x0 = std::min((int)(sx >> 16), srcWidth - 1);
+            const int x1 = std::min(x0 + 1, srcWidth - 1);
+            const int fx = (int)(sx & 0xffff) >> 8;
+            const int top = s0[x0 * srcStep] * (256 - fx) + s0[x1 * srcStep] * fx;
+            const int bot = s1[x0 * srcStep] * (256 - fx) + s1[x1 * srcStep] * fx;
+            d[x * dstStep] = (uint8_t)((top * (256 - fy) + bot * fy + (1 << 15)) >> 16);
+        }
+    }
+}
+
+// srcのrectをdstの全体に拡大縮小/フォーマット変換してコピーする
+static IM_STATUS rga_sw_blit(const rga_buffer_t& src, const im_rect& rect, const rga_buffer_t& dst, int *release_fence_fd) {
+    const auto start = std::chrono::steady_clock::now();
+    if (release_fence_fd) {
+        *release_fence_fd = -1;
+    }
+    RGASwPlanes s, d;
+    if (!rga_sw_get_planes(src, s) || !rga_sw_get_planes(dst, d)) {
+        return IM_STATUS_NOT_SUPPORTED;
+    }
+    const int rectX = rect.x & ~1;
+    const int rectY = rect.y & ~1;
+    const int rectW = (rect.width)  ? rect.width  : s.width  - rectX;
+    const int rectH = (rect.height) ? rect.height : s.height - rectY;
+    if (rectW <= 0 || rectH <= 0 || rectX + rectW > s.width || rectY + rectH > s.height) {
+        return IM_STATUS_INVALID_PARAM;
+    }
+    rga_sw_resize_plane(d.y, d.pitchY, 1, d.width, d.height,
+                        s.y, s.pitchY, 1, rectX, rectY, rectW, rectH);
+    rga_sw_resize_plane(d.u, d.pitchC, d.stepC, (d.width + 1) / 2, (d.height + 1) / 2,
+                        s.u, s.pitchC, s.stepC, rectX / 2, rectY / 2, (rectW + 1) / 2, (rectH + 1) / 2);
+    rga_sw_resize_plane(d.v, d.pitchC, d.stepC, (d.width + 1) / 2, (d.height + 1) / 2,
+                        s.v, s.pitchC, s.stepC, rectX / 2, rectY / 2, (rectW + 1) / 2, (rectH + 1) / 2);
+    mpp_sw_wait_latency(start, mpp_sw_config().rgaLatencyMs);
+    return IM_STATUS_SUCCESS;
+}
+
+IM_STATUS imcrop(const rga_buffer_t src, rga_buffer_t dst, im_rect rect, int sync, int *release_fence_fd) {
+    return rga_sw_blit(src, rect, dst, release_fence_fd);
+}
+
+IM_STATUS imresize(const rga_buffer_t src, rga_buffer_t dst, double fx, double fy, int interpolation, int sync, int *release_fence_fd) {
+    im_rect rect;
+    memset(&rect, 0, sizeof(rect));
+    return rga_sw_blit(src, rect, dst, release_fence_fd);
+}
+
+IM_STATUS imcvtcolor(rga_buffer_t src, rga_buffer_t dst, int sfmt, int dfmt, int mode, int sync, int *release_fence_fd) {
+    src.format = sfmt;
+    dst.format = dfmt;
+    im_rect rect;
+    memset(&rect, 0, sizeof(rect));
+    return rga_sw_blit(src, rect, dst, release_fence_fd);
+}
+
+//---------------------------------------------------------------------------------
+// IEP
+//---------------------------------------------------------------------------------
+struct IEPSwCtx {
+    IepImg src;
+    IepImg dst0;
+    IepImg dst1;
+    int fieldOrder; // IEP2_FIELD_ORDER_TFF / IEP2_FIELD_ORDER_BFF
+};
+
+static MPP_RET iep_sw_init(IepCtx *ctx) {
+    if (ctx == nullptr) {
+        return MPP_ERR_NULL_PTR;
+    }
+    auto p = new IEPSwCtx();
+    memset(p, 0, sizeof(*p));
+    p->fieldOrder = IEP2_FIELD_ORDER_TFF;
+    *ctx = p;
+    return MPP_OK;
+}
+
+static MPP_RET iep_sw_deinit(IepCtx ctx) {
+    delete (IEPSwCtx *)ctx;
+    return MPP_OK;
+}
+
+// 指定したフィールドのラインをそのまま使い、他方のフィールドのラインを上下の平均で補間する (NV12)
+static MPP_RET iep_sw_bob(const IepImg& src, const IepImg& dst, const int field) {
+    size_t srcSize = 0, dstSize = 0;
+    const uint8_t *srcPtr = (const uint8_t *)mpp_sw_buffer_ptr_from_fd(src.mem_addr, &srcSize);
+    uint8_t *dstPtr = (uint8_t *)mpp_sw_buffer_ptr_from_fd(dst.mem_addr, &dstSize);
+    if (srcPtr == nullptr || dstPtr == nullptr) {
+        return MPP_ERR_NULL_PTR;
+    }
+    const int width = std::min(src.act_w, dst.act_w);
+    const int height = std::min(src.act_h, dst.act_h);
+    auto bobPlane = [field](uint8_t *d, const int dpitch, const uint8_t *s, const int spitch, const int w, const int h) {
+        for (int y = 0; y < h; y++) {
+            uint8_t *dline = d + (size_t)y * dpitch;
+            if ((y & 1) == field) {
+                memcpy(dline, s + (size_t)y * spitch, w);
+            } else {
+                const int y0 = (y - 1 >= 0) ? y - 1 : y + 1;
+                const int y1 = (y + 1 < h)  ? y + 1 : y - 1;
+                const uint8_t *s0 = s + (size_t)std::max(y0, 0) * spitch;
+                const uint8_t *s1 = s + (size_t)std::max(y1, 0) * spitch;
+                for (int x = 0; x < w; x++) {
+                    dline[x] = (uint8_t)((s0[x] + s1[x] + 1) >> 1);
+                }
+            }
+        }
+    };
+    bobPlane(dstPtr, dst.vir_w, srcPtr, src.vir_w, width, height);
+    // 色差はNV12のUVを1ラインとして同様に処理する
+    bobPlane(dstPtr + (size_t)dst.vir_w * dst.vir_h, dst.vir_w,
+             srcPtr + (size_t)src.vir_w * src.vir_h, src.vir_w, width, height / 2);
+    return MPP_OK;
+}
+
+static MPP_RET iep_sw_control(IepCtx ctx, IepCmd cmd, void *param) {
+    auto p = (IEPSwCtx *)ctx;
+    if (p == nullptr) {
+        return MPP_ERR_NULL_PTR;
+    }
+    switch (cmd) {
+    case IEP_CMD_SET_SRC:
+        p->src = *(IepImg *)param;
+        break;
+    case IEP_CMD_SET_DST:
+        p->dst0 = *(IepImg *)param;
+        break;
+    case IEP_CMD_SET_DEI_DST1:
+        p->dst1 = *(IepImg *)param;
+        break;
+    case IEP_CMD_SET_DEI_SRC1:
+    case IEP_CMD_SET_DEI_SRC2:
+        break; // 前後のフレームは使用しない
+    case IEP_CMD_SET_DEI_CFG: {
+        auto prm = (struct iep2_api_params *)param;
+        if (prm && prm->ptype == IEP2_PARAM_TYPE_MODE) {
+            p->fieldOrder = prm->param.mode.dil_order;
+        }
+    } break;
+    case IEP_CMD_RUN_SYNC: {
+        const auto start = std::chrono::steady_clock::now();
+        // DSTにトップフィールド、DST1にボトムフィールドを出力する
+        // DSTとDST1が同じ場合は1フレーム出力なので、先のフィールドのみ出力する
+        MPP_RET ret = MPP_OK;
+        if (p->dst1.mem_addr == p->dst0.mem_addr) {
+            ret = iep_sw_bob(p->src, p->dst0, (p->fieldOrder == IEP2_FIELD_ORDER_BFF) ? 1 : 0);
+        } else {
+            ret = iep_sw_bob(p->src, p->dst0, 0);
+            if (ret == MPP_OK) {
+                ret = iep_sw_bob(p->src, p->dst1, 1);
+            }
+        }
+        if (param) {
+            auto info = (struct iep2_api_info *)param;
+            memset(info, 0, sizeof(*info));
+        }
+        mpp_sw_wait_latency(start, mpp_sw_config().rgaLatencyMs);
+        return ret;
+    }
+    default:
+        break;
+    }
+    return MPP_OK;
+}
+
+static void iep_sw_release(iep_com_ctx *ctx) {
+    delete ctx;
+}
+
+static iep_com_ops *iep_sw_ops() {
+    static iep_com_ops ops = []() {
+        iep_com_ops o;
+        memset(&o, 0, sizeof(o));
+        o.init = iep_sw_init;
+        o.deinit = iep_sw_deinit;
+        o.control = iep_sw_control;
+        o.release = iep_sw_release;
+        return o;
+    }();
+    return &ops;
+}
+
+iep_com_ctx *rockchip_iep2_api_alloc_ctx(void) {
+    auto ctx = new iep_com_ctx();
+    memset(ctx, 0, sizeof(*ctx));
+    ctx->ops = iep_sw_ops();
+    ctx->ver = 2;
+    return ctx;
+}
+
+void rockchip_iep2_api_release_ctx(iep_com_ctx *ctx) {
+    delete ctx;
+}
+
+iep_com_ctx *get_iep_ctx() {
+    return rockchip_iep2_api_alloc_ctx();
+}
+
+void put_iep_ctx(iep_com_ctx *ictx) {
+    if (ictx && ictx->ops && ictx->ops->release) {
+        ictx->ops->release(ictx);
+    }
+}
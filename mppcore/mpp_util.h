@@ -100,6 +100,9 @@ struct MPPCfg {
     }
 };
 
+//確保するバッファの末尾に余分に確保する領域 (AVPacketにコピーせず渡すため、AV_INPUT_BUFFER_PADDING_SIZE以上とする)
+static const size_t RGY_BITSTREAM_PADDING = 64;
+
 struct RGYBitstream {
 private:
     uint8_t *dataptr;
@@ -154,6 +157,21 @@ public:
         return ptr;
     }
 
+    //release()で取り出したバッファを再び管理下に置く
+    void attach(uint8_t *buf, size_t bufSize) {
+        clear();
+        dataptr = buf;
+        maxLength = (buf) ? bufSize : 0;
+    }
+
+    //データ領域のみを入れ替える (時刻などの情報はそのまま)
+    void swapBuffer(RGYBitstream *pBitstream) {
+        std::swap(dataptr,    pBitstream->dataptr);
+        std::swap(dataLength, pBitstream->dataLength);
+        std::swap(dataOffset, pBitstream->dataOffset);
+        std::swap(maxLength,  pBitstream->maxLength);
+    }
+
     uint32_t dataflag() const {
         return dataFlag;
     }
@@ -253,7 +271,7 @@ public:
         clear();
 
         if (nSize > 0) {
-            if (nullptr == (dataptr = (uint8_t *)_aligned_malloc(nSize, 32))) {
+            if (nullptr == (dataptr = (uint8_t *)_aligned_malloc(nSize + RGY_BITSTREAM_PADDING, 32))) {
                 return RGY_ERR_NULL_PTR;
             }
 
@@ -277,7 +295,7 @@ public:
             freeMem();
             dataLength = 0;
             dataOffset = 0;
-            if (nullptr == (dataptr = (uint8_t *)_aligned_malloc(setSize, 32))) {
+            if (nullptr == (dataptr = (uint8_t *)_aligned_malloc(setSize + RGY_BITSTREAM_PADDING, 32))) {
                 return RGY_ERR_NULL_PTR;
             }
             maxLength = setSize;
@@ -339,7 +357,7 @@ public:
     }
 
     RGY_ERR changeSize(size_t nNewSize) {
-        uint8_t *pData = (uint8_t *)_aligned_malloc(nNewSize, 32);
+        uint8_t *pData = (uint8_t *)_aligned_malloc(nNewSize + RGY_BITSTREAM_PADDING, 32);
         if (pData == nullptr) {
             return RGY_ERR_NULL_PTR;
         }
@@ -10753,6 +10753,15 @@ int parse_one_common_option(const TCHAR *option_name, const TCHAR *strInput[], i
         }
         return 0;
     }
+    if (IS_OPTION("input-index")) {
+        common->inputIndex.enable = true;
+        if (i + 1 >= nArgNum || strInput[i + 1][0] == _T('-')) {
+            return 0;
+        }
+        i++;
+        common->inputIndex.filename = strInput[i];
+        return 0;
+    }
 #if ENABLE_AVSW_READER && !FOR_AUO
     if (IS_OPTION("audio-source")) {
         i++;
@@ -13070,6 +13079,21 @@ int parse_one_ctrl_option(const TCHAR *option_name, const TCHAR *strInput[], int
         ctrl->clPerfDumpDir = strInput[i];
         return 0;
     }
+    if (IS_OPTION("cl-cache-dir")) {
+        i++;
+        ctrl->clCacheDir = strInput[i];
+        return 0;
+    }
+    if (IS_OPTION("cl-cache-size")) {
+        i++;
+        int value = 0;
+        if (1 != _stscanf_s(strInput[i], _T("%d"), &value) || value < 0) {
+            print_cmd_error_invalid_value(option_name, strInput[i]);
+            return 1;
+        }
+        ctrl->clCacheSizeMB = value;
+        return 0;
+    }
     if (IS_OPTION("cl-perf-timeline")) {
         if (i + 1 < nArgNum && strInput[i + 1][0] != _T('-')) {
             i++;
@@ -13085,6 +13109,22 @@ int parse_one_ctrl_option(const TCHAR *option_name, const TCHAR *strInput[], int
         if (ctrl->clPerfTimelineSec == 0.0) ctrl->clPerfTimelineSec = 10.0;
         return 0;
     }
+    if (IS_OPTION("pipeline-trace")) {
+        //負の値(無制限)は次のオプションと区別するため、'-'に続けて数字が来る場合のみ値とみなす
+        if (i + 1 < nArgNum && (strInput[i + 1][0] != _T('-') || (_T('0') <= strInput[i + 1][1] && strInput[i + 1][1] <= _T('9')))) {
+            i++;
+            try {
+                ctrl->pipelineTraceSec = std::stod(tchar_to_string(strInput[i]));
+            } catch (...) {
+                print_cmd_error_invalid_value(option_name, strInput[i]);
+                return 1;
+            }
+        } else {
+            ctrl->pipelineTraceSec = 10.0;
+        }
+        if (ctrl->pipelineTraceSec == 0.0) ctrl->pipelineTraceSec = 10.0;
+        return 0;
+    }
     if (IS_OPTION("cl-perf-disasm-tool")) {
         i++;
         const auto value = tolowercase(strInput[i]);
@@ -15124,6 +15164,12 @@ tstring gen_cmd(const RGYParamCommon *param, const RGYParamCommon *defaultPrm, b
     }
     OPT_FLOAT(_T("--seek"), seekSec, 2);
     OPT_FLOAT(_T("--seekto"), seekToSec, 2);
+    if (param->inputIndex.enable) {
+        cmd << _T(" --input-index");
+        if (!rgy_disable_gen_cmd(disable_flags, RGYDisableGenCmdFlags::FilePath) && param->inputIndex.filename.length() > 0) {
+            cmd << _T(" \"") << param->inputIndex.filename << _T("\"");
+        }
+    }
     OPT_TCHAR(_T("--input-format"), AVInputFormat);
     OPT_TSTR(_T("--output-format"), muxOutputFormat);
     OPT_STR(_T("--video-tag"), videoCodecTag);
@@ -15725,10 +15771,15 @@ tstring gen_cmd(const RGYParamControl *param, const RGYParamControl *defaultPrm,
 #if ENCODER_QSV
     OPT_NUM(_T("--opencl-task-threads"), openclTaskThreads);
 #endif
+    OPT_TSTR(_T("--cl-cache-dir"), clCacheDir);
+    OPT_NUM(_T("--cl-cache-size"), clCacheSizeMB);
     OPT_TSTR(_T("--cl-perf-dump"), clPerfDumpDir);
     if (param->clPerfTimelineSec != defaultPrm->clPerfTimelineSec && param->clPerfTimelineSec != 0.0) {
         cmd << _T(" --cl-perf-timeline ") << param->clPerfTimelineSec;
     }
+    if (param->pipelineTraceSec != defaultPrm->pipelineTraceSec && param->pipelineTraceSec != 0.0) {
+        cmd << _T(" --pipeline-trace ") << param->pipelineTraceSec;
+    }
     OPT_TSTR(_T("--cl-perf-disasm-tool"), clPerfDisasmTool);
     OPT_TSTR(_T("--ocloc-path"), clPerfOclocPath);
     OPT_TSTR(_T("--rga-path"), clPerfRgaPath);
@@ -15920,6 +15971,10 @@ tstring gen_cmd_help_common() {
         _T("                                 seek will be inaccurate but fast.\n")
         _T("   --seekto [<int>:][<int>:]<int>[.<int>] (hh:mm:ss.ms)\n")
         _T("                                time to end encoding.\n")
+        _T("   --input-index [<string>]     save and reuse frame index of the input file,\n")
+        _T("                                 to make seek and trim start faster.\n")
+        _T("                                 default: <input file>.rgyindex\n")
+        _T("                                 this requires use of avhw/avsw reader.\n")
         _T("   --input-format <string>      set input format of input file.\n")
         _T("                                 this requires use of avhw/avsw reader.\n")
         _T("-f,--output-format <string>     set output format of output file.\n")
@@ -17812,6 +17867,10 @@ tstring gen_cmd_help_ctrl() {
         _T("                                  0: legacy single-thread path\n")
         _T("                                  2: acquire + release workers\n")
 #endif
+        _T("   --cl-cache-dir <dir>         cache OpenCL program binaries in <dir> to skip\n")
+        _T("                                 kernel builds on later runs.\n")
+        _T("   --cl-cache-size <int>        max total size of --cl-cache-dir in MB (default: %d)\n")
+        _T("                                 least recently used binaries are removed. 0: unlimited\n")
         _T("   --cl-perf-dump <dir>         dump OpenCL kernel performance data to <dir>.\n")
         _T("                                 enables CL_QUEUE_PROFILING_ENABLE automatically.\n")
         _T("                                 output: programs.jsonl, launches.jsonl, meta.json,\n")
@@ -17827,7 +17886,12 @@ tstring gen_cmd_help_ctrl() {
         _T("   --rga-path <path>            set Radeon GPU Analyzer path for AMD GPU disasm.\n")
 #endif
         _T("   --cl-perf-timeline [=<sec>]  enable per-event timeline capture for <sec> seconds (default 10).\n")
-        _T("                                requires --cl-perf-dump. output: timeline.jsonl\n"));
+        _T("                                requires --cl-perf-dump. output: timeline.jsonl, trace.json\n")
+        _T("   --pipeline-trace [=<sec>]    record per-stage pipeline events for <sec> seconds (default 10).\n")
+        _T("                                a negative value records without a time limit.\n")
+        _T("                                requires --cl-perf-dump. output: trace.json\n")
+        _T("                                 (Chrome/Perfetto trace format, merged with timeline)\n"),
+        RGY_CL_CACHE_SIZE_MB_DEFAULT);
 #endif
 #if ENCODER_QSV || ENCODER_VCEENC || ENCODER_MPP
     str += strsprintf(_T("\n")
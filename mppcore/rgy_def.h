@@ -54,6 +54,7 @@ static const int MAX_SPLIT_CHANNELS = 32;
 static const char *RGY_CHANNEL_AUTO = "RGY_CHANNEL_AUTO";
 static const int RGY_OUTPUT_BUF_MB_DEFAULT = 8;
 static const int RGY_OUTPUT_BUF_MB_MAX = 128;
+static const int RGY_CL_CACHE_SIZE_MB_DEFAULT = 256;
 
 static const TCHAR *RGY_AVCODEC_AUTO = _T("auto");
 static const TCHAR *RGY_AVCODEC_COPY = _T("copy");
@@ -35,6 +35,13 @@
 #include <climits>
 #include <chrono>
 #include <algorithm>
+#if defined(__linux__)
+#include <cerrno>
+#include <ctime>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#endif
 
 class Event {
 public:
@@ -130,6 +137,58 @@ unique_event CreateEventUnique(void* pDummy, int bManualReset, int bInitialState
     return unique_event(CreateEvent(pDummy, bManualReset, bInitialState, nullptr), CloseEvent);
 }
 
+#if defined(__linux__)
+static_assert(sizeof(std::atomic<uint32_t>) == sizeof(uint32_t), "futex requires 32bit atomic");
+
+static uint32_t futex_wait(std::atomic<uint32_t> *addr, int op, uint32_t expected, uint32_t millisec) {
+    struct timespec timeout;
+    timeout.tv_sec = millisec / 1000;
+    timeout.tv_nsec = (millisec % 1000) * 1000000;
+    const long ret = syscall(SYS_futex, (uint32_t *)addr, op, expected, (millisec == INFINITE) ? nullptr : &timeout, nullptr, 0);
+    return (ret != 0 && errno == ETIMEDOUT) ? WAIT_TIMEOUT : WAIT_OBJECT_0;
+}
+
+uint32_t rgy_wait_on_address(std::atomic<uint32_t> *addr, uint32_t expected, uint32_t millisec) {
+    return futex_wait(addr, FUTEX_WAIT_PRIVATE, expected, millisec);
+}
+
+void rgy_wake_by_address_all(std::atomic<uint32_t> *addr) {
+    syscall(SYS_futex, (uint32_t *)addr, FUTEX_WAKE_PRIVATE, INT_MAX, nullptr, nullptr, 0);
+}
+
+//プロセス間で共有する場合は、FUTEX_PRIVATE_FLAGを付けない
+uint32_t rgy_wait_on_address_shared(std::atomic<uint32_t> *addr, uint32_t expected, uint32_t millisec) {
+    return futex_wait(addr, FUTEX_WAIT, expected, millisec);
+}
+
+void rgy_wake_by_address_all_shared(std::atomic<uint32_t> *addr) {
+    syscall(SYS_futex, (uint32_t *)addr, FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+}
+#else
+//futexがない環境では、短い間隔で値の変化を確認する
+uint32_t rgy_wait_on_address(std::atomic<uint32_t> *addr, uint32_t expected, uint32_t millisec) {
+    const auto start = std::chrono::steady_clock::now();
+    while (addr->load(std::memory_order_acquire) == expected) {
+        if (millisec != INFINITE
+            && std::chrono::steady_clock::now() - start >= std::chrono::milliseconds(millisec)) {
+            return WAIT_TIMEOUT;
+        }
+        std::this_thread::sleep_for(std::chrono::microseconds(100));
+    }
+    return WAIT_OBJECT_0;
+}
+
+void rgy_wake_by_address_all(std::atomic<uint32_t> *addr) {
+}
+
+uint32_t rgy_wait_on_address_shared(std::atomic<uint32_t> *addr, uint32_t expected, uint32_t millisec) {
+    return rgy_wait_on_address(addr, expected, millisec);
+}
+
+void rgy_wake_by_address_all_shared(std::atomic<uint32_t> *addr) {
+}
+#endif //#if defined(__linux__)
+
 #else
 
 unique_event CreateEventUnique(void* pDummy, int bManualReset, int bInitialState, const wchar_t* name) {
@@ -142,5 +201,15 @@ unique_event CreateEventUnique(void* pDummy, int bManualReset, int bInitialState
     return unique_event(CreateEventA((LPSECURITY_ATTRIBUTES)pDummy, bManualReset, bInitialState, nullptr), CloseEvent);
 }
 
+#pragma comment(lib, "Synchronization.lib")
+
+uint32_t rgy_wait_on_address(std::atomic<uint32_t> *addr, uint32_t expected, uint32_t millisec) {
+    return WaitOnAddress((volatile VOID *)addr, &expected, sizeof(expected), millisec) ? WAIT_OBJECT_0 : WAIT_TIMEOUT;
+}
+
+void rgy_wake_by_address_all(std::atomic<uint32_t> *addr) {
+    WakeByAddressAll((PVOID)addr);
+}
+
 #endif //#if !(defined(_WIN32) || defined(_WIN64))
 
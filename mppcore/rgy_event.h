@@ -31,6 +31,7 @@
 
 #include <cstdint>
 #include <climits>
+#include <atomic>
 #include <memory>
 #include "rgy_osdep.h"
 
@@ -68,4 +69,16 @@ unique_event CreateEventUnique(void *pDummy, int bManualReset, int bInitialState
 unique_event CreateEventUnique(void *pDummy, int bManualReset, int bInitialState, const wchar_t* name);
 unique_event CreateEventUnique(void *pDummy, int bManualReset, int bInitialState);
 
+//*addrの値がexpectedのままなら、rgy_wake_by_address_allで起こされるかタイムアウトするまで待機する
+//(Linuxではfutex、WindowsではWaitOnAddressを使用し、イベントのようなmutexを介さない)
+//値が変化していなくても戻ることがあるので、呼び出し側で条件を再確認すること
+uint32_t rgy_wait_on_address(std::atomic<uint32_t> *addr, uint32_t expected, uint32_t millisec);
+void rgy_wake_by_address_all(std::atomic<uint32_t> *addr);
+
+#if !(defined(_WIN32) || defined(_WIN64))
+//共有メモリ上のaddrで、別プロセスとの間で待機・起床する (WindowsのWaitOnAddressはプロセス内のみなので、Linuxのみ)
+uint32_t rgy_wait_on_address_shared(std::atomic<uint32_t> *addr, uint32_t expected, uint32_t millisec);
+void rgy_wake_by_address_all_shared(std::atomic<uint32_t> *addr);
+#endif //#if !(defined(_WIN32) || defined(_WIN64))
+
 #endif //__RGY_EVENT_H__
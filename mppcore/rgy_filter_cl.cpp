@@ -84,6 +84,40 @@ RGY_ERR RGYFilter::AllocFrameBuf(const RGYFrameInfo &frame, int frames) {
     return RGY_ERR_NONE;
 }
 
+RGYFilterMemoryInfo RGYFilter::memoryInfo() const {
+    RGYFilterMemoryInfo info;
+    info.frames = (int)m_frameBuf.size();
+    if (info.frames == 0 || !m_frameBuf[0] || m_frameBuf[0]->frame.ptr[0] == nullptr) {
+        return info;
+    }
+    info.frame = m_frameBuf[0]->frame;
+    info.bytes = m_cl->frameSubBufferSize(info.frame) * info.frames;
+    info.aliasable = memoryAliasable()
+        && info.frames == 1
+        && m_param && !m_param->bOutOverwrite
+        && info.frame.mem_type == RGY_MEM_TYPE_GPU
+        && !m_frameBuf[0]->isPersistentMapped();
+    return info;
+}
+
+RGY_ERR RGYFilter::replaceFrameBuf(std::unique_ptr<RGYCLFrame> frame) {
+    if (!frame || m_frameBuf.size() != 1) {
+        return RGY_ERR_INVALID_CALL;
+    }
+    const auto& cur = m_frameBuf[0]->frame;
+    if (cmpFrameInfoCspResolution(&cur, &frame->frame)) {
+        return RGY_ERR_INVALID_PARAM;
+    }
+    //init時にm_frameBuf[0]のpitchを参照しているフィルタがあるので、pitchは一致していなければならない
+    for (int i = 0; i < RGY_CSP_PLANES[cur.csp]; i++) {
+        if (cur.pitch[i] != frame->frame.pitch[i]) {
+            return RGY_ERR_INVALID_PARAM;
+        }
+    }
+    m_frameBuf[0] = std::move(frame);
+    return RGY_ERR_NONE;
+}
+
 RGY_ERR RGYFilter::filter(RGYFrameInfo *pInputFrame, RGYFrameInfo **ppOutputFrames, int *pOutputFrameNum) {
     return filter(pInputFrame, ppOutputFrames, pOutputFrameNum, m_cl->queue());
 }
@@ -46,6 +46,16 @@ public:
 protected:
 };
 
+//RGYFilterMemoryPlannerに渡す出力バッファの情報
+struct RGYFilterMemoryInfo {
+    int frames;         //m_frameBufの枚数
+    RGYFrameInfo frame; //m_frameBuf[0]の情報
+    size_t bytes;       //m_frameBuf全体のサイズ
+    bool aliasable;     //出力バッファの領域を他のフィルタと共有可能か
+
+    RGYFilterMemoryInfo() : frames(0), frame(), bytes(0), aliasable(false) {};
+};
+
 class RGYFilter : public RGYFilterBase {
 public:
     RGYFilter(shared_ptr<RGYOpenCLContext> context);
@@ -60,6 +70,12 @@ public:
     // Reset only time-dependent state (pending queues, frame counters, cache metadata).
     // GPU buffer allocations and built kernels are preserved.
     virtual void resetTemporalState() {}
+    //出力バッファの共有(RGYFilterMemoryPlanner)に対応するか
+    //毎回1枚だけm_frameBuf[0]に出力し、入力は呼び出し中にのみ参照する(前のフレームを保持しない)フィルタのみtrueとする
+    virtual bool memoryAliasable() const { return false; }
+    RGYFilterMemoryInfo memoryInfo() const;
+    //m_frameBuf[0]をRGYFilterMemoryPlannerの割り当てたバッファに置き換える
+    RGY_ERR replaceFrameBuf(std::unique_ptr<RGYCLFrame> frame);
 protected:
     virtual RGY_ERR AllocFrameBuf(const RGYFrameInfo &frame, int frames) override;
     RGY_ERR filter_as_interlaced_pair(const RGYFrameInfo *pInputFrame, RGYFrameInfo *pOutputFrame);
@@ -97,6 +113,7 @@ public:
     RGYFilterCspCrop(shared_ptr<RGYOpenCLContext> context);
     virtual ~RGYFilterCspCrop();
     virtual RGY_ERR init(shared_ptr<RGYFilterParam> pParam, shared_ptr<RGYLog> pPrintMes) override;
+    virtual bool memoryAliasable() const override { return m_cropChain.empty(); }
 protected:
     virtual RGY_ERR run_filter(const RGYFrameInfo *pInputFrame, RGYFrameInfo **ppOutputFrames, int *pOutputFrameNum, RGYOpenCLQueue &queue, const std::vector<RGYOpenCLEvent> &wait_events, RGYOpenCLEvent *event) override;
     RGY_ERR convertYBitDepth(RGYFrameInfo *pOutputFrame, const RGYFrameInfo *pInputFrame, RGYOpenCLQueue &queue, const std::vector<RGYOpenCLEvent> &wait_events, RGYOpenCLEvent *event);
@@ -124,6 +141,7 @@ public:
     RGYFilterPad(shared_ptr<RGYOpenCLContext> context);
     virtual ~RGYFilterPad();
     virtual RGY_ERR init(shared_ptr<RGYFilterParam> pParam, shared_ptr<RGYLog> pPrintMes) override;
+    virtual bool memoryAliasable() const override { return true; }
 protected:
     virtual RGY_ERR run_filter(const RGYFrameInfo *pInputFrame, RGYFrameInfo **ppOutputFrames, int *pOutputFrameNum, RGYOpenCLQueue &queue, const std::vector<RGYOpenCLEvent> &wait_events, RGYOpenCLEvent *event) override;
     virtual void close() override;
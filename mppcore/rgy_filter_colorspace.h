@@ -138,6 +138,7 @@ public:
     RGYFilterColorspace(shared_ptr<RGYOpenCLContext> context);
     virtual ~RGYFilterColorspace();
     virtual RGY_ERR init(shared_ptr<RGYFilterParam> pParam, shared_ptr<RGYLog> pPrintMes) override;
+    virtual bool memoryAliasable() const override { return true; }
     virtual std::string genKernelCode();
     VideoVUIInfo VuiOut() const;
 protected:
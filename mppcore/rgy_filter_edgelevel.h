@@ -43,6 +43,7 @@ public:
     RGYFilterEdgelevel(shared_ptr<RGYOpenCLContext> context);
     virtual ~RGYFilterEdgelevel();
     virtual RGY_ERR init(shared_ptr<RGYFilterParam> pParam, shared_ptr<RGYLog> pPrintMes) override;
+    virtual bool memoryAliasable() const override { return true; }
 protected:
     virtual RGY_ERR run_filter(const RGYFrameInfo *pInputFrame, RGYFrameInfo **ppOutputFrames, int *pOutputFrameNum, RGYOpenCLQueue &queue, const std::vector<RGYOpenCLEvent> &wait_events, RGYOpenCLEvent *event) override;
     virtual void close() override;
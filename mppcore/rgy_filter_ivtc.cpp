@@ -29,9 +29,16 @@
 #include <algorithm>
 #include <array>
 #include <chrono>
+#include <cstring>
+#include <filesystem>
 #include <limits>
+#include <map>
+#include <mutex>
+#include <thread>
 #include "convert_csp.h"
 #include "rgy_avutil.h"
+#include "rgy_filesystem.h"
+#include "rgy_thread_pool.h"
 #include "rgy_filter_input_probe.h"
 #include "rgy_filter_ivtc.h"
 
@@ -1488,50 +1495,27 @@ RGY_ERR RGYFilterIvtc::overlayField(RGYCLFrame *dst, const RGYCLFrame *src, int
 // than parser-only but still finishes in <30 s for a 2-hour DVD, and
 // correctness trumps the speed gap at init.
 //
-// Returns a vector of per-frame metadata in DECODE order (the same
-// order RGYFilterIvtc::run_filter will see). The caller is
-// responsible for applying the trim offset when walking the vector.
-static RGY_ERR ivtcPreScanInput(const tstring &inputPath,
-                                 std::vector<IvtcPreScanFrame> &frames,
-                                 std::shared_ptr<RGYLog> log) {
+// ivtcPreScanRange decodes the whole input, or one byte range of it.
+//
+// keepStart < 0: sequential scan of the whole file, every decoded frame
+// is kept. This is the reference behaviour.
+//
+// keepStart >= 0: segment scan for the parallel pre-scan. Decoding
+// starts at byte seekPos (a keyframe one GOP before keepStart, so the
+// references of the first kept GOP are available), and only the frames
+// coded in packets at [keepStart, keepEnd) are kept (keepEnd < 0 = to
+// EOF). Each packet's pts is replaced by its byte position so the
+// decoder carries it through reordering to the output frame. Both ends
+// of the range must land exactly on a keyframe packet; otherwise
+// RGY_ERR_INVALID_DATA_TYPE is returned and the caller falls back to
+// the sequential scan.
+static RGY_ERR ivtcPreScanRange(const tstring &inputPath,
+                                const std::string &filenameUtf8,
+                                int64_t seekPos, int64_t keepStart, int64_t keepEnd,
+                                std::vector<IvtcPreScanFrame> &frames,
+                                std::shared_ptr<RGYLog> log) {
     frames.clear();
-    if (inputPath.empty()) {
-        if (log) log->write(RGY_LOG_ERROR, RGY_LOGT_VPP, _T("ivtc prescan: input path is empty\n"));
-        return RGY_ERR_INVALID_PARAM;
-    }
-    std::string filenameUtf8;
-    // The 3-arg tchar_to_string overload takes a const TCHAR*, so we
-    // pass inputPath.c_str() (matches the existing pattern at
-    // rgy_input_avcodec.cpp:1502).
-    if (0 == tchar_to_string(inputPath.c_str(), filenameUtf8, CP_UTF8)) {
-        if (log) log->write(RGY_LOG_ERROR, RGY_LOGT_VPP, _T("ivtc prescan: failed to convert filename to utf-8\n"));
-        return RGY_ERR_UNSUPPORTED;
-    }
-    if (const auto protocol = unsupportedProbeProtocol(filenameUtf8); protocol != nullptr) {
-        if (log) log->write(RGY_LOG_WARN, RGY_LOGT_VPP,
-            _T("ivtc prescan: input \"%s\" uses %s protocol, which cannot be pre-scanned safely. ")
-            _T("--vpp-ivtc expand requires a re-openable local file input.\n"),
-            inputPath.c_str(), char_to_tstring(protocol).c_str());
-        return RGY_ERR_UNSUPPORTED;
-    }
-
-    // Silence libav "[mpeg2video] ac-tex damaged" / "Invalid mb type"
-    // clutter for the duration of the pre-scan. DVD m2v streams often
-    // have start-of-GOP decoder slop that's normally absorbed by
-    // QSVEnc's main reader (which sees more context). For the pre-scan
-    // we only care about the picture-header bits (repeat_pict / tff),
-    // which the decoder resolves even when macroblock coefficients are
-    // mangled -- so these error-level messages are cosmetic here.
-    //
-    // Scope the suppression to this function: save the current level,
-    // set AV_LOG_FATAL (silences ERROR/WARNING/INFO; keeps genuine
-    // fatals visible), restore via RAII when we return.
-    const int savedAvLogLevel = av_log_get_level();
-    av_log_set_level(AV_LOG_FATAL);
-    struct AvLogLevelRestorer {
-        int prev;
-        ~AvLogLevelRestorer() { av_log_set_level(prev); }
-    } avLogGuard{savedAvLogLevel};
+    const bool segment = keepStart >= 0;
 
     AVFormatContext *fmtCtxRaw = nullptr;
     int avret = avformat_open_input(&fmtCtxRaw, filenameUtf8.c_str(), nullptr, nullptr);
@@ -1592,6 +1576,15 @@ static RGY_ERR ivtcPreScanInput(const tstring &inputPath,
         return RGY_ERR_UNKNOWN;
     }
 
+    if (segment && seekPos > 0) {
+        if ((avret = av_seek_frame(fmtCtx, -1, seekPos, AVSEEK_FLAG_BYTE)) < 0) {
+            if (log) log->write(RGY_LOG_DEBUG, RGY_LOGT_VPP,
+                _T("ivtc prescan: byte seek to %lld failed: %s\n"),
+                (long long)seekPos, qsv_av_err2str(avret).c_str());
+            return RGY_ERR_INVALID_DATA_TYPE;
+        }
+    }
+
     AVPacket *pktRaw = av_packet_alloc();
     if (!pktRaw) return RGY_ERR_NULL_PTR;
     std::unique_ptr<AVPacket, RGYAVDeleter<AVPacket>> pktGuard(
@@ -1604,6 +1597,9 @@ static RGY_ERR ivtcPreScanInput(const tstring &inputPath,
         frameRaw, RGYAVDeleter<AVFrame>(av_frame_free));
     AVFrame *frame = frameGuard.get();
 
+    // Segment scan: set when a frame cannot be mapped back to its packet.
+    bool unmappedFrame = false;
+
     // Drain any frames the decoder already has queued before or after a
     // send_packet call. Reads out to `frames` until EAGAIN / EOF.
     auto drainDecoder = [&]() -> int {
@@ -1611,6 +1607,17 @@ static RGY_ERR ivtcPreScanInput(const tstring &inputPath,
             int ret = avcodec_receive_frame(codecCtx, frame);
             if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF) return ret;
             if (ret < 0) return ret;
+            if (segment) {
+                // frame->pts is the byte position of the packet the
+                // picture was coded in (see the send loop below).
+                if (frame->pts == AV_NOPTS_VALUE) {
+                    unmappedFrame = true;
+                }
+                if (frame->pts == AV_NOPTS_VALUE || frame->pts < keepStart) {
+                    av_frame_unref(frame); // warm-up GOP
+                    continue;
+                }
+            }
             IvtcPreScanFrame f;
             // AVFrame::repeat_pict encodes the number of *extra* field
             // half-periods the display should be delayed by:
@@ -1636,12 +1643,38 @@ static RGY_ERR ivtcPreScanInput(const tstring &inputPath,
         }
     };
 
-    const auto scanStart = std::chrono::steady_clock::now();
+    bool startFound = false; // segment scan: first packet at/after keepStart seen
+    bool endFound   = false; // segment scan: first packet at/after keepEnd seen
     while (av_read_frame(fmtCtx, pkt) >= 0) {
         if (pkt->stream_index != videoIdx) {
             av_packet_unref(pkt);
             continue;
         }
+        if (segment) {
+            if (pkt->pos < 0) {
+                av_packet_unref(pkt);
+                return RGY_ERR_INVALID_DATA_TYPE;
+            }
+            const bool key = (pkt->flags & AV_PKT_FLAG_KEY) != 0;
+            if (!startFound && pkt->pos >= keepStart) {
+                // The sequential scan must have a segment boundary here too.
+                if (pkt->pos != keepStart || !key) {
+                    av_packet_unref(pkt);
+                    return RGY_ERR_INVALID_DATA_TYPE;
+                }
+                startFound = true;
+            }
+            if (keepEnd >= 0 && pkt->pos >= keepEnd) {
+                endFound = (pkt->pos == keepEnd && key);
+                av_packet_unref(pkt);
+                if (!endFound) {
+                    return RGY_ERR_INVALID_DATA_TYPE;
+                }
+                break;
+            }
+            pkt->pts = pkt->pos;
+            pkt->dts = AV_NOPTS_VALUE;
+        }
         int sendRet = avcodec_send_packet(codecCtx, pkt);
         if (sendRet < 0 && sendRet != AVERROR(EAGAIN)) {
             // Non-fatal send failure (e.g. corrupt frame) -- skip packet.
@@ -1661,6 +1694,412 @@ static RGY_ERR ivtcPreScanInput(const tstring &inputPath,
     avcodec_send_packet(codecCtx, nullptr);
     drainDecoder();
 
+    if (segment && (!startFound || (keepEnd >= 0 && !endFound) || unmappedFrame)) {
+        return RGY_ERR_INVALID_DATA_TYPE;
+    }
+    return RGY_ERR_NONE;
+}
+
+// Parallel pre-scan: segment boundaries.
+//
+// Byte-seeks a private demuxer to targetPos and returns the positions of
+// the first two keyframe packets after it. The second one becomes a
+// segment boundary; the first one is where that segment starts decoding
+// (one GOP of warm-up, so open-GOP leading B-frames get their forward
+// reference). The first keyframe is not used as the boundary itself
+// because the demuxer/parser may still be resynchronising right after
+// the seek.
+static bool ivtcPreScanFindBoundary(const std::string &filenameUtf8, int64_t targetPos,
+                                    int64_t &warmupPos, int64_t &boundaryPos) {
+    AVFormatContext *fmtCtxRaw = nullptr;
+    if (avformat_open_input(&fmtCtxRaw, filenameUtf8.c_str(), nullptr, nullptr) < 0) {
+        return false;
+    }
+    std::unique_ptr<AVFormatContext, RGYAVDeleter<AVFormatContext>> fmtCtxGuard(
+        fmtCtxRaw, RGYAVDeleter<AVFormatContext>(avformat_close_input));
+    AVFormatContext *fmtCtx = fmtCtxGuard.get();
+    if (avformat_find_stream_info(fmtCtx, nullptr) < 0) {
+        return false;
+    }
+    const int videoIdx = av_find_best_stream(fmtCtx, AVMEDIA_TYPE_VIDEO, -1, -1, nullptr, 0);
+    if (videoIdx < 0 || av_seek_frame(fmtCtx, -1, targetPos, AVSEEK_FLAG_BYTE) < 0) {
+        return false;
+    }
+    AVPacket *pktRaw = av_packet_alloc();
+    if (!pktRaw) return false;
+    std::unique_ptr<AVPacket, RGYAVDeleter<AVPacket>> pktGuard(
+        pktRaw, RGYAVDeleter<AVPacket>(av_packet_free));
+    AVPacket *pkt = pktGuard.get();
+
+    // A GOP is normally well under a second; give up after a generous
+    // number of video packets rather than walk the rest of the file.
+    static const int MAX_PACKETS = 4096;
+    int keyFound = 0;
+    for (int videoPackets = 0; videoPackets < MAX_PACKETS && av_read_frame(fmtCtx, pkt) >= 0; ) {
+        if (pkt->stream_index == videoIdx) {
+            videoPackets++;
+            if ((pkt->flags & AV_PKT_FLAG_KEY) && pkt->pos >= 0) {
+                if (keyFound++ == 0) {
+                    warmupPos = pkt->pos;
+                } else {
+                    boundaryPos = pkt->pos;
+                    av_packet_unref(pkt);
+                    return true;
+                }
+            }
+        }
+        av_packet_unref(pkt);
+    }
+    return false;
+}
+
+// Parallel pre-scan. Splits the file into byte ranges at GOP boundaries
+// and runs ivtcPreScanRange on each range concurrently. Returns false
+// (frames untouched) when the input is not suitable or any segment
+// fails its boundary check; the caller then runs the sequential scan.
+//
+// Only MPEG-1/2 is split: its decoder output order never crosses a GOP
+// boundary (a GOP's leading B-frames are output after the previous
+// GOP's last anchor), so concatenating the per-segment results in byte
+// order reproduces the sequential scan exactly.
+static const uint64_t IVTC_PRESCAN_SEGMENT_MIN = 128ull * 1024 * 1024; // bytes per segment
+static const int      IVTC_PRESCAN_SEGMENT_MAX = 8;
+
+static bool ivtcPreScanParallel(const tstring &inputPath, const std::string &filenameUtf8,
+                                uint64_t fileSize,
+                                std::vector<IvtcPreScanFrame> &frames,
+                                std::shared_ptr<RGYLog> log) {
+    const int threads = std::min<int>({ (int)std::thread::hardware_concurrency(), IVTC_PRESCAN_SEGMENT_MAX,
+                                        (int)std::min<uint64_t>(fileSize / IVTC_PRESCAN_SEGMENT_MIN, IVTC_PRESCAN_SEGMENT_MAX) });
+    if (threads <= 1) {
+        return false;
+    }
+    {
+        // Check the codec and byte-seekability once before spending
+        // any time on boundaries.
+        AVFormatContext *fmtCtxRaw = nullptr;
+        if (avformat_open_input(&fmtCtxRaw, filenameUtf8.c_str(), nullptr, nullptr) < 0) {
+            return false;
+        }
+        std::unique_ptr<AVFormatContext, RGYAVDeleter<AVFormatContext>> fmtCtxGuard(
+            fmtCtxRaw, RGYAVDeleter<AVFormatContext>(avformat_close_input));
+        if (avformat_find_stream_info(fmtCtxRaw, nullptr) < 0) {
+            return false;
+        }
+        const int videoIdx = av_find_best_stream(fmtCtxRaw, AVMEDIA_TYPE_VIDEO, -1, -1, nullptr, 0);
+        if (videoIdx < 0 || (fmtCtxRaw->iformat->flags & AVFMT_NO_BYTE_SEEK)) {
+            return false;
+        }
+        const auto codecId = fmtCtxRaw->streams[videoIdx]->codecpar->codec_id;
+        if (codecId != AV_CODEC_ID_MPEG2VIDEO && codecId != AV_CODEC_ID_MPEG1VIDEO) {
+            return false;
+        }
+    }
+
+    const auto scanStart = std::chrono::steady_clock::now();
+    struct Segment {
+        int64_t seekPos;
+        int64_t keepStart;
+        int64_t keepEnd;
+        RGY_ERR err;
+        std::vector<IvtcPreScanFrame> frames;
+    };
+    std::vector<Segment> segments(threads);
+    RGYThreadPool pool(threads - 1);
+    // Boundaries: segment 0 starts at the top of the file without a seek.
+    segments[0].seekPos = 0;
+    segments[0].keepStart = 0;
+    std::vector<char> boundaryOK(threads, 1);
+    pool.parallel_for(1, threads, threads - 1, [&](int start, int end) {
+        for (int i = start; i < end; i++) {
+            boundaryOK[i] = ivtcPreScanFindBoundary(filenameUtf8, (int64_t)(fileSize * i / threads),
+                                                    segments[i].seekPos, segments[i].keepStart) ? 1 : 0;
+        }
+    });
+    for (int i = 1; i < threads; i++) {
+        if (!boundaryOK[i] || segments[i].keepStart <= segments[i - 1].keepStart) {
+            if (log) log->write(RGY_LOG_DEBUG, RGY_LOGT_VPP,
+                _T("ivtc prescan: could not find segment boundary %d, using sequential scan.\n"), i);
+            return false;
+        }
+    }
+    for (int i = 0; i < threads; i++) {
+        segments[i].keepEnd = (i + 1 < threads) ? segments[i + 1].keepStart : -1;
+    }
+    pool.parallel_for(0, threads, threads, [&](int start, int end) {
+        for (int i = start; i < end; i++) {
+            auto &seg = segments[i];
+            seg.err = ivtcPreScanRange(inputPath, filenameUtf8, seg.seekPos, seg.keepStart, seg.keepEnd, seg.frames, nullptr);
+        }
+    });
+    size_t total = 0;
+    for (int i = 0; i < threads; i++) {
+        if (segments[i].err != RGY_ERR_NONE) {
+            if (log) log->write(RGY_LOG_DEBUG, RGY_LOGT_VPP,
+                _T("ivtc prescan: segment %d [%lld, %lld) failed (%s), using sequential scan.\n"),
+                i, (long long)segments[i].keepStart, (long long)segments[i].keepEnd, get_err_mes(segments[i].err));
+            return false;
+        }
+        total += segments[i].frames.size();
+    }
+    frames.clear();
+    frames.reserve(total);
+    for (const auto &seg : segments) {
+        frames.insert(frames.end(), seg.frames.begin(), seg.frames.end());
+    }
+    const double elapsedMs = std::chrono::duration<double, std::milli>(
+        std::chrono::steady_clock::now() - scanStart).count();
+    if (log) log->write(RGY_LOG_DEBUG, RGY_LOGT_VPP,
+        _T("ivtc prescan: parallel scan with %d segments in %.1f ms\n"), threads, elapsedMs);
+    return true;
+}
+
+// Pre-scan result cache.
+//
+// The pre-scan is a full decode of the input, run before the first
+// frame is encoded, and again whenever the same input is encoded
+// again. Its result depends only on the input file, so it is cached:
+//  - in memory, shared by the --server jobs (they run as threads in
+//    this process). Scans of the same file are serialised so only the
+//    first job decodes;
+//  - on disk in the temp directory, keyed by the absolute input path,
+//    size and mtime, for the next run.
+// The cache file is <tmp>/rgyivtc_<hash of path>.cache: a header, the
+// UTF-8 input path, then one flag byte per frame.
+static const char     IVTC_PRESCAN_CACHE_MAGIC[8]   = { 'R', 'G', 'Y', 'I', 'V', 'T', 'C', '\0' };
+static const uint32_t IVTC_PRESCAN_CACHE_VERSION    = 1;
+static const uint8_t  IVTC_PRESCAN_CACHE_RFF         = 0x01;
+static const uint8_t  IVTC_PRESCAN_CACHE_TFF         = 0x02;
+static const uint8_t  IVTC_PRESCAN_CACHE_PROGRESSIVE = 0x04;
+
+struct IvtcPreScanCacheHeader {
+    char     magic[8];
+    uint32_t version;
+    uint32_t pathBytes;
+    uint64_t srcFileSize;
+    int64_t  srcMtime;
+    uint64_t frameCount;
+};
+
+struct IvtcPreScanKey {
+    std::string pathUtf8; // absolute path
+    uint64_t    fileSize;
+    int64_t     mtime;
+    bool operator==(const IvtcPreScanKey &x) const {
+        return pathUtf8 == x.pathUtf8 && fileSize == x.fileSize && mtime == x.mtime;
+    }
+};
+
+struct IvtcPreScanMemCache {
+    std::mutex                    mtx;   // held while a job loads or scans this file
+    bool                          valid;
+    IvtcPreScanKey                key;
+    std::vector<IvtcPreScanFrame> frames;
+    IvtcPreScanMemCache() : mtx(), valid(false), key(), frames() {};
+};
+
+static bool ivtcPreScanGetKey(const tstring &inputPath, IvtcPreScanKey &key) {
+    std::error_code ec;
+    const auto absPath = std::filesystem::absolute(std::filesystem::path(inputPath), ec).lexically_normal();
+    if (ec) return false;
+    key.fileSize = std::filesystem::file_size(absPath, ec);
+    if (ec) return false;
+    const auto mtime = std::filesystem::last_write_time(absPath, ec);
+    if (ec) return false;
+    key.mtime = (int64_t)mtime.time_since_epoch().count();
+    key.pathUtf8 = absPath.u8string();
+    return true;
+}
+
+static std::filesystem::path ivtcPreScanCachePath(const IvtcPreScanKey &key) {
+    // FNV-1a: stable across runs and builds, unlike std::hash.
+    uint64_t hash = 0xcbf29ce484222325ull;
+    for (const auto c : key.pathUtf8) {
+        hash = (hash ^ (uint8_t)c) * 0x100000001b3ull;
+    }
+    std::error_code ec;
+    auto dir = std::filesystem::temp_directory_path(ec);
+    if (ec) return std::filesystem::path();
+    char name[64];
+    sprintf_s(name, "rgyivtc_%016llx.cache", (unsigned long long)hash);
+    return dir / name;
+}
+
+static RGY_ERR ivtcPreScanCacheLoad(const IvtcPreScanKey &key, std::vector<IvtcPreScanFrame> &frames) {
+    const auto cachePath = ivtcPreScanCachePath(key);
+    if (cachePath.empty()) return RGY_ERR_NOT_FOUND;
+    std::unique_ptr<FILE, fp_deleter> fp(fopen(cachePath.string().c_str(), "rb"), fp_deleter());
+    if (!fp) return RGY_ERR_NOT_FOUND;
+    IvtcPreScanCacheHeader header;
+    if (fread(&header, 1, sizeof(header), fp.get()) != sizeof(header)
+        || memcmp(header.magic, IVTC_PRESCAN_CACHE_MAGIC, sizeof(IVTC_PRESCAN_CACHE_MAGIC)) != 0
+        || header.version != IVTC_PRESCAN_CACHE_VERSION
+        || header.pathBytes != key.pathUtf8.length()
+        || header.srcFileSize != key.fileSize
+        || header.srcMtime != key.mtime) {
+        return RGY_ERR_INVALID_VERSION;
+    }
+    std::string path(header.pathBytes, '\0');
+    if (fread(&path[0], 1, path.length(), fp.get()) != path.length() || path != key.pathUtf8) {
+        return RGY_ERR_INVALID_VERSION;
+    }
+    // frameCount comes from the file; check it against the file size
+    // before allocating.
+    std::error_code ec;
+    const auto cacheSize = std::filesystem::file_size(cachePath, ec);
+    if (ec || cacheSize != sizeof(header) + header.pathBytes + header.frameCount) {
+        return RGY_ERR_INVALID_FORMAT;
+    }
+    std::vector<uint8_t> flags((size_t)header.frameCount);
+    if (fread(flags.data(), 1, flags.size(), fp.get()) != flags.size()) {
+        return RGY_ERR_INVALID_FORMAT;
+    }
+    frames.resize(flags.size());
+    for (size_t i = 0; i < flags.size(); i++) {
+        frames[i].rff         = (flags[i] & IVTC_PRESCAN_CACHE_RFF) != 0;
+        frames[i].tff         = (flags[i] & IVTC_PRESCAN_CACHE_TFF) != 0;
+        frames[i].progressive = (flags[i] & IVTC_PRESCAN_CACHE_PROGRESSIVE) != 0;
+    }
+    return RGY_ERR_NONE;
+}
+
+static RGY_ERR ivtcPreScanCacheWrite(const IvtcPreScanKey &key, const std::vector<IvtcPreScanFrame> &frames) {
+    const auto cachePath = ivtcPreScanCachePath(key);
+    if (cachePath.empty()) return RGY_ERR_NOT_FOUND;
+    IvtcPreScanCacheHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, IVTC_PRESCAN_CACHE_MAGIC, sizeof(IVTC_PRESCAN_CACHE_MAGIC));
+    header.version     = IVTC_PRESCAN_CACHE_VERSION;
+    header.pathBytes   = (uint32_t)key.pathUtf8.length();
+    header.srcFileSize = key.fileSize;
+    header.srcMtime    = key.mtime;
+    header.frameCount  = frames.size();
+    std::vector<uint8_t> flags(frames.size());
+    for (size_t i = 0; i < frames.size(); i++) {
+        flags[i] = (frames[i].rff ? IVTC_PRESCAN_CACHE_RFF : 0)
+                 | (frames[i].tff ? IVTC_PRESCAN_CACHE_TFF : 0)
+                 | (frames[i].progressive ? IVTC_PRESCAN_CACHE_PROGRESSIVE : 0);
+    }
+    // Write to a temporary name and rename, so that a concurrent
+    // process never reads a partial cache (same as RGYFrameIndex::write).
+    const auto tmpPath = cachePath.string() + strsprintf(".%u.%llx.tmp", (uint32_t)GetCurrentProcessId(),
+        (unsigned long long)std::hash<std::thread::id>()(std::this_thread::get_id()));
+    {
+        std::unique_ptr<FILE, fp_deleter> fp(fopen(tmpPath.c_str(), "wb"), fp_deleter());
+        if (!fp) return RGY_ERR_FILE_OPEN;
+        if (fwrite(&header, 1, sizeof(header), fp.get()) != sizeof(header)
+            || fwrite(key.pathUtf8.data(), 1, key.pathUtf8.length(), fp.get()) != key.pathUtf8.length()
+            || fwrite(flags.data(), 1, flags.size(), fp.get()) != flags.size()
+            || fflush(fp.get()) != 0) {
+            fp.reset();
+            rgy_file_remove(tmpPath.c_str());
+            return RGY_ERR_UNKNOWN;
+        }
+    }
+    if (!rgy_file_rename(tmpPath, cachePath.string(), true)) {
+        rgy_file_remove(tmpPath.c_str());
+        return RGY_ERR_ACCESS_DENIED;
+    }
+    return RGY_ERR_NONE;
+}
+
+static std::shared_ptr<IvtcPreScanMemCache> ivtcPreScanMemCacheGet(const std::string &pathUtf8) {
+    static std::mutex mtx;
+    static std::map<std::string, std::shared_ptr<IvtcPreScanMemCache>> caches;
+    std::lock_guard<std::mutex> lock(mtx);
+    auto &entry = caches[pathUtf8];
+    if (!entry) {
+        entry = std::make_shared<IvtcPreScanMemCache>();
+    }
+    return entry;
+}
+
+// Entry point used by init(): cached result if available, otherwise the
+// parallel scan (MPEG-1/2, large files) or the sequential scan.
+//
+// Returns a vector of per-frame metadata in DECODE order (the same
+// order RGYFilterIvtc::run_filter will see). The caller is
+// responsible for applying the trim offset when walking the vector.
+static RGY_ERR ivtcPreScanInput(const tstring &inputPath,
+                                 std::vector<IvtcPreScanFrame> &frames,
+                                 std::shared_ptr<RGYLog> log) {
+    frames.clear();
+    if (inputPath.empty()) {
+        if (log) log->write(RGY_LOG_ERROR, RGY_LOGT_VPP, _T("ivtc prescan: input path is empty\n"));
+        return RGY_ERR_INVALID_PARAM;
+    }
+    std::string filenameUtf8;
+    // The 3-arg tchar_to_string overload takes a const TCHAR*, so we
+    // pass inputPath.c_str() (matches the existing pattern at
+    // rgy_input_avcodec.cpp:1502).
+    if (0 == tchar_to_string(inputPath.c_str(), filenameUtf8, CP_UTF8)) {
+        if (log) log->write(RGY_LOG_ERROR, RGY_LOGT_VPP, _T("ivtc prescan: failed to convert filename to utf-8\n"));
+        return RGY_ERR_UNSUPPORTED;
+    }
+    if (const auto protocol = unsupportedProbeProtocol(filenameUtf8); protocol != nullptr) {
+        if (log) log->write(RGY_LOG_WARN, RGY_LOGT_VPP,
+            _T("ivtc prescan: input \"%s\" uses %s protocol, which cannot be pre-scanned safely. ")
+            _T("--vpp-ivtc expand requires a re-openable local file input.\n"),
+            inputPath.c_str(), char_to_tstring(protocol).c_str());
+        return RGY_ERR_UNSUPPORTED;
+    }
+
+    const auto scanStart = std::chrono::steady_clock::now();
+    IvtcPreScanKey key;
+    const bool cacheable = ivtcPreScanGetKey(inputPath, key);
+    std::shared_ptr<IvtcPreScanMemCache> memCache;
+    std::unique_lock<std::mutex> memCacheLock;
+    const TCHAR *source = _T("scanned");
+    if (cacheable) {
+        memCache = ivtcPreScanMemCacheGet(key.pathUtf8);
+        memCacheLock = std::unique_lock<std::mutex>(memCache->mtx);
+    }
+    if (memCache && memCache->valid && memCache->key == key) {
+        frames = memCache->frames;
+        source = _T("memory cache");
+    } else if (cacheable && ivtcPreScanCacheLoad(key, frames) == RGY_ERR_NONE) {
+        source = _T("cache file");
+    } else {
+        // Silence libav "[mpeg2video] ac-tex damaged" / "Invalid mb type"
+        // clutter for the duration of the pre-scan. DVD m2v streams often
+        // have start-of-GOP decoder slop that's normally absorbed by
+        // QSVEnc's main reader (which sees more context). For the pre-scan
+        // we only care about the picture-header bits (repeat_pict / tff),
+        // which the decoder resolves even when macroblock coefficients are
+        // mangled -- so these error-level messages are cosmetic here.
+        //
+        // Scope the suppression to the scan: save the current level,
+        // set AV_LOG_FATAL (silences ERROR/WARNING/INFO; keeps genuine
+        // fatals visible), restore via RAII when we are done.
+        const int savedAvLogLevel = av_log_get_level();
+        av_log_set_level(AV_LOG_FATAL);
+        struct AvLogLevelRestorer {
+            int prev;
+            ~AvLogLevelRestorer() { av_log_set_level(prev); }
+        } avLogGuard{savedAvLogLevel};
+
+        if (cacheable && ivtcPreScanParallel(inputPath, filenameUtf8, key.fileSize, frames, log)) {
+            source = _T("scanned in parallel");
+        } else {
+            const auto err = ivtcPreScanRange(inputPath, filenameUtf8, 0, -1, -1, frames, log);
+            if (err != RGY_ERR_NONE) {
+                frames.clear();
+                return err;
+            }
+        }
+        if (cacheable) {
+            const auto cacheErr = ivtcPreScanCacheWrite(key, frames);
+            if (log) log->write((cacheErr == RGY_ERR_NONE) ? RGY_LOG_DEBUG : RGY_LOG_WARN, RGY_LOGT_VPP,
+                _T("ivtc prescan: write cache %s: %s\n"),
+                char_to_tstring(ivtcPreScanCachePath(key).string()).c_str(), get_err_mes(cacheErr));
+        }
+    }
+    if (memCache) {
+        memCache->key    = key;
+        memCache->frames = frames;
+        memCache->valid  = true;
+    }
+
     const double elapsedMs = std::chrono::duration<double, std::milli>(
         std::chrono::steady_clock::now() - scanStart).count();
 
@@ -1675,8 +2114,8 @@ static RGY_ERR ivtcPreScanInput(const tstring &inputPath,
         }
     }
     if (log) log->write(RGY_LOG_INFO, RGY_LOGT_VPP,
-        _T("ivtc prescan: %d frames scanned (%d RFF = %.3f%%, RFF-TFF=%d RFF-BFF=%d) in %.1f ms\n"),
-        (int)frames.size(), rffCount,
+        _T("ivtc prescan: %d frames %s (%d RFF = %.3f%%, RFF-TFF=%d RFF-BFF=%d) in %.1f ms\n"),
+        (int)frames.size(), source, rffCount,
         frames.empty() ? 0.0 : (100.0 * rffCount / (double)frames.size()),
         tffCount, bffCount, elapsedMs);
     return RGY_ERR_NONE;
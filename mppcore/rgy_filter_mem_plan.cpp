@@ -0,0 +1,138 @@
+﻿// -----------------------------------------------------------------------------------------
+// QSVEnc/NVEnc by rigaya
+// -----------------------------------------------------------------------------------------
+// The MIT License
+//
+// Copyright (c) 2011-2016 rigaya
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// --------------------------------------------------------------------------------------------
+
+#include <algorithm>
+#include "rgy_filter_mem_plan.h"
+
+RGYFilterMemoryPlanner::RGYFilterMemoryPlanner(std::shared_ptr<RGYOpenCLContext> cl, std::shared_ptr<RGYLog> log) :
+    m_cl(cl),
+    m_log(log),
+    m_arena(),
+    m_bytesBefore(0),
+    m_bytesAfter(0),
+    m_aliasedFilters(0) {
+}
+
+RGYFilterMemoryPlanner::~RGYFilterMemoryPlanner() {
+    close();
+}
+
+void RGYFilterMemoryPlanner::close() {
+    //sub-bufferが残っていても、OpenCLの仕様上arena本体の解放はsub-bufferの解放まで遅延される
+    m_arena.clear();
+    m_bytesBefore = 0;
+    m_bytesAfter = 0;
+    m_aliasedFilters = 0;
+}
+
+void RGYFilterMemoryPlanner::AddMessage(RGYLogLevel log_level, const TCHAR *format, ...) {
+    if (m_log == nullptr || log_level < m_log->getLogLevel(RGY_LOGT_VPP)) {
+        return;
+    }
+    va_list args;
+    va_start(args, format);
+    int len = _vsctprintf(format, args) + 1; // _vscprintf doesn't count terminating '\0'
+    tstring buffer;
+    buffer.resize(len, _T('\0'));
+    _vstprintf_s(&buffer[0], len, format, args);
+    va_end(args);
+    m_log->write(log_level, RGY_LOGT_VPP, (_T("vpp mem plan: ") + tstring(buffer.c_str())).c_str());
+}
+
+RGY_ERR RGYFilterMemoryPlanner::plan(std::vector<std::unique_ptr<RGYFilter>>& filters) {
+    const int nfilters = (int)filters.size();
+    std::vector<RGYFilterMemoryInfo> infos(nfilters);
+    uint64_t bytesBefore = 0;
+    for (int i = 0; i < nfilters; i++) {
+        infos[i] = filters[i]->memoryInfo();
+        bytesBefore += infos[i].bytes;
+        AddMessage(RGY_LOG_DEBUG, _T("  [%d] %s: %d frame(s), %dx%d %s, %.1f MB%s.\n"), i, filters[i]->name().c_str(),
+            infos[i].frames, infos[i].frame.width, infos[i].frame.height, RGY_CSP_NAMES[infos[i].frame.csp],
+            infos[i].bytes / (double)(1024 * 1024), infos[i].aliasable ? _T(", aliasable") : _T(""));
+    }
+    m_bytesBefore += bytesBefore;
+
+    //生存区間 [i, i+1] が重ならないものを同じslotに割り当てる (区間グラフの貪欲法による彩色)
+    //次のフィルタがmemoryAliasable()でない場合、出力を呼び出し後も参照したり、そのまま後段に渡す可能性があるので対象外
+    std::vector<Slot> slots;
+    for (int i = 0; i + 1 < nfilters; i++) {
+        if (!infos[i].aliasable || !infos[i+1].aliasable) {
+            continue;
+        }
+        auto slot = std::find_if(slots.begin(), slots.end(), [i](const Slot& s) { return s.lastUse < i; });
+        if (slot == slots.end()) {
+            slots.push_back(Slot{ 0, 0, 0, {} });
+            slot = slots.end() - 1;
+        }
+        slot->size = std::max(slot->size, m_cl->frameSubBufferSize(infos[i].frame));
+        slot->lastUse = i + 1;
+        slot->members.push_back(i);
+    }
+    //ひとつのフィルタしか使わないslotは共有の効果がないので、個別のバッファのままとする
+    slots.erase(std::remove_if(slots.begin(), slots.end(), [](const Slot& s) { return s.members.size() < 2; }), slots.end());
+
+    size_t arenaSize = 0;
+    uint64_t aliasedBytes = 0;
+    for (auto& slot : slots) {
+        slot.offset = arenaSize;
+        arenaSize += slot.size; // frameSubBufferSizeはsubBufferAlignment()の倍数
+        for (const auto idx : slot.members) {
+            aliasedBytes += infos[idx].bytes;
+        }
+    }
+    if (slots.empty() || arenaSize >= aliasedBytes) {
+        m_bytesAfter += bytesBefore;
+        AddMessage(RGY_LOG_DEBUG, _T("no buffers to alias.\n"));
+        return RGY_ERR_NONE;
+    }
+    const auto maxAlloc = m_cl->platform()->dev(0).info().max_mem_alloc_size;
+    auto arena = (maxAlloc == 0 || arenaSize <= maxAlloc) ? m_cl->createBuffer(arenaSize, CL_MEM_READ_WRITE) : std::unique_ptr<RGYCLBuf>();
+    if (!arena || arena->mem() == nullptr) {
+        m_bytesAfter += bytesBefore;
+        AddMessage(RGY_LOG_WARN, _T("failed to allocate arena (%.1f MB), use dedicated buffers.\n"), arenaSize / (double)(1024 * 1024));
+        return RGY_ERR_NONE;
+    }
+
+    uint64_t bytesAfter = bytesBefore - aliasedBytes + arenaSize;
+    for (int islot = 0; islot < (int)slots.size(); islot++) {
+        for (const auto idx : slots[islot].members) {
+            //割り当てに失敗した場合、そのフィルタは個別に確保済みのバッファをそのまま使用する
+            auto frame = m_cl->createFrameSubBuffer(infos[idx].frame, arena->mem(), slots[islot].offset);
+            auto err = (frame) ? filters[idx]->replaceFrameBuf(std::move(frame)) : RGY_ERR_MEMORY_ALLOC;
+            if (err != RGY_ERR_NONE) {
+                AddMessage(RGY_LOG_WARN, _T("failed to alias output buffer of %s, use dedicated buffer: %s.\n"), filters[idx]->name().c_str(), get_err_mes(err));
+                bytesAfter += infos[idx].bytes;
+                continue;
+            }
+            AddMessage(RGY_LOG_DEBUG, _T("  [%d] %s -> slot %d.\n"), idx, filters[idx]->name().c_str(), islot);
+            m_aliasedFilters++;
+        }
+    }
+    m_bytesAfter += bytesAfter;
+    m_arena.push_back(std::move(arena));
+    return RGY_ERR_NONE;
+}
@@ -0,0 +1,70 @@
+﻿// -----------------------------------------------------------------------------------------
+// QSVEnc/NVEnc by rigaya
+// -----------------------------------------------------------------------------------------
+// The MIT License
+//
+// Copyright (c) 2011-2016 rigaya
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// --------------------------------------------------------------------------------------------
+
+#pragma once
+#ifndef __RGY_FILTER_MEM_PLAN_H__
+#define __RGY_FILTER_MEM_PLAN_H__
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include "rgy_filter_cl.h"
+
+//OpenCLフィルタブロック内の出力バッファの生存期間を求め、重ならないものを共通のarenaの同じ領域に割り当てる
+//ブロック内のフィルタは先頭から順に同一のin-orderキューで処理されるので、
+//i番目のフィルタの出力はi番目で書き込まれ、i+1番目で読み込まれた後は不要となる
+//ただし、そのような仮定ができるのはmemoryAliasable()がtrueのフィルタ同士の間のみで、
+//それ以外のフィルタの出力バッファは従来どおり個別に確保したものを使用する
+class RGYFilterMemoryPlanner {
+public:
+    RGYFilterMemoryPlanner(std::shared_ptr<RGYOpenCLContext> cl, std::shared_ptr<RGYLog> log);
+    ~RGYFilterMemoryPlanner();
+    //filtersはひとつのOpenCLフィルタブロック (複数のブロックに対して呼んでよい)
+    RGY_ERR plan(std::vector<std::unique_ptr<RGYFilter>>& filters);
+    void close();
+
+    uint64_t bytesBefore() const { return m_bytesBefore; }
+    uint64_t bytesAfter() const { return m_bytesAfter; }
+    int aliasedFilters() const { return m_aliasedFilters; }
+protected:
+    struct Slot {
+        size_t offset;
+        size_t size;
+        int lastUse;             //このslotを最後に使用するフィルタのindex
+        std::vector<int> members; //このslotを使用するフィルタのindex
+    };
+    void AddMessage(RGYLogLevel log_level, const TCHAR *format, ...);
+
+    std::shared_ptr<RGYOpenCLContext> m_cl;
+    std::shared_ptr<RGYLog> m_log;
+    std::vector<std::unique_ptr<RGYCLBuf>> m_arena;
+    uint64_t m_bytesBefore;
+    uint64_t m_bytesAfter;
+    int m_aliasedFilters;
+};
+
+#endif //__RGY_FILTER_MEM_PLAN_H__
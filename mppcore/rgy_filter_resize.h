@@ -55,6 +55,7 @@ public:
     RGYFilterResize(shared_ptr<RGYOpenCLContext> context);
     virtual ~RGYFilterResize();
     virtual RGY_ERR init(shared_ptr<RGYFilterParam> pParam, shared_ptr<RGYLog> pPrintMes) override;
+    virtual bool memoryAliasable() const override { return !m_libplaceboResample; }
 protected:
     struct RGYResizeGaussPlane {
         std::unique_ptr<RGYCLFrame> tmp;
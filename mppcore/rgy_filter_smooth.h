@@ -48,6 +48,7 @@ public:
     RGYFilterSmooth(shared_ptr<RGYOpenCLContext> context);
     virtual ~RGYFilterSmooth();
     virtual RGY_ERR init(shared_ptr<RGYFilterParam> pParam, shared_ptr<RGYLog> pPrintMes) override;
+    virtual bool memoryAliasable() const override { return true; }
 protected:
     int qp_size(int res) { return divCeil(res + 15, 16); }
     virtual RGY_ERR run_filter(const RGYFrameInfo *pInputFrame, RGYFrameInfo **ppOutputFrames, int *pOutputFrameNum, RGYOpenCLQueue &queue, const std::vector<RGYOpenCLEvent> &wait_events, RGYOpenCLEvent *event) override;
@@ -84,23 +84,6 @@ const char *csp_rgy_to_y4mheader(const RGY_CSP csp) {
     return nullptr;
 }
 
-RGYConvertCSPPrm::RGYConvertCSPPrm() :
-    abort(false),
-    dst(nullptr),
-    src(nullptr),
-    interlaced(false),
-    width(0),
-    src_y_pitch_byte(0),
-    src_uv_pitch_byte(0),
-    dst_y_pitch_byte(0),
-    dst_uv_pitch_byte(0),
-    height(0),
-    dst_height(0),
-    crop(nullptr) {
-
-}
-
-
 RGYConvertCSP::RGYConvertCSP() : RGYConvertCSP(0, RGYParamThread()) {
 }
 
@@ -111,22 +94,13 @@ RGYConvertCSP::RGYConvertCSP(int threads, RGYParamThread threadParam) :
     m_uv_only(false),
     m_alpha(nullptr),
     m_threads(threads),
-    m_th(), m_heStart(), m_heFin(), m_heFinCopy(),
-    m_threadParam(threadParam), m_prm() {
+    m_threadParam(threadParam),
+    m_pool(),
+    m_affinityBase(-1) {
 };
 
 RGYConvertCSP::~RGYConvertCSP() {
-    m_prm.abort = true;
-    for (size_t i = 0; i < m_heStart.size(); i++) {
-        SetEvent(m_heStart[i].get());
-    }
-    for (size_t i = 0; i < m_th.size(); i++) {
-        m_th[i].join();
-    }
-    m_heFinCopy.clear();
-    m_heStart.clear();
-    m_heFin.clear();
-    m_th.clear();
+    m_pool.reset();
 };
 const ConvertCSP *RGYConvertCSP::getFunc(RGY_CSP csp_from, RGY_CSP csp_to, bool uv_only, RGY_SIMD simd) {
     if (m_csp == nullptr
@@ -150,66 +124,34 @@ int RGYConvertCSP::run(int interlaced, void **dst, const void **src, int width,
         const int max = (m_csp->simd == RGY_SIMD::NONE) ? 8 : 4;
         m_threads = (dst_y_pitch_byte % 128 != 0) ? 1 : std::min(max, ((int)get_cpu_info().physical_cores + div) / div);
     }
-    if (m_threads > 1 && m_th.size() == 0) {
-        m_heFinCopy.clear();
-        m_heStart.clear();
-        m_heFin.clear();
-        for (int ith = 0; ith < m_threads; ith++) {
-            auto heStart = std::unique_ptr<void, handle_deleter>(CreateEvent(nullptr, false, false, nullptr), handle_deleter());
-            auto heFin = std::unique_ptr<void, handle_deleter>(CreateEvent(nullptr, false, false, nullptr), handle_deleter());
-            m_th.push_back(std::thread([heStart = heStart.get(), heFin = heFin.get(), ithId = ith, threadN = m_threads, threadParam = m_threadParam,
-                prm = &m_prm, cspfunc = &m_csp, alphafunc = m_alpha, csp_from = m_csp_from, csp_to = m_csp_to]() {
-                threadParam.apply(GetCurrentThread());
-                WaitForSingleObject((HANDLE)heStart, INFINITE);
-                while (!prm->abort) {
-                    (*cspfunc)->func[prm->interlaced](prm->dst, prm->src,
-                        prm->width, prm->src_y_pitch_byte, prm->src_uv_pitch_byte, prm->dst_y_pitch_byte, prm->dst_uv_pitch_byte,
-                        prm->height, prm->dst_height, ithId, threadN, prm->crop);
-                    if (alphafunc) {
-                        const int dstPlaneOffset = RGY_CSP_PLANES[csp_from] - 1;
-                        const int srcPlaneOffset = RGY_CSP_PLANES[csp_to] - 1;
-                        alphafunc(prm->dst + dstPlaneOffset, prm->src + srcPlaneOffset,
-                            prm->width, prm->src_y_pitch_byte, 0, prm->dst_y_pitch_byte, prm->dst_uv_pitch_byte,
-                            prm->height, prm->dst_height, ithId, threadN, prm->crop);
-                    }
-                    SetEvent((HANDLE)heFin);
-                    WaitForSingleObject((HANDLE)heStart, INFINITE);
-                }
-            }));
-            m_heFinCopy.push_back(heFin.get());
-            m_heStart.push_back(std::move(heStart));
-            m_heFin.push_back(std::move(heFin));
-        }
+    if (m_threads > 1 && !m_pool) {
+        m_pool = RGYThreadPool::shared(m_threadParam);
+        //複数の変換が同時に動作する場合に、同じワーカーに偏らないようずらして割り当てる
+        static std::atomic<int> affinityCounter(0);
+        m_affinityBase = affinityCounter.fetch_add(m_threads - 1) % m_pool->size();
     }
-    m_prm.abort = false;
-    m_prm.interlaced = interlaced;
-    m_prm.dst = dst;
-    m_prm.src = src;
-    m_prm.width = width;
-    m_prm.src_y_pitch_byte = src_y_pitch_byte;
-    m_prm.src_uv_pitch_byte = src_uv_pitch_byte;
-    m_prm.dst_y_pitch_byte = dst_y_pitch_byte;
-    m_prm.dst_uv_pitch_byte = dst_uv_pitch_byte;
-    m_prm.height = height;
-    m_prm.dst_height = dst_height;
-    m_prm.crop = crop;
-    for (size_t i = 0; i < m_heStart.size(); i++) {
-        SetEvent(m_heStart[i].get());
-    }
-    if (m_threads == 1) {
+    auto convert = [&](int ithId, int threadN) {
         m_csp->func[interlaced](dst, src,
             width, src_y_pitch_byte, src_uv_pitch_byte, dst_y_pitch_byte, dst_uv_pitch_byte,
-            height, dst_height, 0, 1, crop);
+            height, dst_height, ithId, threadN, crop);
         if (m_alpha) {
             const int dstPlaneOffset = RGY_CSP_PLANES[m_csp_from] - 1;
             const int srcPlaneOffset = RGY_CSP_PLANES[m_csp_to] - 1;
             m_alpha(dst + dstPlaneOffset, src + srcPlaneOffset,
                 width, src_y_pitch_byte, src_uv_pitch_byte, dst_y_pitch_byte, dst_uv_pitch_byte,
-                height, dst_height, 0, 1, crop);
+                height, dst_height, ithId, threadN, crop);
         }
-    }
-    if (m_th.size() > 0) {
-        WaitForMultipleObjects((uint32_t)m_heFinCopy.size(), m_heFinCopy.data(), TRUE, INFINITE);
+    };
+    if (m_threads <= 1 || !m_pool) {
+        convert(0, 1);
+    } else {
+        //各スレッド番号の担当範囲は変換関数側で決まるので、スレッド番号を1つずつ割り当てる
+        const int threadN = m_threads;
+        m_pool->parallel_for(0, threadN, threadN, [&](int start, int end) {
+            for (int ith = start; ith < end; ith++) {
+                convert(ith, threadN);
+            }
+        }, m_affinityBase);
     }
     return 0;
 }
@@ -480,6 +422,7 @@ RGY_ERR initReaders(
     const bool vpp_rff,
     const bool vpp_require_hdr_metadata,
     const bool vpp_ivtc_expand_active,
+    const bool trimSmart,
     RGYPoolAVPacket *poolPkt,
     RGYPoolAVFrame *poolFrame,
     RGYListRef<RGYFrameDataQP> *qpTableListRef,
@@ -664,6 +607,12 @@ RGY_ERR initReaders(
         inputInfoAVCuvid.seekRatio = common->seekRatio;
         inputInfoAVCuvid.seekSec = common->seekSec;
         inputInfoAVCuvid.seekToSec = common->seekToSec;
+        inputInfoAVCuvid.indexFile = common->inputIndex.getFilename(common->inputFilename, _T(".rgyindex"));
+        //--trimで先頭や途中に範囲外がある場合、フレームインデックスを使用してseekで読み飛ばす (--seek, --trim-smartとは併用しない)
+        inputInfoAVCuvid.trimSeek = inputInfoAVCuvid.indexFile.length() > 0
+            && !trimSmart
+            && common->seekSec <= 0.0f && common->seekRatio <= 0.0f
+            && (common->nTrimCount > 1 || (common->nTrimCount == 1 && common->pTrimList[0].start > 0));
         inputInfoAVCuvid.logFramePosList = ctrl->logFramePosList.getFilename(common->inputFilename, _T(".framelist.csv"));
         inputInfoAVCuvid.logPackets = ctrl->logPacketsList.getFilename(common->inputFilename, _T(".packets.csv"));
         inputInfoAVCuvid.threadInput = ctrl->threadInput;
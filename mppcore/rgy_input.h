@@ -35,6 +35,7 @@
 #include "rgy_tchar.h"
 #include "rgy_log.h"
 #include "rgy_event.h"
+#include "rgy_thread_pool.h"
 #include "rgy_status.h"
 #include "rgy_timecode.h"
 #include "convert_csp.h"
@@ -124,23 +125,6 @@ static const char *trackMediaTypeStr(int trackID) {
 }
 #endif //#if ENABLE_AVSW_READER
 
-struct RGYConvertCSPPrm {
-    bool abort;
-    void **dst;
-    const void **src;
-    int interlaced;
-    int width;
-    int src_y_pitch_byte;
-    int src_uv_pitch_byte;
-    int dst_y_pitch_byte;
-    int dst_uv_pitch_byte;
-    int height;
-    int dst_height;
-    int *crop;
-
-    RGYConvertCSPPrm();
-};
-
 class RGYConvertCSP {
 private:
     const ConvertCSP *m_csp;
@@ -149,12 +133,9 @@ private:
     bool m_uv_only;
     funcConvertCSP m_alpha;
     int m_threads;
-    std::vector<std::thread> m_th;
-    std::vector<std::unique_ptr<void, handle_deleter>> m_heStart;
-    std::vector<std::unique_ptr<void, handle_deleter>> m_heFin;
-    std::vector<HANDLE> m_heFinCopy;
     RGYParamThread m_threadParam;
-    RGYConvertCSPPrm m_prm;
+    std::shared_ptr<RGYThreadPool> m_pool; //同じスレッド設定の変換間で共有するスレッドプール
+    int m_affinityBase; //毎フレーム同じ範囲を同じワーカーで処理するためのワーカー番号
 public:
     RGYConvertCSP();
     RGYConvertCSP(int threads, RGYParamThread threadParam);
@@ -375,6 +356,7 @@ RGY_ERR initReaders(
     const bool vpp_rff,
     const bool vpp_require_hdr_metadata,
     const bool vpp_ivtc_expand_active,
+    const bool trimSmart,
     RGYPoolAVPacket *poolPkt,
     RGYPoolAVFrame *poolFrame,
     RGYListRef<RGYFrameDataQP> *qpTableListRef,
@@ -159,7 +159,19 @@ AVDemuxVideo::AVDemuxVideo() :
     contentLight(std::unique_ptr<AVContentLightMetadata, RGYAVDeleter<AVContentLightMetadata>>(nullptr, RGYAVDeleter<AVContentLightMetadata>(av_freep))),
     qpTableListRef(nullptr),
     parse_nal_h264(get_parse_nal_unit_h264_func()),
-    parse_nal_hevc(get_parse_nal_unit_hevc_func()) {
+    parse_nal_hevc(get_parse_nal_unit_hevc_func()),
+    smartCut(),
+    smartCutGop(),
+    smartCutDecodePkt(),
+    smartCutFrames(0),
+    trimSeekPts(),
+    trimSeekEntry(),
+    trimSeekEnabled(false),
+    trimSeekNextEntry(0),
+    trimSeekRetryEntry(0),
+    trimSeekKeyPts(AV_NOPTS_VALUE),
+    trimSeekCount(0),
+    trimSeekSkipFrames(0) {
 }
 
 void AVDemuxVideo::close(RGYLog *log) {
@@ -211,6 +223,28 @@ void AVDemuxVideo::close(RGYLog *log) {
         CLOSE_LOG_DEBUG(_T("Freed first video packet.\n"));
         firstPkt = nullptr;
     }
+    if (smartCutGop.size() > 0 || smartCutDecodePkt.size() > 0) {
+        CLOSE_LOG_DEBUG(_T("Free smart cut packets...\n"));
+        for (auto& pkt : smartCutGop) {
+            av_packet_free(&pkt);
+        }
+        smartCutGop.clear();
+        for (auto& pkt : smartCutDecodePkt) {
+            av_packet_free(&pkt.first);
+        }
+        smartCutDecodePkt.clear();
+        CLOSE_LOG_DEBUG(_T("Freed smart cut packets.\n"));
+    }
+    smartCut.reset();
+    smartCutFrames = 0;
+    trimSeekEnabled = false;
+    trimSeekPts.clear();
+    trimSeekEntry.clear();
+    trimSeekNextEntry = 0;
+    trimSeekRetryEntry = 0;
+    trimSeekKeyPts = AV_NOPTS_VALUE;
+    trimSeekCount = 0;
+    trimSeekSkipFrames = 0;
 
     if (extradata) {
         CLOSE_LOG_DEBUG(_T("Free extra data...\n"));
@@ -269,6 +303,8 @@ RGYInputAvcodecPrm::RGYInputAvcodecPrm(RGYInputPrm base) :
     logFramePosList(),
     logCopyFrameData(),
     logPackets(),
+    indexFile(),
+    trimSeek(false),
     threadInput(0),
     threadParamInput(),
     queueInfo(nullptr),
@@ -294,6 +330,9 @@ RGYInputAvcodec::RGYInputAvcodec() :
     m_Demux(),
     m_logFramePosList(),
     m_fpPacketList(),
+    m_frameIndex(),
+    m_frameIndexFile(),
+    m_frameIndexRecord(false),
     m_hevcMp42AnnexbBuffer(),
     m_maxSrcWidth(0),
     m_maxSrcHeight(0),
@@ -377,6 +416,8 @@ void RGYInputAvcodec::Close() {
     m_trimParam.offset = 0;
 
     m_hevcMp42AnnexbBuffer.clear();
+    m_frameIndexRecord = false;
+    m_frameIndexFile.clear();
 
     //free input buffer (使用していない)
     //if (buffer) {
@@ -453,6 +494,26 @@ RGY_ERR RGYInputAvcodec::initVideoBsfs() {
     return RGY_ERR_NONE;
 }
 
+//parserの解析結果からpict_type, pic_struct, repeat_pictを取得する
+static void getParserPictInfo(const AVCodecParserContext *parserCtx, uint8_t *pict_type, uint8_t *pic_struct, uint8_t *repeat_pict) {
+    *pict_type = (uint8_t)(std::max)(parserCtx->pict_type, 0);
+    switch (parserCtx->picture_structure) {
+        //フィールドとして符号化されている
+    case AV_PICTURE_STRUCTURE_TOP_FIELD:    *pic_struct = RGY_PICSTRUCT_FIELD_TOP; break;
+    case AV_PICTURE_STRUCTURE_BOTTOM_FIELD: *pic_struct = RGY_PICSTRUCT_FIELD_BOTTOM; break;
+        //フレームとして符号化されている
+    default:
+        switch (parserCtx->field_order) {
+        case AV_FIELD_TT:
+        case AV_FIELD_TB: *pic_struct = RGY_PICSTRUCT_FRAME_TFF; break;
+        case AV_FIELD_BT:
+        case AV_FIELD_BB: *pic_struct = RGY_PICSTRUCT_FRAME_BFF; break;
+        default:          *pic_struct = RGY_PICSTRUCT_FRAME;     break;
+        }
+    }
+    *repeat_pict = (uint8_t)parserCtx->repeat_pict;
+}
+
 RGY_ERR RGYInputAvcodec::initVideoParser() {
     if (m_Demux.video.pParserCtx) {
         AddMessage(RGY_LOG_DEBUG, _T("initVideoParser: Close old parser...\n"));
@@ -2123,6 +2184,25 @@ RGY_ERR RGYInputAvcodec::Init(const TCHAR *strFileName, VideoInfo *inputInfo, co
 
         AddMessage(RGY_LOG_DEBUG, _T("start predecode.\n"));
 
+        //trimの範囲外をseekで読み飛ばす (HWデコードのみ)
+        const bool trimSeekRequested = input_prm->trimSeek
+            && m_inputVideoInfo.codec != RGY_CODEC_UNKNOWN
+            && m_inputVideoInfo.codec != RGY_CODEC_MPEG2;
+        if (input_prm->indexFile.length() > 0) {
+            initFrameIndex(strFileName, input_prm->indexFile);
+            //trimでのseekに使用するため、読み込みを始める前に作成しておく
+            if (trimSeekRequested && m_frameIndexFile.length() > 0 && !m_frameIndex.complete()) {
+                m_frameIndexRecord = false;
+                if (buildFrameIndex() == RGY_ERR_NONE) {
+                    writeFrameIndex();
+                }
+                if (int ret = frameIndexSeekToStart(m_Demux.format.formatCtx); ret < 0) {
+                    AddMessage(RGY_LOG_ERROR, _T("failed to seek to the beginning of the file: %s.\n"), qsv_av_err2str(ret).c_str());
+                    return RGY_ERR_UNKNOWN;
+                }
+            }
+        }
+
         //ヘッダーの取得を確認する
         RGY_ERR sts = RGY_ERR_NONE;
         RGYBitstream bitstream = RGYBitstreamInit();
@@ -2189,6 +2269,14 @@ RGY_ERR RGYInputAvcodec::Init(const TCHAR *strFileName, VideoInfo *inputInfo, co
                 AddMessage(RGY_LOG_ERROR, _T("Failed to get firstpkt of video!\n"));
                 return RGY_ERR_UNKNOWN;
             }
+            //seekすると先頭から連続して読み込まなくなるので、getSampleでの記録は行えない
+            //インデックスがなければここで作成し、以降のseekや次回の実行で使用する
+            m_frameIndexRecord = false;
+            if (m_frameIndexFile.length() > 0 && !m_frameIndex.complete()) {
+                if (buildFrameIndex() == RGY_ERR_NONE) {
+                    writeFrameIndex();
+                }
+            }
             double seek_sec = input_prm->seekSec;
             if (input_prm->seekRatio > 0.0f) {
                 double seek_start_sec = (input_prm->seekSec > 0.0f) ? (double)input_prm->seekSec : 0.0;
@@ -2199,7 +2287,13 @@ RGY_ERR RGYInputAvcodec::Init(const TCHAR *strFileName, VideoInfo *inputInfo, co
                 seek_sec = seek_start_sec + (duration_fin_sec - seek_start_sec) * input_prm->seekRatio;
             }
             const auto seek_time = av_rescale_q(1, av_d2q(seek_sec, 1<<24), m_Demux.video.stream->time_base);
-            int seek_ret = av_seek_frame(m_Demux.format.formatCtx, m_Demux.video.index, firstpkt->pts + seek_time, 0);
+            int seek_ret = -1;
+            if (m_frameIndex.complete() && seekByFrameIndex(firstpkt->pts + seek_time) == RGY_ERR_NONE) {
+                seek_ret = 0;
+            }
+            if (0 > seek_ret) {
+                seek_ret = av_seek_frame(m_Demux.format.formatCtx, m_Demux.video.index, firstpkt->pts + seek_time, 0);
+            }
             if (0 > seek_ret) {
                 seek_ret = av_seek_frame(m_Demux.format.formatCtx, m_Demux.video.index, firstpkt->pts + seek_time, AVSEEK_FLAG_ANY);
             }
@@ -2274,6 +2368,9 @@ RGY_ERR RGYInputAvcodec::Init(const TCHAR *strFileName, VideoInfo *inputInfo, co
             }
             AddMessage(RGY_LOG_DEBUG, _T("adjust trim by offset %d.\n"), m_trimParam.offset);
         }
+        if (trimSeekRequested && m_frameIndex.complete()) {
+            initTrimSeek();
+        }
 
         m_seek.second = input_prm->seekToSec;
         if (input_prm->seekToSec > 0.0f) {
@@ -3127,6 +3224,11 @@ void RGYInputAvcodec::checkPmtChange() {
                     AddMessage(RGY_LOG_INFO, _T("pmt follow: video stream %d (pid 0x%x) -> %d (pid 0x%x).\n"),
                         m_Demux.video.index, oldCurrentStream->id, newIndex, newStream->id);
                     m_Demux.video.index = newIndex;
+                    //フレームインデックスは1つのストリームのみを対象とするので、記録を中止する
+                    if (m_frameIndexRecord) {
+                        m_frameIndexRecord = false;
+                        m_frameIndex.clear();
+                    }
                     //新ストリームの途中から読み始めることになるため、先頭がIピクチャとは限らない。
                     //次のキーフレームが来るまでパケットを捨てる(実際の破棄は getSample() 側)
                     m_Demux.video.waitKeyAfterSwitch = true;
@@ -3277,6 +3379,11 @@ void RGYInputAvcodec::sortAndPushSubtitlePacket() {
     m_Demux.format.subPacketTemporalBufferIntervalCount = -1;
 }
 
+//フレームインデックスの情報からframesに登録するフレーム情報を作る (seekで読み飛ばしたフレーム用)
+static FramePos framePosFromIndex(const RGYFrameIndexEntry& entry) {
+    return framePos(entry.pts, entry.dts, entry.duration, 0, FRAMEPOS_POC_INVALID, entry.flags, entry.pic_struct, entry.repeat_pict, entry.pict_type);
+}
+
 std::tuple<int, std::unique_ptr<AVPacket, RGYAVDeleter<AVPacket>>> RGYInputAvcodec::getSample(bool bTreatFirstPacketAsKeyframe) {
     int i_samples = 0;
     int ret_read_frame = 0;
@@ -3330,6 +3437,32 @@ std::tuple<int, std::unique_ptr<AVPacket, RGYAVDeleter<AVPacket>>> RGYInputAvcod
                     m_Demux.video.pmtSwitchDropCount);
                 m_Demux.video.waitKeyAfterSwitch = false;
             }
+            int indexEntryIdx = -1;
+            if (m_Demux.video.trimSeekPts.size() > 0) {
+                auto& video = m_Demux.video;
+                indexEntryIdx = trimSeekEntryIdx(pkt->pts);
+                if (indexEntryIdx >= 0) {
+                    if (indexEntryIdx < video.trimSeekNextEntry) {
+                        //seek直後に、読み込み済みのパケットを再度読んだ場合は捨てる
+                        av_packet_unref(pkt.get());
+                        continue;
+                    }
+                    //seekで読み飛ばしたフレームも、音声との同期のためframesに登録しておく
+                    const auto& entries = m_frameIndex.entries();
+                    for (int i = video.trimSeekNextEntry; i < indexEntryIdx; i++) {
+                        m_Demux.frames.add(framePosFromIndex(entries[i]));
+                        video.trimSeekSkipFrames++;
+                    }
+                    video.trimSeekNextEntry = indexEntryIdx + 1;
+                    if (video.trimSeekKeyPts != AV_NOPTS_VALUE && pkt->pts < video.trimSeekKeyPts) {
+                        //seek先のキーフレームより前に表示されるフレーム(leading picture)は参照先がないので、デコードに回さない
+                        m_Demux.frames.add(framePosFromIndex(entries[indexEntryIdx]));
+                        video.trimSeekSkipFrames++;
+                        av_packet_unref(pkt.get());
+                        continue;
+                    }
+                }
+            }
             if (pkt->flags & AV_PKT_FLAG_CORRUPT) {
                 const auto timestamp = (pkt->pts == AV_NOPTS_VALUE) ? pkt->dts : pkt->pts;
                 AddMessage(RGY_LOG_WARN, _T("corrupt packet in video: %lld (%s)\n"), (long long int)timestamp, getTimestampString(timestamp, m_Demux.video.stream->time_base).c_str());
@@ -3378,22 +3511,19 @@ std::tuple<int, std::unique_ptr<AVPacket, RGYAVDeleter<AVPacket>>> RGYInputAvcod
                 uint8_t* dummy = nullptr;
                 int dummy_size = 0;
                 av_parser_parse2(m_Demux.video.pParserCtx, m_Demux.video.pCodecCtxParser, &dummy, &dummy_size, pkt->data, pkt->size, pkt->pts, pkt->dts, pkt->pos);
-                pos.pict_type = (uint8_t)(std::max)(m_Demux.video.pParserCtx->pict_type, 0);
-                switch (m_Demux.video.pParserCtx->picture_structure) {
-                    //フィールドとして符号化されている
-                case AV_PICTURE_STRUCTURE_TOP_FIELD:    pos.pic_struct = RGY_PICSTRUCT_FIELD_TOP; break;
-                case AV_PICTURE_STRUCTURE_BOTTOM_FIELD: pos.pic_struct = RGY_PICSTRUCT_FIELD_BOTTOM; break;
-                    //フレームとして符号化されている
-                default:
-                    switch (m_Demux.video.pParserCtx->field_order) {
-                    case AV_FIELD_TT:
-                    case AV_FIELD_TB: pos.pic_struct = RGY_PICSTRUCT_FRAME_TFF; break;
-                    case AV_FIELD_BT:
-                    case AV_FIELD_BB: pos.pic_struct = RGY_PICSTRUCT_FRAME_BFF; break;
-                    default:          pos.pic_struct = RGY_PICSTRUCT_FRAME;     break;
-                    }
-                }
-                pos.repeat_pict = (uint8_t)m_Demux.video.pParserCtx->repeat_pict;
+                getParserPictInfo(m_Demux.video.pParserCtx, &pos.pict_type, &pos.pic_struct, &pos.repeat_pict);
+            }
+            if (m_frameIndexRecord) {
+                RGYFrameIndexEntry entry = { 0 };
+                entry.pts = pkt->pts;
+                entry.dts = pkt->dts;
+                entry.pos = pkt->pos;
+                entry.duration = (int32_t)pkt->duration;
+                entry.flags = (uint8_t)(pkt->flags | ((pos.pict_type == AV_PICTURE_TYPE_I) ? AV_PKT_FLAG_KEY : 0));
+                entry.pic_struct = pos.pic_struct;
+                entry.repeat_pict = pos.repeat_pict;
+                entry.pict_type = pos.pict_type;
+                m_frameIndex.add(entry);
             }
             //mkv入りのVC-1をカットしたものなど、動画によってはpkt->flagsにフラグがセットされていないことがある
             //parserの情報も活用してキーフレームかどうかを判定する
@@ -3441,6 +3571,9 @@ std::tuple<int, std::unique_ptr<AVPacket, RGYAVDeleter<AVPacket>>> RGYInputAvcod
             }
             //ptsの確定したところまで、音声を出力する
             CheckAndMoveStreamPacketList();
+            if (m_Demux.video.trimSeekEnabled && indexEntryIdx >= 0) {
+                trimSeekSkip(indexEntryIdx, pkt->pts);
+            }
             return { 0, std::move(pkt) };
         }
         auto *stream = getPacketStreamData(pkt.get());
@@ -3468,7 +3601,18 @@ std::tuple<int, std::unique_ptr<AVPacket, RGYAVDeleter<AVPacket>>> RGYInputAvcod
         AddMessage(RGY_LOG_ERROR, _T("error while reading file: %d frames, %s\n"), m_Demux.frames.frameNum(), qsv_av_err2str(ret_read_frame).c_str());
         m_Demux.format.inputError = RGY_ERR_INVALID_DATA_TYPE;
     }
+    if (m_frameIndexRecord) {
+        //trimやseektoで途中で読み込みを打ち切った場合は、不完全なので保存しない
+        if (ret_read_frame == AVERROR_EOF) {
+            m_frameIndex.setComplete();
+            writeFrameIndex();
+        }
+        m_frameIndexRecord = false;
+    }
     AddMessage(RGY_LOG_DEBUG, _T("%d frames, %s\n"), m_Demux.frames.frameNum(), qsv_av_err2str(ret_read_frame).c_str());
+    if (m_Demux.video.trimSeekCount > 0) {
+        AddMessage(RGY_LOG_INFO, _T("trim seek: skipped %d frames by %d seeks.\n"), m_Demux.video.trimSeekSkipFrames, m_Demux.video.trimSeekCount);
+    }
     //たまっている字幕があれば送出する
     sortAndPushSubtitlePacket();
     //動画の終端を表す最後のptsを挿入する
@@ -3505,15 +3649,324 @@ std::tuple<int, std::unique_ptr<AVPacket, RGYAVDeleter<AVPacket>>> RGYInputAvcod
     return { AVERROR_EOF, nullptr };
 }
 
-//動画ストリームの1フレーム分のデータをbitstreamに追加する (リーダー側のデータは消す)
-RGY_ERR RGYInputAvcodec::GetNextBitstream(RGYBitstream *pBitstream) {
+//TSなどタイムスタンプが不連続になりうる形式では、タイムスタンプでのseekはファイル内の二分探索となり遅く不正確なので、
+//フレームインデックスに記録したバイト位置でseekする
+static bool frameIndexUseByteSeek(const AVFormatContext *formatCtx) {
+    return (formatCtx->iformat->flags & AVFMT_TS_DISCONT) != 0
+        && (formatCtx->iformat->flags & AVFMT_NO_BYTE_SEEK) == 0;
+}
+
+//ファイルの先頭に戻す
+static int frameIndexSeekToStart(AVFormatContext *formatCtx) {
+    if (frameIndexUseByteSeek(formatCtx)) {
+        return av_seek_frame(formatCtx, -1, 0, AVSEEK_FLAG_BYTE);
+    }
+    const auto startTime = (formatCtx->start_time != AV_NOPTS_VALUE) ? formatCtx->start_time : 0;
+    return avformat_seek_file(formatCtx, -1, INT64_MIN, startTime, startTime, 0);
+}
+
+void RGYInputAvcodec::initFrameIndex(const tstring& srcFile, const tstring& indexFile) {
+    m_frameIndexFile.clear();
+    m_frameIndexRecord = false;
+    if (m_Demux.format.isPipe || !seekable()) {
+        AddMessage(RGY_LOG_WARN, _T("frame index is not available for this input, --input-index disabled.\n"));
+        return;
+    }
+    auto sts = m_frameIndex.init(srcFile, m_Demux.video.index, m_Demux.video.stream->codecpar->codec_id, m_Demux.video.stream->time_base);
+    if (sts != RGY_ERR_NONE) {
+        AddMessage(RGY_LOG_WARN, _T("failed to get file info of \"%s\", --input-index disabled: %s.\n"), srcFile.c_str(), get_err_mes(sts));
+        return;
+    }
+    m_frameIndexFile = indexFile;
+    sts = m_frameIndex.load(m_frameIndexFile);
+    if (sts == RGY_ERR_NONE) {
+        AddMessage(RGY_LOG_DEBUG, _T("loaded frame index \"%s\": %d packets, duration %s.\n"),
+            m_frameIndexFile.c_str(), (int)m_frameIndex.entries().size(), print_time(m_frameIndex.durationSec()).c_str());
+        return;
+    }
+    if (sts == RGY_ERR_FILE_OPEN) {
+        AddMessage(RGY_LOG_DEBUG, _T("frame index \"%s\" not found.\n"), m_frameIndexFile.c_str());
+    } else {
+        AddMessage(RGY_LOG_DEBUG, _T("frame index \"%s\" does not match input, will be recreated: %s.\n"), m_frameIndexFile.c_str(), get_err_mes(sts));
+    }
+    //seekしない場合は、通常の読み込み中に記録し、最後まで読み込めたら保存する
+    m_frameIndexRecord = true;
+}
+
+RGY_ERR RGYInputAvcodec::buildFrameIndex() {
+    auto formatCtx = m_Demux.format.formatCtx;
+    const auto codecpar = m_Demux.video.stream->codecpar;
+    m_frameIndex.clear();
+    AddMessage(RGY_LOG_INFO, _T("creating frame index \"%s\"...\n"), m_frameIndexFile.c_str());
+    const auto timeStart = std::chrono::system_clock::now();
+
+    int ret = frameIndexSeekToStart(formatCtx);
+    if (ret < 0) {
+        AddMessage(RGY_LOG_WARN, _T("failed to seek to the beginning of the file to create frame index: %s.\n"), qsv_av_err2str(ret).c_str());
+        return RGY_ERR_UNKNOWN;
+    }
+
+    //映像のパケットのみを読み込む
+    std::vector<AVDiscard> discardOrg(formatCtx->nb_streams);
+    for (uint32_t i = 0; i < formatCtx->nb_streams; i++) {
+        discardOrg[i] = formatCtx->streams[i]->discard;
+        if ((int)i != m_Demux.video.index) {
+            formatCtx->streams[i]->discard = AVDISCARD_ALL;
+        }
+    }
+    //pic_structはparserから取得する (parserのないコーデックでは記録しない)
+    std::unique_ptr<AVCodecParserContext, RGYAVDeleter<AVCodecParserContext>> parserCtx(av_parser_init(codecpar->codec_id),
+        RGYAVDeleter<AVCodecParserContext>([](AVCodecParserContext **ptr) { av_parser_close(*ptr); }));
+    std::unique_ptr<AVCodecContext, RGYAVDeleter<AVCodecContext>> parserCodecCtx(nullptr, RGYAVDeleter<AVCodecContext>(avcodec_free_context));
+    if (parserCtx) {
+        parserCtx->flags |= PARSER_FLAG_COMPLETE_FRAMES;
+        parserCodecCtx.reset(avcodec_alloc_context3(avcodec_find_decoder(codecpar->codec_id)));
+        if (!parserCodecCtx || avcodec_parameters_to_context(parserCodecCtx.get(), codecpar) < 0) {
+            parserCtx.reset();
+        }
+    }
+    auto pkt = m_poolPkt->getFree();
+    while ((ret = av_read_frame(formatCtx, pkt.get())) >= 0 || ret == AVERROR(EAGAIN)) {
+        if (ret == AVERROR(EAGAIN)) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            continue;
+        }
+        if (pkt->stream_index == m_Demux.video.index) {
+            RGYFrameIndexEntry entry = { 0 };
+            entry.pts = pkt->pts;
+            entry.dts = pkt->dts;
+            entry.pos = pkt->pos;
+            entry.duration = (int32_t)pkt->duration;
+            entry.flags = (uint8_t)pkt->flags;
+            if (parserCtx) {
+                uint8_t *dummy = nullptr;
+                int dummy_size = 0;
+                av_parser_parse2(parserCtx.get(), parserCodecCtx.get(), &dummy, &dummy_size, pkt->data, pkt->size, pkt->pts, pkt->dts, pkt->pos);
+                getParserPictInfo(parserCtx.get(), &entry.pict_type, &entry.pic_struct, &entry.repeat_pict);
+                if (entry.pict_type == AV_PICTURE_TYPE_I) {
+                    entry.flags |= AV_PKT_FLAG_KEY;
+                }
+            }
+            m_frameIndex.add(entry);
+        }
+        av_packet_unref(pkt.get());
+    }
+    pkt.reset();
+    for (uint32_t i = 0; i < (uint32_t)discardOrg.size(); i++) {
+        formatCtx->streams[i]->discard = discardOrg[i];
+    }
+    if (ret != AVERROR_EOF) {
+        AddMessage(RGY_LOG_WARN, _T("error while creating frame index: %s.\n"), qsv_av_err2str(ret).c_str());
+        m_frameIndex.clear();
+        return RGY_ERR_UNKNOWN;
+    }
+    m_frameIndex.setComplete();
+    if (!m_frameIndex.complete()) {
+        AddMessage(RGY_LOG_WARN, _T("no keyframe found while creating frame index.\n"));
+        return RGY_ERR_NOT_FOUND;
+    }
+    const auto timeFin = std::chrono::system_clock::now();
+    AddMessage(RGY_LOG_INFO, _T("created frame index: %d packets, duration %s, %.1f sec.\n"),
+        (int)m_frameIndex.entries().size(), print_time(m_frameIndex.durationSec()).c_str(),
+        std::chrono::duration_cast<std::chrono::milliseconds>(timeFin - timeStart).count() * 0.001);
+    return RGY_ERR_NONE;
+}
+
+RGY_ERR RGYInputAvcodec::seekByFrameIndex(int64_t pts) {
+    const auto keyframe = m_frameIndex.findKeyframe(pts);
+    if (keyframe == nullptr) {
+        return RGY_ERR_NOT_FOUND;
+    }
+    int ret = -1;
+    if (frameIndexUseByteSeek(m_Demux.format.formatCtx) && keyframe->pos >= 0) {
+        ret = av_seek_frame(m_Demux.format.formatCtx, m_Demux.video.index, keyframe->pos, AVSEEK_FLAG_BYTE);
+    }
+    if (ret < 0) {
+        //キーフレームのタイムスタンプそのものを指定するので、前後のキーフレームに外れることはない
+        const auto keyTimestamp = (keyframe->pts != AV_NOPTS_VALUE) ? keyframe->pts : keyframe->dts;
+        ret = av_seek_frame(m_Demux.format.formatCtx, m_Demux.video.index, keyTimestamp, AVSEEK_FLAG_BACKWARD);
+    }
+    if (ret < 0) {
+        AddMessage(RGY_LOG_DEBUG, _T("failed to seek by frame index: %s.\n"), qsv_av_err2str(ret).c_str());
+        return RGY_ERR_UNKNOWN;
+    }
+    AddMessage(RGY_LOG_DEBUG, _T("seek by frame index: target %lld, keyframe pts %lld, pos %lld.\n"),
+        (long long int)pts, (long long int)keyframe->pts, (long long int)keyframe->pos);
+    return RGY_ERR_NONE;
+}
+
+//trimでのseekは、これより少ないパケットしか読み飛ばせない場合は行わない
+static const int TRIM_SEEK_MIN_SKIP_PACKETS = 60;
+//範囲の先頭の音声が映像より前に多重化されていても取りこぼさないよう、少し手前のキーフレームへseekする
+static const double TRIM_SEEK_MARGIN_SEC = 1.0;
+
+void RGYInputAvcodec::initTrimSeek() {
+    auto& video = m_Demux.video;
+    video.trimSeekPts.clear();
+    video.trimSeekEntry.clear();
+    //swデコードに切り替わった場合など
+    if (m_inputVideoInfo.codec == RGY_CODEC_UNKNOWN || m_inputVideoInfo.codec == RGY_CODEC_MPEG2) {
+        return;
+    }
+    if (m_trimParam.list.size() == 0 || (m_trimParam.list.size() == 1 && m_trimParam.list[0].start <= 0)) {
+        return;
+    }
+    if ((m_Demux.frames.getStreamPtsStatus() & (~RGY_PTS_NORMAL)) != 0) {
+        AddMessage(RGY_LOG_DEBUG, _T("trim seek: disabled, video timestamp is not normal.\n"));
+        return;
+    }
+    //ptsの順位(表示順)をフレーム番号として使用するので、すべてのパケットにptsがあり、重複していないこと
+    const auto& entries = m_frameIndex.entries();
+    std::vector<std::pair<int64_t, int>> ptsList;
+    ptsList.reserve(entries.size());
+    for (int i = 0; i < (int)entries.size(); i++) {
+        if (entries[i].pts == AV_NOPTS_VALUE) {
+            AddMessage(RGY_LOG_DEBUG, _T("trim seek: disabled, frame index has packets without pts.\n"));
+            return;
+        }
+        ptsList.push_back(std::make_pair(entries[i].pts, i));
+    }
+    std::sort(ptsList.begin(), ptsList.end());
+    for (size_t i = 1; i < ptsList.size(); i++) {
+        if (ptsList[i].first == ptsList[i-1].first) {
+            AddMessage(RGY_LOG_DEBUG, _T("trim seek: disabled, frame index has duplicate pts %lld.\n"), (long long int)ptsList[i].first);
+            return;
+        }
+    }
+    video.trimSeekPts.reserve(ptsList.size());
+    video.trimSeekEntry.reserve(ptsList.size());
+    for (const auto& p : ptsList) {
+        video.trimSeekPts.push_back(p.first);
+        video.trimSeekEntry.push_back(p.second);
+    }
+    //getFirstFramePosAndFrameRateで読み込み済みのフレームから、次に読み込む位置を決める
+    int nextEntry = 0;
+    for (int i = 0; i < m_Demux.frames.frameNum(); i++) {
+        const int entryIdx = trimSeekEntryIdx(m_Demux.frames.list(i).pts);
+        if (entryIdx < 0) {
+            AddMessage(RGY_LOG_DEBUG, _T("trim seek: disabled, frame %d (pts %lld) not found in frame index.\n"), i, (long long int)m_Demux.frames.list(i).pts);
+            video.trimSeekPts.clear();
+            video.trimSeekEntry.clear();
+            return;
+        }
+        nextEntry = (std::max)(nextEntry, entryIdx + 1);
+    }
+    video.trimSeekNextEntry = nextEntry;
+    video.trimSeekRetryEntry = nextEntry;
+    video.trimSeekKeyPts = AV_NOPTS_VALUE;
+    AddMessage(RGY_LOG_DEBUG, _T("trim seek: available, %d frames in index, next entry %d.\n"), (int)video.trimSeekPts.size(), nextEntry);
+}
+
+void RGYInputAvcodec::enableTrimSeek() {
+    if (!trimSeekAvailable() || m_Demux.video.smartCut) {
+        return;
+    }
+    m_Demux.video.trimSeekEnabled = true;
+    AddMessage(RGY_LOG_DEBUG, _T("trim seek: enabled.\n"));
+}
+
+int RGYInputAvcodec::trimSeekFrameIdx(int64_t pts) const {
+    const auto& ptsList = m_Demux.video.trimSeekPts;
+    auto it = std::lower_bound(ptsList.begin(), ptsList.end(), pts);
+    if (it == ptsList.end() || *it != pts) {
+        return -1;
+    }
+    //最初のキーフレームより前のフレームは負の値となる
+    return (int)std::distance(ptsList.begin(), it) - m_trimParam.offset;
+}
+
+int RGYInputAvcodec::trimSeekEntryIdx(int64_t pts) const {
+    const auto& ptsList = m_Demux.video.trimSeekPts;
+    auto it = std::lower_bound(ptsList.begin(), ptsList.end(), pts);
+    if (it == ptsList.end() || *it != pts) {
+        return -1;
+    }
+    return m_Demux.video.trimSeekEntry[std::distance(ptsList.begin(), it)];
+}
+
+void RGYInputAvcodec::trimSeekSkip(int entryIdx, int64_t pts) {
+    auto& video = m_Demux.video;
+    if (entryIdx < video.trimSeekRetryEntry) {
+        return;
+    }
+    const int frameIdx = trimSeekFrameIdx(pts);
+    const auto inside = frame_inside_range(frameIdx, m_trimParam.list);
+    if (inside.first || inside.second >= (int)m_trimParam.list.size()) {
+        //範囲内、あるいは最後の範囲より後 (読み込みはgetSampleで打ち切られる)
+        return;
+    }
+    const int nextStart = m_trimParam.list[inside.second].start;
+    const int nextStartRank = nextStart + m_trimParam.offset;
+    if (nextStartRank >= (int)video.trimSeekPts.size()) {
+        return;
+    }
+    const auto marginPts = av_rescale_q(1, av_d2q(TRIM_SEEK_MARGIN_SEC, 1<<24), video.stream->time_base);
+    const auto targetPts = video.trimSeekPts[nextStartRank] - marginPts;
+    const auto keyframe = m_frameIndex.findKeyframe(targetPts);
+    if (keyframe == nullptr) {
+        return;
+    }
+    const auto& entries = m_frameIndex.entries();
+    const int keyIdx = (int)(keyframe - entries.data());
+    if (keyIdx <= entryIdx + TRIM_SEEK_MIN_SKIP_PACKETS) {
+        return;
+    }
+    //読み飛ばすフレームとseek先のleading pictureが、すべてtrimの範囲外であることを確認する
+    for (int i = entryIdx + 1; i < keyIdx; i++) {
+        if (frame_inside_range(trimSeekFrameIdx(entries[i].pts), m_trimParam.list).first) {
+            video.trimSeekRetryEntry = i + 1;
+            return;
+        }
+    }
+    for (int i = keyIdx + 1; i < (int)entries.size() && (entries[i].flags & AV_PKT_FLAG_KEY) == 0; i++) {
+        if (entries[i].pts < keyframe->pts
+            && frame_inside_range(trimSeekFrameIdx(entries[i].pts), m_trimParam.list).first) {
+            video.trimSeekRetryEntry = keyIdx + 1;
+            return;
+        }
+    }
+    if (seekByFrameIndex(targetPts) != RGY_ERR_NONE) {
+        //以降はseekせず、そのまま読み込む
+        AddMessage(RGY_LOG_WARN, _T("trim seek: failed to seek to frame %d, continue reading without seek.\n"), nextStart);
+        video.trimSeekRetryEntry = std::numeric_limits<int>::max();
+        return;
+    }
+    if (video.bsfcCtx) {
+        av_bsf_flush(video.bsfcCtx);
+    }
+    video.trimSeekKeyPts = keyframe->pts;
+    video.trimSeekCount++;
+    AddMessage(RGY_LOG_DEBUG, _T("trim seek: frame %d -> keyframe before frame %d, skip %d packets.\n"),
+        frameIdx, nextStart, keyIdx - entryIdx - 1);
+}
+
+void RGYInputAvcodec::writeFrameIndex() {
+    if (m_frameIndexFile.length() == 0) {
+        return;
+    }
+    const auto sts = m_frameIndex.write(m_frameIndexFile);
+    if (sts != RGY_ERR_NONE) {
+        AddMessage(RGY_LOG_WARN, _T("failed to write frame index \"%s\": %s.\n"), m_frameIndexFile.c_str(), get_err_mes(sts));
+        return;
+    }
+    AddMessage(RGY_LOG_DEBUG, _T("wrote frame index \"%s\": %d packets.\n"), m_frameIndexFile.c_str(), (int)m_frameIndex.entries().size());
+}
+
+void RGYInputAvcodec::setSmartCut(std::shared_ptr<RGYSmartCut> smartCut) {
+    m_Demux.video.smartCut = smartCut;
+    m_Demux.video.smartCutFrames = 0;
+}
+
+//映像のパケットをキューから1つ取り出す
+AVPacket *RGYInputAvcodec::popVideoPacket() {
     if (!m_Demux.thread.thInput.joinable() //入力スレッドがなければ、自分で読み込む
         && m_Demux.qVideoPkt.get_keep_length() > 0) { //keep_length == 0なら読み込みは終了していて、これ以上読み込む必要はない
         auto [ret, pkt] = getSample();
         if (ret == 0) {
             m_Demux.qVideoPkt.push(pkt.release());
         } else if (ret != AVERROR_EOF) {
-            return RGY_ERR_UNKNOWN;
+            m_Demux.format.inputError = RGY_ERR_UNKNOWN;
+            return nullptr;
         }
     }
 
@@ -3522,6 +3975,109 @@ RGY_ERR RGYInputAvcodec::GetNextBitstream(RGYBitstream *pBitstream) {
     for (int i = 0; false == (bGetPacket = m_Demux.qVideoPkt.front_copy_and_pop_no_lock(&pkt, (m_Demux.thread.queueInfo) ? &m_Demux.thread.queueInfo->usage_vid_in : nullptr)) && m_Demux.qVideoPkt.size() > 0; i++) {
         m_Demux.qVideoPkt.wait_for_push();
     }
+    return (bGetPacket) ? pkt : nullptr;
+}
+
+//--trim-smart: 読み込み中のGOPを、trimの範囲に完全に含まれていればコピー、そうでなければデコードに回す
+void RGYInputAvcodec::smartCutFlushGop(bool nextGopIsIDR) {
+    auto& video = m_Demux.video;
+    auto& gop = video.smartCutGop;
+    if (gop.empty()) {
+        return;
+    }
+    //GOP内のptsの順位から、各パケットの表示順のフレーム番号を決める
+    //(GOPごとに表示順のフレーム番号が連続していることを仮定する)
+    std::vector<int64_t> ptsSorted;
+    bool ptsValid = true;
+    for (const auto pkt : gop) {
+        ptsValid &= pkt->pts != AV_NOPTS_VALUE;
+        ptsSorted.push_back(pkt->pts);
+    }
+    std::sort(ptsSorted.begin(), ptsSorted.end());
+    std::vector<int> frameIdx;
+    for (size_t i = 0; i < gop.size(); i++) {
+        const auto rank = (ptsValid) ? std::distance(ptsSorted.begin(), std::lower_bound(ptsSorted.begin(), ptsSorted.end(), gop[i]->pts)) : (ptrdiff_t)i;
+        frameIdx.push_back(video.smartCutFrames + (int)rank);
+    }
+    const int frameStart = video.smartCutFrames;
+    const int frames = (int)gop.size();
+    video.smartCutFrames += frames;
+
+    //IDRで始まり、次のGOPもIDRで始まる(他のGOPを参照しない)もののみコピーできる
+    const bool copy = ptsValid && nextGopIsIDR
+        && (gop.front()->flags & AV_PKT_FLAG_KEY)
+        && video.smartCut->isIDR(gop.front()->data, gop.front()->size)
+        && video.smartCut->insideOneTrimRange(frameStart, frames);
+    if (copy) {
+        auto copyGop = std::make_unique<RGYSmartCutGop>();
+        copyGop->frameStart = frameStart;
+        copyGop->frames = frames;
+        for (size_t i = 0; i < gop.size(); i++) {
+            copyGop->pkts.push_back(std::unique_ptr<AVPacket, RGYAVDeleter<AVPacket>>(gop[i], RGYAVDeleter<AVPacket>(av_packet_free)));
+            copyGop->pktFrameIdx.push_back(frameIdx[i]);
+        }
+        AddMessage(RGY_LOG_TRACE, _T("smart cut: copy gop %d-%d.\n"), frameStart, frameStart + frames - 1);
+        video.smartCut->addCopyGop(std::move(copyGop));
+        //コピーしたフレームも入力フレームとして数える
+        m_Demux.video.nSampleGetCount += frames;
+        m_encSatusInfo->m_sData.frameIn += frames;
+    } else {
+        for (size_t i = 0; i < gop.size(); i++) {
+            video.smartCut->addDecodeFrame(frameIdx[i]);
+            video.smartCutDecodePkt.push_back(std::make_pair(gop[i], frameIdx[i]));
+        }
+    }
+    gop.clear();
+}
+
+std::pair<AVPacket *, int> RGYInputAvcodec::popVideoPacketSmartCut() {
+    auto& video = m_Demux.video;
+    while (video.smartCutDecodePkt.empty()) {
+        auto pkt = popVideoPacket();
+        if (pkt == nullptr) { //終了
+            if (video.smartCutGop.empty()) {
+                return { nullptr, -1 };
+            }
+            smartCutFlushGop(true);
+            continue;
+        }
+        if ((pkt->flags & AV_PKT_FLAG_KEY) && video.smartCutGop.size() > 0) {
+            const auto gopsBefore = video.smartCut->copiedGops();
+            smartCutFlushGop(video.smartCut->isIDR(pkt->data, pkt->size));
+            video.smartCutGop.push_back(pkt);
+            if (video.smartCutDecodePkt.empty() && video.smartCut->copiedGops() != gopsBefore) {
+                //GOPをコピーに回した場合は、エンコーダ側で出力できるよう一度戻る
+                return { nullptr, 0 };
+            }
+            continue;
+        }
+        video.smartCutGop.push_back(pkt);
+    }
+    auto ret = video.smartCutDecodePkt.front();
+    video.smartCutDecodePkt.pop_front();
+    return ret;
+}
+
+//動画ストリームの1フレーム分のデータをbitstreamに追加する (リーダー側のデータは消す)
+RGY_ERR RGYInputAvcodec::GetNextBitstream(RGYBitstream *pBitstream) {
+    AVPacket *pkt = nullptr;
+    int frameIdx = -1;
+    if (m_Demux.video.smartCut) {
+        std::tie(pkt, frameIdx) = popVideoPacketSmartCut();
+        if (pkt == nullptr && frameIdx >= 0) {
+            //コピーするGOPのみで、デコードするパケットはない
+            pBitstream->setSize(0);
+            pBitstream->setOffset(0);
+            return (m_Demux.format.inputError != RGY_ERR_NONE) ? m_Demux.format.inputError : RGY_ERR_NONE;
+        }
+    } else {
+        pkt = popVideoPacket();
+        if (pkt != nullptr && m_Demux.video.trimSeekEnabled) {
+            //seekで読み飛ばすとデコードしたフレーム数とフレーム番号が一致しなくなるので、インデックスから求めたものを渡す
+            frameIdx = trimSeekFrameIdx(pkt->pts);
+        }
+    }
+    const bool bGetPacket = pkt != nullptr;
     RGY_ERR sts = RGY_ERR_MORE_BITSTREAM;
     if (bGetPacket) {
         if (pkt->data) {
@@ -3543,6 +4099,7 @@ RGY_ERR RGYInputAvcodec::GetNextBitstream(RGYBitstream *pBitstream) {
             flags |= RGY_FRAME_FLAG_RFF;
         }
         pBitstream->setDataflag(flags);
+        pBitstream->setFrameIdx(frameIdx);
         m_poolPkt->returnFree(&pkt);
         m_Demux.video.nSampleGetCount++;
         m_encSatusInfo->m_sData.frameIn++;
@@ -3673,6 +4230,12 @@ const AVStream *RGYInputAvcodec::GetInputVideoStream() const {
 
 double RGYInputAvcodec::GetInputVideoDuration() {
     double duration = m_Demux.format.formatCtx->duration * (1.0 / (double)AV_TIME_BASE);
+    //フレームインデックスがあれば、推定値ではなく実際の映像の長さを使用する
+    if (m_frameIndex.complete()) {
+        if (const auto indexDuration = m_frameIndex.durationSec(); indexDuration > 0.0) {
+            duration = indexDuration;
+        }
+    }
     if (m_seek.second > 0.0f) {
         duration = std::min<double>(duration, m_seek.second);
     }
@@ -37,6 +37,8 @@
 #include "rgy_queue.h"
 #include "rgy_perf_monitor.h"
 #include "rgy_bitstream.h"
+#include "rgy_input_avcodec_index.h"
+#include "rgy_smartcut.h"
 #include "convert_csp.h"
 #include <deque>
 #include <set>
@@ -786,6 +788,20 @@ struct AVDemuxVideo {
     decltype(parse_nal_unit_h264_c) *parse_nal_h264; // H.264用のnal unit分解関数へのポインタ
     decltype(parse_nal_unit_hevc_c) *parse_nal_hevc; // HEVC用のnal unit分解関数へのポインタ
 
+    std::shared_ptr<RGYSmartCut> smartCut;            //--trim-smart (使用しない場合はnullptr)
+    std::vector<AVPacket *>   smartCutGop;           //--trim-smart: 読み込み中のGOPのパケット (デコード順)
+    std::deque<std::pair<AVPacket *, int>> smartCutDecodePkt; //--trim-smart: デコードに回すパケットとそのフレーム番号
+    int                       smartCutFrames;        //--trim-smart: 振り分けの済んだフレーム数
+
+    std::vector<int64_t>      trimSeekPts;           //trimの範囲外をseekで飛ばす場合のフレームインデックスのpts (昇順、使用しない場合は空)
+    std::vector<int>          trimSeekEntry;         //trimSeekPtsの各ptsに対応するフレームインデックスの位置 (デコード順)
+    std::atomic<bool>         trimSeekEnabled;       //trimの範囲外をseekで飛ばす
+    int                       trimSeekNextEntry;     //次に読み込むはずのフレームインデックスの位置
+    int                       trimSeekRetryEntry;    //この位置を読み込むまではseekを再試行しない
+    int64_t                   trimSeekKeyPts;        //直前にseekしたキーフレームのpts (これより前のleading pictureは捨てる)
+    int                       trimSeekCount;         //seekした回数
+    int                       trimSeekSkipFrames;    //seekで読み込まなかったフレーム数
+
     AVDemuxVideo();
     ~AVDemuxVideo() { close(); }
     void close(RGYLog *log = nullptr);
@@ -855,6 +871,8 @@ public:
     tstring        logFramePosList;         //FramePosListの内容を入力終了時に出力する (デバッグ用)
     tstring        logCopyFrameData;        //frame情報copy関数のログ出力先 (デバッグ用)
     tstring        logPackets;              //読み込んだパケットの情報を出力する
+    tstring        indexFile;               //フレームインデックスファイル (空なら使用しない)
+    bool           trimSeek;                //フレームインデックスを使用して、trimの範囲外をseekで飛ばす (--input-indexあり、--seek/--trim-smartなし、trimに範囲外がある場合)
     int            threadInput;             //入力スレッドを有効にする
     RGYParamThread threadParamInput;        //入力スレッドのスレッドアフィニティ
     PerfQueueInfo *queueInfo;               //キューの情報を格納する構造体
@@ -979,6 +997,17 @@ public:
     //並列エンコードの親側で不要なデコーダを終了させる
     void CloseVideoDecoder();
 
+    //--trim-smartを有効にする (GetNextBitstreamを呼ぶ前に設定すること)
+    //以降、trimの範囲に完全に含まれるGOPはsmartCutに渡され、GetNextBitstreamからは返さない
+    void setSmartCut(std::shared_ptr<RGYSmartCut> smartCut);
+
+    //trimの範囲外をseekで飛ばすことが可能か
+    bool trimSeekAvailable() const { return m_Demux.video.trimSeekPts.size() > 0; }
+
+    //trimの範囲外をseekで飛ばすようにする
+    //GetNextBitstreamはフレーム番号(trim適用前の表示順)をbitstreamにセットするので、デコーダ側はこれを使用すること
+    void enableTrimSeek();
+
     //swデコーダの初期化
     RGY_ERR initSWVideoDecoder(const tstring& avswDecoder);
 
@@ -1000,6 +1029,14 @@ protected:
 
     RGY_ERR parseHDRData();
 
+    //映像のパケットをキューから1つ取り出す (なければnullptr)
+    AVPacket *popVideoPacket();
+    //--trim-smart: GOP単位で振り分け、デコードに回すパケットを1つ取り出す
+    //コピーするGOPのみでデコードに回すパケットがない場合は{ nullptr, 0 }、終了なら{ nullptr, -1 }を返す
+    std::pair<AVPacket *, int> popVideoPacketSmartCut();
+    //--trim-smart: 読み込み中のGOPをコピーするかデコードするか振り分ける
+    void smartCutFlushGop(bool nextGopIsIDR);
+
     RGY_ERR packMetadataToPacket(AVPacket *pkt, const char *key, const uint8_t *data, const size_t size);
     RGY_ERR parseHDR10plusDOVIRpu(AVPacket *pkt, const bool hdr10plus, const bool doviRpu);
     RGY_ERR parseHDR10plusDOVIRpuHEVC(AVPacket *pkt, const bool hdr10plus, const bool doviRpu);
@@ -1040,6 +1077,30 @@ protected:
     //対象ストリームのパケットを取得
     std::tuple<int, std::unique_ptr<AVPacket, RGYAVDeleter<AVPacket>>> getSample(bool bTreatFirstPacketAsKeyframe = false);
 
+    //フレームインデックスを読み込み、無効なら記録の準備をする
+    void initFrameIndex(const tstring& srcFile, const tstring& indexFile);
+
+    //映像パケットのみを先頭から読み込み、フレームインデックスを作成する
+    RGY_ERR buildFrameIndex();
+
+    //フレームインデックスからpts以前で最も近いキーフレームを探し、そこへseekする
+    RGY_ERR seekByFrameIndex(int64_t pts);
+
+    //trimの範囲外をseekで飛ばすための準備をする
+    void initTrimSeek();
+
+    //フレームインデックスから、ptsに対応するtrim適用前の表示順のフレーム番号を返す (見つからなければ-1、最初のキーフレームより前も負の値)
+    int trimSeekFrameIdx(int64_t pts) const;
+
+    //フレームインデックスから、ptsに対応するパケットのデコード順の位置を返す (見つからなければ-1)
+    int trimSeekEntryIdx(int64_t pts) const;
+
+    //trimの範囲外のパケットを読み込んだら、次の範囲の直前のキーフレームまでseekする
+    void trimSeekSkip(int entryIdx, int64_t pts);
+
+    //フレームインデックスが完成していれば書き出す
+    void writeFrameIndex();
+
     //対象・字幕の音声パケットを追加するかどうか
     bool checkStreamPacketToAdd(AVPacket *pkt, AVDemuxStream *stream);
 
@@ -1094,6 +1155,9 @@ protected:
     AVDemuxer        m_Demux;                      //デコード用情報
     tstring          m_logFramePosList;           //FramePosListの内容を入力終了時に出力する (デバッグ用)
     std::unique_ptr<FILE, fp_deleter> m_fpPacketList; // 読み取ったパケット情報を出力するファイル
+    RGYFrameIndex    m_frameIndex;                 //フレームインデックス (--input-index)
+    tstring          m_frameIndexFile;             //フレームインデックスファイル (空なら使用しない)
+    bool             m_frameIndexRecord;           //getSampleで読み込んだパケットをフレームインデックスに記録する
     vector<uint8_t>  m_hevcMp42AnnexbBuffer;       //HEVCのmp4->AnnexB簡易変換用バッファ
     // 入力プールの物理確保上限。m_inputVideoInfo.srcWidth/Heightのように現在の論理解像度に追従させない。
     // 途中でこれを超えた場合は、サーフェスへのコピー前に明示エラーとする。
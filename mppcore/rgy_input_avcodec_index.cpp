@@ -0,0 +1,254 @@
+﻿// -----------------------------------------------------------------------------------------
+// QSVEnc/NVEnc by rigaya
+// -----------------------------------------------------------------------------------------
+// The MIT License
+//
+// Copyright (c) 2011-2016 rigaya
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// ------------------------------------------------------------------------------------------
+
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <functional>
+#include <thread>
+#include "rgy_input_avcodec_index.h"
+#include "rgy_filesystem.h"
+#include "rgy_util.h"
+
+#if ENABLE_AVSW_READER
+
+static const char RGY_FRAME_INDEX_MAGIC[8] = { 'R', 'G', 'Y', 'F', 'I', 'D', 'X', '\0' };
+static const uint32_t RGY_FRAME_INDEX_VERSION = 1;
+
+//インデックスファイルのヘッダ (この後にRGYFrameIndexEntryがentryCount個続く)
+struct RGYFrameIndexHeader {
+    char     magic[8];
+    uint32_t version;
+    uint32_t entrySize;
+    uint64_t srcFileSize;
+    int64_t  srcMtime;
+    int32_t  streamIndex;
+    int32_t  codecId;
+    int32_t  timebaseNum;
+    int32_t  timebaseDen;
+    uint64_t entryCount;
+};
+
+static int64_t frameIndexTimestamp(const RGYFrameIndexEntry& entry) {
+    return (entry.pts != AV_NOPTS_VALUE) ? entry.pts : entry.dts;
+}
+
+RGYFrameIndex::RGYFrameIndex() :
+    m_srcFileSize(0),
+    m_srcMtime(0),
+    m_streamIndex(-1),
+    m_codecId(AV_CODEC_ID_NONE),
+    m_timebase({ 0, 1 }),
+    m_entries(),
+    m_keyframes(),
+    m_complete(false) {
+}
+
+RGYFrameIndex::~RGYFrameIndex() {
+}
+
+RGY_ERR RGYFrameIndex::init(const tstring& srcFile, int streamIndex, AVCodecID codecId, AVRational timebase) {
+    m_entries.clear();
+    m_keyframes.clear();
+    m_complete = false;
+    m_streamIndex = streamIndex;
+    m_codecId = codecId;
+    m_timebase = timebase;
+    if (!rgy_get_filesize(srcFile.c_str(), &m_srcFileSize)) {
+        return RGY_ERR_FILE_OPEN;
+    }
+    std::error_code ec;
+    const auto mtime = std::filesystem::last_write_time(std::filesystem::path(srcFile), ec);
+    if (ec) {
+        return RGY_ERR_FILE_OPEN;
+    }
+    m_srcMtime = (int64_t)mtime.time_since_epoch().count();
+    return RGY_ERR_NONE;
+}
+
+RGY_ERR RGYFrameIndex::load(const tstring& indexFile) {
+    m_entries.clear();
+    m_keyframes.clear();
+    m_complete = false;
+
+    std::unique_ptr<FILE, fp_deleter> fp(_tfopen(indexFile.c_str(), _T("rb")), fp_deleter());
+    if (!fp) {
+        return RGY_ERR_FILE_OPEN;
+    }
+    RGYFrameIndexHeader header;
+    if (fread(&header, 1, sizeof(header), fp.get()) != sizeof(header)
+        || memcmp(header.magic, RGY_FRAME_INDEX_MAGIC, sizeof(RGY_FRAME_INDEX_MAGIC)) != 0) {
+        return RGY_ERR_INVALID_FORMAT;
+    }
+    if (header.version != RGY_FRAME_INDEX_VERSION
+        || header.entrySize != sizeof(RGYFrameIndexEntry)
+        || header.srcFileSize != m_srcFileSize
+        || header.srcMtime != m_srcMtime
+        || header.streamIndex != m_streamIndex
+        || header.codecId != (int32_t)m_codecId
+        || header.timebaseNum != m_timebase.num
+        || header.timebaseDen != m_timebase.den) {
+        return RGY_ERR_INVALID_VERSION;
+    }
+    //entryCountが壊れていても巨大な確保をしないよう、ファイルサイズと照合する
+    uint64_t indexFileSize = 0;
+    if (!rgy_get_filesize(indexFile.c_str(), &indexFileSize)
+        || indexFileSize != sizeof(header) + header.entryCount * sizeof(RGYFrameIndexEntry)) {
+        return RGY_ERR_INVALID_FORMAT;
+    }
+    m_entries.resize((size_t)header.entryCount);
+    if (fread(m_entries.data(), sizeof(RGYFrameIndexEntry), m_entries.size(), fp.get()) != m_entries.size()) {
+        m_entries.clear();
+        return RGY_ERR_INVALID_FORMAT;
+    }
+    for (size_t i = 0; i < m_entries.size(); i++) {
+        if ((m_entries[i].flags & AV_PKT_FLAG_KEY) && frameIndexTimestamp(m_entries[i]) != AV_NOPTS_VALUE) {
+            m_keyframes.push_back(i);
+        }
+    }
+    std::stable_sort(m_keyframes.begin(), m_keyframes.end(), [this](size_t a, size_t b) {
+        return frameIndexTimestamp(m_entries[a]) < frameIndexTimestamp(m_entries[b]);
+    });
+    m_complete = true;
+    if (!hasKeyframe()) {
+        m_entries.clear();
+        m_keyframes.clear();
+        m_complete = false;
+        return RGY_ERR_INVALID_FORMAT;
+    }
+    return RGY_ERR_NONE;
+}
+
+RGY_ERR RGYFrameIndex::write(const tstring& indexFile) const {
+    if (!complete()) {
+        return RGY_ERR_NOT_INITIALIZED;
+    }
+    RGYFrameIndexHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, RGY_FRAME_INDEX_MAGIC, sizeof(RGY_FRAME_INDEX_MAGIC));
+    header.version = RGY_FRAME_INDEX_VERSION;
+    header.entrySize = sizeof(RGYFrameIndexEntry);
+    header.srcFileSize = m_srcFileSize;
+    header.srcMtime = m_srcMtime;
+    header.streamIndex = m_streamIndex;
+    header.codecId = (int32_t)m_codecId;
+    header.timebaseNum = m_timebase.num;
+    header.timebaseDen = m_timebase.den;
+    header.entryCount = m_entries.size();
+
+    //--serverのジョブは同じプロセスのスレッドとして動作するので、プロセスIDとスレッドIDで一時ファイル名を分ける
+    const auto tmpFile = indexFile + strsprintf(_T(".%u.%llx.tmp"), (uint32_t)GetCurrentProcessId(),
+        (unsigned long long)std::hash<std::thread::id>()(std::this_thread::get_id()));
+    {
+        std::unique_ptr<FILE, fp_deleter> fp(_tfopen(tmpFile.c_str(), _T("wb")), fp_deleter());
+        if (!fp) {
+            return RGY_ERR_FILE_OPEN;
+        }
+        if (fwrite(&header, 1, sizeof(header), fp.get()) != sizeof(header)
+            || fwrite(m_entries.data(), sizeof(RGYFrameIndexEntry), m_entries.size(), fp.get()) != m_entries.size()
+            || fflush(fp.get()) != 0) {
+            fp.reset();
+            rgy_file_remove(tmpFile.c_str());
+            return RGY_ERR_UNKNOWN;
+        }
+    }
+    if (!rgy_file_rename(tmpFile, indexFile, true)) {
+        rgy_file_remove(tmpFile.c_str());
+        return RGY_ERR_ACCESS_DENIED;
+    }
+    return RGY_ERR_NONE;
+}
+
+void RGYFrameIndex::add(const RGYFrameIndexEntry& entry) {
+    if (m_entries.size() > 0) {
+        //getSampleは入力位置が戻ると同じパケットを再度読むので、既に追加済みの位置までは無視する
+        const auto& last = m_entries.back();
+        if (entry.pos >= 0 && last.pos >= 0) {
+            if (entry.pos <= last.pos) {
+                return;
+            }
+        } else if (entry.dts != AV_NOPTS_VALUE && last.dts != AV_NOPTS_VALUE && entry.dts <= last.dts) {
+            return;
+        }
+    }
+    m_entries.push_back(entry);
+    if ((entry.flags & AV_PKT_FLAG_KEY) && frameIndexTimestamp(entry) != AV_NOPTS_VALUE) {
+        const auto idx = m_entries.size() - 1;
+        const auto ts = frameIndexTimestamp(entry);
+        //通常はpts順に来るので、末尾への追加となる
+        auto it = std::upper_bound(m_keyframes.begin(), m_keyframes.end(), ts, [this](int64_t t, size_t i) {
+            return t < frameIndexTimestamp(m_entries[i]);
+        });
+        m_keyframes.insert(it, idx);
+    }
+}
+
+bool RGYFrameIndex::hasKeyframe() const {
+    return m_keyframes.size() > 0;
+}
+
+int64_t RGYFrameIndex::firstKeyPts() const {
+    if (!hasKeyframe()) {
+        return AV_NOPTS_VALUE;
+    }
+    //デコード順で最初のキーフレーム
+    const auto first = *std::min_element(m_keyframes.begin(), m_keyframes.end());
+    return frameIndexTimestamp(m_entries[first]);
+}
+
+const RGYFrameIndexEntry *RGYFrameIndex::findKeyframe(int64_t pts) const {
+    if (!hasKeyframe()) {
+        return nullptr;
+    }
+    auto it = std::upper_bound(m_keyframes.begin(), m_keyframes.end(), pts, [this](int64_t t, size_t i) {
+        return t < frameIndexTimestamp(m_entries[i]);
+    });
+    if (it == m_keyframes.begin()) {
+        return &m_entries[m_keyframes.front()];
+    }
+    return &m_entries[*(it - 1)];
+}
+
+double RGYFrameIndex::durationSec() const {
+    const auto firstPts = firstKeyPts();
+    if (firstPts == AV_NOPTS_VALUE || m_timebase.num <= 0 || m_timebase.den <= 0) {
+        return -1.0;
+    }
+    int64_t finPts = AV_NOPTS_VALUE;
+    for (const auto& entry : m_entries) {
+        const auto ts = frameIndexTimestamp(entry);
+        if (ts != AV_NOPTS_VALUE) {
+            finPts = (finPts == AV_NOPTS_VALUE) ? ts + entry.duration : std::max(finPts, ts + entry.duration);
+        }
+    }
+    if (finPts == AV_NOPTS_VALUE || finPts <= firstPts) {
+        return -1.0;
+    }
+    return (finPts - firstPts) * av_q2d(m_timebase);
+}
+
+#endif //#if ENABLE_AVSW_READER
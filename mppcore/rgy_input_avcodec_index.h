@@ -0,0 +1,114 @@
+﻿// -----------------------------------------------------------------------------------------
+// QSVEnc/NVEnc by rigaya
+// -----------------------------------------------------------------------------------------
+// The MIT License
+//
+// Copyright (c) 2011-2016 rigaya
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// ------------------------------------------------------------------------------------------
+
+#pragma once
+#ifndef __RGY_INPUT_AVCODEC_INDEX_H__
+#define __RGY_INPUT_AVCODEC_INDEX_H__
+
+#include "rgy_version.h"
+
+#if ENABLE_AVSW_READER
+#include <vector>
+#include <cstdint>
+#include "rgy_avutil.h"
+#include "rgy_err.h"
+#include "rgy_tchar.h"
+
+//フレームインデックス (--input-index) の1パケット分の情報
+//ファイルにそのまま書き出すので、メンバの追加・変更時はRGY_FRAME_INDEX_VERSIONを更新すること
+struct RGYFrameIndexEntry {
+    int64_t pts;         //pts (AV_NOPTS_VALUEの場合あり)
+    int64_t dts;         //dts (AV_NOPTS_VALUEの場合あり)
+    int64_t pos;         //ファイル先頭からのバイト位置 (不明な場合は-1)
+    int32_t duration;    //パケットの表示時間
+    uint8_t flags;       //AV_PKT_FLAG_xxx (キーフレームならAV_PKT_FLAG_KEY)
+    uint8_t pic_struct;  //RGY_PICSTRUCT_xxx (parserが使用できない場合は0)
+    uint8_t repeat_pict; //通常は1, RFFなら2+
+    uint8_t pict_type;   //I,P,Bフレーム
+};
+static_assert(sizeof(RGYFrameIndexEntry) == 32, "sizeof(RGYFrameIndexEntry) must be 32");
+
+//入力ファイルの映像パケットの一覧を保持し、インデックスファイルとして保存・再利用する
+//インデックスファイルは入力ファイルのサイズと更新時刻で有効かどうかを判定する
+class RGYFrameIndex {
+public:
+    RGYFrameIndex();
+    ~RGYFrameIndex();
+
+    //入力ファイルの情報を設定し、保持しているパケット情報をクリアする
+    RGY_ERR init(const tstring& srcFile, int streamIndex, AVCodecID codecId, AVRational timebase);
+
+    //インデックスファイルを読み込む
+    //入力ファイルのサイズ・更新時刻・ストリームが一致しない場合はRGY_ERR_INVALID_VERSIONを返す
+    RGY_ERR load(const tstring& indexFile);
+
+    //インデックスファイルを書き出す
+    //複数のrkmppencのプロセスや--serverのジョブから同時に書き込まれても壊れないよう、一時ファイルに書いてからrenameする
+    RGY_ERR write(const tstring& indexFile) const;
+
+    //パケット情報を追加する
+    //読み込み位置が戻った場合(追加済みのパケット)は無視する
+    void add(const RGYFrameIndexEntry& entry);
+
+    //保持しているパケット情報をクリアする (入力ファイルの情報は保持する)
+    void clear() { m_entries.clear(); m_keyframes.clear(); m_complete = false; }
+
+    //ファイル末尾まで読み込んだことを記録する
+    void setComplete() { m_complete = true; }
+
+    //ファイル全体のパケット情報を保持しているか
+    bool complete() const { return m_complete && hasKeyframe(); }
+
+    const std::vector<RGYFrameIndexEntry>& entries() const { return m_entries; }
+    AVRational timebase() const { return m_timebase; }
+
+    //最初のキーフレームのpts
+    int64_t firstKeyPts() const;
+
+    //指定したpts以前で最も近いキーフレームを返す
+    //見つからない場合は最初のキーフレームを返す
+    const RGYFrameIndexEntry *findKeyframe(int64_t pts) const;
+
+    //最初のキーフレームから最後のフレームの終わりまでの長さ(秒)
+    //求められない場合は負の値を返す
+    double durationSec() const;
+protected:
+    bool hasKeyframe() const;
+
+    uint64_t m_srcFileSize;
+    int64_t m_srcMtime;
+    int m_streamIndex;
+    AVCodecID m_codecId;
+    AVRational m_timebase;
+    std::vector<RGYFrameIndexEntry> m_entries;
+    std::vector<size_t> m_keyframes; //m_entriesのうちキーフレームのindex (pts順)
+    bool m_complete;
+};
+
+#endif //#if ENABLE_AVSW_READER
+
+#endif //__RGY_INPUT_AVCODEC_INDEX_H__
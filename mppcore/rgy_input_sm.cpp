@@ -29,6 +29,9 @@
 
 #if ENABLE_SM_READER
 
+#if !(defined(_WIN32) || defined(_WIN64))
+#include <signal.h>
+#endif
 
 RGYInputSMPrm::RGYInputSMPrm(RGYInputPrm base) :
     RGYInputPrm(base),
@@ -37,11 +40,16 @@ RGYInputSMPrm::RGYInputSMPrm(RGYInputPrm base) :
 }
 
 RGYInputSM::RGYInputSM() :
+#if defined(_WIN32) || defined(_WIN64)
     m_prm(),
     m_sm(),
     m_heBufEmpty(),
     m_heBufFilled(),
     m_parentProcess(NULL),
+#else
+    m_ringMem(),
+    m_ring(nullptr),
+#endif
     m_droppedInAviutl(0) {
     m_readerName = _T("sm");
 }
@@ -51,6 +59,7 @@ RGYInputSM::~RGYInputSM() {
 }
 
 void RGYInputSM::Close() {
+#if defined(_WIN32) || defined(_WIN64)
     for (size_t i = 0; i < m_heBufEmpty.size(); i++) {
         m_heBufEmpty[i] = NULL;
     }
@@ -61,6 +70,15 @@ void RGYInputSM::Close() {
     for (auto& mem : m_sm) {
         mem.reset();
     }
+#else
+    if (m_ring) {
+        //生産者が空きスロットを待っている場合に備えて、終了を通知する
+        m_ring->consumerClosed.store(1, std::memory_order_release);
+        rgy_wake_by_address_all_shared(&m_ring->consumed);
+        m_ring = nullptr;
+    }
+    m_ringMem.reset();
+#endif
     RGYInput::Close();
 }
 
@@ -68,11 +86,74 @@ rgy_rational<int> RGYInputSM::getInputTimebase() const {
     return rgy_rational<int>(m_inputVideoInfo.fpsN, m_inputVideoInfo.fpsD).inv() * rgy_rational<int>(1, 4);
 }
 
+RGYInputSMSharedData *RGYInputSM::sharedPrm() {
+#if defined(_WIN32) || defined(_WIN64)
+    return (RGYInputSMSharedData *)m_prm->ptr();
+#else
+    return &m_ring->prm;
+#endif
+}
+
 bool RGYInputSM::isAfs() {
-    RGYInputSMSharedData* prmsm = (RGYInputSMSharedData*)m_prm->ptr();
+    RGYInputSMSharedData* prmsm = sharedPrm();
     return prmsm->afs;
 }
 
+#if !(defined(_WIN32) || defined(_WIN64))
+RGY_ERR RGYInputSM::openRing(const TCHAR *strFileName) {
+    //入力ファイル名として、生産者が作成した共有メモリの名前を指定する
+    const auto name = tchar_to_string(strFileName);
+    m_ringMem = std::make_unique<RGYSharedMemLinux>();
+    if (name.length() == 0 || m_ringMem->openNamed(name.c_str(), 0, false) != 0) {
+        AddMessage(RGY_LOG_ERROR, _T("could not open shared memory for input: %s.\n"), strFileName);
+        return RGY_ERR_FILE_OPEN;
+    }
+    m_ring = (RGYInputSMRing *)m_ringMem->ptr();
+    if (m_ringMem->size() < sizeof(RGYInputSMRing)
+        || m_ring->magic != RGY_INPUT_SM_RING_MAGIC
+        || m_ring->version != RGY_INPUT_SM_RING_VERSION
+        || m_ring->headerSize != sizeof(RGYInputSMRing)) {
+        AddMessage(RGY_LOG_ERROR, _T("invalid shared memory for input: %s.\n"), strFileName);
+        m_ring = nullptr;
+        return RGY_ERR_INVALID_FORMAT;
+    }
+    if (m_ring->slotCount == 0 || m_ring->slotCount > RGY_INPUT_SM_RING_MAX_SLOTS
+        || m_ring->slotOffset < sizeof(RGYInputSMRing)
+        || m_ring->slotStride < m_ring->prm.bufSize
+        || m_ring->slotOffset + m_ring->slotStride * m_ring->slotCount > m_ringMem->size()) {
+        AddMessage(RGY_LOG_ERROR, _T("invalid slot layout in shared memory: slots %u, offset %llu, stride %llu, size %llu.\n"),
+            m_ring->slotCount, (unsigned long long)m_ring->slotOffset, (unsigned long long)m_ring->slotStride, (unsigned long long)m_ringMem->size());
+        m_ring = nullptr;
+        return RGY_ERR_INVALID_FORMAT;
+    }
+    AddMessage(RGY_LOG_DEBUG, _T("Opened shared memory %s, size: %llu, slots: %u, producer pid: %d.\n"),
+        strFileName, (unsigned long long)m_ringMem->size(), m_ring->slotCount, m_ring->producerPid);
+    return RGY_ERR_NONE;
+}
+
+RGY_ERR RGYInputSM::waitRingFilled(uint32_t frame) {
+    for (;;) {
+        const uint32_t filled = m_ring->filled.load(std::memory_order_acquire);
+        if (filled != frame) {
+            return RGY_ERR_NONE;
+        }
+        //eofの後は、書き込み済みのフレームを読み切ってから終了する
+        if (m_ring->eof.load(std::memory_order_acquire)) {
+            return (m_ring->filled.load(std::memory_order_acquire) != frame) ? RGY_ERR_NONE : RGY_ERR_MORE_DATA;
+        }
+        if (m_ring->prm.abort) {
+            return RGY_ERR_MORE_DATA;
+        }
+        if (rgy_wait_on_address_shared(&m_ring->filled, filled, 1000) == WAIT_TIMEOUT) {
+            if (m_ring->producerPid > 0 && kill(m_ring->producerPid, 0) != 0 && errno == ESRCH) {
+                AddMessage(RGY_LOG_ERROR, _T("Producer process has terminated!\n"));
+                return RGY_ERR_ABORTED;
+            }
+        }
+    }
+}
+#endif //#if !(defined(_WIN32) || defined(_WIN64))
+
 #pragma warning(push)
 #pragma warning(disable: 4312) //'型キャスト': 'uint32_t' からより大きいサイズの 'HANDLE' へ変換します。
 RGY_ERR RGYInputSM::Init(const TCHAR *strFileName, VideoInfo *pInputInfo, const RGYInputPrm *prm) {
@@ -92,6 +173,7 @@ RGY_ERR RGYInputSM::Init(const TCHAR *strFileName, VideoInfo *pInputInfo, const
 
     auto nOutputCSP = m_inputVideoInfo.csp;
 
+#if defined(_WIN32) || defined(_WIN64)
     m_prm = std::unique_ptr<RGYSharedMemWin>(new RGYSharedMemWin(strsprintf("%s_%08x", RGYInputSMPrmSM, prmSM->parentProcessID).c_str(), sizeof(RGYInputSMSharedData)));
     if (!m_prm->is_open()) {
         AddMessage(RGY_LOG_ERROR, _T("could not open params for input: %s.\n"), char_to_tstring(m_prm->name()).c_str());
@@ -108,6 +190,18 @@ RGY_ERR RGYInputSM::Init(const TCHAR *strFileName, VideoInfo *pInputInfo, const
 
     RGYInputSMSharedData *prmsm = (RGYInputSMSharedData *)m_prm->ptr();
     prmsm->pitch = ALIGN(prmsm->w, 128) * (RGY_CSP_BIT_DEPTH[prmsm->csp] > 8 ? 2 : 1);
+#else
+    UNREFERENCED_PARAMETER(prmSM);
+    //Linuxでは、ピッチやバッファのサイズは生産者が決める
+    if (auto sts = openRing(strFileName); sts != RGY_ERR_NONE) {
+        return sts;
+    }
+    RGYInputSMSharedData *prmsm = sharedPrm();
+    if (prmsm->pitch < prmsm->w * (RGY_CSP_BIT_DEPTH[prmsm->csp] > 8 ? 2 : 1)) {
+        AddMessage(RGY_LOG_ERROR, _T("invalid pitch %d for width %d.\n"), prmsm->pitch, prmsm->w);
+        return RGY_ERR_INVALID_PARAM;
+    }
+#endif
     m_inputVideoInfo.srcWidth = prmsm->w;
     m_inputVideoInfo.srcHeight = prmsm->h;
     m_inputVideoInfo.fpsN = prmsm->fpsN;
@@ -116,6 +210,7 @@ RGY_ERR RGYInputSM::Init(const TCHAR *strFileName, VideoInfo *pInputInfo, const
     m_inputVideoInfo.picstruct = prmsm->picstruct;
     m_inputVideoInfo.frames = prmsm->frames;
     m_inputCsp = m_inputVideoInfo.csp = prmsm->csp;
+#if defined(_WIN32) || defined(_WIN64)
     for (size_t i = 0; i < m_heBufEmpty.size(); i++) {
         m_heBufEmpty[i] = (HANDLE)prmsm->heBufEmpty[i];
     }
@@ -123,17 +218,16 @@ RGY_ERR RGYInputSM::Init(const TCHAR *strFileName, VideoInfo *pInputInfo, const
         m_heBufFilled[i] = (HANDLE)prmsm->heBufFilled[i];
     }
     AddMessage(RGY_LOG_DEBUG, _T("Got event handle empty: 0x%08p, 0x%08p, filled: 0x%08p, 0x%08p\n"), m_heBufEmpty[0], m_heBufEmpty[1], m_heBufFilled[0], m_heBufFilled[1]);
+#endif
 
     RGY_CSP output_csp_if_lossless = RGY_CSP_NA;
-    uint32_t bufferSize = 0;
+    const uint32_t bufferSize = rgy_input_sm_frame_size(m_inputCsp, m_inputVideoInfo.srcPitch, m_inputVideoInfo.srcHeight);
     switch (m_inputCsp) {
     case RGY_CSP_NV12:
     case RGY_CSP_YV12:
-        bufferSize = m_inputVideoInfo.srcPitch * m_inputVideoInfo.srcHeight * 3 / 2;
         output_csp_if_lossless = RGY_CSP_NV12;
         break;
     case RGY_CSP_P010:
-        bufferSize = m_inputVideoInfo.srcPitch * m_inputVideoInfo.srcHeight * 3;
         output_csp_if_lossless = RGY_CSP_P010;
         break;
     case RGY_CSP_YV12_09:
@@ -141,11 +235,9 @@ RGY_ERR RGYInputSM::Init(const TCHAR *strFileName, VideoInfo *pInputInfo, const
     case RGY_CSP_YV12_12:
     case RGY_CSP_YV12_14:
     case RGY_CSP_YV12_16:
-        bufferSize = m_inputVideoInfo.srcPitch * m_inputVideoInfo.srcHeight * 3;
         output_csp_if_lossless = RGY_CSP_P010;
         break;
     case RGY_CSP_YUV422:
-        bufferSize = m_inputVideoInfo.srcPitch * m_inputVideoInfo.srcHeight * 2;
         if (ENCODER_VCEENC) {
             AddMessage(RGY_LOG_ERROR, _T("yuv422 not supported as input color format.\n"));
             return RGY_ERR_INVALID_FORMAT;
@@ -159,7 +251,6 @@ RGY_ERR RGYInputSM::Init(const TCHAR *strFileName, VideoInfo *pInputInfo, const
     case RGY_CSP_YUV422_12:
     case RGY_CSP_YUV422_14:
     case RGY_CSP_YUV422_16:
-        bufferSize = m_inputVideoInfo.srcPitch * m_inputVideoInfo.srcHeight * 4;
         if (ENCODER_VCEENC) {
             AddMessage(RGY_LOG_ERROR, _T("yuv422 not supported as input color format.\n"));
             return RGY_ERR_INVALID_FORMAT;
@@ -169,7 +260,6 @@ RGY_ERR RGYInputSM::Init(const TCHAR *strFileName, VideoInfo *pInputInfo, const
         output_csp_if_lossless = RGY_CSP_YUV444_16;
         break;
     case RGY_CSP_YUV444:
-        bufferSize = m_inputVideoInfo.srcPitch * m_inputVideoInfo.srcHeight * 3;
         output_csp_if_lossless = RGY_CSP_YUV444;
         break;
     case RGY_CSP_YUV444_09:
@@ -177,11 +267,9 @@ RGY_ERR RGYInputSM::Init(const TCHAR *strFileName, VideoInfo *pInputInfo, const
     case RGY_CSP_YUV444_12:
     case RGY_CSP_YUV444_14:
     case RGY_CSP_YUV444_16:
-        bufferSize = m_inputVideoInfo.srcPitch * m_inputVideoInfo.srcHeight * 6;
         output_csp_if_lossless = RGY_CSP_YUV444_16;
         break;
     case RGY_CSP_RGB:
-        bufferSize = m_inputVideoInfo.srcPitch * m_inputVideoInfo.srcHeight * 3;
         output_csp_if_lossless = RGY_CSP_RGB;
         nOutputCSP = RGY_CSP_RGB;
         break;
@@ -207,6 +295,7 @@ RGY_ERR RGYInputSM::Init(const TCHAR *strFileName, VideoInfo *pInputInfo, const
         m_inputVideoInfo.bitdepth = RGY_CSP_BIT_DEPTH[m_inputCsp];
     }
 
+#if defined(_WIN32) || defined(_WIN64)
     prmsm->bufSize = bufferSize;
     for (size_t i = 0; i < m_sm.size(); i++) {
         m_sm[i] = std::unique_ptr<RGYSharedMemWin>(new RGYSharedMemWin(strsprintf("%s_%08x_%d", RGYInputSMBuffer, prmSM->parentProcessID, i).c_str(), bufferSize));
@@ -223,6 +312,13 @@ RGY_ERR RGYInputSM::Init(const TCHAR *strFileName, VideoInfo *pInputInfo, const
         }
         AddMessage(RGY_LOG_DEBUG, _T("SetEvent: heBufEmpty[%d].\n"), i);
     }
+#else
+    if (prmsm->bufSize < bufferSize) {
+        AddMessage(RGY_LOG_ERROR, _T("buffer size in shared memory is too small: %u < %u.\n"), prmsm->bufSize, bufferSize);
+        return RGY_ERR_INVALID_PARAM;
+    }
+    m_ring->consumerPid = (int32_t)getpid();
+#endif
 
     if (m_convert->getFunc(m_inputCsp, m_inputVideoInfo.csp, false, prm->simdCsp) == nullptr) {
         AddMessage(RGY_LOG_ERROR, _T("sm: color conversion not supported: %s -> %s.\n"),
@@ -243,11 +339,12 @@ RGY_ERR RGYInputSM::LoadNextFrameInternal(RGYFrame *pSurface) {
     if (getVideoTrimMaxFramIdx() < (int)m_encSatusInfo->m_sData.frameIn - TRIM_OVERREAD_FRAMES) {
         return RGY_ERR_MORE_DATA;
     }
-    RGYInputSMSharedData *prmsm = (RGYInputSMSharedData *)m_prm->ptr();
+    RGYInputSMSharedData *prmsm = sharedPrm();
     if (prmsm->abort) {
         return RGY_ERR_MORE_DATA;
     }
 
+#if defined(_WIN32) || defined(_WIN64)
     DWORD waiterr = 0;
     while ((waiterr = WaitForSingleObject(m_heBufFilled[m_encSatusInfo->m_sData.frameIn&1], 1000)) != WAIT_OBJECT_0) {
         if (prmsm->abort) {
@@ -265,65 +362,28 @@ RGY_ERR RGYInputSM::LoadNextFrameInternal(RGYFrame *pSurface) {
     if (prmsm->abort) {
         return RGY_ERR_MORE_DATA;
     }
+    const void *src = m_sm[m_encSatusInfo->m_sData.frameIn & 1]->ptr();
+#else
+    const uint32_t frame = m_ring->consumed.load(std::memory_order_relaxed);
+    if (auto sts = waitRingFilled(frame); sts != RGY_ERR_NONE) {
+        return sts;
+    }
+    //スロットから直接読み込む (生産者はconsumedが進むまでこのスロットを上書きしない)
+    const void *src = m_ring->slotPtr(frame);
+#endif
 
     void *dst_array[RGY_MAX_PLANES];
     pSurface->ptrArray(dst_array);
 
     const void *src_array[RGY_MAX_PLANES];
-    src_array[0] = m_sm[m_encSatusInfo->m_sData.frameIn & 1]->ptr();
-    src_array[1] = (uint8_t *)src_array[0] + m_inputVideoInfo.srcPitch * m_inputVideoInfo.srcHeight;
-    switch (m_convert->getFunc()->csp_from) {
-    case RGY_CSP_YV12:
-    case RGY_CSP_YV12_09:
-    case RGY_CSP_YV12_10:
-    case RGY_CSP_YV12_12:
-    case RGY_CSP_YV12_14:
-    case RGY_CSP_YV12_16:
-        src_array[2] = (uint8_t *)src_array[1] + m_inputVideoInfo.srcPitch * m_inputVideoInfo.srcHeight / 4;
-        break;
-    case RGY_CSP_YUV422:
-    case RGY_CSP_YUV422_09:
-    case RGY_CSP_YUV422_10:
-    case RGY_CSP_YUV422_12:
-    case RGY_CSP_YUV422_14:
-    case RGY_CSP_YUV422_16:
-        src_array[2] = (uint8_t *)src_array[1] + m_inputVideoInfo.srcPitch * m_inputVideoInfo.srcHeight / 2;
-        break;
-    case RGY_CSP_YUV444:
-    case RGY_CSP_YUV444_09:
-    case RGY_CSP_YUV444_10:
-    case RGY_CSP_YUV444_12:
-    case RGY_CSP_YUV444_14:
-    case RGY_CSP_YUV444_16:
-    case RGY_CSP_RGB:
-        src_array[2] = (uint8_t *)src_array[1] + m_inputVideoInfo.srcPitch * m_inputVideoInfo.srcHeight;
-        break;
-    case RGY_CSP_NV12:
-    case RGY_CSP_P010:
-    default:
-        break;
-    }
-    src_array[3] = nullptr;
+    rgy_input_sm_plane_ptr(src_array, src, m_convert->getFunc()->csp_from, m_inputVideoInfo.srcPitch, m_inputVideoInfo.srcHeight);
 
-    int src_uv_pitch = m_inputVideoInfo.srcPitch;
-    switch (RGY_CSP_CHROMA_FORMAT[m_convert->getFunc()->csp_from]) {
-    case RGY_CHROMAFMT_YUV422:
-        src_uv_pitch >>= 1;
-        break;
-    case RGY_CHROMAFMT_YUV444:
-        break;
-    case RGY_CHROMAFMT_RGB:
-    case RGY_CHROMAFMT_RGB_PACKED:
-        break;
-    case RGY_CHROMAFMT_YUV420:
-    default:
-        src_uv_pitch >>= 1;
-        break;
-    }
+    const int src_uv_pitch = rgy_input_sm_pitch_uv(m_convert->getFunc()->csp_from, m_inputVideoInfo.srcPitch);
     m_convert->run((m_inputVideoInfo.picstruct & RGY_PICSTRUCT_INTERLACED) ? 1 : 0,
         dst_array, src_array, m_inputVideoInfo.srcWidth, m_inputVideoInfo.srcPitch,
         src_uv_pitch, pSurface->pitch(), pSurface->pitch(RGY_PLANE_C), m_inputVideoInfo.srcHeight, m_inputVideoInfo.srcHeight, m_inputVideoInfo.crop.c);
 
+#if defined(_WIN32) || defined(_WIN64)
     pSurface->setTimestamp(prmsm->timestamp[m_encSatusInfo->m_sData.frameIn & 1]);
     pSurface->setDuration(prmsm->duration[m_encSatusInfo->m_sData.frameIn & 1]);
     m_droppedInAviutl = prmsm->dropped[m_encSatusInfo->m_sData.frameIn & 1];
@@ -332,6 +392,16 @@ RGY_ERR RGYInputSM::LoadNextFrameInternal(RGYFrame *pSurface) {
         AddMessage(RGY_LOG_ERROR, _T("Failed to set event!\n"));
         return RGY_ERR_UNKNOWN;
     }
+#else
+    const auto slotInfo = m_ring->slotInfo(frame);
+    pSurface->setTimestamp(slotInfo->timestamp);
+    pSurface->setDuration(slotInfo->duration);
+    m_droppedInAviutl = slotInfo->dropped;
+
+    //スロットを生産者に返す
+    m_ring->consumed.store(frame + 1, std::memory_order_release);
+    rgy_wake_by_address_all_shared(&m_ring->consumed);
+#endif
     m_encSatusInfo->m_sData.frameIn++;
     return m_encSatusInfo->UpdateDisplay();
 }
@@ -31,30 +31,7 @@
 
 #include "rgy_input.h"
 #include "rgy_shared_mem.h"
-
-static const char *RGYInputSMPrmSM       = "RGYInputSMPrmSM";
-static const char *RGYInputSMBuffer      = "RGYInputSMBuffer";
-
-#pragma pack(push)
-#pragma pack(1)
-struct RGYInputSMSharedData {
-    int w, h;
-    int fpsN, fpsD;
-    int pitch;
-    RGY_CSP csp;
-    RGY_PICSTRUCT picstruct;
-    int frames;
-    uint32_t bufSize;
-    int64_t timestamp[2];
-    int duration[2];
-    bool afs;
-    bool abort;
-    bool reserved[2];
-    uint64_t heBufEmpty[2];
-    uint64_t heBufFilled[2];
-    int dropped[2];
-};
-#pragma pack(pop)
+#include "rgy_input_sm_ring.h"
 
 #if ENABLE_SM_READER
 
@@ -80,12 +57,21 @@ public:
 protected:
     virtual RGY_ERR Init(const TCHAR *strFileName, VideoInfo *pInputInfo, const RGYInputPrm *prm) override;
     virtual RGY_ERR LoadNextFrameInternal(RGYFrame *pSurface) override;
+    RGYInputSMSharedData *sharedPrm();
 
+#if defined(_WIN32) || defined(_WIN64)
     std::unique_ptr<RGYSharedMemWin> m_prm;
     std::array<std::unique_ptr<RGYSharedMem>,2> m_sm;
     std::array<HANDLE,2> m_heBufEmpty;
     std::array<HANDLE,2> m_heBufFilled;
     HANDLE m_parentProcess;
+#else
+    RGY_ERR openRing(const TCHAR *strFileName);
+    RGY_ERR waitRingFilled(uint32_t frame);
+
+    std::unique_ptr<RGYSharedMemLinux> m_ringMem; //生産者が作成したフレームのリング
+    RGYInputSMRing *m_ring;
+#endif
     int m_droppedInAviutl;
 };
 
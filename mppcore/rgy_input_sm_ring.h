@@ -0,0 +1,190 @@
+﻿// -----------------------------------------------------------------------------------------
+// QSVEnc/NVEnc by rigaya
+// -----------------------------------------------------------------------------------------
+// The MIT License
+//
+// Copyright (c) 2011-2016 rigaya
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// --------------------------------------------------------------------------------------------
+
+#pragma once
+#ifndef __RGY_INPUT_SM_RING_H__
+#define __RGY_INPUT_SM_RING_H__
+
+#include <cstdint>
+#include <atomic>
+#include "rgy_osdep.h"
+#include "convert_csp.h"
+
+//共有メモリ入力(--sm)で、フレームを渡す側(生産者)とrkmppenc(消費者)で共有する定義
+
+static const char *RGYInputSMPrmSM       = "RGYInputSMPrmSM";
+static const char *RGYInputSMBuffer      = "RGYInputSMBuffer";
+
+#pragma pack(push)
+#pragma pack(1)
+struct RGYInputSMSharedData {
+    int w, h;
+    int fpsN, fpsD;
+    int pitch;
+    RGY_CSP csp;
+    RGY_PICSTRUCT picstruct;
+    int frames;
+    uint32_t bufSize;
+    int64_t timestamp[2];
+    int duration[2];
+    bool afs;
+    bool abort;
+    bool reserved[2];
+    uint64_t heBufEmpty[2];
+    uint64_t heBufFilled[2];
+    int dropped[2];
+};
+#pragma pack(pop)
+
+//1フレームのバッファサイズ (0なら非対応の色空間)
+//各平面はY, U, Vの順に連続して置き、Yのピッチはpitch、U/Vのピッチは色差の間引きに合わせる
+static inline uint32_t rgy_input_sm_frame_size(const RGY_CSP csp, const int pitch, const int height) {
+    switch (csp) {
+    case RGY_CSP_NV12:
+    case RGY_CSP_YV12:
+        return pitch * height * 3 / 2;
+    case RGY_CSP_P010:
+    case RGY_CSP_YV12_09:
+    case RGY_CSP_YV12_10:
+    case RGY_CSP_YV12_12:
+    case RGY_CSP_YV12_14:
+    case RGY_CSP_YV12_16:
+        return pitch * height * 3;
+    case RGY_CSP_YUV422:
+        return pitch * height * 2;
+    case RGY_CSP_YUV422_09:
+    case RGY_CSP_YUV422_10:
+    case RGY_CSP_YUV422_12:
+    case RGY_CSP_YUV422_14:
+    case RGY_CSP_YUV422_16:
+        return pitch * height * 4;
+    case RGY_CSP_YUV444:
+    case RGY_CSP_RGB:
+        return pitch * height * 3;
+    case RGY_CSP_YUV444_09:
+    case RGY_CSP_YUV444_10:
+    case RGY_CSP_YUV444_12:
+    case RGY_CSP_YUV444_14:
+    case RGY_CSP_YUV444_16:
+        return pitch * height * 6;
+    default:
+        return 0;
+    }
+}
+
+//1フレームのバッファから各平面の先頭を求める
+static inline void rgy_input_sm_plane_ptr(const void *src_array[RGY_MAX_PLANES], const void *buf, const RGY_CSP csp, const int pitch, const int height) {
+    src_array[0] = buf;
+    src_array[1] = (const uint8_t *)src_array[0] + pitch * height;
+    src_array[2] = nullptr;
+    src_array[3] = nullptr;
+    switch (RGY_CSP_CHROMA_FORMAT[csp]) {
+    case RGY_CHROMAFMT_YUV420:
+        if (RGY_CSP_PLANES[csp] == 3) {
+            src_array[2] = (const uint8_t *)src_array[1] + pitch * height / 4;
+        }
+        break;
+    case RGY_CHROMAFMT_YUV422:
+        src_array[2] = (const uint8_t *)src_array[1] + pitch * height / 2;
+        break;
+    case RGY_CHROMAFMT_YUV444:
+    case RGY_CHROMAFMT_RGB:
+        src_array[2] = (const uint8_t *)src_array[1] + pitch * height;
+        break;
+    default:
+        break;
+    }
+}
+
+//U/V平面のピッチ
+static inline int rgy_input_sm_pitch_uv(const RGY_CSP csp, const int pitch) {
+    switch (RGY_CSP_CHROMA_FORMAT[csp]) {
+    case RGY_CHROMAFMT_YUV444:
+    case RGY_CHROMAFMT_RGB:
+    case RGY_CHROMAFMT_RGB_PACKED:
+        return pitch;
+    case RGY_CHROMAFMT_YUV420:
+    case RGY_CHROMAFMT_YUV422:
+    default:
+        return pitch >> 1;
+    }
+}
+
+#if !(defined(_WIN32) || defined(_WIN64))
+//Linux版: 1つの名前付き共有メモリ(/dev/shm)上にフレームのリングを置く
+// [RGYInputSMRing][slot 0][slot 1]...[slot slotCount-1]  (スロットはページ境界に置く)
+// 生産者: prmなどを設定してmagicを書き込み、slot(filled % slotCount)にフレームを書いてfilledを進める
+//         filled - consumed == slotCountの間は空きがないので、consumedの変化を待つ
+// 消費者: slot(consumed % slotCount)から直接読み込み(色変換)、consumedを進める
+// filled/consumedはプロセス間のfutexで待機・起床する
+// タイムスタンプの時間単位は、Windows版と同じく 1/(fps*4)
+static const uint32_t RGY_INPUT_SM_RING_MAGIC     = 0x52534752; //"RGSR"
+static const uint32_t RGY_INPUT_SM_RING_VERSION   = 1;
+static const uint32_t RGY_INPUT_SM_RING_MAX_SLOTS = 32;
+static const uint64_t RGY_INPUT_SM_RING_ALIGN     = 4096;
+
+struct RGYInputSMRingSlot {
+    int64_t timestamp;
+    int32_t duration;
+    int32_t dropped;
+};
+
+struct RGYInputSMRing {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t slotCount;
+    uint32_t headerSize;  //sizeof(RGYInputSMRing)
+    uint64_t slotOffset;  //共有メモリの先頭から最初のスロットまで
+    uint64_t slotStride;  //スロットの間隔
+    int32_t producerPid;
+    int32_t consumerPid;  //消費者が開いたら設定する
+    RGYInputSMSharedData prm;  //w, h, fps, pitch, csp, picstruct, frames, bufSize(1フレームのサイズ), afs, abort
+    alignas(64) std::atomic<uint32_t> filled;   //生産者が書き込みを終えたフレーム数
+    alignas(64) std::atomic<uint32_t> consumed; //消費者が読み終えたフレーム数
+    alignas(64) std::atomic<uint32_t> eof;      //生産者の書き込み終了
+    std::atomic<uint32_t> consumerClosed;       //消費者の終了 (生産者の待機を解除する)
+    RGYInputSMRingSlot slot[RGY_INPUT_SM_RING_MAX_SLOTS];
+
+    uint8_t *slotPtr(const uint32_t frame) {
+        return (uint8_t *)this + slotOffset + slotStride * (frame % slotCount);
+    }
+    RGYInputSMRingSlot *slotInfo(const uint32_t frame) {
+        return &slot[frame % slotCount];
+    }
+};
+static_assert(sizeof(std::atomic<uint32_t>) == sizeof(uint32_t), "futex requires 32bit atomic");
+
+//共有メモリ全体のサイズ
+static inline uint64_t rgy_input_sm_ring_size(const uint32_t slotCount, const uint32_t frameSize, uint64_t *slotOffset, uint64_t *slotStride) {
+    const auto align = [](uint64_t x) { return (x + RGY_INPUT_SM_RING_ALIGN - 1) & ~(RGY_INPUT_SM_RING_ALIGN - 1); };
+    *slotOffset = align(sizeof(RGYInputSMRing));
+    *slotStride = align(frameSize);
+    return *slotOffset + *slotStride * slotCount;
+}
+#endif //#if !(defined(_WIN32) || defined(_WIN64))
+
+#endif //__RGY_INPUT_SM_RING_H__
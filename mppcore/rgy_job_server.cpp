@@ -0,0 +1,322 @@
+﻿// -----------------------------------------------------------------------------------------
+// QSVEnc/NVEnc by rigaya
+// -----------------------------------------------------------------------------------------
+// The MIT License
+//
+// Copyright (c) 2011-2016 rigaya
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// --------------------------------------------------------------------------------------------
+
+#include "rgy_job_server.h"
+
+#if ENABLE_RGY_JOB_SERVER
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include "rgy_util.h"
+
+static const int RGY_JOB_SERVER_POLL_MS = 200;
+static const int RGY_JOB_SERVER_REQUEST_TIMEOUT_MS = 10000;
+static const size_t RGY_JOB_SERVER_REQUEST_MAX = 1024 * 1024;
+
+RGYJobServer::RGYJobServer() :
+    m_socketPath(),
+    m_fd(-1),
+    m_jobCount(0) {
+}
+
+RGYJobServer::~RGYJobServer() {
+    close();
+}
+
+RGY_ERR RGYJobServer::init(const tstring& socketPath) {
+    close();
+    const auto path = tchar_to_string(socketPath);
+    sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (path.length() == 0 || path.length() >= sizeof(addr.sun_path)) {
+        _ftprintf(stderr, _T("Invalid socket path: \"%s\".\n"), socketPath.c_str());
+        return RGY_ERR_INVALID_PARAM;
+    }
+    memcpy(addr.sun_path, path.c_str(), path.length());
+
+    //前回の異常終了で残ったソケットは削除する (動作中のサーバーのソケットやソケット以外のファイルは残す)
+    struct stat st;
+    if (lstat(path.c_str(), &st) == 0) {
+        if (!S_ISSOCK(st.st_mode)) {
+            _ftprintf(stderr, _T("\"%s\" already exists and is not a socket.\n"), socketPath.c_str());
+            return RGY_ERR_ACCESS_DENIED;
+        }
+        const int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        const bool inUse = fd >= 0 && connect(fd, (const sockaddr *)&addr, sizeof(addr)) == 0;
+        if (fd >= 0) {
+            ::close(fd);
+        }
+        if (inUse) {
+            _ftprintf(stderr, _T("Another server is already running on \"%s\".\n"), socketPath.c_str());
+            return RGY_ERR_ALREADY_INITIALIZED;
+        }
+        unlink(path.c_str());
+    }
+
+    m_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (m_fd < 0) {
+        _ftprintf(stderr, _T("Failed to create socket: %s.\n"), char_to_tstring(strerror(errno)).c_str());
+        return RGY_ERR_UNKNOWN;
+    }
+    //ジョブは任意のファイルを読み書きするので、接続できるのはサーバーと同じユーザーのみとする
+    const auto prevMask = umask(0077);
+    const int bindRet = bind(m_fd, (const sockaddr *)&addr, sizeof(addr));
+    umask(prevMask);
+    if (bindRet != 0) {
+        _ftprintf(stderr, _T("Failed to bind socket \"%s\": %s.\n"), socketPath.c_str(), char_to_tstring(strerror(errno)).c_str());
+        close();
+        return RGY_ERR_ACCESS_DENIED;
+    }
+    m_socketPath = socketPath;
+    if (listen(m_fd, 16) != 0) {
+        _ftprintf(stderr, _T("Failed to listen on \"%s\": %s.\n"), socketPath.c_str(), char_to_tstring(strerror(errno)).c_str());
+        close();
+        return RGY_ERR_ACCESS_DENIED;
+    }
+    //クライアントの切断後に書き込んでも、プロセスが終了しないようにする
+    signal(SIGPIPE, SIG_IGN);
+    return RGY_ERR_NONE;
+}
+
+void RGYJobServer::close() {
+    if (m_fd >= 0) {
+        ::close(m_fd);
+        m_fd = -1;
+    }
+    if (m_socketPath.length() > 0) {
+        unlink(tchar_to_string(m_socketPath).c_str());
+        m_socketPath.clear();
+    }
+}
+
+RGY_ERR RGYJobServer::run(JobFunc job, std::atomic<bool> *stop) {
+    if (m_fd < 0) {
+        return RGY_ERR_NOT_INITIALIZED;
+    }
+    while (!*stop) {
+        pollfd pfd = { m_fd, POLLIN, 0 };
+        const int ret = poll(&pfd, 1, RGY_JOB_SERVER_POLL_MS);
+        if (ret < 0 && errno != EINTR) {
+            _ftprintf(stderr, _T("Failed to wait for connection: %s.\n"), char_to_tstring(strerror(errno)).c_str());
+            return RGY_ERR_UNKNOWN;
+        }
+        if (ret <= 0) {
+            continue;
+        }
+        const int fd = accept4(m_fd, nullptr, nullptr, SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno == EINTR || errno == EAGAIN || errno == ECONNABORTED) {
+                continue;
+            }
+            _ftprintf(stderr, _T("Failed to accept connection: %s.\n"), char_to_tstring(strerror(errno)).c_str());
+            return RGY_ERR_UNKNOWN;
+        }
+        runJob(fd, job, stop);
+        ::close(fd);
+    }
+    return RGY_ERR_NONE;
+}
+
+RGY_ERR RGYJobServer::readRequest(std::string& request, int fd, std::atomic<bool> *stop) {
+    request.clear();
+    const auto start = std::chrono::steady_clock::now();
+    char buf[4096];
+    while (!*stop) {
+        pollfd pfd = { fd, POLLIN, 0 };
+        const int ret = poll(&pfd, 1, RGY_JOB_SERVER_POLL_MS);
+        if (ret < 0 && errno != EINTR) {
+            return RGY_ERR_UNKNOWN;
+        }
+        if (ret > 0) {
+            const auto size = recv(fd, buf, sizeof(buf), 0);
+            if (size < 0 && errno != EINTR) {
+                return RGY_ERR_UNKNOWN;
+            }
+            if (size == 0) { //改行なしで送信側が閉じられた場合は、そこまでを1行とする
+                return (request.length() > 0) ? RGY_ERR_NONE : RGY_ERR_MORE_DATA;
+            }
+            if (size > 0) {
+                request.append(buf, size);
+                const auto pos = request.find('\n');
+                if (pos != std::string::npos) {
+                    request.resize(pos);
+                    return RGY_ERR_NONE;
+                }
+                if (request.length() > RGY_JOB_SERVER_REQUEST_MAX) {
+                    return RGY_ERR_INVALID_PARAM;
+                }
+            }
+        }
+        if (std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count() > RGY_JOB_SERVER_REQUEST_TIMEOUT_MS) {
+            return RGY_ERR_INVALID_CALL;
+        }
+    }
+    return RGY_ERR_ABORTED;
+}
+
+int RGYJobServer::runJob(int fd, JobFunc& job, std::atomic<bool> *stop) {
+    const int jobId = ++m_jobCount;
+    auto sendStr = [fd](const std::string& str) {
+        for (size_t sent = 0; sent < str.length(); ) {
+            const auto size = send(fd, str.data() + sent, str.length() - sent, MSG_NOSIGNAL);
+            if (size <= 0) {
+                if (size < 0 && errno == EINTR) continue;
+                break;
+            }
+            sent += size;
+        }
+    };
+
+    std::string request;
+    const auto err = readRequest(request, fd, stop);
+    if (err == RGY_ERR_MORE_DATA || err == RGY_ERR_ABORTED) { //何も送らずに切断された場合 (接続確認など)
+        return 0;
+    }
+    if (err != RGY_ERR_NONE) {
+        _ftprintf(stderr, _T("job #%d: failed to read command line.\n"), jobId);
+        sendStr("Failed to read command line.\nRESULT 1\n");
+        return 1;
+    }
+    if (request.length() > 0 && request.back() == '\r') {
+        request.pop_back();
+    }
+    std::vector<std::string> argsChar;
+    if (splitCmdLine(argsChar, request) != RGY_ERR_NONE || argsChar.size() == 0) {
+        _ftprintf(stderr, _T("job #%d: invalid command line.\n"), jobId);
+        sendStr("Invalid command line.\nRESULT 1\n");
+        return 1;
+    }
+    std::vector<tstring> args;
+    for (const auto& arg : argsChar) {
+        args.push_back(char_to_tstring(arg, CP_UTF8));
+    }
+    _ftprintf(stderr, _T("job #%d: start: %s\n"), jobId, char_to_tstring(request, CP_UTF8).c_str());
+    const auto start = std::chrono::steady_clock::now();
+
+    //ジョブの標準出力・標準エラー出力 (ログ・進捗表示) をクライアントに送る
+    fflush(stdout);
+    fflush(stderr);
+    const int savedStdout = dup(STDOUT_FILENO);
+    const int savedStderr = dup(STDERR_FILENO);
+    dup2(fd, STDOUT_FILENO);
+    dup2(fd, STDERR_FILENO);
+
+    //クライアントの切断・サーバーの停止で、ジョブを中断する
+    //送信側のみ閉じた場合(shutdown(SHUT_WR))は、出力の受信を続けているので中断しない
+    //abortは監視スレッドが書き込み、ジョブのスレッドが読み取るのでatomicとする
+    std::atomic<bool> abort(false);
+    std::atomic<bool> finished(false);
+    std::thread watcher([&]() {
+        while (!finished) {
+            pollfd pfd = { fd, 0, 0 };
+            const int ret = poll(&pfd, 1, RGY_JOB_SERVER_POLL_MS);
+            if (*stop || (ret > 0 && (pfd.revents & (POLLHUP | POLLERR)))) {
+                abort = true;
+                break;
+            }
+        }
+    });
+    int ret = 1;
+    try {
+        ret = job(args, &abort);
+    } catch (...) {
+        _ftprintf(stderr, _T("fatal error in job.\n"));
+        ret = 1;
+    }
+    finished = true;
+    watcher.join();
+
+    fflush(stdout);
+    fflush(stderr);
+    dup2(savedStdout, STDOUT_FILENO);
+    dup2(savedStderr, STDERR_FILENO);
+    ::close(savedStdout);
+    ::close(savedStderr);
+
+    sendStr(strsprintf("RESULT %d\n", ret));
+    const auto sec = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count() * 1e-3;
+    _ftprintf(stderr, _T("job #%d: %s, exit code %d (%.1f sec).\n"), jobId, abort ? _T("aborted") : _T("finished"), ret, sec);
+    return ret;
+}
+
+RGY_ERR RGYJobServer::splitCmdLine(std::vector<std::string>& args, const std::string& cmd) {
+    args.clear();
+    std::string arg;
+    bool inArg = false;
+    char quote = '\0';
+    for (size_t i = 0; i < cmd.length(); i++) {
+        const char c = cmd[i];
+        if (quote == '\'') { //'...'の中はそのまま
+            if (c == '\'') {
+                quote = '\0';
+            } else {
+                arg += c;
+            }
+        } else if (quote == '"') { //"..."の中では、\" と \\ のみエスケープとする
+            if (c == '"') {
+                quote = '\0';
+            } else if (c == '\\' && i + 1 < cmd.length() && (cmd[i + 1] == '"' || cmd[i + 1] == '\\')) {
+                arg += cmd[++i];
+            } else {
+                arg += c;
+            }
+        } else if (c == ' ' || c == '\t' || c == '\r' || c == '\n') {
+            if (inArg) {
+                args.push_back(arg);
+                arg.clear();
+                inArg = false;
+            }
+        } else {
+            inArg = true;
+            if (c == '\'' || c == '"') {
+                quote = c;
+            } else if (c == '\\' && i + 1 < cmd.length()) {
+                arg += cmd[++i];
+            } else {
+                arg += c;
+            }
+        }
+    }
+    if (quote != '\0') {
+        return RGY_ERR_INVALID_PARAM;
+    }
+    if (inArg) {
+        args.push_back(arg);
+    }
+    return RGY_ERR_NONE;
+}
+
+#endif //#if ENABLE_RGY_JOB_SERVER
@@ -0,0 +1,78 @@
+﻿// -----------------------------------------------------------------------------------------
+// QSVEnc/NVEnc by rigaya
+// -----------------------------------------------------------------------------------------
+// The MIT License
+//
+// Copyright (c) 2011-2016 rigaya
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// --------------------------------------------------------------------------------------------
+
+#pragma once
+#ifndef __RGY_JOB_SERVER_H__
+#define __RGY_JOB_SERVER_H__
+
+#include <atomic>
+#include <functional>
+#include <string>
+#include <vector>
+#include "rgy_err.h"
+#include "rgy_tchar.h"
+
+#if defined(_WIN32) || defined(_WIN64)
+#define ENABLE_RGY_JOB_SERVER 0
+#else
+#define ENABLE_RGY_JOB_SERVER 1
+#endif
+
+#if ENABLE_RGY_JOB_SERVER
+
+//UNIXドメインソケットで受け付けたジョブを、1つずつ順に実行する常駐サーバー
+//  client -> server: 1行のコマンドライン (UTF-8、改行で終端、シェルと同様に空白区切りで引用符・エスケープが使用可能)
+//  server -> client: ジョブ実行中の標準出力・標準エラー出力 (ログ・進捗表示) に続けて、
+//                    最後に "RESULT <終了コード>" の1行を送信して切断する
+//ジョブの実行中にクライアントが切断した場合は、そのジョブを中断する
+class RGYJobServer {
+public:
+    //args: コマンドライン (実行ファイル名は含まない)、abort: 中断時にtrueとなるフラグ、戻り値: 終了コード
+    using JobFunc = std::function<int(const std::vector<tstring>& args, std::atomic<bool> *abort)>;
+
+    RGYJobServer();
+    ~RGYJobServer();
+
+    RGY_ERR init(const tstring& socketPath);
+    //*stopがtrueになるまで、ジョブを受け付けて実行する
+    RGY_ERR run(JobFunc job, std::atomic<bool> *stop);
+    void close();
+
+    //シェルと同様の規則でコマンドラインを分割する
+    static RGY_ERR splitCmdLine(std::vector<std::string>& args, const std::string& cmd);
+protected:
+    RGY_ERR readRequest(std::string& request, int fd, std::atomic<bool> *stop);
+    int runJob(int fd, JobFunc& job, std::atomic<bool> *stop);
+
+    tstring m_socketPath;
+    int m_fd;
+    int m_jobCount;
+};
+
+#endif //#if ENABLE_RGY_JOB_SERVER
+
+#endif //__RGY_JOB_SERVER_H__
@@ -37,6 +37,7 @@
 #define CL_EXTERN
 #include "rgy_opencl.h"
 #include "rgy_opencl_perf.h"
+#include "rgy_opencl_cache.h"
 #include "rgy_resource.h"
 #include "rgy_filesystem.h"
 
@@ -347,9 +348,11 @@ int initOpenCLGlobal() {
     LOAD(clGetSupportedImageFormats);
 
     LOAD(clCreateProgramWithSource);
+    LOAD(clCreateProgramWithBinary);
     LOAD(clBuildProgram);
     LOAD(clGetProgramBuildInfo);
     LOAD(clGetProgramInfo);
+    LOAD(clRetainProgram);
     LOAD(clReleaseProgram);
 
     LOAD(clCreateBuffer);
@@ -395,6 +398,9 @@ int initOpenCLGlobal() {
     LOAD(clEnqueueWaitForEvents);
     LOAD(clEnqueueMarker);
     LOAD_NO_CHECK(clGetDeviceAndHostTimer);
+    LOAD_NO_CHECK(clEnqueueMarkerWithWaitList);
+    LOAD_NO_CHECK(clSVMAlloc);
+    LOAD_NO_CHECK(clSVMFree);
 
     LOAD_NO_CHECK(clCreateSemaphoreWithPropertiesKHR);
     LOAD_NO_CHECK(clEnqueueWaitSemaphoresKHR);
@@ -1373,7 +1379,11 @@ RGYOpenCLContext::RGYOpenCLContext(shared_ptr<RGYOpenCLPlatform> platform, int b
     m_copy(),
     m_threadPool(),
     m_buildThreads(buildThreads > 0 ? buildThreads : std::min(RGY_OPENCL_BUILD_THREAD_DEFAULT_MAX, (int)std::thread::hardware_concurrency())),
-    m_hmodule(NULL) {
+    m_hmodule(NULL),
+    m_programReuse(false),
+    m_programReuseMtx(),
+    m_programReuseMap(),
+    m_persistentMapSupported(false) {
 
 }
 
@@ -1386,6 +1396,10 @@ RGYOpenCLContext::~RGYOpenCLContext() {
     m_threadPool.reset();
     CL_LOG(RGY_LOG_DEBUG, _T("Closing CL Context...\n"));
     m_copy.clear();     CL_LOG(RGY_LOG_DEBUG, _T("Closed CL m_copy program.\n"));
+    for (auto& [key, program] : m_programReuseMap) {
+        clReleaseProgram(program);
+    }
+    m_programReuseMap.clear();
     m_queue.clear();    CL_LOG(RGY_LOG_DEBUG, _T("Closed CL Queue.\n"));
     m_context.reset();  CL_LOG(RGY_LOG_DEBUG, _T("Closed CL Context.\n"));
     m_platform.reset(); CL_LOG(RGY_LOG_DEBUG, _T("Closed CL Platform.\n"));
@@ -1451,6 +1465,9 @@ RGY_ERR RGYOpenCLContext::createContext(const cl_command_queue_properties queue_
     for (int idev = 0; idev < (int)m_platform->devs().size(); idev++) {
         m_queue.push_back(createQueue(m_platform->dev(idev).id(), queue_properties));
     }
+    //フレームの確保のたびに問い合わせないよう、ここで確認しておく
+    m_persistentMapSupported = checkPersistentMapSupport();
+    CL_LOG(RGY_LOG_DEBUG, _T("persistent map (fine-grain SVM): %s\n"), m_persistentMapSupported ? _T("supported") : _T("not supported"));
     return RGY_ERR_NONE;
 }
 
@@ -1946,10 +1963,13 @@ RGY_ERR RGYCLFrameMap::map(cl_map_flags map_flags, RGYOpenCLQueue& queue) {
 }
 
 RGY_ERR RGYCLFrameMap::map(cl_map_flags map_flags, RGYOpenCLQueue &queue, const std::vector<RGYOpenCLEvent> &wait_events, const RGYCLMapBlock block_map) {
+    m_queue = queue.get();
+    if (m_dev->isPersistentMapped()) {
+        return mapPersistent(wait_events, block_map);
+    }
     std::vector<cl_event> v_wait_list = toVec(wait_events);
     cl_event *wait_list = (v_wait_list.size() > 0) ? v_wait_list.data() : nullptr;
     frame = m_dev->frameInfo();
-    m_queue = queue.get();
     auto& perf_collector = RGYOpenCLPerfCollector::instance();
     const bool perf_enabled = perf_collector.isEnabled();
     for (int i = 0; i < _countof(frame.ptr); i++) {
@@ -1987,6 +2007,33 @@ RGY_ERR RGYCLFrameMap::map(cl_map_flags map_flags, RGYOpenCLQueue &queue, const
     return RGY_ERR_NONE;
 }
 
+RGY_ERR RGYCLFrameMap::mapPersistent(const std::vector<RGYOpenCLEvent> &wait_events, const RGYCLMapBlock block_map) {
+    // fine-grain SVMはそのままホストから参照できるので、map/unmapは行わない
+    // それまでに投入された処理の完了をmarkerのeventで待てるようにする
+    std::vector<cl_event> v_wait_list = toVec(wait_events);
+    frame = m_dev->frameInfo();
+    for (int i = 0; i < _countof(frame.ptr); i++) {
+        frame.ptr[i] = (uint8_t *)m_dev->svm[i];
+    }
+    m_eventMap.resize(1);
+    auto& perf_collector = RGYOpenCLPerfCollector::instance();
+    const bool perf_enabled = perf_collector.isEnabled();
+    const auto host_start = rgy_cl_perf_begin(perf_enabled);
+    const auto clerr = clEnqueueMarkerWithWaitList(m_queue, (cl_uint)v_wait_list.size(), (v_wait_list.size() > 0) ? v_wait_list.data() : nullptr, m_eventMap[0].reset_ptr());
+    const auto host_time = rgy_cl_perf_end(perf_enabled, host_start);
+    if (clerr != CL_SUCCESS) {
+        return err_cl_to_rgy(clerr);
+    }
+    if (perf_enabled) {
+        perf_collector.recordCommand(strsprintf("clEnqueueMarkerWithWaitList:frame:persistent:%s", rgy_cl_map_block_perf_name(block_map)),
+            0, host_time, m_eventMap[0], host_start, host_start + host_time, (uint64_t)(uintptr_t)m_queue);
+    }
+    if (block_map != RGY_CL_MAP_BLOCK_NONE) {
+        return map_wait();
+    }
+    return RGY_ERR_NONE;
+}
+
 RGY_ERR RGYCLFrameMap::unmap() {
     return unmap(m_queue, {});
 }
@@ -1997,6 +2044,13 @@ RGY_ERR RGYCLFrameMap::unmap(RGYOpenCLQueue &queue, const std::vector<RGYOpenCLE
     return unmap(queue.get(), wait_events);
 }
 RGY_ERR RGYCLFrameMap::unmap(cl_command_queue queue, const std::vector<RGYOpenCLEvent> &wait_events) {
+    if (m_dev->isPersistentMapped()) {
+        // 常時mapされたバッファは参照をやめるだけでよい
+        for (int i = 0; i < _countof(frame.ptr); i++) {
+            frame.ptr[i] = nullptr;
+        }
+        return RGY_ERR_NONE;
+    }
     std::vector<cl_event> v_wait_list = toVec(wait_events);
     cl_event *wait_list = (v_wait_list.size() > 0) ? v_wait_list.data() : nullptr;
     m_queue = queue;
@@ -2072,9 +2126,15 @@ void RGYCLFrame::clear() {
                 perf_collector.recordAllocation("clReleaseMemObject:frame", bytes, host_time, clerr == CL_SUCCESS);
             }
         }
+        // SVMはそれを使うmem objectの解放後に解放する
+        if (svm[i]) {
+            clSVMFree(svmContext, svm[i]);
+            svm[i] = nullptr;
+        }
         frame.ptr[i] = nullptr;
         frame.pitch[i] = 0;
     }
+    svmContext = nullptr;
 }
 
 RGYCLMemObjInfo RGYCLFrame::getMemObjectInfo() const {
@@ -2897,29 +2957,93 @@ std::unique_ptr<RGYOpenCLProgram> RGYOpenCLContext::buildProgram(const std::stri
     }
     CL_LOG(RGY_LOG_DEBUG, _T("building OpenCL source: size %u.\n"), datalen);
 
+    // 同じソース・オプションでビルド済みのプログラムがあれば、そのまま使用する
+    std::string reuse_key;
+    if (m_programReuse) {
+        reuse_key = options + '\0' + std::string(data, datalen);
+        std::lock_guard<std::mutex> lock(m_programReuseMtx);
+        auto it = m_programReuseMap.find(reuse_key);
+        if (it != m_programReuseMap.end() && clRetainProgram(it->second) == CL_SUCCESS) {
+            CL_LOG(RGY_LOG_DEBUG, _T("Reuse built OpenCL program.\n"));
+            return std::make_unique<RGYOpenCLProgram>(it->second, m_log);
+        }
+    }
+
+    auto& perf_collector = RGYOpenCLPerfCollector::instance();
     bool buildCrush = false;
     cl_int err = CL_SUCCESS;
     cl_program program = nullptr;
-    try {
-        program = clCreateProgramWithSource(m_context.get(), 1, &data, &datalen, &err);
-        if (err != CL_SUCCESS) {
-            CL_LOG(RGY_LOG_ERROR, _T("Error (clCreateProgramWithSource): %s\n"), cl_errmes(err));
+    uint64_t build_time_ns = 0;
+
+    // --cl-cache-dir: キャッシュにバイナリがあれば、ソースからのビルドを省略する
+    // バイナリはデバイスごとなので、単一デバイスの場合のみ使用する
+    auto& program_cache = RGYOpenCLProgramCache::instance();
+    std::string cache_key;
+    std::string cache_status;
+    if (program_cache.isEnabled() && m_platform->devs().size() == 1) {
+        const auto devInfo = RGYOpenCLDevice(m_platform->devs()[0]).info();
+        cache_key = RGYOpenCLProgramCache::key(data, datalen, options, m_platform->info().version, devInfo.name, devInfo.version, devInfo.driver_version);
+        const auto load_start = std::chrono::steady_clock::now();
+        std::vector<uint8_t> binary;
+        uint64_t cached_build_time_ns = 0;
+        if (program_cache.load(cache_key, binary, cached_build_time_ns) == RGY_ERR_NONE) {
+            const unsigned char *binary_ptr = binary.data();
+            const size_t binary_size = binary.size();
+            cl_int binary_status = CL_SUCCESS;
+            try {
+                program = clCreateProgramWithBinary(m_context.get(), 1, m_platform->devs().data(), &binary_size, &binary_ptr, &binary_status, &err);
+                if (program && (err != CL_SUCCESS || binary_status != CL_SUCCESS)) {
+                    clReleaseProgram(program);
+                    program = nullptr;
+                }
+                if (program) {
+                    err = clBuildProgram(program, 1, m_platform->devs().data(), options.c_str(), NULL, NULL);
+                    if (err != CL_SUCCESS) {
+                        clReleaseProgram(program);
+                        program = nullptr;
+                    }
+                }
+            } catch (...) {
+                program = nullptr;
+            }
+            if (!program) {
+                // ドライバ更新などで使用できなくなったバイナリは削除して、ソースからビルドしなおす
+                CL_LOG(RGY_LOG_DEBUG, _T("Failed to load cached OpenCL program binary, rebuild from source.\n"));
+                program_cache.remove(cache_key);
+                err = CL_SUCCESS;
+            }
+        }
+        if (program) {
+            build_time_ns = (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - load_start).count();
+            cache_status = "hit";
+            CL_LOG(RGY_LOG_DEBUG, _T("Loaded OpenCL program binary from cache: %.1f ms (build %.1f ms).\n"), build_time_ns * 1e-6, cached_build_time_ns * 1e-6);
+            perf_collector.recordProgramCache(true, build_time_ns, cached_build_time_ns);
+        } else {
+            cache_status = "miss";
         }
-    } catch (...) {
-        CL_LOG(RGY_LOG_ERROR, _T("Error (clCreateProgramWithSource): Crush!\n"));
-        return nullptr;
     }
 
-    uint64_t build_time_ns = 0;
-    const auto build_start = std::chrono::steady_clock::now();
-    try {
-        err = clBuildProgram(program, (cl_uint)m_platform->devs().size(), m_platform->devs().data(), options.c_str(), NULL, NULL);
-    } catch (...) {
-        err = CL_BUILD_PROGRAM_FAILURE;
-        buildCrush = true;
+    if (!program) {
+        try {
+            program = clCreateProgramWithSource(m_context.get(), 1, &data, &datalen, &err);
+            if (err != CL_SUCCESS) {
+                CL_LOG(RGY_LOG_ERROR, _T("Error (clCreateProgramWithSource): %s\n"), cl_errmes(err));
+            }
+        } catch (...) {
+            CL_LOG(RGY_LOG_ERROR, _T("Error (clCreateProgramWithSource): Crush!\n"));
+            return nullptr;
+        }
+
+        const auto build_start = std::chrono::steady_clock::now();
+        try {
+            err = clBuildProgram(program, (cl_uint)m_platform->devs().size(), m_platform->devs().data(), options.c_str(), NULL, NULL);
+        } catch (...) {
+            err = CL_BUILD_PROGRAM_FAILURE;
+            buildCrush = true;
+        }
+        const auto build_end = std::chrono::steady_clock::now();
+        build_time_ns = (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(build_end - build_start).count();
     }
-    const auto build_end = std::chrono::steady_clock::now();
-    build_time_ns = (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(build_end - build_start).count();
 
     // build log を常時取得 (perf collector / エラー表示 両用)
     std::string build_log_str;
@@ -2961,18 +3085,31 @@ std::unique_ptr<RGYOpenCLProgram> RGYOpenCLContext::buildProgram(const std::stri
     CL_LOG(RGY_LOG_DEBUG, _T("clBuildProgram success!\n"));
 
     // パフォーマンスコレクタにビルド情報を記録
-    auto& perf_collector = RGYOpenCLPerfCollector::instance();
     uint64_t prog_id = 0;
     if (perf_collector.isEnabled() && !m_platform->devs().empty()) {
         // name_hint が空なら "<inline:N>" を割り当てる (N はプログラムID確定前なので仮のもの)
         // recordProgramBuild 内部で program_id が発行されるので、ここでは hint を渡すだけ
         std::string hint = name_hint.empty() ? "<inline>" : name_hint;
-        prog_id = perf_collector.recordProgramBuild(hint, options, program, m_platform->devs()[0], build_log_str, build_time_ns);
+        prog_id = perf_collector.recordProgramBuild(hint, options, program, m_platform->devs()[0], build_log_str, build_time_ns, cache_status);
         // name_hint が空だった場合は "<inline:ID>" に更新 (記録後にIDが分かる)
         // → 設計上 recordProgramBuild の戻り値が prog_id なので、後段で上書きは不要
     }
 
-    return std::make_unique<RGYOpenCLProgram>(program, m_log, prog_id);
+    auto clprogram = std::make_unique<RGYOpenCLProgram>(program, m_log, prog_id);
+    if (cache_status == "miss") {
+        perf_collector.recordProgramCache(false, build_time_ns, 0);
+        const auto sts = program_cache.store(cache_key, clprogram->getBinary(), build_time_ns);
+        if (sts != RGY_ERR_NONE) {
+            CL_LOG(RGY_LOG_DEBUG, _T("Failed to store OpenCL program binary to cache: %s.\n"), get_err_mes(sts));
+        }
+    }
+    if (m_programReuse && clRetainProgram(program) == CL_SUCCESS) {
+        std::lock_guard<std::mutex> lock(m_programReuseMtx);
+        if (!m_programReuseMap.emplace(reuse_key, program).second) {
+            clReleaseProgram(program); // 並列に同じプログラムをビルドしていた場合
+        }
+    }
+    return clprogram;
 }
 
 std::unique_ptr<RGYOpenCLProgram> RGYOpenCLContext::build(const std::string &source, const char *options) {
@@ -3166,6 +3303,23 @@ std::unique_ptr<RGYCLFrame> RGYOpenCLContext::createFrameBuffer(const int width,
 }
 
 std::unique_ptr<RGYCLFrame> RGYOpenCLContext::createFrameBuffer(const RGYFrameInfo& frame, cl_mem_flags flags) {
+    return createFrameBuffer(frame, flags, 0, false);
+}
+
+bool RGYOpenCLContext::checkPersistentMapSupport() const {
+    if (clSVMAlloc == nullptr || clSVMFree == nullptr || clEnqueueMarkerWithWaitList == nullptr) {
+        return false;
+    }
+    // 通常のバッファをmapしたままkernelから書き込むのは未定義動作で、Maliなどではキャッシュの一貫性も保証されない
+    // ホストとデバイスで一貫性が保証されるfine-grain SVMが使える場合のみ有効とする
+    cl_device_svm_capabilities svm_caps = 0;
+    if (clGetDeviceInfo(m_platform->dev(0).id(), CL_DEVICE_SVM_CAPABILITIES, sizeof(svm_caps), &svm_caps, nullptr) != CL_SUCCESS) {
+        return false;
+    }
+    return (svm_caps & CL_DEVICE_SVM_FINE_GRAIN_BUFFER) != 0;
+}
+
+std::unique_ptr<RGYCLFrame> RGYOpenCLContext::createFrameBuffer(const RGYFrameInfo& frame, cl_mem_flags flags, const int pitch, const bool persistentMap) {
     cl_int err = CL_SUCCESS;
     int pixsize = (RGY_CSP_BIT_DEPTH[frame.csp] + 7) / 8;
     switch (frame.csp) {
@@ -3206,7 +3360,12 @@ std::unique_ptr<RGYCLFrame> RGYOpenCLContext::createFrameBuffer(const RGYFrameIn
 
     // convert系の関数でalignmentを前提としている箇所があるので、最低でも64にするようにする
     // またQSVEncのfixed-funcに渡すとき、256でないと異常が生じる場合がある
-    const int image_pitch_alignment = std::max(m_platform->dev(0).info().image_pitch_alignment, 256);
+    const int device_pitch_alignment = m_platform->dev(0).info().image_pitch_alignment;
+    const int image_pitch_alignment = std::max(device_pitch_alignment, 256);
+    // pitchの指定があり、alignmentの条件を満たせばそれを優先する
+    const int pitch_alignment_min = std::max(device_pitch_alignment, 64);
+    const bool useSVM = persistentMap && persistentMapSupported();
+    std::array<void *, RGY_MAX_PLANES> svmPtr = { 0 };
 
     RGYFrameInfo clframe = frame;
     clframe.mem_type = RGY_MEM_TYPE_GPU;
@@ -3217,12 +3376,22 @@ std::unique_ptr<RGYCLFrame> RGYOpenCLContext::createFrameBuffer(const RGYFrameIn
     for (int i = 0; i < RGY_CSP_PLANES[frame.csp]; i++) {
         const auto plane = getPlane(&clframe, (RGY_PLANE)i);
         const int widthByte = plane.width * pixsize;
-        const int memPitch = ALIGN(widthByte, image_pitch_alignment);
+        const int memPitch = (pitch >= widthByte && (pitch % pitch_alignment_min) == 0) ? pitch : ALIGN(widthByte, image_pitch_alignment);
         const int size = memPitch * plane.height;
         auto& perf_collector = RGYOpenCLPerfCollector::instance();
         const bool perf_enabled = perf_collector.isEnabled();
         const auto host_start = rgy_cl_perf_begin(perf_enabled);
-        cl_mem mem = clCreateBuffer(m_context.get(), flags, size, nullptr, &err);
+        cl_mem mem = nullptr;
+        if (useSVM) {
+            svmPtr[i] = clSVMAlloc(m_context.get(), CL_MEM_READ_WRITE | CL_MEM_SVM_FINE_GRAIN_BUFFER, size, 0);
+            if (svmPtr[i] == nullptr) {
+                err = CL_MEM_OBJECT_ALLOCATION_FAILURE;
+            } else {
+                mem = clCreateBuffer(m_context.get(), (flags & ~(CL_MEM_ALLOC_HOST_PTR | CL_MEM_COPY_HOST_PTR)) | CL_MEM_USE_HOST_PTR, size, svmPtr[i], &err);
+            }
+        } else {
+            mem = clCreateBuffer(m_context.get(), flags, size, nullptr, &err);
+        }
         const auto host_time = rgy_cl_perf_end(perf_enabled, host_start);
         if (perf_enabled) {
             perf_collector.recordAllocation("createFrameBuffer.clCreateBuffer", size, host_time, err == CL_SUCCESS);
@@ -3242,11 +3411,70 @@ std::unique_ptr<RGYCLFrame> RGYOpenCLContext::createFrameBuffer(const RGYFrameIn
                     clframe.ptr[j] = nullptr;
                 }
             }
+            for (auto& ptr : svmPtr) {
+                if (ptr) {
+                    clSVMFree(m_context.get(), ptr);
+                    ptr = nullptr;
+                }
+            }
             return std::unique_ptr<RGYCLFrame>();
         }
         clframe.pitch[i] = memPitch;
         clframe.ptr[i] = (uint8_t *)mem;
     }
+    auto clframeBuf = std::make_unique<RGYCLFrame>(clframe, flags);
+    if (useSVM) {
+        clframeBuf->svmContext = m_context.get();
+        clframeBuf->svm = svmPtr;
+    }
+    return clframeBuf;
+}
+
+size_t RGYOpenCLContext::subBufferAlignment() const {
+    //mem_base_addr_alignはbit単位
+    const int alignBits = std::max(m_platform->dev(0).info().mem_base_addr_align, 8);
+    return std::max<size_t>((alignBits + 7) / 8, 256);
+}
+
+size_t RGYOpenCLContext::frameSubBufferSize(const RGYFrameInfo &frame) const {
+    const size_t align = subBufferAlignment();
+    size_t size = 0;
+    for (int i = 0; i < RGY_CSP_PLANES[frame.csp]; i++) {
+        const auto plane = getPlane(&frame, (RGY_PLANE)i);
+        size += ALIGN((size_t)plane.pitch[0] * plane.height, align);
+    }
+    return size;
+}
+
+std::unique_ptr<RGYCLFrame> RGYOpenCLContext::createFrameSubBuffer(const RGYFrameInfo &frame, cl_mem parent, const size_t offset, cl_mem_flags flags) {
+    const size_t align = subBufferAlignment();
+    if ((offset % align) != 0) {
+        CL_LOG(RGY_LOG_ERROR, _T("sub-buffer offset is not aligned (offset %zu, align %zu).\n"), offset, align);
+        return std::unique_ptr<RGYCLFrame>();
+    }
+    RGYFrameInfo clframe = frame;
+    clframe.mem_type = RGY_MEM_TYPE_GPU;
+    for (int i = 0; i < _countof(clframe.ptr); i++) {
+        clframe.ptr[i] = nullptr;
+    }
+    size_t origin = offset;
+    for (int i = 0; i < RGY_CSP_PLANES[frame.csp]; i++) {
+        const auto plane = getPlane(&frame, (RGY_PLANE)i);
+        const size_t size = (size_t)plane.pitch[0] * plane.height;
+        cl_buffer_region region = { origin, size };
+        cl_int err = CL_SUCCESS;
+        cl_mem mem = clCreateSubBuffer(parent, flags, CL_BUFFER_CREATE_TYPE_REGION, &region, &err);
+        if (err != CL_SUCCESS) {
+            CL_LOG(RGY_LOG_ERROR, _T("Failed to create sub-buffer (plane %d, offset %zu, size %zu): %s\n"), i, origin, size, cl_errmes(err));
+            for (int j = i - 1; j >= 0; j--) {
+                clReleaseMemObject((cl_mem)clframe.ptr[j]);
+                clframe.ptr[j] = nullptr;
+            }
+            return std::unique_ptr<RGYCLFrame>();
+        }
+        clframe.ptr[i] = (uint8_t *)mem;
+        origin += ALIGN(size, align);
+    }
     return std::make_unique<RGYCLFrame>(clframe, flags);
 }
 
@@ -212,9 +212,11 @@ CL_EXTERN cl_int (CL_API_CALL* f_clReleaseCommandQueue) (cl_command_queue comman
 CL_EXTERN cl_int (CL_API_CALL* f_clGetSupportedImageFormats)(cl_context context, cl_mem_flags flags, cl_mem_object_type image_type, cl_uint num_entries, cl_image_format * image_formats, cl_uint * num_image_formats);
 
 CL_EXTERN cl_program(CL_API_CALL* f_clCreateProgramWithSource) (cl_context context, cl_uint count, const char **strings, const size_t *lengths, cl_int *errcode_ret);
+CL_EXTERN cl_program(CL_API_CALL* f_clCreateProgramWithBinary) (cl_context context, cl_uint num_devices, const cl_device_id *device_list, const size_t *lengths, const unsigned char **binaries, cl_int *binary_status, cl_int *errcode_ret);
 CL_EXTERN cl_int (CL_API_CALL* f_clBuildProgram) (cl_program program, cl_uint num_devices, const cl_device_id *device_list, const char *options, void (CL_CALLBACK *pfn_notify)(cl_program program, void *user_data), void* user_data);
 CL_EXTERN cl_int (CL_API_CALL* f_clGetProgramBuildInfo) (cl_program program, cl_device_id device, cl_program_build_info param_name, size_t param_value_size, void *param_value, size_t *param_value_size_ret);
 CL_EXTERN cl_int (CL_API_CALL* f_clGetProgramInfo)(cl_program program, cl_program_info param_name, size_t param_value_size, void *param_value, size_t *param_value_size_ret);
+CL_EXTERN cl_int (CL_API_CALL* f_clRetainProgram) (cl_program program);
 CL_EXTERN cl_int (CL_API_CALL* f_clReleaseProgram) (cl_program program);
 
 CL_EXTERN cl_mem (CL_API_CALL* f_clCreateBuffer) (cl_context context, cl_mem_flags flags, size_t size, void *host_ptr, cl_int *errcode_ret);
@@ -260,6 +262,9 @@ CL_EXTERN cl_int(CL_API_CALL *f_clGetEventProfilingInfo)(cl_event event, cl_prof
 CL_EXTERN cl_int(CL_API_CALL *f_clEnqueueWaitForEvents)(cl_command_queue command_queue, cl_uint num_events, const cl_event *event_list);
 CL_EXTERN cl_int(CL_API_CALL *f_clEnqueueMarker)(cl_command_queue command_queue, cl_event *event);
 CL_EXTERN cl_int(CL_API_CALL *f_clGetDeviceAndHostTimer)(cl_device_id device, cl_ulong *device_timestamp, cl_ulong *host_timestamp);
+CL_EXTERN cl_int(CL_API_CALL *f_clEnqueueMarkerWithWaitList)(cl_command_queue command_queue, cl_uint num_events_in_wait_list, const cl_event *event_wait_list, cl_event *event);
+CL_EXTERN void *(CL_API_CALL *f_clSVMAlloc)(cl_context context, cl_svm_mem_flags flags, size_t size, cl_uint alignment);
+CL_EXTERN void (CL_API_CALL *f_clSVMFree)(cl_context context, void *svm_pointer);
 
 CL_EXTERN cl_semaphore_khr (CL_API_CALL *f_clCreateSemaphoreWithPropertiesKHR)(cl_context context, const cl_semaphore_properties_khr *sema_props, cl_int *errcode_ret);
 CL_EXTERN cl_int(CL_API_CALL *f_clEnqueueWaitSemaphoresKHR)(cl_command_queue command_queue,cl_uint num_sema_objects,const cl_semaphore_khr* sema_objects,const cl_semaphore_payload_khr* sema_payload_list,cl_uint num_events_in_wait_list,const cl_event* event_wait_list,cl_event* event);
@@ -318,9 +323,11 @@ CL_EXTERN cl_int(CL_API_CALL* f_clEnqueueReleaseVA_APIMediaSurfacesINTEL)(cl_com
 #define clGetSupportedImageFormats f_clGetSupportedImageFormats
 
 #define clCreateProgramWithSource f_clCreateProgramWithSource
+#define clCreateProgramWithBinary f_clCreateProgramWithBinary
 #define clBuildProgram f_clBuildProgram
 #define clGetProgramBuildInfo f_clGetProgramBuildInfo
 #define clGetProgramInfo f_clGetProgramInfo
+#define clRetainProgram f_clRetainProgram
 #define clReleaseProgram f_clReleaseProgram
 
 #define clCreateBuffer f_clCreateBuffer
@@ -366,6 +373,9 @@ CL_EXTERN cl_int(CL_API_CALL* f_clEnqueueReleaseVA_APIMediaSurfacesINTEL)(cl_com
 #define clEnqueueWaitForEvents f_clEnqueueWaitForEvents
 #define clEnqueueMarker f_clEnqueueMarker
 #define clGetDeviceAndHostTimer f_clGetDeviceAndHostTimer
+#define clEnqueueMarkerWithWaitList f_clEnqueueMarkerWithWaitList
+#define clSVMAlloc f_clSVMAlloc
+#define clSVMFree f_clSVMFree
 
 #define clCreateSemaphoreWithPropertiesKHR f_clCreateSemaphoreWithPropertiesKHR
 #define clEnqueueWaitSemaphoresKHR f_clEnqueueWaitSemaphoresKHR
@@ -650,11 +660,13 @@ public:
     RGYFrameInfo frame;
     cl_mem_flags clflags;
     std::unique_ptr<RGYCLFrameMap> m_mapped;
+    cl_context svmContext; //常時mapされたバッファ(fine-grain SVM)の場合、確保したcontext
+    std::array<void *, RGY_MAX_PLANES> svm; //常時mapされたバッファ(fine-grain SVM)の場合、各planeのホスト側のポインタ
     RGYCLFrame()
-        : frame(), clflags(0), m_mapped() {
+        : frame(), clflags(0), m_mapped(), svmContext(nullptr), svm() {
     };
     RGYCLFrame(const RGYFrameInfo &info_, cl_mem_flags flags_ = CL_MEM_READ_WRITE)
-        : frame(info_), clflags(flags_), m_mapped() {
+        : frame(info_), clflags(flags_), m_mapped(), svmContext(nullptr), svm() {
     };
     RGY_ERR queueMapBuffer(RGYOpenCLQueue &queue, cl_map_flags map_flags, const std::vector<RGYOpenCLEvent> &wait_events = {}, const RGYCLMapBlock block_map = RGY_CL_MAP_BLOCK_NONE);
     RGY_ERR unmapBuffer();
@@ -666,6 +678,8 @@ public:
     std::vector<RGYOpenCLEvent>& mapEvents();
     RGYCLMemObjInfo getMemObjectInfo() const;
     void resetMappedFrame();
+    //map/unmapなしにホストから参照できるバッファか (queueMapBufferは同期用のeventを返すのみとなる)
+    bool isPersistentMapped() const { return svm[0] != nullptr; }
 protected:
     RGYCLFrame(const RGYCLFrame &) = delete;
     void operator =(const RGYCLFrame &) = delete;
@@ -720,6 +734,7 @@ public:
     virtual void setDataList(const std::vector<std::shared_ptr<RGYFrameData>>& dataList) override;
 protected:
     RGY_ERR unmap(cl_command_queue queue, const std::vector<RGYOpenCLEvent> &wait_events);
+    RGY_ERR mapPersistent(const std::vector<RGYOpenCLEvent> &wait_events, const RGYCLMapBlock block_map);
     RGYCLFrameMap(const RGYCLFrameMap &) = delete;
     void operator =(const RGYCLFrameMap &) = delete;
     RGYCLFrame *m_dev;
@@ -1200,12 +1215,22 @@ public:
     std::recursive_mutex& interopMutex() { return m_interopMutex; };
 
     RGYThreadPool *threadPool() {
-        if (!m_threadPool) { m_threadPool = std::make_unique<RGYThreadPool>(m_buildThreads); }
+        if (!m_threadPool) {
+            //ビルドスレッド数を論理コア数より少なく制限する場合のみ専用のプールを作り、
+            //それ以外はCSP変換などと共有のプールでコアを使い分ける
+            m_threadPool = (m_buildThreads < (int)std::thread::hardware_concurrency())
+                ? std::make_shared<RGYThreadPool>(m_buildThreads)
+                : RGYThreadPool::shared(RGYParamThread());
+        }
         return m_threadPool.get();
     }
 
     void setModuleHandle(const HMODULE hmodule) { m_hmodule = hmodule; }
     HMODULE getModuleHandle() const { return m_hmodule; }
+    //コンテキストを複数のジョブで共有する場合に、ジョブごとのログに切り替える
+    void setLog(shared_ptr<RGYLog> pLog) { m_log = pLog; }
+    //ビルドしたプログラムを保持し、同じソース・オプションのビルドで再利用する
+    void enableProgramReuse() { m_programReuse = true; }
     std::unique_ptr<RGYOpenCLProgram> build(const std::string& source, const char *options);
     std::unique_ptr<RGYOpenCLProgram> buildFile(const tstring filename, const std::string options);
     std::unique_ptr<RGYOpenCLProgram> buildResource(const tstring name, const tstring type, const std::string options);
@@ -1222,6 +1247,17 @@ public:
     std::unique_ptr<RGYCLFrame, RGYCLImageFromBufferDeleter> createImageFromFrameBuffer(const RGYFrameInfo &frame, const bool normalized, const cl_mem_flags flags, RGYCLFramePool *imgpool);
     std::unique_ptr<RGYCLFrame> createFrameBuffer(const int width, const int height, const RGY_CSP csp, const int bitdepth, const cl_mem_flags flags = CL_MEM_READ_WRITE);
     std::unique_ptr<RGYCLFrame> createFrameBuffer(const RGYFrameInfo &frame, cl_mem_flags flags = CL_MEM_READ_WRITE);
+    //pitch: 0以外なら、可能な場合そのpitchで確保する (後段のバッファとレイアウトを合わせる場合)
+    //persistentMap: 可能な場合、map/unmapなしにホストから参照できるバッファ(fine-grain SVM)として確保する
+    std::unique_ptr<RGYCLFrame> createFrameBuffer(const RGYFrameInfo &frame, cl_mem_flags flags, const int pitch, const bool persistentMap);
+    //parentのoffsetの位置から、frameのpitchのままsub-bufferとしてフレームを作成する (各planeはsubBufferAlignment()ごとに配置)
+    std::unique_ptr<RGYCLFrame> createFrameSubBuffer(const RGYFrameInfo &frame, cl_mem parent, const size_t offset, cl_mem_flags flags = CL_MEM_READ_WRITE);
+    //createFrameSubBufferで必要となるサイズ
+    size_t frameSubBufferSize(const RGYFrameInfo &frame) const;
+    //sub-bufferの開始位置に必要なalignment (byte)
+    size_t subBufferAlignment() const;
+    //fine-grain SVMによる常時mapされたバッファを使用可能か (createContextで確認した結果)
+    bool persistentMapSupported() const { return m_persistentMapSupported; }
     std::unique_ptr<RGYCLFrameInterop> createFrameFromD3D9Surface(void *surf, HANDLE shared_handle, const RGYFrameInfo &frame, RGYOpenCLQueue& queue, cl_mem_flags flags = CL_MEM_READ_WRITE);
     std::unique_ptr<RGYCLFrameInterop> createFrameFromD3D11Surface(void *surf, const RGYFrameInfo &frame, RGYOpenCLQueue& queue, cl_mem_flags flags = CL_MEM_READ_WRITE);
     std::unique_ptr<RGYCLFrameInterop> createFrameFromD3D11SurfacePlanar(const RGYFrameInfo &frame, RGYOpenCLQueue& queue, cl_mem_flags flags = CL_MEM_READ_WRITE);
@@ -1259,6 +1295,7 @@ public:
 
 protected:
     std::unique_ptr<RGYOpenCLProgram> buildProgram(std::string datacopy, const std::string options, const std::string name_hint = std::string());
+    bool checkPersistentMapSupport() const;
 
     shared_ptr<RGYOpenCLPlatform> m_platform;
     unique_context m_context;
@@ -1266,9 +1303,13 @@ protected:
     std::recursive_mutex m_interopMutex;
     std::shared_ptr<RGYLog> m_log;
     std::unordered_map<std::string, RGYOpenCLProgramAsync> m_copy;
-    std::unique_ptr<RGYThreadPool> m_threadPool;
+    std::shared_ptr<RGYThreadPool> m_threadPool;
     int m_buildThreads;
     HMODULE m_hmodule;
+    bool m_programReuse;
+    std::mutex m_programReuseMtx;
+    std::unordered_map<std::string, cl_program> m_programReuseMap; // options + '\0' + source -> program
+    bool m_persistentMapSupported;
 };
 
 class RGYOpenCL {
@@ -0,0 +1,235 @@
+﻿// -----------------------------------------------------------------------------------------
+// QSVEnc/NVEnc by rigaya
+// -----------------------------------------------------------------------------------------
+// The MIT License
+//
+// Copyright (c) 2011-2016 rigaya
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// ------------------------------------------------------------------------------------------
+
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <functional>
+#include <thread>
+#include "rgy_opencl_cache.h"
+
+#if ENABLE_OPENCL
+
+#include "rgy_opencl_perf.h"
+#include "rgy_filesystem.h"
+#include "rgy_util.h"
+
+static const char RGY_CL_CACHE_MAGIC[8] = { 'R', 'G', 'Y', 'C', 'L', 'B', 'I', 'N' };
+static const uint32_t RGY_CL_CACHE_VERSION = 1;
+static const TCHAR *RGY_CL_CACHE_EXT = _T(".clbin");
+
+//キャッシュファイルのヘッダ (この後にキー文字列がkeySize byte、バイナリがbinarySize byte続く)
+struct RGYOpenCLCacheHeader {
+    char     magic[8];
+    uint32_t version;
+    uint32_t keySize;
+    uint64_t binarySize;
+    uint64_t buildTimeNs;
+};
+
+RGYOpenCLProgramCache::RGYOpenCLProgramCache() :
+    m_enabled(false),
+    m_dir(),
+    m_maxBytes(0),
+    m_mtx() {
+}
+
+RGYOpenCLProgramCache& RGYOpenCLProgramCache::instance() {
+    static RGYOpenCLProgramCache s_instance;
+    return s_instance;
+}
+
+void RGYOpenCLProgramCache::enable(const tstring& dir, uint64_t maxBytes) {
+    std::lock_guard<std::mutex> lock(m_mtx);
+    m_dir = dir;
+    m_maxBytes = maxBytes;
+    m_enabled.store(!dir.empty(), std::memory_order_release);
+}
+
+std::string RGYOpenCLProgramCache::key(const char *source, size_t sourceLen, const std::string& options,
+    const std::string& platformVersion, const std::string& deviceName, const std::string& deviceVersion, const std::string& driverVersion) {
+    //ソースはハッシュと長さのみをキーに含め、それ以外はそのまま含める (読み込み時に全体を照合する)
+    std::string str;
+    str += "source=" + rgy_cl_perf_fnv1a_hex(std::string(source, sourceLen)) + strsprintf(":%llu\n", (unsigned long long)sourceLen);
+    str += "options=" + options + "\n";
+    str += "platform=" + platformVersion + "\n";
+    str += "device=" + deviceName + "\n";
+    str += "device_version=" + deviceVersion + "\n";
+    str += "driver=" + driverVersion + "\n";
+    return str;
+}
+
+tstring RGYOpenCLProgramCache::filepath(const std::string& key) const {
+    return PathCombineS(m_dir, char_to_tstring(rgy_cl_perf_fnv1a_hex(key)) + RGY_CL_CACHE_EXT);
+}
+
+RGY_ERR RGYOpenCLProgramCache::load(const std::string& key, std::vector<uint8_t>& binary, uint64_t& buildTimeNs) {
+    binary.clear();
+    buildTimeNs = 0;
+    if (!isEnabled()) {
+        return RGY_ERR_NOT_INITIALIZED;
+    }
+    const auto path = filepath(key);
+    std::unique_ptr<FILE, fp_deleter> fp(_tfopen(path.c_str(), _T("rb")), fp_deleter());
+    if (!fp) {
+        return RGY_ERR_NOT_FOUND;
+    }
+    RGYOpenCLCacheHeader header;
+    if (fread(&header, 1, sizeof(header), fp.get()) != sizeof(header)
+        || memcmp(header.magic, RGY_CL_CACHE_MAGIC, sizeof(RGY_CL_CACHE_MAGIC)) != 0) {
+        return RGY_ERR_INVALID_FORMAT;
+    }
+    if (header.version != RGY_CL_CACHE_VERSION
+        || header.keySize != key.length()) {
+        return RGY_ERR_INVALID_VERSION;
+    }
+    //binarySizeが壊れていても巨大な確保をしないよう、ファイルサイズと照合する
+    uint64_t fileSize = 0;
+    if (!rgy_get_filesize(path.c_str(), &fileSize)
+        || header.binarySize == 0
+        || fileSize != sizeof(header) + header.keySize + header.binarySize) {
+        return RGY_ERR_INVALID_FORMAT;
+    }
+    std::string fileKey(header.keySize, '\0');
+    if (fread(&fileKey[0], 1, fileKey.length(), fp.get()) != fileKey.length()) {
+        return RGY_ERR_INVALID_FORMAT;
+    }
+    if (fileKey != key) {
+        //ファイル名のハッシュの衝突
+        return RGY_ERR_NOT_FOUND;
+    }
+    binary.resize((size_t)header.binarySize);
+    if (fread(binary.data(), 1, binary.size(), fp.get()) != binary.size()) {
+        binary.clear();
+        return RGY_ERR_INVALID_FORMAT;
+    }
+    fp.reset();
+    buildTimeNs = header.buildTimeNs;
+
+    //上限を超えたときに最近使ったものを残すよう、更新時刻を更新しておく (失敗しても問題ない)
+    std::error_code ec;
+    std::filesystem::last_write_time(std::filesystem::path(path), std::filesystem::file_time_type::clock::now(), ec);
+    return RGY_ERR_NONE;
+}
+
+RGY_ERR RGYOpenCLProgramCache::store(const std::string& key, const std::vector<uint8_t>& binary, uint64_t buildTimeNs) {
+    if (!isEnabled()) {
+        return RGY_ERR_NOT_INITIALIZED;
+    }
+    if (binary.size() == 0) {
+        return RGY_ERR_INVALID_PARAM;
+    }
+    if (!rgy_directory_exists(m_dir) && !CreateDirectoryRecursive(m_dir.c_str())) {
+        return RGY_ERR_FILE_OPEN;
+    }
+    RGYOpenCLCacheHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, RGY_CL_CACHE_MAGIC, sizeof(RGY_CL_CACHE_MAGIC));
+    header.version = RGY_CL_CACHE_VERSION;
+    header.keySize = (uint32_t)key.length();
+    header.binarySize = binary.size();
+    header.buildTimeNs = buildTimeNs;
+
+    //別のプロセスや、--serverで同じプロセス内のスレッドとして動作するジョブと重ならないよう、プロセスIDとスレッドIDで一時ファイル名を分ける
+    const auto path = filepath(key);
+    const auto tmpFile = path + strsprintf(_T(".%u.%llx.tmp"), (uint32_t)GetCurrentProcessId(),
+        (unsigned long long)std::hash<std::thread::id>()(std::this_thread::get_id()));
+    {
+        std::unique_ptr<FILE, fp_deleter> fp(_tfopen(tmpFile.c_str(), _T("wb")), fp_deleter());
+        if (!fp) {
+            return RGY_ERR_FILE_OPEN;
+        }
+        if (fwrite(&header, 1, sizeof(header), fp.get()) != sizeof(header)
+            || fwrite(key.data(), 1, key.length(), fp.get()) != key.length()
+            || fwrite(binary.data(), 1, binary.size(), fp.get()) != binary.size()
+            || fflush(fp.get()) != 0) {
+            fp.reset();
+            rgy_file_remove(tmpFile.c_str());
+            return RGY_ERR_UNKNOWN;
+        }
+    }
+    if (!rgy_file_rename(tmpFile, path, true)) {
+        rgy_file_remove(tmpFile.c_str());
+        return RGY_ERR_ACCESS_DENIED;
+    }
+    evict();
+    return RGY_ERR_NONE;
+}
+
+void RGYOpenCLProgramCache::remove(const std::string& key) {
+    if (!isEnabled()) {
+        return;
+    }
+    rgy_file_remove(filepath(key).c_str());
+}
+
+void RGYOpenCLProgramCache::evict() {
+    if (m_maxBytes == 0) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(m_mtx);
+    struct CacheFile {
+        std::filesystem::path path;
+        uint64_t size;
+        std::filesystem::file_time_type mtime;
+    };
+    std::vector<CacheFile> files;
+    uint64_t totalSize = 0;
+    std::error_code ec;
+    for (const auto& entry : std::filesystem::directory_iterator(std::filesystem::path(m_dir), ec)) {
+        std::error_code ec2;
+        if (!entry.is_regular_file(ec2) || entry.path().extension() != RGY_CL_CACHE_EXT) {
+            continue;
+        }
+        CacheFile file;
+        file.path = entry.path();
+        file.size = (uint64_t)entry.file_size(ec2);
+        if (ec2) continue;
+        file.mtime = entry.last_write_time(ec2);
+        if (ec2) continue;
+        totalSize += file.size;
+        files.push_back(file);
+    }
+    if (totalSize <= m_maxBytes) {
+        return;
+    }
+    //最後に使われたのが古いものから削除する
+    //他のプロセスが同時に削除・読み込みしている場合もあるので、削除の失敗は無視する
+    std::sort(files.begin(), files.end(), [](const CacheFile& a, const CacheFile& b) {
+        return a.mtime < b.mtime;
+    });
+    for (const auto& file : files) {
+        if (totalSize <= m_maxBytes) {
+            break;
+        }
+        std::error_code ec2;
+        std::filesystem::remove(file.path, ec2);
+        totalSize -= file.size;
+    }
+}
+
+#endif //#if ENABLE_OPENCL
@@ -0,0 +1,86 @@
+﻿// -----------------------------------------------------------------------------------------
+// QSVEnc/NVEnc by rigaya
+// -----------------------------------------------------------------------------------------
+// The MIT License
+//
+// Copyright (c) 2011-2016 rigaya
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// ------------------------------------------------------------------------------------------
+
+#pragma once
+#ifndef __RGY_OPENCL_CACHE_H__
+#define __RGY_OPENCL_CACHE_H__
+
+#include "rgy_version.h"
+#include "rgy_tchar.h"
+
+#if ENABLE_OPENCL
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <mutex>
+#include <atomic>
+#include "rgy_err.h"
+
+// OpenCLのプログラムバイナリのディスクキャッシュ (--cl-cache-dir)
+// ソース・ビルドオプション・デバイス/ドライバから作ったキーでclGetProgramInfo(CL_PROGRAM_BINARIES)の結果を保存し、
+// 次回以降はclCreateProgramWithBinaryで読み込むことでビルド時間を省略する
+// 同時に実行した複数のrkmppencや--serverの各ジョブから同時に使われても壊れないよう、書き込みは一時ファイルからのrenameで行う
+class RGYOpenCLProgramCache {
+public:
+    static RGYOpenCLProgramCache& instance();
+
+    // 有効化。maxBytes = キャッシュの合計サイズの上限 (0 = 無制限)
+    void enable(const tstring& dir, uint64_t maxBytes);
+    bool isEnabled() const { return m_enabled.load(std::memory_order_acquire); }
+
+    // キャッシュのキーとなる文字列を作成する
+    static std::string key(const char *source, size_t sourceLen, const std::string& options,
+        const std::string& platformVersion, const std::string& deviceName, const std::string& deviceVersion, const std::string& driverVersion);
+
+    // キャッシュを読み込む。見つからない場合はRGY_ERR_NOT_FOUND
+    // buildTimeNs = 保存時のソースからのビルドにかかった時間
+    RGY_ERR load(const std::string& key, std::vector<uint8_t>& binary, uint64_t& buildTimeNs);
+
+    // キャッシュに保存し、上限を超えた場合は古いものから削除する
+    RGY_ERR store(const std::string& key, const std::vector<uint8_t>& binary, uint64_t buildTimeNs);
+
+    // 読み込んだバイナリが使用できなかった場合にキャッシュから削除する
+    void remove(const std::string& key);
+private:
+    RGYOpenCLProgramCache();
+    ~RGYOpenCLProgramCache() = default;
+    RGYOpenCLProgramCache(const RGYOpenCLProgramCache&) = delete;
+    void operator=(const RGYOpenCLProgramCache&) = delete;
+
+    tstring filepath(const std::string& key) const;
+    void evict();
+
+    std::atomic<bool> m_enabled;
+    tstring m_dir;
+    uint64_t m_maxBytes;
+    std::mutex m_mtx; // 同一プロセス内のevictの排他
+};
+
+#endif //#if ENABLE_OPENCL
+
+#endif //__RGY_OPENCL_CACHE_H__
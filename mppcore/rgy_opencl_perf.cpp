@@ -40,6 +40,7 @@
 #include <cstdarg>
 #include <cstdio>
 #include <filesystem>
+#include <map>
 
 #include "rgy_filesystem.h"
 #include "rgy_resource.h"
@@ -129,13 +130,14 @@ static std::string get_timestamp() {
 RGYOpenCLPerfCollector::RGYOpenCLPerfCollector()
     : m_enabled(false), m_dump_dir(), m_mtx(),
       m_next_program_id(1), m_programs(), m_aggs(), m_pending(),
-      m_command_aggs(), m_command_pending(), m_allocation_aggs(),
+      m_command_aggs(), m_command_pending(), m_allocation_aggs(), m_program_cache_agg(),
       m_timeline_enabled(false), m_timeline_window_ns(0),
       m_capture_start_host_ns(0),
       m_has_dev_host_timer(false), m_timeline_devid(nullptr),
       m_cal_dev0(0), m_cal_steady0(0), m_cal_scale(1.0), m_cal_finalized(false),
       m_timeline_seq(0),
-      m_timeline_events(), m_timeline_pending() {
+      m_timeline_events(), m_timeline_pending(),
+      m_pipeline_trace_enabled(false), m_thread_names() {
 }
 
 RGYOpenCLPerfCollector& RGYOpenCLPerfCollector::instance() {
@@ -172,6 +174,36 @@ void RGYOpenCLPerfCollector::enableTimeline(uint64_t window_ns, cl_device_id dev
     m_timeline_enabled.store(true, std::memory_order_release);
 }
 
+void RGYOpenCLPerfCollector::enablePipelineTrace() {
+    m_pipeline_trace_enabled.store(true, std::memory_order_release);
+}
+
+void RGYOpenCLPerfCollector::recordPipelineEvent(const char *name, uint64_t host_start_abs_ns, uint64_t host_end_abs_ns, int64_t frame_id) {
+    if (!isPipelineTraceEnabled() || !isTimelineEnabled()) return;
+
+    const uint64_t thread_id = (uint64_t)std::hash<std::thread::id>{}(std::this_thread::get_id());
+    std::lock_guard<std::mutex> lock(m_mtx);
+    const uint64_t elapsed = normalizeHostNs(host_start_abs_ns);
+    if (m_timeline_window_ns != 0 && elapsed > m_timeline_window_ns) return;
+
+    RGYOpenCLPerfTimelineEvent te;
+    te.seq                 = m_timeline_seq.fetch_add(1, std::memory_order_relaxed);
+    te.category            = "pipeline";
+    te.name                = name;
+    te.thread_id           = thread_id;
+    te.host_enqueue_ns     = elapsed;
+    te.host_enqueue_end_ns = normalizeHostNs(host_end_abs_ns);
+    te.frame_id            = frame_id;
+    m_timeline_events.push_back(std::move(te));
+}
+
+void RGYOpenCLPerfCollector::setTraceThreadName(const std::string& name) {
+    if (!isEnabled()) return;
+    const uint64_t thread_id = (uint64_t)std::hash<std::thread::id>{}(std::this_thread::get_id());
+    std::lock_guard<std::mutex> lock(m_mtx);
+    m_thread_names[thread_id] = name;
+}
+
 void RGYOpenCLPerfCollector::finalizeTimelineCalibration(cl_device_id devid) {
     if (!m_has_dev_host_timer || m_cal_finalized) return;
     if (!f_clGetDeviceAndHostTimer || !devid) return;
@@ -206,7 +238,8 @@ uint64_t RGYOpenCLPerfCollector::recordProgramBuild(
     cl_program         program,
     cl_device_id       devid,
     const std::string& build_log,
-    uint64_t           build_time_ns)
+    uint64_t           build_time_ns,
+    const std::string& program_cache)
 {
     if (!isEnabled()) return 0;
 
@@ -220,6 +253,7 @@ uint64_t RGYOpenCLPerfCollector::recordProgramBuild(
     rec.build_options = build_options;
     rec.build_log     = build_log;
     rec.build_time_ns = build_time_ns;
+    rec.program_cache = program_cache;
 
     // デバイス情報取得
     {
@@ -517,6 +551,21 @@ void RGYOpenCLPerfCollector::recordAllocation(
     if (host_time_ns > agg.host_time_max_ns) agg.host_time_max_ns = host_time_ns;
 }
 
+void RGYOpenCLPerfCollector::recordProgramCache(bool hit, uint64_t time_ns, uint64_t cached_build_time_ns) {
+    if (!isEnabled()) return;
+
+    std::lock_guard<std::mutex> lock(m_mtx);
+    auto& agg = m_program_cache_agg;
+    if (hit) {
+        agg.hits++;
+        agg.hit_time_sum_ns += time_ns;
+        agg.saved_time_sum_ns += (cached_build_time_ns > time_ns) ? cached_build_time_ns - time_ns : 0;
+    } else {
+        agg.misses++;
+        agg.miss_time_sum_ns += time_ns;
+    }
+}
+
 void RGYOpenCLPerfCollector::drainPending() {
     // m_pending を走査: 完了済み event からプロファイリング情報を回収
     for (auto& [key, event, kobj] : m_pending) {
@@ -646,6 +695,7 @@ void RGYOpenCLPerfCollector::flush() {
         writeMetaJson(dump_dir_str + "/meta.json");
         if (has_timeline) {
             writeTimelineJsonl(dump_dir_str + "/timeline.jsonl");
+            writeChromeTraceJson(dump_dir_str + "/trace.json");
         }
     } catch (...) {
         // best-effort: 例外を飲む
@@ -678,6 +728,10 @@ void RGYOpenCLPerfCollector::writeProgramsJsonl(const std::string& path) {
         }
         ofs << ",\"driver_version\":\"" << json_escape(rec.driver_version) << "\"";
         ofs << ",\"build_time_ns\":" << rec.build_time_ns;
+        if (!rec.program_cache.empty())
+            ofs << ",\"program_cache\":\"" << json_escape(rec.program_cache) << "\"";
+        else
+            ofs << ",\"program_cache\":null";
         ofs << ",\"binary_path\":\"" << json_escape(rec.binary_filename) << "\"";
         ofs << ",\"build_log_path\":\"" << json_escape(rec.build_log_filename) << "\"";
         ofs << ",\"kernels\":[";
@@ -860,9 +914,19 @@ void RGYOpenCLPerfCollector::writeMetaJson(const std::string& path) {
         ofs << "    \"cal_finalized\":" << (m_cal_finalized ? "true" : "false") << ",\n";
         ofs << "    \"has_dev_host_timer\":" << (m_has_dev_host_timer ? "true" : "false") << ",\n";
         ofs << "    \"window_ns\":" << m_timeline_window_ns << ",\n";
+        ofs << "    \"pipeline_trace\":" << (isPipelineTraceEnabled() ? "true" : "false") << ",\n";
         ofs << "    \"event_count\":" << m_timeline_events.size() << "\n";
         ofs << "  }";
     }
+    if (m_program_cache_agg.hits + m_program_cache_agg.misses > 0) {
+        ofs << ",\n  \"program_cache\":{\n";
+        ofs << "    \"hits\":" << m_program_cache_agg.hits << ",\n";
+        ofs << "    \"misses\":" << m_program_cache_agg.misses << ",\n";
+        ofs << "    \"hit_time_sum_ns\":" << m_program_cache_agg.hit_time_sum_ns << ",\n";
+        ofs << "    \"miss_time_sum_ns\":" << m_program_cache_agg.miss_time_sum_ns << ",\n";
+        ofs << "    \"saved_time_sum_ns\":" << m_program_cache_agg.saved_time_sum_ns << "\n";
+        ofs << "  }";
+    }
     ofs << "\n}\n";
 }
 
@@ -885,10 +949,88 @@ void RGYOpenCLPerfCollector::writeTimelineJsonl(const std::string& path) {
         if (te.dev_submit_ns != UINT64_MAX) ofs << ",\"d_submit\":" << te.dev_submit_ns;
         if (te.dev_start_ns  != UINT64_MAX) ofs << ",\"d_start\":" << te.dev_start_ns;
         if (te.dev_end_ns    != UINT64_MAX) ofs << ",\"d_end\":" << te.dev_end_ns;
+        if (te.frame_id >= 0) ofs << ",\"frame\":" << te.frame_id;
         ofs << "}\n";
     }
 }
 
+// Chrome Trace Event Format (chrome://tracing, ui.perfetto.dev で読み込み可能)
+//   pid 1: host (スレッドごと), pid 2: device (command queue ごと)
+//   host 発行 → device 実行 は seq を id とする flow event で結ぶ
+void RGYOpenCLPerfCollector::writeChromeTraceJson(const std::string& path) {
+    std::ofstream ofs(path);
+    if (!ofs) return;
+
+    // ts/dur は us 単位 (小数部で ns を表現)
+    auto us = [](uint64_t ns) {
+        char buf[64];
+        snprintf(buf, sizeof(buf), "%llu.%03llu", (unsigned long long)(ns / 1000), (unsigned long long)(ns % 1000));
+        return std::string(buf);
+    };
+    auto dur = [&us](uint64_t start_ns, uint64_t end_ns) {
+        return us((end_ns > start_ns) ? end_ns - start_ns : 0);
+    };
+    static const int TRACE_PID_HOST = 1;
+    static const int TRACE_PID_DEVICE = 2;
+
+    // ハッシュ済みの thread_id / queue_id を出現順の小さな番号に振り直す
+    std::map<uint64_t, int> host_tids, dev_tids;
+    for (const auto& te : m_timeline_events) {
+        if (host_tids.count(te.thread_id) == 0) {
+            const int tid = (int)host_tids.size() + 1;
+            host_tids[te.thread_id] = tid;
+        }
+        if (te.dev_start_ns != UINT64_MAX && te.dev_end_ns != UINT64_MAX && dev_tids.count(te.queue_id) == 0) {
+            const int tid = (int)dev_tids.size() + 1;
+            dev_tids[te.queue_id] = tid;
+        }
+    }
+
+    ofs << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n";
+    ofs << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":" << TRACE_PID_HOST << ",\"args\":{\"name\":\"host\"}}";
+    ofs << ",\n{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":" << TRACE_PID_DEVICE << ",\"args\":{\"name\":\"device\"}}";
+    for (const auto& [thread_id, tid] : host_tids) {
+        auto it = m_thread_names.find(thread_id);
+        const std::string name = (it != m_thread_names.end()) ? it->second : "thread " + std::to_string(tid);
+        ofs << ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":" << TRACE_PID_HOST << ",\"tid\":" << tid
+            << ",\"args\":{\"name\":\"" << json_escape(name) << "\"}}";
+    }
+    for (const auto& [queue_id, tid] : dev_tids) {
+        char buf[64];
+        snprintf(buf, sizeof(buf), "queue 0x%llx", (unsigned long long)queue_id);
+        ofs << ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":" << TRACE_PID_DEVICE << ",\"tid\":" << tid
+            << ",\"args\":{\"name\":\"" << buf << "\"}}";
+    }
+
+    for (const auto& te : m_timeline_events) {
+        const int htid = host_tids[te.thread_id];
+        std::string args = "\"seq\":" + std::to_string(te.seq);
+        if (te.frame_id >= 0) args += ",\"frame\":" + std::to_string(te.frame_id);
+        if (te.bytes != 0) args += ",\"bytes\":" + std::to_string(te.bytes);
+        if (te.program_id != 0) args += ",\"program_id\":" + std::to_string(te.program_id);
+
+        ofs << ",\n{\"name\":\"" << json_escape(te.name) << "\",\"cat\":\"" << json_escape(te.category) << "\",\"ph\":\"X\""
+            << ",\"pid\":" << TRACE_PID_HOST << ",\"tid\":" << htid
+            << ",\"ts\":" << us(te.host_enqueue_ns) << ",\"dur\":" << dur(te.host_enqueue_ns, te.host_enqueue_end_ns)
+            << ",\"args\":{" << args << "}}";
+
+        if (te.dev_start_ns == UINT64_MAX || te.dev_end_ns == UINT64_MAX) continue;
+        const int dtid = dev_tids[te.queue_id];
+        std::string dev_args = args;
+        if (te.dev_queued_ns != UINT64_MAX) dev_args += ",\"queued_to_start_us\":" + dur(te.dev_queued_ns, te.dev_start_ns);
+        ofs << ",\n{\"name\":\"" << json_escape(te.name) << "\",\"cat\":\"" << json_escape(te.category) << "\",\"ph\":\"X\""
+            << ",\"pid\":" << TRACE_PID_DEVICE << ",\"tid\":" << dtid
+            << ",\"ts\":" << us(te.dev_start_ns) << ",\"dur\":" << dur(te.dev_start_ns, te.dev_end_ns)
+            << ",\"args\":{" << dev_args << "}}";
+        // host 発行 → device 実行の flow
+        ofs << ",\n{\"name\":\"enqueue\",\"cat\":\"flow\",\"ph\":\"s\",\"id\":" << te.seq
+            << ",\"pid\":" << TRACE_PID_HOST << ",\"tid\":" << htid << ",\"ts\":" << us(te.host_enqueue_ns) << "}";
+        ofs << ",\n{\"name\":\"enqueue\",\"cat\":\"flow\",\"ph\":\"f\",\"bp\":\"e\",\"id\":" << te.seq
+            << ",\"pid\":" << TRACE_PID_DEVICE << ",\"tid\":" << dtid << ",\"ts\":" << us(te.dev_start_ns) << "}";
+    }
+    ofs << "\n]}\n";
+}
+
 static tstring cl_perf_path_to_tstring(const std::filesystem::path& path) {
 #if defined(_WIN32) || defined(_WIN64)
     return path.wstring();
@@ -43,6 +43,7 @@
 #include <atomic>
 #include <tuple>
 #include <functional>
+#include <chrono>
 #include "rgy_opencl.h"
 
 // ヒストグラム段数: 100ns 起点 × 1.4 倍 × 64 段
@@ -97,6 +98,16 @@ struct RGYOpenCLPerfProgramRecord {
     std::vector<KernelInfo> kernels;
     std::string binary_filename;        // 相対パス: "binaries/<resource>__<hash>.bin"
     std::string build_log_filename;     // 相対パス: "build_logs/<resource>__<hash>.log"
+    std::string program_cache;          // --cl-cache-dir: "hit" | "miss" (空 = 不使用)
+};
+
+// --cl-cache-dir のプログラムキャッシュの集計
+struct RGYOpenCLPerfProgramCacheAgg {
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    uint64_t hit_time_sum_ns = 0;   // キャッシュから読み込んだ時間の合計
+    uint64_t miss_time_sum_ns = 0;  // キャッシュになくソースからビルドした時間の合計
+    uint64_t saved_time_sum_ns = 0; // 保存時のビルド時間 - 読み込み時間 の合計
 };
 
 struct RGYOpenCLPerfLaunchKey {
@@ -195,7 +206,7 @@ struct RGYOpenCLPerfAllocationAgg {
 // ----------------------------------------
 struct RGYOpenCLPerfTimelineEvent {
     uint64_t       seq                 = 0;          // host 発行と device 実行を結ぶ correlation id
-    std::string    category;                         // "kernel" | "command" | "alloc"
+    std::string    category;                         // "kernel" | "command" | "alloc" | "pipeline"
     std::string    name;                             // kernel_name または command_name
     uint64_t       program_id          = 0;          // kernel の場合のみ (0 = なし)
     uint64_t       thread_id           = 0;          // host 発行スレッド (ハッシュ済み)
@@ -207,6 +218,7 @@ struct RGYOpenCLPerfTimelineEvent {
     uint64_t       dev_submit_ns       = UINT64_MAX;
     uint64_t       dev_start_ns        = UINT64_MAX;
     uint64_t       dev_end_ns          = UINT64_MAX;
+    int64_t        frame_id            = -1;         // pipeline の場合の入力フレーム番号 (-1 = なし)
     RGYOpenCLEvent event;                            // device 時刻回収用に flush まで保持
     bool           has_event           = false;
 };
@@ -228,13 +240,30 @@ public:
     void enableTimeline(uint64_t window_ns, cl_device_id devid);
     bool isTimelineEnabled() const { return m_timeline_enabled.load(std::memory_order_acquire); }
 
+    // パイプライン各段 (sendFrame/getOutput/getWorkSurf/WriteNextFrame) の記録を有効化 (--pipeline-trace)
+    // 有効時は flush で timeline と合わせて Chrome/Perfetto 形式の trace.json を出力する
+    void enablePipelineTrace();
+    bool isPipelineTraceEnabled() const { return m_pipeline_trace_enabled.load(std::memory_order_acquire); }
+
+    // パイプラインイベントの記録
+    // host_start_abs_ns / host_end_abs_ns: steady_clock epoch 基準の絶対時刻
+    // frame_id: 入力フレーム番号 (-1 = 不明)
+    void recordPipelineEvent(const char *name, uint64_t host_start_abs_ns, uint64_t host_end_abs_ns, int64_t frame_id);
+    // 呼び出しスレッドに trace 上の表示名をつける
+    void setTraceThreadName(const std::string& name);
+
     // ビルド完了フック。program_id を返す
     uint64_t recordProgramBuild(const std::string& resource_name,
                                 const std::string& build_options,
                                 cl_program         program,
                                 cl_device_id       devid,
                                 const std::string& build_log,
-                                uint64_t           build_time_ns);
+                                uint64_t           build_time_ns,
+                                const std::string& program_cache = std::string());
+
+    // プログラムキャッシュ (--cl-cache-dir) のヒット/ミスの記録
+    // time_ns: 読み込み(hit)またはビルド(miss)にかかった時間, cached_build_time_ns: hit の場合の保存時のビルド時間
+    void recordProgramCache(bool hit, uint64_t time_ns, uint64_t cached_build_time_ns);
 
     // launch フック (event は pending キューに積むだけ)
     // host_enqueue_abs_ns / host_enqueue_end_abs_ns: steady_clock epoch 基準の絶対時刻 (timeline 用, 0 = 不使用)
@@ -284,6 +313,7 @@ private:
     void writeAllocationsJsonl(const std::string& path);
     void writeMetaJson(const std::string& path);
     void writeTimelineJsonl(const std::string& path);
+    void writeChromeTraceJson(const std::string& path);
 
     // timeline pending の device profiling 情報を回収し m_timeline_events に移動
     void drainTimelinePending();
@@ -312,6 +342,7 @@ private:
     std::unordered_map<RGYOpenCLPerfAllocationKey,
                        RGYOpenCLPerfAllocationAgg,
                        RGYOpenCLPerfAllocationKeyHash> m_allocation_aggs;
+    RGYOpenCLPerfProgramCacheAgg m_program_cache_agg;
 
     // --- timeline ---
     std::atomic<bool>     m_timeline_enabled;
@@ -328,8 +359,18 @@ private:
     std::atomic<uint64_t> m_timeline_seq;
     std::vector<RGYOpenCLPerfTimelineEvent> m_timeline_events;
     std::vector<RGYOpenCLPerfTimelineEvent> m_timeline_pending;
+
+    // --- pipeline trace ---
+    std::atomic<bool>     m_pipeline_trace_enabled;
+    std::unordered_map<uint64_t, std::string> m_thread_names; // thread_id(ハッシュ済み) → 表示名
 };
 
+// steady_clock epoch 基準の現在時刻 (ns)
+static inline uint64_t rgy_perf_trace_now_ns() {
+    return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
 void cl_perf_generate_report(const tstring& dumpDir, const tstring& disasmTool, const tstring& oclocPath, const tstring& rgaPath, const tstring& pythonPath);
 
 #else
@@ -40,7 +40,7 @@
 static const uint8_t AUD_H264_PRIMARY[] = { 0x00, 0x00, 0x00, 0x01, 0x09, 0x10 }; // AUD (primary_pic_type = 0)
 static const uint8_t AUD_HEVC_PRIMARY[] = { 0x00, 0x00, 0x00, 0x01, 0x46, 0x01 }; // AUD (pic_type = 0)
 
-static RGY_ERR WriteY4MHeader(FILE *fp, const VideoInfo *info, const RGY_CSP csp) {
+static RGY_ERR WriteY4MHeader(RGYOutputWriter *writer, const VideoInfo *info, const RGY_CSP csp) {
     char buffer[256] = { 0 };
     char *ptr = buffer;
     uint32_t len = 0;
@@ -61,13 +61,13 @@ static RGY_ERR WriteY4MHeader(FILE *fp, const VideoInfo *info, const RGY_CSP csp
     if (!cspHeader) return RGY_ERR_INVALID_COLOR_FORMAT;
 
     len += sprintf_s(ptr+len, sizeof(buffer)-len, "C%s\n", cspHeader);
-    return (len == fwrite(buffer, 1, len, fp)) ? RGY_ERR_NONE : RGY_ERR_UNDEFINED_BEHAVIOR;
+    return writer->write(buffer, len);
 }
 
-#define WRITE_CHECK(writtenBytes, expected) { \
-    if (writtenBytes != expected) { \
+#define WRITE_CHECK(err) { \
+    if (err != RGY_ERR_NONE) { \
         AddMessage(RGY_LOG_ERROR, _T("Error writing file.\nNot enough disk space!\n")); \
-        return RGY_ERR_UNDEFINED_BEHAVIOR; \
+        return err; \
     } }
 
 const char *RGYOutput::OUT_DEBUG_FILE_HEADER = "size %d, pts %lld, dts %lld, duration %lld, frametype %d, frameidx %d, picstruct %d";
@@ -90,7 +90,7 @@ RGYOutput::RGYOutput() :
     m_strOutputInfo(),
     m_VideoOutputInfo(),
     m_printMes(),
-    m_outputBuffer(),
+    m_writer(),
     m_readBuffer(),
     m_UVBuffer(),
     m_bsf(),
@@ -108,6 +108,14 @@ RGYOutput::~RGYOutput() {
 
 void RGYOutput::Close() {
     AddMessage(RGY_LOG_DEBUG, _T("Closing file \"%s\"...\n"), m_outFilename.c_str());
+    if (m_writer) {
+        //m_fDestを閉じる前に、溜めているデータを書き出す
+        if (m_writer->close() != RGY_ERR_NONE) {
+            AddMessage(RGY_LOG_ERROR, _T("Error writing file.\nNot enough disk space!\n"));
+        }
+        AddMessage(RGY_LOG_DEBUG, _T("Closed writer: %llu write calls.\n"), (unsigned long long)m_writer->writeCalls());
+        m_writer.reset();
+    }
     if (m_fDest) {
         m_fDest.reset();
         AddMessage(RGY_LOG_DEBUG, _T("Closed file pointer.\n"));
@@ -115,7 +123,6 @@ void RGYOutput::Close() {
     m_fpOutReplay.reset();
     m_fpDebug.reset();
     m_encSatusInfo.reset();
-    m_outputBuffer.reset();
     m_readBuffer.reset();
     m_UVBuffer.reset();
     m_bsf.reset();
@@ -828,17 +835,16 @@ RGY_ERR RGYOutputRaw::Init(const TCHAR *strFileName, const VideoInfo *pVideoOutp
             }
             m_fDest.reset(fp);
             AddMessage(RGY_LOG_DEBUG, _T("Opened file \"%s\"\n"), strFileName);
-
-            int bufferSizeByte = clamp(rawPrm->bufSizeMB, 0, RGY_OUTPUT_BUF_MB_MAX) * 1024 * 1024;
-            if (bufferSizeByte) {
-                void *ptr = nullptr;
-                bufferSizeByte = (int)malloc_degeneracy(&ptr, bufferSizeByte, 1024 * 1024);
-                if (bufferSizeByte) {
-                    m_outputBuffer.reset((char*)ptr);
-                    setvbuf(m_fDest.get(), m_outputBuffer.get(), _IOFBF, bufferSizeByte);
-                    AddMessage(RGY_LOG_DEBUG, _T("Added %d MB output buffer.\n"), bufferSizeByte / (1024 * 1024));
-                }
+        }
+        if (m_fDest) {
+            const size_t bufferSizeByte = (size_t)clamp(rawPrm->bufSizeMB, 0, RGY_OUTPUT_BUF_MB_MAX) * 1024 * 1024;
+            m_writer = std::make_unique<RGYOutputWriter>();
+            auto err = m_writer->init(m_fDest.get(), bufferSizeByte, rawPrm->threadOutput > 0, rawPrm->threadParamOutput);
+            if (err != RGY_ERR_NONE) {
+                AddMessage(RGY_LOG_ERROR, _T("failed to init output writer: %s.\n"), get_err_mes(err));
+                return err;
             }
+            AddMessage(RGY_LOG_DEBUG, _T("Added %d MB output buffer%s.\n"), (int)(bufferSizeByte / (1024 * 1024)), m_writer->async() ? _T(", using output thread") : _T(""));
         }
 
         if (auto sts = InitVideoBsf(pVideoOutputInfo); sts != RGY_ERR_NONE) {
@@ -1051,14 +1057,20 @@ RGY_ERR RGYOutputRaw::WriteNextOneFrame(RGYBitstream *pBitstream) {
             m_qFirstProcessData->push(ptr);
             nBytesWritten += pBitstream->size();
         } else {
-            auto ret = _fwrite_nolock(&peHeader, 1, sizeof(peHeader), m_fDest.get());
-            WRITE_CHECK(ret, sizeof(peHeader));
+            //ヘッダとデータをまとめて書き出す
+            RGYIovec iov[2];
+            iov[0].iov_base = &peHeader;
+            iov[0].iov_len = sizeof(peHeader);
+            iov[1].iov_base = pBitstream->data();
+            iov[1].iov_len = pBitstream->size();
+            err = m_writer->write(iov, _countof(iov));
+            WRITE_CHECK(err);
+            nBytesWritten += pBitstream->size();
         }
-    }
-    if (!m_qFirstProcessData) {
-        const auto dataSize = _fwrite_nolock(pBitstream->data(), 1, pBitstream->size(), m_fDest.get());
-        WRITE_CHECK(dataSize, pBitstream->size());
-        nBytesWritten += dataSize;
+    } else {
+        err = m_writer->write(pBitstream->data(), pBitstream->size());
+        WRITE_CHECK(err);
+        nBytesWritten += pBitstream->size();
     }
 
     m_encSatusInfo->SetOutputData(pBitstream->frametype(), nBytesWritten, 0);
@@ -1072,7 +1084,7 @@ RGY_ERR RGYOutputRaw::WriteNextFrame(RGYFrame *pSurface) {
     return RGY_ERR_UNSUPPORTED;
 }
 
-RGYOutFrame::RGYOutFrame() : m_bY4m(true) {
+RGYOutFrame::RGYOutFrame() : m_bY4m(true), m_stagingSize(0), m_iov() {
     m_strWriterName = _T("yuv writer");
     m_OutType = OUT_TYPE_SURFACE;
 };
@@ -1099,6 +1111,15 @@ RGY_ERR RGYOutFrame::Init(const TCHAR *strFileName, const VideoInfo *pVideoOutpu
     YUVWriterParam *writerParam = (YUVWriterParam *)prm;
 
     m_bY4m = writerParam->bY4m;
+
+    const size_t bufferSizeByte = (size_t)clamp(writerParam->bufSizeMB, 0, RGY_OUTPUT_BUF_MB_MAX) * 1024 * 1024;
+    m_writer = std::make_unique<RGYOutputWriter>();
+    auto err = m_writer->init(m_fDest.get(), bufferSizeByte, writerParam->threadOutput > 0, writerParam->threadParamOutput);
+    if (err != RGY_ERR_NONE) {
+        AddMessage(RGY_LOG_ERROR, _T("failed to init output writer: %s.\n"), get_err_mes(err));
+        return err;
+    }
+    AddMessage(RGY_LOG_DEBUG, _T("Added %d MB output buffer%s.\n"), (int)(bufferSizeByte / (1024 * 1024)), m_writer->async() ? _T(", using output thread") : _T(""));
     m_sourceHWMem = true;
     m_inited = true;
 
@@ -1114,28 +1135,28 @@ RGY_ERR RGYOutFrame::WriteNextFrame(RGYFrame *pSurface) {
     if (!pSurface) {
         return RGY_ERR_NONE;
     }
-    if (!m_fDest) {
+    if (!m_fDest || !m_writer) {
         return RGY_ERR_NULL_PTR;
     }
 
-    if (m_sourceHWMem) {
-        if (m_readBuffer.get() == nullptr) {
-            m_readBuffer.reset((uint8_t *)_aligned_malloc(pSurface->pitch() + 128, 16));
-        }
+    const auto chromafmt = RGY_CSP_CHROMA_FORMAT[pSurface->csp()];
+    if (chromafmt != RGY_CHROMAFMT_YUV420 && chromafmt != RGY_CHROMAFMT_YUV444) {
+        AddMessage(RGY_LOG_ERROR, _T("Unsupported colorspace %s.\n"), RGY_CSP_NAMES[pSurface->csp()]);
+        return RGY_ERR_INVALID_COLOR_FORMAT;
     }
+    //NV12/P010はUとVに分離して書き出す
+    const bool splitUV = pSurface->csp() == RGY_CSP_NV12 || pSurface->csp() == RGY_CSP_P010;
 
-    if (m_bY4m) {
-        if (!m_y4mHeaderWritten) {
-            auto csp = pSurface->csp();
-            if (csp == RGY_CSP_NV12) {
-                csp = RGY_CSP_YV12;
-            } else if (csp == RGY_CSP_P010) {
-                csp = RGY_CSP_YV12_16;
-            }
-            WriteY4MHeader(m_fDest.get(), &m_VideoOutputInfo, csp);
-            m_y4mHeaderWritten = true;
+    if (m_bY4m && !m_y4mHeaderWritten) {
+        auto csp = pSurface->csp();
+        if (csp == RGY_CSP_NV12) {
+            csp = RGY_CSP_YV12;
+        } else if (csp == RGY_CSP_P010) {
+            csp = RGY_CSP_YV12_16;
         }
-        WRITE_CHECK(fwrite("FRAME\n", 1, strlen("FRAME\n"), m_fDest.get()), strlen("FRAME\n"));
+        auto err = WriteY4MHeader(m_writer.get(), &m_VideoOutputInfo, csp);
+        WRITE_CHECK(err);
+        m_y4mHeaderWritten = true;
     }
 
     auto loadLineToBuffer = [](uint8_t *ptrBuf, uint8_t *ptrSrc, const int pitch) {
@@ -1162,6 +1183,13 @@ RGY_ERR RGYOutFrame::WriteNextFrame(RGYFrame *pSurface) {
         memcpy(ptrBuf, ptrSrc, pitch);
 #endif
     };
+#if (defined(_M_IX86) || defined(_M_X64) || defined(__x86_64)) && ENCODER_QSV
+    //GPUメモリからはstreaming loadで1行ずつ読み出して詰め替える
+    const bool loadToBuffer = m_sourceHWMem;
+#else
+    //それ以外はフレームのメモリを直接iovecで指定し、コピーしない
+    const bool loadToBuffer = false;
+#endif
 
     auto crop = initCrop();
 #if ENCODER_QSV
@@ -1170,48 +1198,75 @@ RGY_ERR RGYOutFrame::WriteNextFrame(RGYFrame *pSurface) {
     }
 #endif
     const int pixSize = RGY_CSP_BIT_DEPTH[pSurface->csp()] > 8 ? 2 : 1;
-    if (   RGY_CSP_CHROMA_FORMAT[pSurface->csp()] == RGY_CHROMAFMT_YUV420
-        || RGY_CSP_CHROMA_FORMAT[pSurface->csp()] == RGY_CHROMAFMT_YUV444) {
-        const uint32_t lumaWidthBytes = pSurface->width() * pixSize;
-        const uint32_t cropOffset = crop.e.up * pSurface->pitch() + crop.e.left * pixSize;
-        if (m_sourceHWMem) {
-            for (decltype(pSurface->height()) j = 0; j < pSurface->height(); j++) {
-                uint8_t *ptrBuf = m_readBuffer.get();
-                uint8_t *ptrSrc = pSurface->ptrY() + (crop.e.up + j) * pSurface->pitch();
-                loadLineToBuffer(ptrBuf, ptrSrc, pSurface->pitch());
-                WRITE_CHECK(fwrite(ptrBuf + crop.e.left * pixSize, 1, lumaWidthBytes, m_fDest.get()), lumaWidthBytes);
+    const int shiftUV = (chromafmt == RGY_CHROMAFMT_YUV420) ? 1 : 0;
+    const uint32_t lumaWidthBytes = pSurface->width() * pixSize;
+    const uint32_t widthUV = pSurface->width() >> shiftUV;
+    const uint32_t heightUV = pSurface->height() >> shiftUV;
+    const size_t planeSizeY = ALIGN32((size_t)lumaWidthBytes * pSurface->height());
+    const size_t planeSizeUV = ALIGN32(((size_t)widthUV * heightUV + 32) * pixSize);
+
+    //詰め替えが必要な分だけステージング用のバッファを確保する
+    const size_t stagingSize = ((loadToBuffer) ? planeSizeY : 0) + ((loadToBuffer || splitUV) ? planeSizeUV * 2 : 0);
+    if (stagingSize > m_stagingSize) {
+        m_UVBuffer.reset((uint8_t *)_aligned_malloc(stagingSize, 64));
+        if (!m_UVBuffer) {
+            return RGY_ERR_NULL_PTR;
+        }
+        m_stagingSize = stagingSize;
+    }
+    if (loadToBuffer && m_readBuffer.get() == nullptr) {
+        m_readBuffer.reset((uint8_t *)_aligned_malloc(pSurface->pitch() + 128, 16));
+    }
+    uint8_t *ptrStaging = m_UVBuffer.get();
+
+    m_iov.clear();
+    auto addIov = [this](const uint8_t *ptr, size_t size) {
+        //連続した領域は1つにまとめる
+        if (m_iov.size() > 0 && (const uint8_t *)m_iov.back().iov_base + m_iov.back().iov_len == ptr) {
+            m_iov.back().iov_len += size;
+        } else {
+            RGYIovec iov;
+            iov.iov_base = (void *)ptr;
+            iov.iov_len = size;
+            m_iov.push_back(iov);
+        }
+    };
+    //ptrLineはcrop後の先頭行の先頭、offsetはcrop.e.leftの位置
+    auto addPlane = [&](uint8_t *ptrLine, const int pitch, const uint32_t offset, const uint32_t widthBytes, const uint32_t height) {
+        if (loadToBuffer) {
+            uint8_t *ptrDst = ptrStaging;
+            for (uint32_t j = 0; j < height; j++, ptrDst += widthBytes) {
+                loadLineToBuffer(m_readBuffer.get(), ptrLine + j * pitch, pitch);
+                memcpy(ptrDst, m_readBuffer.get() + offset, widthBytes);
             }
+            addIov(ptrStaging, (size_t)widthBytes * height);
+            ptrStaging += ALIGN32((size_t)widthBytes * height);
         } else {
-            for (decltype(pSurface->height()) j = 0; j < pSurface->height(); j++) {
-                WRITE_CHECK(fwrite(pSurface->ptrY() + cropOffset + j * pSurface->pitch(), 1, lumaWidthBytes, m_fDest.get()), lumaWidthBytes);
+            for (uint32_t j = 0; j < height; j++) {
+                addIov(ptrLine + j * pitch + offset, widthBytes);
             }
         }
-    } else {
-        AddMessage(RGY_LOG_ERROR, _T("Unsupported colorspace %s.\n"), RGY_CSP_NAMES[pSurface->csp()]);
-        return RGY_ERR_INVALID_COLOR_FORMAT;
-    }
+    };
 
-    uint32_t frameSize = 0;
-    if (   pSurface->csp() == RGY_CSP_NV12
-        || pSurface->csp() == RGY_CSP_P010) {
-        const uint32_t widthUV = pSurface->width() >> 1;
-        const uint32_t heightUV = pSurface->height() >> 1;
-        const uint32_t planeOffsetUV = ALIGN32((widthUV * heightUV + 32) * pixSize);
-        if (!m_UVBuffer) {
-            m_UVBuffer.reset((uint8_t *)_aligned_malloc(planeOffsetUV * 2, 32));
-        }
+    if (m_bY4m) {
+        static const char Y4M_FRAME_HEADER[] = "FRAME\n";
+        addIov((const uint8_t *)Y4M_FRAME_HEADER, strlen(Y4M_FRAME_HEADER));
+    }
+    addPlane(pSurface->ptrY() + crop.e.up * pSurface->pitch(), pSurface->pitch(), crop.e.left * pixSize, lumaWidthBytes, pSurface->height());
 
+    if (splitUV) {
+        uint8_t *ptrPlaneU = ptrStaging;
+        uint8_t *ptrPlaneV = ptrPlaneU + planeSizeUV;
         for (uint32_t j = 0; j < heightUV; j++) {
-            uint8_t *ptrSrc = pSurface->ptrUV() + (crop.e.up + j) * pSurface->pitch();
-            uint8_t *ptrBuf = ptrSrc;
-            if (m_sourceHWMem) {
-                loadLineToBuffer(m_readBuffer.get(), ptrSrc, pSurface->pitch());
+            uint8_t *ptrBuf = pSurface->ptrUV() + ((crop.e.up >> 1) + j) * pSurface->pitch(RGY_PLANE_C);
+            if (loadToBuffer) {
+                loadLineToBuffer(m_readBuffer.get(), ptrBuf, pSurface->pitch(RGY_PLANE_C));
                 ptrBuf = m_readBuffer.get();
             }
 
             const void *ptrLineUV = ptrBuf + crop.e.left * pixSize;
-            void *ptrLineU = m_UVBuffer.get() + j * widthUV * pixSize;
-            void *ptrLineV = m_UVBuffer.get() + j * widthUV * pixSize + planeOffsetUV;
+            void *ptrLineU = ptrPlaneU + j * widthUV * pixSize;
+            void *ptrLineV = ptrPlaneV + j * widthUV * pixSize;
             if (pSurface->csp() == RGY_CSP_NV12) {
                 const uint8_t *ptrUV = (const uint8_t *)ptrLineUV;
                 uint8_t *ptrU = (uint8_t *)ptrLineU;
@@ -1231,7 +1286,7 @@ RGY_ERR RGYOutFrame::WriteNextFrame(RGYFrame *pSurface) {
 #else
                 convert_nv12_to_yv12_line_c<uint8_t, 8, uint8_t, 8>(ptrU, ptrV, ptrUV, widthUV);
 #endif
-            } else if (pSurface->csp() == RGY_CSP_P010) {
+            } else {
                 const uint16_t *ptrUV = (const uint16_t *)ptrLineUV;
                 uint16_t *ptrU = (uint16_t *)ptrLineU;
                 uint16_t *ptrV = (uint16_t *)ptrLineV;
@@ -1242,28 +1297,26 @@ RGY_ERR RGYOutFrame::WriteNextFrame(RGYFrame *pSurface) {
                 case 16:
                 default: convert_nv12_to_yv12_line_c<uint16_t, 16, uint16_t, 16>(ptrU, ptrV, ptrUV, widthUV); break;
                 }
-            } else {
-                return RGY_ERR_INVALID_COLOR_FORMAT;
             }
         }
-        WRITE_CHECK(fwrite(m_UVBuffer.get(),                 1, widthUV * heightUV, m_fDest.get()), widthUV * heightUV);
-        WRITE_CHECK(fwrite(m_UVBuffer.get() + planeOffsetUV, 1, widthUV * heightUV, m_fDest.get()), widthUV * heightUV);
-    } else if (RGY_CSP_CHROMA_FORMAT[pSurface->csp()] == RGY_CHROMAFMT_YUV420
-            || RGY_CSP_CHROMA_FORMAT[pSurface->csp()] == RGY_CHROMAFMT_YUV444) {
-        uint8_t *const ptrBuf = m_readBuffer.get();
-
+        addIov(ptrPlaneU, (size_t)widthUV * heightUV * pixSize);
+        addIov(ptrPlaneV, (size_t)widthUV * heightUV * pixSize);
+    } else {
         for (int iplane = 1; iplane < RGY_CSP_PLANES[pSurface->csp()]; iplane++) {
-            const uint32_t widthUV = pSurface->width() >> (RGY_CSP_CHROMA_FORMAT[pSurface->csp()] == RGY_CHROMAFMT_YUV420 ? 1 : 0);
-            const uint32_t heightUV = pSurface->height() >> (RGY_CSP_CHROMA_FORMAT[pSurface->csp()] == RGY_CHROMAFMT_YUV420 ? 1 : 0);
-            for (uint32_t i = 0; i < heightUV; i++) {
-                loadLineToBuffer(ptrBuf, pSurface->ptrPlane((RGY_PLANE)iplane) + (crop.e.up + i) * pSurface->pitch((RGY_PLANE)iplane), pSurface->pitch((RGY_PLANE)iplane));
-                WRITE_CHECK(fwrite(ptrBuf + (crop.e.left * pixSize >> 1), 1, widthUV * pixSize, m_fDest.get()), widthUV * pixSize);
-            }
+            const auto plane = (RGY_PLANE)iplane;
+            addPlane(pSurface->ptrPlane(plane) + (crop.e.up >> shiftUV) * pSurface->pitch(plane), pSurface->pitch(plane),
+                (crop.e.left >> shiftUV) * pixSize, widthUV * pixSize, heightUV);
         }
-    } else {
-        return RGY_ERR_INVALID_COLOR_FORMAT;
     }
 
+    //1フレーム分をまとめて書き出す
+    uint32_t frameSize = 0;
+    for (const auto& iov : m_iov) {
+        frameSize += (uint32_t)iov.iov_len;
+    }
+    auto err = m_writer->write(m_iov.data(), (int)m_iov.size());
+    WRITE_CHECK(err);
+
     m_encSatusInfo->SetOutputData(RGY_FRAMETYPE_IDR, frameSize, 0);
     return RGY_ERR_NONE;
 }
@@ -1756,10 +1809,15 @@ RGY_ERR initWriters(
         return RGY_ERR_UNKNOWN;
     } else {
 #endif //ENABLE_AVSW_READER
+        //自動の場合は、低遅延モード以外で書き出しスレッドを使用する
+        const int threadOutput = (ctrl->threadOutput == RGY_OUTPUT_THREAD_AUTO) ? ((ctrl->lowLatency) ? 0 : 1) : ctrl->threadOutput;
         if (outputVideoInfo.codec == RGY_CODEC_RAW) {
             pFileWriter = std::make_shared<RGYOutFrame>();
             YUVWriterParam param;
             param.bY4m = common->muxOutputFormat != _T("raw");
+            param.bufSizeMB = ctrl->outputBufSizeMB;
+            param.threadOutput = threadOutput;
+            param.threadParamOutput = ctrl->threadParams.get(RGYThreadType::OUTPUT);
             auto sts = pFileWriter->Init(common->outputFilename.c_str(), &outputVideoInfo, &param, log, pStatus);
             if (sts != RGY_ERR_NONE) {
                 log->write(RGY_LOG_ERROR, RGY_LOGT_OUT, pFileWriter->GetOutputMessage());
@@ -1771,6 +1829,8 @@ RGY_ERR initWriters(
             pFileWriter = std::make_shared<RGYOutputRaw>();
             RGYOutputRawPrm rawPrm;
             rawPrm.bufSizeMB = ctrl->outputBufSizeMB;
+            rawPrm.threadOutput = threadOutput;
+            rawPrm.threadParamOutput = ctrl->threadParams.get(RGYThreadType::OUTPUT);
             rawPrm.benchmark = benchmark;
             rawPrm.codecId = outputVideoInfo.codec;
             rawPrm.hdrMetadataIn = hdrMetadataIn;
@@ -40,6 +40,7 @@
 #include "rgy_avutil.h"
 #include "rgy_bitstream.h"
 #include "rgy_input.h"
+#include "rgy_output_writer.h"
 #if ENCODER_NVENC
 #include "NVEncUtil.h"
 #include "NVEncParam.h"
@@ -400,7 +401,7 @@ protected:
     tstring     m_strOutputInfo;
     VideoInfo   m_VideoOutputInfo;
     std::shared_ptr<RGYLog> m_printMes;  //ログ出力
-    std::unique_ptr<char, malloc_deleter>            m_outputBuffer;
+    std::unique_ptr<RGYOutputWriter>                 m_writer; //m_fDestへの書き出し
     std::unique_ptr<uint8_t, aligned_malloc_deleter> m_readBuffer;
     std::unique_ptr<uint8_t, aligned_malloc_deleter> m_UVBuffer;
     std::unique_ptr<RGYOutputBSF> m_bsf;
@@ -422,6 +423,8 @@ struct RGYOutputRawPrm {
     tstring outReplayFile;
     RGY_CODEC outReplayCodec;
     int bufSizeMB;
+    int threadOutput; //書き出しスレッドを使うか (0/1)
+    RGYParamThread threadParamOutput;
     RGY_CODEC codecId;
     const RGYHDRMetadata *hdrMetadataIn;
     RGYHDR10Plus *hdr10plus;
@@ -502,6 +505,9 @@ RGY_ERR initWriters(
 
 struct YUVWriterParam {
     bool bY4m;
+    int bufSizeMB;
+    int threadOutput; //書き出しスレッドを使うか (0/1)
+    RGYParamThread threadParamOutput;
 };
 
 class RGYOutFrame : public RGYOutput {
@@ -516,6 +522,8 @@ protected:
     virtual RGY_ERR Init(const TCHAR *strFileName, const VideoInfo *pOutputInfo, const void *prm) override;
 
     bool m_bY4m;
+    size_t m_stagingSize;       //m_UVBufferのサイズ
+    std::vector<RGYIovec> m_iov; //1フレーム分の書き出し領域のリスト
 };
 
 #endif //__RGY_OUTPUT_H__
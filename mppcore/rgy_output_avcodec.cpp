@@ -180,6 +180,92 @@ AVMuxFormat::AVMuxFormat() :
     fpTsLogFile() {
 }
 
+static_assert(RGY_BITSTREAM_PADDING >= AV_INPUT_BUFFER_PADDING_SIZE, "RGY_BITSTREAM_PADDING must be >= AV_INPUT_BUFFER_PADDING_SIZE");
+
+RGYOutputBitstreamPool::RGYOutputBitstreamPool() :
+    m_freeI(),
+    m_freePB(),
+    m_mtx(),
+    m_closed(false) {
+    //あまり多すぎると無駄にメモリを使用するので、上限を超えたものは解放する
+    m_freeI.init(VID_BITSTREAM_QUEUE_SIZE_I * 2, VID_BITSTREAM_QUEUE_SIZE_I);
+    m_freePB.init(VID_BITSTREAM_QUEUE_SIZE_PB * 2, VID_BITSTREAM_QUEUE_SIZE_PB);
+}
+
+RGYOutputBitstreamPool::~RGYOutputBitstreamPool() {
+    close();
+}
+
+bool RGYOutputBitstreamPool::get(RGYBitstream *bitstream, bool frameI) {
+    auto& queue = (frameI) ? m_freeI : m_freePB;
+    RGYBitstream freeStream = RGYBitstreamInit();
+    {
+        std::lock_guard<std::mutex> lock(m_mtx);
+        if (m_closed || !queue.front_copy_and_pop_no_lock(&freeStream)) {
+            return false;
+        }
+    }
+    bitstream->attach(freeStream.release(), freeStream.bufsize());
+    return true;
+}
+
+void RGYOutputBitstreamPool::put(RGYBitstream *bitstream, bool frameI) {
+    if (bitstream->bufsize() == 0) { //データ領域を所有していない
+        bitstream->clear();
+        return;
+    }
+    RGYBitstream freeStream = RGYBitstreamInit();
+    const auto bufsize = bitstream->bufsize();
+    freeStream.attach(bitstream->release(), bufsize);
+    auto& queue = (frameI) ? m_freeI : m_freePB;
+    //エンコードスレッドが終了していると空きを待っても戻らないので、満杯なら待機せず破棄する
+    bool pushed = false;
+    {
+        std::lock_guard<std::mutex> lock(m_mtx);
+        pushed = !m_closed && queue.try_push(freeStream);
+    }
+    if (!pushed) {
+        freeStream.clear();
+    }
+}
+
+AVBufferRef *RGYOutputBitstreamPool::wrap(RGYBitstream *bitstream, bool frameI) {
+    if (bitstream->bufsize() == 0 || bitstream->size() == 0) {
+        return nullptr;
+    }
+    //AVPacketのデータの後ろにはゼロ埋めした領域が必要
+    memset(bitstream->data() + bitstream->size(), 0, AV_INPUT_BUFFER_PADDING_SIZE);
+    auto ref = new BufferRef{ shared_from_this(), bitstream->bufsize(), frameI };
+    auto buf = av_buffer_create(bitstream->bufptr(), (int)(bitstream->bufsize() + RGY_BITSTREAM_PADDING), freeBuffer, ref, 0);
+    if (!buf) {
+        delete ref;
+        return nullptr;
+    }
+    //AVPacketのdataはbufの先頭ではなく、bitstreamのデータの位置を指すようにする
+    buf->data = bitstream->data();
+    buf->size = (int)bitstream->size();
+    bitstream->release();
+    return buf;
+}
+
+void RGYOutputBitstreamPool::freeBuffer(void *opaque, uint8_t *data) {
+    auto ref = (BufferRef *)opaque;
+    RGYBitstream bitstream = RGYBitstreamInit();
+    bitstream.attach(data, ref->bufsize);
+    ref->pool->put(&bitstream, ref->frameI);
+    delete ref;
+}
+
+void RGYOutputBitstreamPool::close() {
+    std::lock_guard<std::mutex> lock(m_mtx);
+    if (m_closed) {
+        return;
+    }
+    m_closed = true;
+    m_freeI.close([](RGYBitstream *pBitstream) { pBitstream->clear(); });
+    m_freePB.close([](RGYBitstream *pBitstream) { pBitstream->clear(); });
+}
+
 AVMuxVideo::AVMuxVideo() :
     codec(nullptr),
     codecCtx(nullptr),
@@ -206,6 +292,10 @@ AVMuxVideo::AVMuxVideo() :
     timestamp(nullptr),
     pktOut(nullptr),
     pktParse(nullptr),
+    bitstreamPool(),
+    copyFrames(0),
+    copyBytes(0),
+    copyBytesPeak(0),
     prevEncodeFrameId(-1),
     prevInputFrameId(-1),
     parserCtx(nullptr),
@@ -362,8 +452,6 @@ AVMuxThread::AVMuxThread() :
     enableAudEncodeThread(false),
     thOutput(),
     thRawVideo(),
-    qVideobitstreamFreeI(),
-    qVideobitstreamFreePB(),
     qVideobitstream(),
     thAud(),
     streamOutMaxDts(0),
@@ -488,6 +576,15 @@ void RGYOutputAvcodec::CloseVideo(AVMuxVideo *muxVideo) {
     m_Mux.video.hdr10plus = nullptr;
     m_Mux.video.doviRpu = nullptr;
     m_Mux.video.timestamp = nullptr;
+    if (m_Mux.video.bitstreamPool) {
+        //libavformatがまだ保持しているデータ領域は、解放時にそのまま破棄される
+        m_Mux.video.bitstreamPool->close();
+        m_Mux.video.bitstreamPool.reset();
+    }
+    if (m_Mux.video.copyFrames > 0) {
+        AddMessage(RGY_LOG_INFO, _T("video bitstream copy: avg %.1f KB/frame, peak %.1f KB/frame.\n"),
+            m_Mux.video.copyBytes / (double)m_Mux.video.copyFrames / 1024.0, m_Mux.video.copyBytesPeak / 1024.0);
+    }
 
     if (muxVideo->rawVideoCodecCtx) {
         muxVideo->rawVideoCodecCtx.reset();
@@ -547,8 +644,6 @@ void RGYOutputAvcodec::CloseFormat(AVMuxFormat *muxFormat) {
 void RGYOutputAvcodec::CloseQueues() {
 #if ENABLE_AVCODEC_OUT_THREAD
     m_Mux.thread.qVideobitstream.close();
-    m_Mux.thread.qVideobitstreamFreeI.close([](RGYBitstream *pBitstream) { pBitstream->clear(); });
-    m_Mux.thread.qVideobitstreamFreePB.close([](RGYBitstream *pBitstream) { pBitstream->clear(); });
     AddMessage(RGY_LOG_DEBUG, _T("closed queues...\n"));
 #endif
 }
@@ -1151,6 +1246,7 @@ RGY_ERR RGYOutputAvcodec::InitVideo(const VideoInfo *videoOutputInfo, const Avco
     m_Mux.video.prevInputFrameId  = -1;
     m_Mux.video.pktOut            = av_packet_alloc();
     m_Mux.video.pktParse          = av_packet_alloc();
+    m_Mux.video.bitstreamPool     = std::make_shared<RGYOutputBitstreamPool>();
     m_Mux.video.afs               = prm->afs;
     m_Mux.video.debugDirectAV1Out = prm->debugDirectAV1Out;
     m_Mux.video.hdr10plus         = prm->hdr10plus;
@@ -2685,8 +2781,6 @@ RGY_ERR RGYOutputAvcodec::Init(const TCHAR *strFileName, const VideoInfo *videoO
         AddMessage(RGY_LOG_DEBUG, _T("starting output thread...\n"));
         const int audioQueueCapacity = 4096;
         m_Mux.thread.qVideobitstream.init(4096, (std::max)(256, (m_Mux.video.outputFps.den) ? m_Mux.video.outputFps.num * 4 / m_Mux.video.outputFps.den : 0));
-        m_Mux.thread.qVideobitstreamFreeI.init(256);
-        m_Mux.thread.qVideobitstreamFreePB.init(3840);
         m_Mux.thread.thOutput = std::make_unique<AVMuxThreadWorker>();
         m_Mux.thread.thOutput->thAbort = false;
         m_Mux.thread.thOutput->qPackets.init(16384, audioQueueCapacity * std::max(1, (int)m_Mux.audio.size())); //字幕のみコピーするときのため、最低でもある程度は確保する
@@ -3117,17 +3211,25 @@ RGY_ERR RGYOutputAvcodec::WriteNextFrame(RGYBitstream *bitstream) {
         RGYBitstream copyStream = RGYBitstreamInit();
         bool bFrameI = (bitstream->frametype() & RGY_FRAMETYPE_I) != 0;
         bool bFrameP = (bitstream->frametype() & RGY_FRAMETYPE_P) != 0;
-        //IフレームかPBフレームかでサイズが大きく違うため、空きのmfxBistreamは異なるキューで管理する
-        auto& qVideoQueueFree = (bFrameI) ? m_Mux.thread.qVideobitstreamFreeI : m_Mux.thread.qVideobitstreamFreePB;
-        //空いているmfxBistreamを取り出す
-        if (!qVideoQueueFree.front_copy_and_pop_no_lock(&copyStream) || copyStream.bufsize() < bitstream->size()) {
-            //空いているmfxBistreamがない、あるいはそのバッファサイズが小さい場合は、領域を取り直す
-            const auto allocate_bytes = bitstream->size() * ((bFrameI | bFrameP) ? 2 : 8);
-            if (RGY_ERR_NONE != copyStream.init(allocate_bytes)) {
-                AddMessage(RGY_LOG_ERROR, _T("Failed to allocate memory for video bitstream output buffer, %sB.\n"), allocate_bytes);
-                m_Mux.format.streamError = true;
-                return RGY_ERR_MEMORY_ALLOC;
+        //IフレームかPBフレームかでサイズが大きく違うため、空きのデータ領域は異なるキューで管理する
+        const bool freeAvailable = m_Mux.video.bitstreamPool->get(&copyStream, bFrameI);
+        if (bitstream->bufsize() > 0) {
+            //bitstreamがデータ領域を所有している場合は、コピーせずに空きのデータ領域と入れ替える
+            copyStream.swapBuffer(bitstream);
+        } else {
+            if (!freeAvailable || copyStream.bufsize() < bitstream->size()) {
+                //空いているデータ領域がない、あるいはそのバッファサイズが小さい場合は、領域を取り直す
+                const auto allocate_bytes = bitstream->size() * ((bFrameI | bFrameP) ? 2 : 8);
+                if (RGY_ERR_NONE != copyStream.init(allocate_bytes)) {
+                    AddMessage(RGY_LOG_ERROR, _T("Failed to allocate memory for video bitstream output buffer, %sB.\n"), allocate_bytes);
+                    m_Mux.format.streamError = true;
+                    return RGY_ERR_MEMORY_ALLOC;
+                }
             }
+            copyStream.setSize(bitstream->size());
+            copyStream.setOffset(0);
+            memcpy(copyStream.bufptr(), bitstream->data(), copyStream.size());
+            VidAddCopyStats(copyStream.size());
         }
         //必要な情報をコピー
         copyStream.setDataflag(bitstream->dataflag());
@@ -3135,10 +3237,8 @@ RGY_ERR RGYOutputAvcodec::WriteNextFrame(RGYBitstream *bitstream) {
         copyStream.setDts(bitstream->dts());
         copyStream.setDuration(bitstream->duration());
         copyStream.setFrametype(bitstream->frametype());
-        copyStream.setSize(bitstream->size());
+        copyStream.setFrameIdx(bitstream->frameIdx());
         copyStream.setAvgQP(bitstream->avgQP());
-        copyStream.setOffset(0);
-        memcpy(copyStream.bufptr(), bitstream->data(), copyStream.size());
         //キューに押し込む
         if (!m_Mux.thread.qVideobitstream.push(copyStream)) {
             AddMessage(RGY_LOG_ERROR, _T("Failed to allocate memory for video bitstream queue.\n"));
@@ -3188,22 +3288,49 @@ RGY_ERR RGYOutputAvcodec::VidCheckStreamAVParser(RGYBitstream *pBitstream) {
     return err;
 }
 
+RGY_ERR RGYOutputAvcodec::VidSetPacketData(AVPacket *pkt, RGYBitstream *bitstream) {
+    const auto frameI = (bitstream->frametype() & (RGY_FRAMETYPE_IDR | RGY_FRAMETYPE_I)) != 0;
+    const auto size = (int)bitstream->size();
+    m_Mux.video.copyFrames++;
+    //データ領域をAVBufferRefで包んで渡し、libavformatが解放したときにプールに戻す
+    if (auto buf = m_Mux.video.bitstreamPool->wrap(bitstream, frameI); buf != nullptr) {
+        av_packet_unref(pkt);
+        pkt->buf = buf;
+        pkt->data = buf->data;
+        pkt->size = size;
+        return RGY_ERR_NONE;
+    }
+    //bitstreamがデータ領域を所有していない場合はコピーする
+    if (av_new_packet(pkt, size) < 0) {
+        AddMessage(RGY_LOG_ERROR, _T("Failed to allocate memory for video packet.\n"));
+        return RGY_ERR_NULL_PTR;
+    }
+    memcpy(pkt->data, bitstream->data(), size);
+    VidAddCopyStats(size);
+    return RGY_ERR_NONE;
+}
+
+void RGYOutputAvcodec::VidAddCopyStats(size_t copyBytes) {
+    m_Mux.video.copyBytes += (int64_t)copyBytes;
+    int64_t peak = m_Mux.video.copyBytesPeak.load();
+    while ((int64_t)copyBytes > peak && !m_Mux.video.copyBytesPeak.compare_exchange_weak(peak, (int64_t)copyBytes)) {
+        ;
+    }
+}
+
 RGY_ERR RGYOutputAvcodec::WriteNextFrameFinish(RGYBitstream *bitstream, const RGY_FRAMETYPE frameType) {
+    const auto frameI = (frameType & (RGY_FRAMETYPE_IDR | RGY_FRAMETYPE_I)) != 0;
 #if ENABLE_AVCODEC_OUT_THREAD
-    //最初のヘッダーを書いたパケットはコピーではないので、キューに入れない
     if (m_Mux.thread.thOutput) {
-        //確保したメモリ領域を使いまわすためにキューに格納
-        const auto frameI = (frameType & (RGY_FRAMETYPE_IDR | RGY_FRAMETYPE_I)) != 0;
-        auto& qVideoQueueFree = (frameI) ? m_Mux.thread.qVideobitstreamFreeI : m_Mux.thread.qVideobitstreamFreePB;
-        auto queueFavoredSize = (frameI) ? VID_BITSTREAM_QUEUE_SIZE_I : VID_BITSTREAM_QUEUE_SIZE_PB;
-        if ((int64_t)qVideoQueueFree.size() > queueFavoredSize) {
-            //あまり多すぎると無駄にメモリを使用するので減らす
-            bitstream->clear();
-        } else {
-            qVideoQueueFree.push(*bitstream);
-        }
+        //データ領域は通常AVPacketに渡されていて、libavformatが解放したときにプールに戻る
+        //コピーして渡した場合などで残っていれば、使いまわすためにプールに戻す
+        m_Mux.video.bitstreamPool->put(bitstream, frameI);
     } else {
 #endif
+        //エンコーダのbitstreamのデータ領域をAVPacketに渡した場合は、空きのデータ領域を補充しておく
+        if (bitstream->bufsize() == 0) {
+            m_Mux.video.bitstreamPool->get(bitstream, frameI);
+        }
         bitstream->setSize(0);
         bitstream->setOffset(0);
 #if ENABLE_AVCODEC_OUT_THREAD
@@ -3246,7 +3373,9 @@ RGY_ERR RGYOutputAvcodec::WriteNextFrameInternalOneFrame(RGYBitstream *bitstream
             return RGY_ERR_UNSUPPORTED;
         }
     }
-    if (ENCODER_VCEENC || ENCODER_MPP) {
+    //入力からコピーしたbitstreamは入力のヘッダ・メタ情報をそのまま使う
+    const bool bitstreamCopy = (bitstream->dataflag() & RGY_FRAME_FLAG_BITSTREAM_COPY) != 0;
+    if ((ENCODER_VCEENC || ENCODER_MPP) && !bitstreamCopy) {
         err = InsertHeader(bitstream, isIDR);
         if (err != RGY_ERR_NONE) {
             return err;
@@ -3290,15 +3419,20 @@ RGY_ERR RGYOutputAvcodec::WriteNextFrameInternalOneFrame(RGYBitstream *bitstream
         }
     }
 
-    err = InsertMetadata(bitstream, metadataList);
-    if (err != RGY_ERR_NONE) {
-        return err;
+    if (!bitstreamCopy) {
+        err = InsertMetadata(bitstream, metadataList);
+        if (err != RGY_ERR_NONE) {
+            return err;
+        }
     }
 
+    //VidSetPacketDataでbitstreamのデータ領域はpktに移るので、必要な情報を先に取得しておく
+    const auto bitstreamSize = bitstream->size();
     AVPacket *pkt = m_Mux.video.pktOut;
-    av_new_packet(pkt, (int)bitstream->size());
-    memcpy(pkt->data, bitstream->data(), bitstream->size());
-    pkt->size = (int)bitstream->size();
+    err = VidSetPacketData(pkt, bitstream);
+    if (err != RGY_ERR_NONE) {
+        return err;
+    }
 
     const AVRational streamTimebase = m_Mux.video.streamOut->time_base;
     pkt->stream_index = m_Mux.video.streamOut->index;
@@ -3383,13 +3517,13 @@ RGY_ERR RGYOutputAvcodec::WriteNextFrameInternalOneFrame(RGYBitstream *bitstream
     if (m_Mux.video.fpTsLogFile) {
         const TCHAR *pFrameTypeStr =
             (frameType & (RGY_FRAMETYPE_IDR | RGY_FRAMETYPE_I)) ? _T("I") : (((frameType & RGY_FRAMETYPE_B) == 0) ? _T("P") : _T("B"));
-        _ftprintf(m_Mux.video.fpTsLogFile.get(), _T("%s, %20lld, %20lld, %20lld, %20lld, %d, %7zd\n"), pFrameTypeStr, (lls)bitstream->pts(), (lls)bitstream->dts(), (lls)pts, (lls)dts, (int)duration, bitstream->size());
+        _ftprintf(m_Mux.video.fpTsLogFile.get(), _T("%s, %20lld, %20lld, %20lld, %20lld, %d, %7zd\n"), pFrameTypeStr, (lls)bitstream->pts(), (lls)bitstream->dts(), (lls)pts, (lls)dts, (int)duration, bitstreamSize);
         {
             std::lock_guard<std::mutex> lock(m_Mux.format.fpTsLogMtx);
-            _ftprintf(m_Mux.format.fpTsLogFile.get(), _T("v, %d, %s, %20lld, %20lld, %20lld, %20lld, %d, %7zd\n"), pkt->stream_index, pFrameTypeStr, (lls)bitstream->pts(), (lls)bitstream->dts(), (lls)pts, (lls)dts, (int)duration, bitstream->size());
+            _ftprintf(m_Mux.format.fpTsLogFile.get(), _T("v, %d, %s, %20lld, %20lld, %20lld, %20lld, %d, %7zd\n"), pkt->stream_index, pFrameTypeStr, (lls)bitstream->pts(), (lls)bitstream->dts(), (lls)pts, (lls)dts, (int)duration, bitstreamSize);
         }
     }
-    m_encSatusInfo->SetOutputData(frameType, bitstream->size(), bitstream->avgQP());
+    m_encSatusInfo->SetOutputData(frameType, bitstreamSize, bitstream->avgQP());
     return (m_Mux.format.streamError) ? RGY_ERR_UNKNOWN : RGY_ERR_NONE;
 }
 
@@ -3436,7 +3570,11 @@ RGY_ERR RGYOutputAvcodec::WriteNextFrameInternal(RGYBitstream *bitstream, int64_
             return RGY_ERR_NONE; // 特にflushするものはない
         }
         RGYTimestampMapVal bs_framedata;
-        if (m_Mux.video.timestamp) {
+        if (bitstream->dataflag() & RGY_FRAME_FLAG_BITSTREAM_COPY) {
+            //入力からコピーしたbitstreamはエンコーダを通っていないので、timestampの情報はない
+            bs_framedata.inputFrameId = bitstream->frameIdx();
+            m_Mux.video.prevInputFrameId = bs_framedata.inputFrameId;
+        } else if (m_Mux.video.timestamp) {
             bs_framedata = m_Mux.video.timestamp->get(bitstream->pts());
             if (bs_framedata.inputFrameId < 0) {
                 bs_framedata.inputFrameId = m_Mux.video.prevInputFrameId;
@@ -3513,6 +3651,7 @@ RGY_ERR RGYOutputAvcodec::WriteNextFrameInternal(RGYBitstream *bitstream, int64_
             memcpy(bitstream->data() + copy_size, unit_data.data(), unit_data.size());
             copy_size += unit_data.size();
         }
+        VidAddCopyStats(copy_size);
         // コピーし終わったユニットを破棄
         for (size_t iunit = 0; iunit < next_delim; iunit++) {
             m_Mux.videoAV1Merge.pop_front();
@@ -34,6 +34,7 @@
 
 #if ENABLE_AVSW_READER
 #include <thread>
+#include <mutex>
 #include <deque>
 #include <atomic>
 #include <unordered_map>
@@ -63,6 +64,38 @@ static const int SUB_ENC_BUF_MAX_SIZE = 1024 * 1024;
 static const int VID_BITSTREAM_QUEUE_SIZE_I  = 4;
 static const int VID_BITSTREAM_QUEUE_SIZE_PB = 64;
 
+//映像パケットのデータ領域を使いまわすためのプール
+//データ領域はコピーせずにAVBufferRefとしてAVPacketに渡し、libavformatが解放したときにプールに戻す
+//libavformatはav_write_trailerまでパケットを保持することがあるので、AVBufferRef側からも参照を持つ
+class RGYOutputBitstreamPool : public std::enable_shared_from_this<RGYOutputBitstreamPool> {
+public:
+    RGYOutputBitstreamPool();
+    ~RGYOutputBitstreamPool();
+    //空いているデータ領域を取り出してbitstreamに設定する (空きがなければfalse)
+    bool get(RGYBitstream *bitstream, bool frameI);
+    //bitstreamのデータ領域をプールに戻す (多すぎる場合とclose後は解放する)
+    void put(RGYBitstream *bitstream, bool frameI);
+    //bitstreamのデータ領域の所有権をAVBufferRefに移す (bitstreamは空になる)
+    //bitstreamがデータ領域を所有していない場合はnullptr
+    AVBufferRef *wrap(RGYBitstream *bitstream, bool frameI);
+    //プールしているデータ領域を解放し、以降戻されたものはすぐに解放する
+    //AVBufferRefの解放(put)はlibavformatの呼び出し元のスレッドで行われるので、get/putとはm_mtxで排他する
+    void close();
+protected:
+    struct BufferRef {
+        std::shared_ptr<RGYOutputBitstreamPool> pool;
+        size_t bufsize;
+        bool frameI;
+    };
+    static void freeBuffer(void *opaque, uint8_t *data);
+
+    //IフレームかPBフレームかでサイズが大きく違うため、別のキューで管理する
+    RGYQueueMPSC<RGYBitstream> m_freeI;  //Iフレーム用の空きデータ領域 (出力スレッド -> エンコードスレッド)
+    RGYQueueMPSC<RGYBitstream> m_freePB; //P/Bフレーム用の空きデータ領域 (出力スレッド -> エンコードスレッド)
+    std::mutex m_mtx;                    //closeによるキューの破棄と、get/putによるキューの操作の排他
+    bool m_closed;                       //m_mtxで保護
+};
+
 enum RGYMetadataCopyDefault {
     RGY_METADATA_DEFAULT_CLEAR,
     RGY_METADATA_DEFAULT_COPY_LANG_ONLY,
@@ -162,6 +195,10 @@ struct AVMuxVideo {
     RGYTimestamp         *timestamp;            //timestampの情報
     AVPacket             *pktOut;               //出力用のAVPacket
     AVPacket             *pktParse;             //parser用のAVPacket
+    std::shared_ptr<RGYOutputBitstreamPool> bitstreamPool; //映像パケットのデータ領域のプール
+    std::atomic<int64_t>  copyFrames;           //出力した映像のフレーム数
+    std::atomic<int64_t>  copyBytes;            //エンコーダからlibavformatに渡すまでにコピーした映像のバイト数
+    std::atomic<int64_t>  copyBytesPeak;        //1フレームでコピーした最大のバイト数
     int64_t               prevEncodeFrameId;    //前回のエンコードフレームID
     int64_t               prevInputFrameId;     //前回の入力フレームID
     AVCodecParserContext *parserCtx;            //動画ストリームのParser (VCEのみ)
@@ -322,10 +359,8 @@ struct AVMuxThread {
     bool                           enableAudEncodeThread;     //音声エンコードスレッドを使用する
     std::unique_ptr<AVMuxThreadWorker> thOutput;              //出力スレッド
     std::unique_ptr<AVMuxThreadWorker> thRawVideo;            //raw映像処理用スレッド
-    RGYQueueMPMP<AVPktMuxData, 64> qVideoRawFrames;           //raw映像フレームを出力スレッドに渡すためのキュー
-    RGYQueueMPMP<RGYBitstream, 64> qVideobitstreamFreeI;      //映像 Iフレーム用に空いているデータ領域を格納する
-    RGYQueueMPMP<RGYBitstream, 64> qVideobitstreamFreePB;     //映像 P/Bフレーム用に空いているデータ領域を格納する
-    RGYQueueMPMP<RGYBitstream, 64> qVideobitstream;           //映像パケットを出力スレッドに渡すためのキュー
+    RGYQueueMPSC<AVPktMuxData>     qVideoRawFrames;           //raw映像フレームを出力スレッドに渡すためのキュー
+    RGYQueueMPSC<RGYBitstream>     qVideobitstream;           //映像パケットを出力スレッドに渡すためのキュー
     std::unordered_map<const AVMuxAudio *, std::unique_ptr<AVMuxThreadAudio>> thAud; //音声スレッド
     std::atomic<int64_t>           streamOutMaxDts;           //音声・字幕キューの最後のdts (timebase = QUEUE_DTS_TIMEBASE) (キューの同期に使用)
     PerfQueueInfo                 *queueInfo;                 //キューの情報を格納する構造体
@@ -703,6 +738,12 @@ protected:
 
     RGY_ERR VidCheckStreamAVParser(RGYBitstream *pBitstream);
 
+    //映像パケットのデータ領域をAVPacketに設定する (可能ならコピーせずに所有権を移す)
+    RGY_ERR VidSetPacketData(AVPacket *pkt, RGYBitstream *bitstream);
+
+    //エンコーダからlibavformatに渡すまでに映像データをコピーした量を記録する
+    void VidAddCopyStats(size_t copyBytes);
+
     void CloseOther(AVMuxOther *pMuxOther);
     void CloseAudio(AVMuxAudio *muxAudio);
     void CloseVideo(AVMuxVideo *pMuxVideo);
@@ -0,0 +1,315 @@
+﻿// -----------------------------------------------------------------------------------------
+// QSVEnc/NVEnc by rigaya
+// -----------------------------------------------------------------------------------------
+// The MIT License
+//
+// Copyright (c) 2011-2016 rigaya
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// --------------------------------------------------------------------------------------------
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <climits>
+#include <chrono>
+#include "rgy_output_writer.h"
+#if defined(_WIN32) || defined(_WIN64)
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+#if defined(IOV_MAX)
+static const int RGY_IOV_MAX = IOV_MAX;
+#else
+static const int RGY_IOV_MAX = 1024;
+#endif
+
+RGYOutputWriter::RGYOutputWriter() :
+    m_fp(nullptr),
+    m_fd(-1),
+    m_blockSize(0),
+    m_async(false),
+    m_blockBuf(),
+    m_blocks(),
+    m_cur(nullptr),
+    m_qFilled(),
+    m_qFree(),
+    m_thread(),
+    m_err(RGY_ERR_NONE),
+    m_writeCalls(0) {
+}
+
+RGYOutputWriter::~RGYOutputWriter() {
+    close();
+}
+
+RGY_ERR RGYOutputWriter::init(FILE *fp, size_t blockSize, bool async, const RGYParamThread& threadParam) {
+    close();
+    if (fp == nullptr) {
+        return RGY_ERR_NULL_PTR;
+    }
+    //これまでにfpに書き込まれたデータを先に書き出しておく
+    if (fflush(fp) != 0) {
+        return RGY_ERR_UNDEFINED_BEHAVIOR;
+    }
+    m_fp = fp;
+#if defined(_WIN32) || defined(_WIN64)
+    m_fd = _fileno(fp);
+#else
+    m_fd = fileno(fp);
+#endif
+    if (m_fd < 0) {
+        return RGY_ERR_INVALID_HANDLE;
+    }
+    m_async = async;
+    m_blockSize = (m_async) ? std::max<size_t>(blockSize, 1024 * 1024) : blockSize;
+    m_err = RGY_ERR_NONE;
+    m_writeCalls = 0;
+
+    const int blockCount = (m_async) ? RGY_OUTPUT_WRITER_ASYNC_BLOCKS : ((m_blockSize > 0) ? 1 : 0);
+    m_blockBuf.resize(blockCount);
+    m_blocks.resize(blockCount);
+    for (int i = 0; i < blockCount; i++) {
+        m_blockBuf[i].reset((uint8_t *)_aligned_malloc(m_blockSize, 4096));
+        //確保できない場合はブロックサイズを縮小してやり直す
+        if (!m_blockBuf[i]) {
+            if (m_blockSize <= 1024 * 1024) {
+                return RGY_ERR_NULL_PTR;
+            }
+            m_blockSize >>= 1;
+            i = -1;
+        }
+    }
+    for (int i = 0; i < blockCount; i++) {
+        m_blocks[i].ptr = m_blockBuf[i].get();
+        m_blocks[i].size = 0;
+    }
+    if (m_async) {
+        m_qFilled.init(blockCount + 1);
+        m_qFree.init(blockCount + 1);
+        for (auto& block : m_blocks) {
+            m_qFree.push(&block);
+        }
+        m_thread = std::thread(&RGYOutputWriter::writeThreadFunc, this, threadParam);
+    } else if (blockCount > 0) {
+        m_cur = &m_blocks[0];
+    }
+    return RGY_ERR_NONE;
+}
+
+RGY_ERR RGYOutputWriter::writeDirect(const RGYIovec *iov, int count) {
+#if defined(_WIN32) || defined(_WIN64)
+    for (int i = 0; i < count; i++) {
+        const uint8_t *ptr = (const uint8_t *)iov[i].iov_base;
+        size_t remain = iov[i].iov_len;
+        while (remain > 0) {
+            const auto ret = _write(m_fd, ptr, (unsigned int)std::min<size_t>(remain, INT_MAX));
+            m_writeCalls++;
+            if (ret <= 0) {
+                return RGY_ERR_UNDEFINED_BEHAVIOR;
+            }
+            ptr += ret;
+            remain -= ret;
+        }
+    }
+#else
+    RGYIovec vec[RGY_IOV_MAX];
+    int idx = 0;
+    size_t offset = 0; //iov[idx]のうち書き出し済みのバイト数
+    while (idx < count) {
+        const int n = std::min(count - idx, RGY_IOV_MAX);
+        memcpy(vec, iov + idx, sizeof(vec[0]) * n);
+        vec[0].iov_base = (uint8_t *)vec[0].iov_base + offset;
+        vec[0].iov_len -= offset;
+        const auto ret = writev(m_fd, vec, n);
+        m_writeCalls++;
+        if (ret < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return RGY_ERR_UNDEFINED_BEHAVIOR;
+        }
+        //書き出せた分だけ進める (一部しか書き出せないこともある)
+        size_t written = (size_t)ret + offset;
+        const int idxPrev = idx;
+        while (idx < count && written >= iov[idx].iov_len) {
+            written -= iov[idx].iov_len;
+            idx++;
+        }
+        offset = written;
+        if (ret == 0 && idx == idxPrev) {
+            return RGY_ERR_UNDEFINED_BEHAVIOR;
+        }
+    }
+#endif
+    return RGY_ERR_NONE;
+}
+
+RGY_ERR RGYOutputWriter::getFreeBlock() {
+    block_t *block = nullptr;
+    while (!m_qFree.front_copy_and_pop_no_lock(&block)) {
+        if (m_err != RGY_ERR_NONE) {
+            return (RGY_ERR)m_err.load();
+        }
+        m_qFree.wait_for_push();
+    }
+    block->size = 0;
+    m_cur = block;
+    return RGY_ERR_NONE;
+}
+
+RGY_ERR RGYOutputWriter::submitBlock() {
+    if (m_cur == nullptr || m_cur->size == 0) {
+        return RGY_ERR_NONE;
+    }
+    if (m_async) {
+        m_qFilled.push(m_cur);
+        m_cur = nullptr;
+        return RGY_ERR_NONE;
+    }
+    RGYIovec iov;
+    iov.iov_base = m_cur->ptr;
+    iov.iov_len = m_cur->size;
+    m_cur->size = 0;
+    return writeDirect(&iov, 1);
+}
+
+RGY_ERR RGYOutputWriter::write(const RGYIovec *iov, int count) {
+    if (m_fd < 0) {
+        return RGY_ERR_NOT_INITIALIZED;
+    }
+    if (m_err != RGY_ERR_NONE) {
+        return (RGY_ERR)m_err.load();
+    }
+    if (!m_async) {
+        size_t total = 0;
+        for (int i = 0; i < count; i++) {
+            total += iov[i].iov_len;
+        }
+#if defined(_WIN32) || defined(_WIN64)
+        const bool direct = m_cur == nullptr || (total >= RGY_OUTPUT_WRITER_DIRECT_MIN && count == 1);
+#else
+        const bool direct = m_cur == nullptr || total >= RGY_OUTPUT_WRITER_DIRECT_MIN;
+#endif
+        if (direct) {
+            //順序を保つため、溜めていたデータを先に書き出す
+            auto err = submitBlock();
+            if (err != RGY_ERR_NONE) {
+                return err;
+            }
+            return writeDirect(iov, count);
+        }
+    }
+    for (int i = 0; i < count; i++) {
+        const uint8_t *ptr = (const uint8_t *)iov[i].iov_base;
+        size_t remain = iov[i].iov_len;
+        while (remain > 0) {
+            if (m_cur == nullptr) {
+                auto err = getFreeBlock();
+                if (err != RGY_ERR_NONE) {
+                    return err;
+                }
+            }
+            const auto copySize = std::min(remain, m_blockSize - m_cur->size);
+            memcpy(m_cur->ptr + m_cur->size, ptr, copySize);
+            m_cur->size += copySize;
+            ptr += copySize;
+            remain -= copySize;
+            if (m_cur->size == m_blockSize) {
+                auto err = submitBlock();
+                if (err != RGY_ERR_NONE) {
+                    return err;
+                }
+            }
+        }
+    }
+    return RGY_ERR_NONE;
+}
+
+RGY_ERR RGYOutputWriter::write(const void *ptr, size_t size) {
+    RGYIovec iov;
+    iov.iov_base = (void *)ptr;
+    iov.iov_len = size;
+    return write(&iov, 1);
+}
+
+RGY_ERR RGYOutputWriter::flush() {
+    if (m_fd < 0) {
+        return RGY_ERR_NONE;
+    }
+    auto err = submitBlock();
+    if (err != RGY_ERR_NONE) {
+        return err;
+    }
+    if (m_async) {
+        //すべてのブロックが空きに戻るまで待つ
+        while (m_qFree.size() + ((m_cur) ? 1 : 0) < m_blocks.size()) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    }
+    return (RGY_ERR)m_err.load();
+}
+
+RGY_ERR RGYOutputWriter::close() {
+    if (m_fd < 0) {
+        return RGY_ERR_NONE;
+    }
+    auto err = flush();
+    if (m_thread.joinable()) {
+        m_qFilled.push(nullptr);
+        m_thread.join();
+    }
+    m_qFilled.close();
+    m_qFree.close();
+    m_cur = nullptr;
+    m_blocks.clear();
+    m_blockBuf.clear();
+    m_fp = nullptr;
+    m_fd = -1;
+    return err;
+}
+
+void RGYOutputWriter::writeThreadFunc(RGYParamThread threadParam) {
+    threadParam.apply(GetCurrentThread());
+    for (;;) {
+        block_t *block = nullptr;
+        if (!m_qFilled.front_copy_and_pop_no_lock(&block)) {
+            m_qFilled.wait_for_push();
+            continue;
+        }
+        if (block == nullptr) {
+            break;
+        }
+        //エラー後は書き出さずにブロックを返却し、呼び出し元が待ち続けないようにする
+        if (m_err == RGY_ERR_NONE) {
+            RGYIovec iov;
+            iov.iov_base = block->ptr;
+            iov.iov_len = block->size;
+            auto err = writeDirect(&iov, 1);
+            if (err != RGY_ERR_NONE) {
+                m_err = err;
+            }
+        }
+        block->size = 0;
+        m_qFree.push(block);
+    }
+}
@@ -0,0 +1,104 @@
+﻿// -----------------------------------------------------------------------------------------
+// QSVEnc/NVEnc by rigaya
+// -----------------------------------------------------------------------------------------
+// The MIT License
+//
+// Copyright (c) 2011-2016 rigaya
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// --------------------------------------------------------------------------------------------
+
+#pragma once
+#ifndef __RGY_OUTPUT_WRITER_H__
+#define __RGY_OUTPUT_WRITER_H__
+
+#include <cstdio>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <memory>
+#include "rgy_osdep.h"
+#include "rgy_err.h"
+#include "rgy_util.h"
+#include "rgy_queue.h"
+#include "rgy_thread_affinity.h"
+#if !(defined(_WIN32) || defined(_WIN64))
+#include <sys/uio.h>
+#endif
+
+//書き出すデータの断片 (POSIXではwritevにそのまま渡す)
+#if defined(_WIN32) || defined(_WIN64)
+struct RGYIovec {
+    void *iov_base;
+    size_t iov_len;
+};
+#else
+typedef struct iovec RGYIovec;
+#endif
+
+static const size_t RGY_OUTPUT_WRITER_DIRECT_MIN = 256 * 1024; //これ以上の書き込みはステージングせず直接書き出す
+static const int    RGY_OUTPUT_WRITER_ASYNC_BLOCKS = 3;       //非同期モードで確保するブロック数
+
+//ファイルへの書き出しをまとめて行うクラス
+// 同期モード: 小さな書き込みはブロックに溜めて書き出し、大きな書き込みはiovecのままwritevで書き出す
+// 非同期モード: ブロックにコピーして書き出しスレッドに渡し、呼び出し元はディスクへの書き込みを待たない
+class RGYOutputWriter {
+public:
+    RGYOutputWriter();
+    ~RGYOutputWriter();
+
+    //fpのバッファは使用せず、fdに直接書き出す
+    //blockSize = 0 の場合、同期モードではステージングせずそのまま書き出す
+    RGY_ERR init(FILE *fp, size_t blockSize, bool async, const RGYParamThread& threadParam);
+    //iovのデータを順に書き出す (関数から戻った後は、iovの指すメモリを再利用してよい)
+    RGY_ERR write(const RGYIovec *iov, int count);
+    RGY_ERR write(const void *ptr, size_t size);
+    //溜めているデータをすべて書き出し、完了を待つ
+    RGY_ERR flush();
+    //flushして書き出しスレッドを終了する (fpは閉じない)
+    RGY_ERR close();
+
+    bool async() const { return m_async; }
+    uint64_t writeCalls() const { return m_writeCalls.load(); }
+protected:
+    struct block_t {
+        uint8_t *ptr;
+        size_t size;
+    };
+    RGY_ERR writeDirect(const RGYIovec *iov, int count);
+    RGY_ERR submitBlock();
+    RGY_ERR getFreeBlock();
+    void writeThreadFunc(RGYParamThread threadParam);
+
+    FILE *m_fp;
+    int m_fd;
+    size_t m_blockSize;
+    bool m_async;
+    std::vector<std::unique_ptr<uint8_t, aligned_malloc_deleter>> m_blockBuf;
+    std::vector<block_t> m_blocks;
+    block_t *m_cur;                     //書き込み中のブロック
+    RGYQueueSPSC<block_t *> m_qFilled; //書き出し待ちのブロック
+    RGYQueueSPSC<block_t *> m_qFree;   //空きブロック
+    std::thread m_thread;
+    std::atomic<int> m_err;             //書き出しスレッドで発生したエラー
+    std::atomic<uint64_t> m_writeCalls; //write/writevの呼び出し回数
+};
+
+#endif //__RGY_OUTPUT_WRITER_H__
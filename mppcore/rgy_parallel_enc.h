@@ -181,7 +181,7 @@ protected:
     std::thread m_thRunProcess;
     std::optional<RGY_ERR> m_thRunProcessRet;
     unique_event m_processFinished;
-    bool m_thAbort;
+    std::atomic<bool> m_thAbort;
     std::shared_ptr<RGYLog> m_log;
 };
 
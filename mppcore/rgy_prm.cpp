@@ -4374,6 +4374,7 @@ RGYParamCommon::RGYParamCommon() :
     seekRatio(0.0f),
     seekSec(0.0f),               //指定された秒数分先頭を飛ばす
     seekToSec(0.0f),
+    inputIndex(),
     nSubtitleSelectCount(0),
     ppSubtitleSelectList(nullptr),
     subSource(),
@@ -4510,9 +4511,12 @@ RGYParamControl::RGYParamControl() :
     openclTaskThreads(-1), // 自動選択
     clPerfDumpDir(),
     clPerfTimelineSec(0.0),
+    pipelineTraceSec(0.0),
     clPerfDisasmTool(),
     clPerfOclocPath(),
     clPerfRgaPath(),
+    clCacheDir(),
+    clCacheSizeMB(RGY_CL_CACHE_SIZE_MB_DEFAULT),
     avoidIdleClock(),
     processMonitorDevUsage(false),
     processMonitorDevUsageReset(false),
@@ -4213,6 +4213,7 @@ struct RGYParamCommon {
     float seekRatio;               //指定された秒数分先頭を飛ばす
     float seekSec;               //指定された秒数分先頭を飛ばす
     float seekToSec;
+    RGYDebugLogFile inputIndex;  //フレームインデックスファイル
     int nSubtitleSelectCount;
     SubtitleSelect **ppSubtitleSelectList;
     std::vector<SubSource> subSource;
@@ -4380,9 +4381,12 @@ struct RGYParamControl {
     int openclTaskThreads;
     tstring clPerfDumpDir;          // --cl-perf-dump <dir>: OpenCL kernel perf dump 先ディレクトリ (空=無効)
     double  clPerfTimelineSec;      // --cl-perf-timeline [=<sec>]: timeline 収集の時間窓 (秒)。0 = 無効、負値 = 無制限
+    double  pipelineTraceSec;       // --pipeline-trace [=<sec>]: パイプライン各段の trace 収集の時間窓 (秒)。0 = 無効、負値 = 無制限
     tstring clPerfDisasmTool;       // --cl-perf-disasm-tool <auto|ocloc|rga|none>
     tstring clPerfOclocPath;        // --ocloc-path <path>: cl_perf aggregate に渡す ocloc 実行ファイルパス
     tstring clPerfRgaPath;          // --rga-path <path>: cl_perf aggregate に渡す RGA 実行ファイルパス
+    tstring clCacheDir;             // --cl-cache-dir <dir>: OpenCL プログラムバイナリのキャッシュ先ディレクトリ (空=無効)
+    int     clCacheSizeMB;          // --cl-cache-size <int>: キャッシュの合計サイズの上限 (MB, 0 = 無制限)
     RGYParamAvoidIdleClock avoidIdleClock;
     bool processMonitorDevUsage;
     bool processMonitorDevUsageReset;
@@ -4411,6 +4415,8 @@ const FEATURE_DESC list_simd[] = {
     { _T("sse41"),    (uint64_t)(RGY_SIMD::SSE41| RGY_SIMD::SSSE3| RGY_SIMD::SSE3| RGY_SIMD::SSE2) },
     { _T("avx"),      (uint64_t)(RGY_SIMD::AVX  | RGY_SIMD::SSE42| RGY_SIMD::SSE41| RGY_SIMD::SSSE3| RGY_SIMD::SSE3| RGY_SIMD::SSE2) },
     { _T("avx2"),     (uint64_t)(RGY_SIMD::AVX2 | RGY_SIMD::AVX| RGY_SIMD::SSE42| RGY_SIMD::SSE41| RGY_SIMD::SSSE3| RGY_SIMD::SSE3| RGY_SIMD::SSE2) },
+    { _T("vec128"),   (uint64_t)RGY_SIMD::VEC128 },
+    { _T("neon"),     (uint64_t)(RGY_SIMD::NEON | RGY_SIMD::VEC128) },
     { nullptr,        (uint64_t)RGY_SIMD::NONE }
 };
 
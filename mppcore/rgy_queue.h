@@ -372,6 +372,285 @@ protected:
     alignas(64) std::atomic<bool> m_bUsingData; //キューから読み出し中のスレッドの数
     alignas(64) std::atomic<bool> m_bPush; //push用のロックの数
 };
+
+//固定長のリングバッファによるロックフリーのキュー
+//取り出しは単一のスレッドからのみ、押し込みはmultiProducer=trueなら複数のスレッドから可能
+//RGYQueueMPMPのうち、スレッド間のパケットの受け渡しに必要なインターフェースを同じ名前で提供する
+//各要素のシーケンス番号で格納済みか空きかを判定するので、ロックは不要 (D. Vyukovのbounded queue)
+//キューが満杯・空の場合の待機はfutexで行い、待機中のスレッドがいなければ通知も行わない
+template<typename Type, bool multiProducer>
+class RGYQueueRing {
+    static const int QUEUE_RING_YIELD_COUNT = 16; //futexで待機する前にyieldして確認する回数
+    struct alignas(64) queueSlot {
+        std::atomic<size_t> seq; //pos+1なら格納済み、posなら空き (posはこの要素に対応する通し番号)
+        union {
+            Type data;
+        };
+        queueSlot() : seq(0) {};
+        ~queueSlot() {};
+    };
+public:
+    RGYQueueRing() :
+        m_pBuf(),
+        m_nMask(0),
+        m_nMaxCapacity(0),
+        m_nKeepLength(0),
+        m_nHead(0),
+        m_nPopSeq(0),
+        m_nTail(0),
+        m_nPushSeq(0),
+        m_bPushWaiting(0),
+        m_bPopWaiting(0) {
+    }
+    ~RGYQueueRing() {
+        close();
+    }
+    //キューを初期化する
+    //内部のリングバッファはbufSizeとmaxCapacityのうち大きいほうを2の累乗に切り上げた長さとなる
+    //maxCapacityはキューに格納できる最大のデータ数 (リングバッファの長さが上限)
+    void init(size_t bufSize = 1024, size_t maxCapacity = SIZE_MAX) {
+        close();
+        const size_t required = (std::max)(bufSize, (maxCapacity == SIZE_MAX) ? 0 : maxCapacity);
+        size_t ringSize = 2;
+        while (ringSize < required && ringSize < (SIZE_MAX >> 2)) {
+            ringSize <<= 1;
+        }
+        m_pBuf.reset(new queueSlot[ringSize]);
+        for (size_t i = 0; i < ringSize; i++) {
+            m_pBuf[i].seq.store(i, std::memory_order_relaxed);
+        }
+        m_nMask = ringSize - 1;
+        m_nMaxCapacity = (std::min)(maxCapacity, ringSize);
+        m_nKeepLength = 0;
+        m_nHead = 0;
+        m_nTail = 0;
+    }
+    //キューのデータをクリアする
+    // !! push側のスレッドが動作していないときのみ有効 !!
+    void clear() {
+        if (!m_pBuf) {
+            return;
+        }
+        for (size_t i = 0; i <= m_nMask; i++) {
+            m_pBuf[i].seq.store(i, std::memory_order_relaxed);
+        }
+        m_nHead = 0;
+        m_nTail = 0;
+        wake(m_nPopSeq, m_bPopWaiting);
+    }
+    //キューのデータをクリアする際に、指定した関数で内部データを開放してから、データをクリアする
+    template<typename Func>
+    void clear(Func deleter) {
+        if (!m_pBuf) {
+            return;
+        }
+        const size_t tail = m_nTail.load(std::memory_order_acquire);
+        for (size_t pos = m_nHead.load(std::memory_order_relaxed); pos != tail; pos++) {
+            auto slot = &m_pBuf[pos & m_nMask];
+            if (slot->seq.load(std::memory_order_acquire) == pos + 1) {
+                deleter(&slot->data);
+            }
+        }
+        clear();
+    }
+    //キューのデータをクリアし、リソースを破棄する
+    void close() {
+        m_pBuf.reset();
+        m_nMask = 0;
+        m_nMaxCapacity = 0;
+        m_nHead = 0;
+        m_nTail = 0;
+    }
+    //キューのデータをクリアする際に、指定した関数で内部データを開放してから、リソースを破棄する
+    template<typename Func>
+    void close(Func deleter) {
+        clear(deleter);
+        close();
+    }
+    //キューが一定の長さに達しないとfront_copy/popできないように設定する
+    void set_keep_length(size_t keepLength) {
+        m_nKeepLength = keepLength;
+    }
+    size_t get_keep_length() {
+        return m_nKeepLength;
+    }
+    //データをキューにコピーし押し込む
+    //キューに空きがない場合は何もせずfalseを返す
+    bool try_push(const Type& in) {
+        queueSlot *slot = nullptr;
+        size_t pos = m_nTail.load(std::memory_order_relaxed);
+        for (;;) {
+            //posが古い場合は負になりうるので、符号付きで比較する
+            if ((int64_t)(pos - m_nHead.load(std::memory_order_acquire)) >= (int64_t)m_nMaxCapacity.load(std::memory_order_relaxed)) {
+                return false;
+            }
+            slot = &m_pBuf[pos & m_nMask];
+            const auto diff = (int64_t)(slot->seq.load(std::memory_order_acquire) - pos);
+            if (diff == 0) {
+                if (!multiProducer) {
+                    m_nTail.store(pos + 1, std::memory_order_relaxed);
+                    break;
+                }
+                if (m_nTail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            } else if (diff < 0) {
+                return false; //取り出し側がまだ読み出していない
+            } else {
+                pos = m_nTail.load(std::memory_order_relaxed); //他のスレッドが先に確保した
+            }
+        }
+        slot->data = in;
+        slot->seq.store(pos + 1, std::memory_order_release);
+        wake(m_nPushSeq, m_bPushWaiting);
+        return true;
+    }
+    //データをキューにコピーし押し込む
+    //キューのデータ量があらかじめ設定した上限に達した場合は、キューに空きができるまで待機する
+    bool push(const Type& in) {
+        if (!m_pBuf) {
+            return false;
+        }
+        for (int i = 0;; i++) {
+            const uint32_t popSeq = m_nPopSeq.load(std::memory_order_seq_cst);
+            if (try_push(in)) {
+                return true;
+            }
+            //すぐに空きができることが多いので、少しの間はyieldしながら確認する
+            if (i < QUEUE_RING_YIELD_COUNT) {
+                rgy_yield();
+                continue;
+            }
+            //popSeqの読み込み後に取り出しがあれば、futexはすぐに戻る
+            m_bPopWaiting.store(1, std::memory_order_seq_cst);
+            rgy_wait_on_address(&m_nPopSeq, popSeq, 16);
+        }
+    }
+    //キューのsizeを取得する (押し込み中のデータを含む場合がある)
+    size_t size() const {
+        const size_t head = m_nHead.load(std::memory_order_acquire);
+        return m_nTail.load(std::memory_order_acquire) - head;
+    }
+    //キューが空ならtrueを返す
+    bool empty() const {
+        return size() == 0;
+    }
+    //キューの最大サイズを取得する
+    size_t capacity() const {
+        return m_nMaxCapacity.load(std::memory_order_relaxed);
+    }
+    //キューの最大サイズを設定する (リングバッファの長さが上限)
+    void set_capacity(size_t capacity) {
+        m_nMaxCapacity = (m_pBuf) ? (std::min)(capacity, m_nMask + 1) : 0;
+        //空きができたので、待機中の押し込み側を起こす
+        wake(m_nPopSeq, m_bPopWaiting);
+    }
+    //キューの先頭のデータをoutにコピーする
+    //キューが空ならなにもせずfalseを返す
+    // !! 取り出し側のスレッドからのみ有効 !!
+    bool front_copy_no_lock(Type *out, size_t *pnSize = nullptr) {
+        queueSlot *slot = nullptr;
+        const size_t nSize = front(&slot);
+        if (slot) {
+            *out = slot->data;
+        }
+        if (pnSize) {
+            *pnSize = nSize;
+        }
+        return slot != nullptr;
+    }
+    //キューの先頭のデータを取り出しながら(outにコピーする)、キューから取り除く
+    //キューが空ならなにもせずfalseを返す
+    // !! 取り出し側のスレッドからのみ有効 !!
+    bool front_copy_and_pop_no_lock(Type *out, size_t *pnSize = nullptr) {
+        queueSlot *slot = nullptr;
+        const size_t nSize = front(&slot);
+        if (slot) {
+            *out = slot->data;
+            release(slot);
+        }
+        if (pnSize) {
+            *pnSize = nSize;
+        }
+        return slot != nullptr;
+    }
+    //キューの先頭のデータを取り除く
+    //キューが空ならfalseを返す
+    // !! 取り出し側のスレッドからのみ有効 !!
+    bool pop() {
+        queueSlot *slot = nullptr;
+        front(&slot);
+        if (slot) {
+            release(slot);
+        }
+        return slot != nullptr;
+    }
+    //要素が追加されるまで待機する
+    void wait_for_push(uint32_t millisec = 16) {
+        uint32_t pushSeq = 0;
+        for (int i = 0; i <= QUEUE_RING_YIELD_COUNT; i++) {
+            pushSeq = m_nPushSeq.load(std::memory_order_seq_cst);
+            if (size() > m_nKeepLength) {
+                return;
+            }
+            if (i < QUEUE_RING_YIELD_COUNT) {
+                rgy_yield();
+            }
+        }
+        m_bPushWaiting.store(1, std::memory_order_seq_cst);
+        rgy_wait_on_address(&m_nPushSeq, pushSeq, millisec);
+    }
+protected:
+    //先頭の要素が格納済みならslotに設定し、キューのサイズを返す
+    size_t front(queueSlot **slot) const {
+        *slot = nullptr;
+        if (!m_pBuf) {
+            return 0;
+        }
+        const size_t pos = m_nHead.load(std::memory_order_relaxed);
+        const size_t nSize = m_nTail.load(std::memory_order_acquire) - pos;
+        if (nSize > m_nKeepLength) {
+            auto ptr = &m_pBuf[pos & m_nMask];
+            if (ptr->seq.load(std::memory_order_acquire) == pos + 1) {
+                *slot = ptr;
+            }
+        }
+        return nSize;
+    }
+    //先頭の要素を空きとして押し込み側に返す
+    void release(queueSlot *slot) {
+        const size_t pos = m_nHead.load(std::memory_order_relaxed);
+        slot->seq.store(pos + m_nMask + 1, std::memory_order_release);
+        m_nHead.store(pos + 1, std::memory_order_release);
+        wake(m_nPopSeq, m_bPopWaiting);
+    }
+    //シーケンスを進め、待機中のスレッドがいれば起こす
+    //起こす際にフラグを下ろすので、待機側が再度待機するまでは通知のシステムコールは行わない
+    static void wake(std::atomic<uint32_t>& seq, std::atomic<uint32_t>& waiting) {
+        seq.fetch_add(1, std::memory_order_seq_cst);
+        if (waiting.load(std::memory_order_seq_cst) && waiting.exchange(0, std::memory_order_seq_cst)) {
+            rgy_wake_by_address_all(&seq);
+        }
+    }
+
+    std::unique_ptr<queueSlot[]> m_pBuf; //リングバッファ
+    size_t m_nMask; //リングバッファの長さ - 1
+    std::atomic<size_t> m_nMaxCapacity; //キューに詰められる有効なデータの最大数
+    size_t m_nKeepLength; //ある一定の長さを常にキュー内に保持するようにする
+    alignas(64) std::atomic<size_t> m_nHead; //次に取り出す要素の通し番号 (取り出し側が更新)
+                std::atomic<uint32_t> m_nPopSeq; //取り出しのたびに更新 (押し込み側の待機用)
+    alignas(64) std::atomic<size_t> m_nTail; //次に押し込む要素の通し番号 (押し込み側が更新)
+                std::atomic<uint32_t> m_nPushSeq; //押し込みのたびに更新 (取り出し側の待機用)
+    alignas(64) std::atomic<uint32_t> m_bPushWaiting; //m_nPushSeqで待機中のスレッドがいれば1
+                std::atomic<uint32_t> m_bPopWaiting; //m_nPopSeqで待機中のスレッドがいれば1
+};
+
+//単一の押し込みスレッドと単一の取り出しスレッドの間のキュー
+template<typename Type>
+using RGYQueueSPSC = RGYQueueRing<Type, false>;
+//複数の押し込みスレッドと単一の取り出しスレッドの間のキュー
+template<typename Type>
+using RGYQueueMPSC = RGYQueueRing<Type, true>;
 #pragma warning (pop)
 
 class RGYQueueBuffer {
@@ -37,6 +37,10 @@
 using SMHandle = HANDLE;
 #else
 #include <sys/shm.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
 using SMHandle = key_t;
 #endif
 
@@ -138,22 +142,28 @@ public:
 };
 #else
 class RGYSharedMemLinux : public RGYSharedMem {
+protected:
+    int memfd; // openNamed()で開いたfd (mmapでマッピング)
+    std::string unlinkPath; // openNamed()で作成した場合、close時に削除するパス
 public:
     RGYSharedMemLinux() {
         shared_size = 0;
         handle = -1;
         buffer = nullptr;
+        memfd = -1;
     };
     RGYSharedMemLinux(const char *pipename, uint64_t size) : RGYSharedMem() {
         shared_size = 0;
         handle = -1;
         buffer = nullptr;
+        memfd = -1;
         open(pipename, size);
     };
     RGYSharedMemLinux(const int id, uint64_t size) : RGYSharedMem() {
         shared_size = 0;
         handle = -1;
         buffer = nullptr;
+        memfd = -1;
         open(id, size);
     };
     virtual ~RGYSharedMemLinux() {
@@ -199,24 +209,81 @@ public:
         shared_size = size;
         return 0;
     }
+    // 別プロセスから名前で参照できる共有メモリを作成/オープンする (shm_openと同様に/dev/shm上に置く)
+    // create=falseの場合は既存のものを開き、size=0なら既存のサイズでマッピングする
+    int openNamed(const char *name, uint64_t size, bool create) {
+        close();
+        const std::string path = std::string("/dev/shm/") + ((name[0] == '/') ? name + 1 : name);
+        const int fd = ::open(path.c_str(), (create) ? (O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC) : (O_RDWR | O_CLOEXEC), S_IRUSR | S_IWUSR);
+        if (fd < 0) {
+            return 1;
+        }
+        if (create) {
+            if (ftruncate(fd, (off_t)size) != 0) {
+                ::close(fd);
+                unlink(path.c_str());
+                return 1;
+            }
+        } else if (size == 0) {
+            struct stat st;
+            if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+                ::close(fd);
+                return 1;
+            }
+            size = (uint64_t)st.st_size;
+        }
+        void *ptr = mmap(nullptr, (size_t)size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (ptr == MAP_FAILED) {
+            ::close(fd);
+            if (create) {
+                unlink(path.c_str());
+            }
+            return 1;
+        }
+        memfd = fd;
+        buffer = ptr;
+        shared_size = size;
+        mem_name = name;
+        if (create) {
+            unlinkPath = path;
+        }
+        return 0;
+    }
     void detach() override {
         if (buffer != nullptr) {
-            shmdt(buffer);
-            buffer = nullptr;
+            unmap();
         }
         handle = -1;
+        unlinkPath.clear();
         shared_size = 0;
     }
     void close() override {
         if (buffer != nullptr) {
-            shmdt(buffer);
-            buffer = nullptr;
+            unmap();
         }
         if (handle != -1) {
             shmctl(handle, IPC_RMID, 0);
             handle = -1;
         }
+        if (unlinkPath.length() > 0) {
+            unlink(unlinkPath.c_str());
+            unlinkPath.clear();
+        }
         shared_size = 0;
+        mem_name.clear();
+    }
+protected:
+    void unmap() {
+        if (mem_name.length() > 0) { // openNamed()でmmapしたもの
+            munmap(buffer, (size_t)shared_size);
+            if (memfd >= 0) {
+                ::close(memfd);
+                memfd = -1;
+            }
+        } else {
+            shmdt(buffer);
+        }
+        buffer = nullptr;
     }
 };
 #endif //#if defined(_WIN32) || defined(_WIN64)
@@ -40,7 +40,7 @@ RGY_SIMD get_availableSIMD() {
     int CPUInfo[4];
     __cpuid(CPUInfo, 1);
     RGY_SIMD simd = RGY_SIMD::NONE;
-    if (CPUInfo[3] & 0x04000000) simd |= RGY_SIMD::SSE2;
+    if (CPUInfo[3] & 0x04000000) simd |= RGY_SIMD::SSE2 | RGY_SIMD::VEC128;
     if (CPUInfo[2] & 0x00000001) simd |= RGY_SIMD::SSE3;
     if (CPUInfo[2] & 0x00000200) simd |= RGY_SIMD::SSSE3;
     if (CPUInfo[2] & 0x00080000) simd |= RGY_SIMD::SSE41;
@@ -83,6 +83,11 @@ RGY_SIMD get_availableSIMD() {
 }
 #else
 RGY_SIMD get_availableSIMD() {
-    return RGY_SIMD::NONE;
+    // aarch64ではASIMD(NEON)は必須の拡張
+#if defined(__aarch64__)
+    return RGY_SIMD::NEON | RGY_SIMD::VEC128;
+#else
+    return RGY_SIMD::VEC128;
+#endif
 }
 #endif
@@ -0,0 +1,145 @@
+﻿// -----------------------------------------------------------------------------------------
+// QSVEnc/NVEnc by rigaya
+// -----------------------------------------------------------------------------------------
+// The MIT License
+//
+// Copyright (c) 2011-2016 rigaya
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// ------------------------------------------------------------------------------------------
+
+#pragma once
+#ifndef __RGY_SIMD_VEC_H__
+#define __RGY_SIMD_VEC_H__
+
+#include <cstdint>
+#include <cstring>
+
+// GCC/clangのvector拡張による128bit幅のポータブルなSIMD
+// 演算はコンパイラがx86ではSSE2、aarch64ではNEON(ASIMD)の命令に変換する
+// 飽和演算・幅の変換・インターリーブなど、vector拡張では効率が悪いものはNEONの命令を直接使う
+#if (defined(__GNUC__) || defined(__clang__)) && !defined(__CUDACC__)
+#define ENABLE_RGY_SIMD_VEC 1
+#else
+#define ENABLE_RGY_SIMD_VEC 0
+#endif
+
+#if ENABLE_RGY_SIMD_VEC
+
+#if defined(__aarch64__) && (defined(__ARM_NEON) || defined(__ARM_NEON__))
+#include <arm_neon.h>
+#define RGY_SIMD_VEC_NEON 1
+#else
+#define RGY_SIMD_VEC_NEON 0
+#endif
+
+typedef uint8_t  rgy_u8x8  __attribute__((vector_size(8)));
+typedef uint8_t  rgy_u8x16 __attribute__((vector_size(16)));
+typedef uint16_t rgy_u16x8 __attribute__((vector_size(16)));
+typedef uint32_t rgy_u32x4 __attribute__((vector_size(16)));
+
+// アラインされていないアドレスからの読み込み・書き込み
+template<typename T>
+static inline T rgy_vec_load(const void *ptr) {
+    T v;
+    memcpy(&v, ptr, sizeof(v));
+    return v;
+}
+
+template<typename T>
+static inline void rgy_vec_store(void *ptr, const T& v) {
+    memcpy(ptr, &v, sizeof(v));
+}
+
+static inline rgy_u16x8 rgy_vec_set1_u16(uint16_t x) {
+    return rgy_u16x8{ x, x, x, x, x, x, x, x };
+}
+
+// u8x8 -> u16x8 (ゼロ拡張)
+static inline rgy_u16x8 rgy_vec_widen_u8(const rgy_u8x8& v) {
+#if RGY_SIMD_VEC_NEON
+    return (rgy_u16x8)vmovl_u8((uint8x8_t)v);
+#else
+    return __builtin_convertvector(v, rgy_u16x8);
+#endif
+}
+
+// u16x8 -> u8x8 (255で飽和)
+static inline rgy_u8x8 rgy_vec_narrow_sat_u16(const rgy_u16x8& v) {
+#if RGY_SIMD_VEC_NEON
+    return (rgy_u8x8)vqmovn_u16((uint16x8_t)v);
+#else
+    const rgy_u16x8 max = rgy_vec_set1_u16(255);
+    const rgy_u16x8 mask = (rgy_u16x8)(v > max);
+    return __builtin_convertvector((v & ~mask) | (max & mask), rgy_u8x8);
+#endif
+}
+
+// u16の飽和加算
+static inline rgy_u16x8 rgy_vec_adds_u16(const rgy_u16x8& a, const rgy_u16x8& b) {
+#if RGY_SIMD_VEC_NEON
+    return (rgy_u16x8)vqaddq_u16((uint16x8_t)a, (uint16x8_t)b);
+#else
+    const rgy_u16x8 sum = a + b;
+    return sum | (rgy_u16x8)(sum < a);
+#endif
+}
+
+// u16の最小値
+static inline rgy_u16x8 rgy_vec_min_u16(const rgy_u16x8& a, const rgy_u16x8& b) {
+#if RGY_SIMD_VEC_NEON
+    return (rgy_u16x8)vminq_u16((uint16x8_t)a, (uint16x8_t)b);
+#else
+    const rgy_u16x8 mask = (rgy_u16x8)(a > b);
+    return (a & ~mask) | (b & mask);
+#endif
+}
+
+// u16x8のインターリーブ (lo = a0,b0,a1,b1,..., a3,b3 / hi = a4,b4,...,a7,b7)
+static inline void rgy_vec_zip_u16(rgy_u16x8& lo, rgy_u16x8& hi, const rgy_u16x8& a, const rgy_u16x8& b) {
+#if RGY_SIMD_VEC_NEON
+    lo = (rgy_u16x8)vzip1q_u16((uint16x8_t)a, (uint16x8_t)b);
+    hi = (rgy_u16x8)vzip2q_u16((uint16x8_t)a, (uint16x8_t)b);
+#elif defined(__clang__) || (defined(__GNUC__) && __GNUC__ >= 12)
+    lo = __builtin_shufflevector(a, b, 0, 8, 1, 9, 2, 10, 3, 11);
+    hi = __builtin_shufflevector(a, b, 4, 12, 5, 13, 6, 14, 7, 15);
+#else
+    lo = __builtin_shuffle(a, b, rgy_u16x8{ 0, 8, 1, 9, 2, 10, 3, 11 });
+    hi = __builtin_shuffle(a, b, rgy_u16x8{ 4, 12, 5, 13, 6, 14, 7, 15 });
+#endif
+}
+
+// u16x8の偶数番目・奇数番目の要素への分離 (ab = a0,b0,a1,b1,... の2本から)
+static inline void rgy_vec_unzip_u16(rgy_u16x8& even, rgy_u16x8& odd, const rgy_u16x8& ab0, const rgy_u16x8& ab1) {
+#if RGY_SIMD_VEC_NEON
+    even = (rgy_u16x8)vuzp1q_u16((uint16x8_t)ab0, (uint16x8_t)ab1);
+    odd  = (rgy_u16x8)vuzp2q_u16((uint16x8_t)ab0, (uint16x8_t)ab1);
+#elif defined(__clang__) || (defined(__GNUC__) && __GNUC__ >= 12)
+    even = __builtin_shufflevector(ab0, ab1, 0, 2, 4, 6, 8, 10, 12, 14);
+    odd  = __builtin_shufflevector(ab0, ab1, 1, 3, 5, 7, 9, 11, 13, 15);
+#else
+    even = __builtin_shuffle(ab0, ab1, rgy_u16x8{ 0, 2, 4, 6, 8, 10, 12, 14 });
+    odd  = __builtin_shuffle(ab0, ab1, rgy_u16x8{ 1, 3, 5, 7, 9, 11, 13, 15 });
+#endif
+}
+
+#endif //#if ENABLE_RGY_SIMD_VEC
+
+#endif //__RGY_SIMD_VEC_H__
@@ -0,0 +1,141 @@
+﻿// -----------------------------------------------------------------------------------------
+// QSVEnc/NVEnc by rigaya
+// -----------------------------------------------------------------------------------------
+// The MIT License
+//
+// Copyright (c) 2011-2016 rigaya
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// ------------------------------------------------------------------------------------------
+
+#include <algorithm>
+#include "rgy_smartcut.h"
+#include "rgy_prm.h"
+
+#if ENABLE_AVSW_READER
+
+RGYSmartCut::RGYSmartCut(const sTrimParam& trim, RGY_CODEC codec, int videoDelay) :
+    m_trimList(trim.list),
+    m_codec(codec),
+    m_videoDelay(videoDelay),
+    m_parseNalH264(get_parse_nal_unit_h264_func()),
+    m_parseNalHevc(get_parse_nal_unit_hevc_func()),
+    m_mtx(),
+    m_copyGops(),
+    m_copiedRanges(),
+    m_decodeFramesInTrim(0),
+    m_copiedFrames(0) {
+}
+
+RGYSmartCut::~RGYSmartCut() {
+    m_copyGops.clear();
+}
+
+bool RGYSmartCut::isIDR(const uint8_t *data, size_t size) const {
+    if (data == nullptr || size == 0) {
+        return false;
+    }
+    if (m_codec == RGY_CODEC_H264) {
+        const auto nal_list = m_parseNalH264(data, size);
+        return std::any_of(nal_list.begin(), nal_list.end(), [](const nal_info& info) { return info.type == NALU_H264_IDR; });
+    } else if (m_codec == RGY_CODEC_HEVC) {
+        const auto nal_list = m_parseNalHevc(data, size);
+        return std::any_of(nal_list.begin(), nal_list.end(), [](const nal_info& info) {
+            return info.type == NALU_HEVC_SLICE_IDR_W_RADL || info.type == NALU_HEVC_SLICE_IDR_N_LP;
+        });
+    }
+    return false;
+}
+
+bool RGYSmartCut::insideOneTrimRange(int frameStart, int frames) const {
+    if (frames <= 0) {
+        return false;
+    }
+    const auto first = frame_inside_range(frameStart, m_trimList);
+    const auto last  = frame_inside_range(frameStart + frames - 1, m_trimList);
+    return first.first && last.first && first.second == last.second;
+}
+
+void RGYSmartCut::addDecodeFrame(int frameIdx) {
+    if (frame_inside_range(frameIdx, m_trimList).first) {
+        std::lock_guard<std::mutex> lock(m_mtx);
+        m_decodeFramesInTrim++;
+    }
+}
+
+void RGYSmartCut::addCopyGop(std::unique_ptr<RGYSmartCutGop> gop) {
+    std::lock_guard<std::mutex> lock(m_mtx);
+    gop->encodeFramesBefore = m_decodeFramesInTrim;
+    m_copiedRanges.push_back(std::make_pair(gop->frameStart, gop->frames));
+    m_copiedFrames += gop->frames;
+    m_copyGops.push_back(std::move(gop));
+}
+
+std::unique_ptr<RGYSmartCutGop> RGYSmartCut::popCopyGop(int encodedFrames, int64_t nextFrameId, bool flush) {
+    std::lock_guard<std::mutex> lock(m_mtx);
+    if (m_copyGops.empty()) {
+        return nullptr;
+    }
+    const auto& gop = m_copyGops.front();
+    //このGOPより前にエンコードされるフレームがすべて出力済みか、
+    //次に出力するフレームがこのGOPより後なら出力してよい
+    if (flush
+        || encodedFrames >= gop->encodeFramesBefore
+        || (nextFrameId >= 0 && gop->frameStart < nextFrameId)) {
+        auto ret = std::move(m_copyGops.front());
+        m_copyGops.pop_front();
+        return ret;
+    }
+    return nullptr;
+}
+
+bool RGYSmartCut::copiedBetween(int64_t prevFrameId, int64_t frameId) const {
+    std::lock_guard<std::mutex> lock(m_mtx);
+    return std::any_of(m_copiedRanges.begin(), m_copiedRanges.end(), [prevFrameId, frameId](const std::pair<int, int>& range) {
+        return prevFrameId < range.first && range.first < frameId;
+    });
+}
+
+int64_t RGYSmartCut::outputFrameIndex(int64_t frameId) const {
+    if (m_trimList.size() == 0) {
+        return frameId;
+    }
+    int64_t idx = 0;
+    for (const auto& trim : m_trimList) {
+        if (frameId <= trim.start) {
+            break;
+        }
+        const int64_t fin = (trim.fin == TRIM_MAX) ? frameId : std::min<int64_t>(frameId, (int64_t)trim.fin + 1);
+        idx += fin - trim.start;
+    }
+    return idx;
+}
+
+int RGYSmartCut::copiedGops() const {
+    std::lock_guard<std::mutex> lock(m_mtx);
+    return (int)m_copiedRanges.size();
+}
+
+int RGYSmartCut::copiedFrames() const {
+    std::lock_guard<std::mutex> lock(m_mtx);
+    return m_copiedFrames;
+}
+
+#endif //#if ENABLE_AVSW_READER
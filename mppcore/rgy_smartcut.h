@@ -0,0 +1,105 @@
+﻿// -----------------------------------------------------------------------------------------
+// QSVEnc/NVEnc by rigaya
+// -----------------------------------------------------------------------------------------
+// The MIT License
+//
+// Copyright (c) 2011-2016 rigaya
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// ------------------------------------------------------------------------------------------
+
+#pragma once
+#ifndef __RGY_SMARTCUT_H__
+#define __RGY_SMARTCUT_H__
+
+#include "rgy_version.h"
+
+#if ENABLE_AVSW_READER
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <cstdint>
+#include "rgy_avutil.h"
+#include "rgy_def.h"
+#include "rgy_bitstream.h"
+
+//--trim-smartで再エンコードせずにそのまま出力するGOP
+struct RGYSmartCutGop {
+    int frameStart;          //GOPの先頭のフレーム番号 (表示順)
+    int frames;              //GOPのフレーム数
+    int encodeFramesBefore;  //このGOPより前にエンコードされるフレーム数 (出力の順序付けに使用)
+    std::vector<std::unique_ptr<AVPacket, RGYAVDeleter<AVPacket>>> pkts; //デコード順のパケット
+    std::vector<int> pktFrameIdx; //各パケットのフレーム番号 (表示順)
+
+    RGYSmartCutGop() : frameStart(0), frames(0), encodeFramesBefore(0), pkts(), pktFrameIdx() {};
+};
+
+//--trim-smart: trimの範囲に完全に含まれるGOPはコピーし、カット点の前後のみ再エンコードする
+//GOPの振り分けはリーダー(RGYInputAvcodec)が行い、エンコーダのタスクがエンコード結果とコピーするGOPを表示順に並べて出力する
+//リーダーとエンコーダは別スレッドで動作するので、mutexで保護する
+class RGYSmartCut {
+public:
+    RGYSmartCut(const sTrimParam& trim, RGY_CODEC codec, int videoDelay);
+    ~RGYSmartCut();
+
+    RGY_CODEC codec() const { return m_codec; }
+    //出力のdts計算に使用する遅延フレーム数
+    int videoDelay() const { return m_videoDelay; }
+
+    //パケットにIDRのスライスが含まれるか
+    bool isIDR(const uint8_t *data, size_t size) const;
+    //[frameStart, frameStart + frames) がtrimのひとつの範囲に収まっているか
+    bool insideOneTrimRange(int frameStart, int frames) const;
+
+    //デコードに回したフレームを記録する (リーダー側)
+    void addDecodeFrame(int frameIdx);
+    //コピーするGOPを追加する (リーダー側)
+    void addCopyGop(std::unique_ptr<RGYSmartCutGop> gop);
+
+    //出力可能なコピーするGOPを取り出す (エンコーダ側)、なければnullptr
+    //encodedFrames: これまでにエンコーダから出力したフレーム数
+    //nextFrameId: 次に出力するエンコード済みフレームのフレーム番号 (わからなければ-1)
+    //flush: 残っているものをすべて取り出す
+    std::unique_ptr<RGYSmartCutGop> popCopyGop(int encodedFrames, int64_t nextFrameId, bool flush);
+    //prevFrameIdとframeIdの間のフレームをコピーしたか (カット点直後のIDR挿入の判定用)
+    bool copiedBetween(int64_t prevFrameId, int64_t frameId) const;
+
+    //trimで除かれたフレームを詰めたときの出力でのフレーム位置
+    int64_t outputFrameIndex(int64_t frameId) const;
+
+    int copiedGops() const;
+    int copiedFrames() const;
+protected:
+    std::vector<sTrim> m_trimList;
+    RGY_CODEC m_codec;
+    int m_videoDelay;
+    decltype(parse_nal_unit_h264_c) *m_parseNalH264;
+    decltype(parse_nal_unit_hevc_c) *m_parseNalHevc;
+    mutable std::mutex m_mtx;
+    std::deque<std::unique_ptr<RGYSmartCutGop>> m_copyGops; //出力待ちのコピーするGOP
+    std::vector<std::pair<int, int>> m_copiedRanges; //コピーしたGOPの範囲 (先頭のフレーム番号, フレーム数)
+    int m_decodeFramesInTrim; //デコードに回したフレームのうち、trimの範囲内のもの
+    int m_copiedFrames;
+};
+
+#endif //#if ENABLE_AVSW_READER
+
+#endif //__RGY_SMARTCUT_H__
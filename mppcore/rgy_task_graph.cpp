@@ -0,0 +1,186 @@
+﻿// -----------------------------------------------------------------------------------------
+// QSVEnc/NVEnc by rigaya
+// -----------------------------------------------------------------------------------------
+// The MIT License
+//
+// Copyright (c) 2011-2016 rigaya
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// --------------------------------------------------------------------------------------------
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include "rgy_task_graph.h"
+#include "rgy_util.h"
+
+RGYTaskGraph::RGYTaskGraph(const tstring& name, std::shared_ptr<RGYLog> log, const RGYLogType logType) :
+    m_name(name),
+    m_log(log),
+    m_logType(logType),
+    m_tasks() {
+}
+
+RGYTaskGraph::~RGYTaskGraph() {
+}
+
+void RGYTaskGraph::AddMessage(RGYLogLevel log_level, const TCHAR *format, ...) {
+    if (m_log == nullptr || log_level < m_log->getLogLevel(m_logType)) {
+        return;
+    }
+    va_list args;
+    va_start(args, format);
+    int len = _vsctprintf(format, args) + 1; // _vscprintf doesn't count terminating '\0'
+    tstring buffer;
+    buffer.resize(len, _T('\0'));
+    _vstprintf_s(&buffer[0], len, format, args);
+    va_end(args);
+    m_log->write(log_level, m_logType, (m_name + _T(": ") + tstring(buffer.c_str())).c_str());
+}
+
+int RGYTaskGraph::add(const tstring& name, std::function<RGY_ERR()> func, const std::vector<int>& deps) {
+    const int id = (int)m_tasks.size();
+    Task task;
+    task.name = name;
+    task.func = std::move(func);
+    for (const auto dep : deps) {
+        //先に追加したタスクにしか依存できないので、循環は生じない
+        if (dep >= 0 && dep < id && std::find(task.deps.begin(), task.deps.end(), dep) == task.deps.end()) {
+            task.deps.push_back(dep);
+            m_tasks[dep].children.push_back(id);
+        }
+    }
+    m_tasks.push_back(std::move(task));
+    return id;
+}
+
+RGY_ERR RGYTaskGraph::run() {
+    const int taskCount = (int)m_tasks.size();
+    if (taskCount == 0) {
+        return RGY_ERR_NONE;
+    }
+    std::mutex mtx;
+    std::condition_variable cv;
+    std::deque<int> ready;
+    std::vector<int> waitDeps(taskCount);
+    for (int i = 0; i < taskCount; i++) {
+        waitDeps[i] = (int)m_tasks[i].deps.size();
+        if (waitDeps[i] == 0) {
+            ready.push_back(i);
+        }
+    }
+    int finished = 0;
+    int running = 0;
+    int idle = 0;
+    RGY_ERR result = RGY_ERR_NONE;
+    std::vector<std::thread> threads;
+    const auto timeStart = std::chrono::steady_clock::now();
+    auto elapsedMs = [timeStart]() {
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - timeStart).count();
+    };
+
+    std::function<void(bool)> worker;
+    //実行可能なタスクに対してスレッドが不足していれば追加する (mtxを取得した状態で呼ぶこと)
+    auto addWorkers = [&](const int selfTakes) {
+        for (int i = (int)ready.size() - selfTakes - idle; i > 0; i--) {
+            threads.push_back(std::thread(worker, true));
+            idle++; // 起動したスレッドは待機中として扱う
+        }
+    };
+    worker = [&](bool counted) {
+        std::unique_lock<std::mutex> lock(mtx);
+        for (;;) {
+            if (!counted) {
+                idle++;
+            }
+            counted = false;
+            cv.wait(lock, [&]() {
+                return finished == taskCount
+                    || (result != RGY_ERR_NONE && running == 0)
+                    || (result == RGY_ERR_NONE && !ready.empty());
+            });
+            idle--;
+            if (finished == taskCount || result != RGY_ERR_NONE) {
+                break;
+            }
+            const int id = ready.front();
+            ready.pop_front();
+            running++;
+            lock.unlock();
+
+            const auto& task = m_tasks[id];
+            const double start = elapsedMs();
+            AddMessage(RGY_LOG_DEBUG, _T("%s start at %.1f ms.\n"), task.name.c_str(), start);
+            RGY_ERR err = RGY_ERR_NONE;
+            try {
+                err = task.func();
+            } catch (const std::exception& e) {
+                AddMessage(RGY_LOG_ERROR, _T("%s: %s\n"), task.name.c_str(), char_to_tstring(e.what()).c_str());
+                err = RGY_ERR_UNKNOWN;
+            }
+            const double end = elapsedMs();
+            AddMessage(RGY_LOG_DEBUG, _T("%s end at %.1f ms (%.1f ms)%s.\n"), task.name.c_str(), end, end - start,
+                (err != RGY_ERR_NONE) ? (_T(": ") + tstring(get_err_mes(err))).c_str() : _T(""));
+
+            lock.lock();
+            running--;
+            finished++;
+            if (err != RGY_ERR_NONE) {
+                if (result == RGY_ERR_NONE) {
+                    result = err;
+                }
+            } else {
+                for (const auto child : task.children) {
+                    if (--waitDeps[child] == 0) {
+                        ready.push_back(child);
+                    }
+                }
+                addWorkers(1);
+            }
+            cv.notify_all();
+        }
+    };
+
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        addWorkers(1);
+    }
+    worker(false);
+    //worker()を抜けた時点で実行中のタスクはないので、これ以上threadsは増えない
+    for (auto& th : threads) {
+        th.join();
+    }
+    if (result != RGY_ERR_NONE && finished < taskCount) {
+        tstring skipped;
+        for (int i = 0; i < taskCount; i++) {
+            if (waitDeps[i] > 0 || std::find(ready.begin(), ready.end(), i) != ready.end()) {
+                skipped += _T(", ") + m_tasks[i].name;
+            }
+        }
+        if (skipped.length() > 0) {
+            AddMessage(RGY_LOG_DEBUG, _T("skipped %s.\n"), skipped.substr(2).c_str());
+        }
+    }
+    AddMessage(RGY_LOG_DEBUG, _T("total %.1f ms.\n"), elapsedMs());
+    return result;
+}
@@ -0,0 +1,68 @@
+﻿// -----------------------------------------------------------------------------------------
+// QSVEnc/NVEnc by rigaya
+// -----------------------------------------------------------------------------------------
+// The MIT License
+//
+// Copyright (c) 2011-2016 rigaya
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// --------------------------------------------------------------------------------------------
+
+#pragma once
+#ifndef __RGY_TASK_GRAPH_H__
+#define __RGY_TASK_GRAPH_H__
+
+#include <functional>
+#include <memory>
+#include <vector>
+#include "rgy_err.h"
+#include "rgy_log.h"
+#include "rgy_tchar.h"
+
+//依存関係のある処理(初期化など)を、依存するタスクの完了したものから並列に実行する
+//タスクはI/Oやドライバの待ちが主なので、同時に実行可能なタスクの数だけスレッドを使用する
+class RGYTaskGraph {
+public:
+    RGYTaskGraph(const tstring& name, std::shared_ptr<RGYLog> log, const RGYLogType logType = RGY_LOGT_CORE);
+    ~RGYTaskGraph();
+
+    //depsのタスクがすべて正常終了してから実行する
+    //戻り値はdepsに指定するためのタスクのid
+    int add(const tstring& name, std::function<RGY_ERR()> func, const std::vector<int>& deps = {});
+
+    //すべてのタスクを実行し、最初に発生したエラーを返す
+    //エラーが発生した場合、まだ開始していないタスクは実行せず、実行中のタスクの終了を待って戻る
+    RGY_ERR run();
+protected:
+    struct Task {
+        tstring name;
+        std::function<RGY_ERR()> func;
+        std::vector<int> deps;
+        std::vector<int> children;
+    };
+    void AddMessage(RGYLogLevel log_level, const TCHAR *format, ...);
+
+    tstring m_name;
+    std::shared_ptr<RGYLog> m_log;
+    RGYLogType m_logType;
+    std::vector<Task> m_tasks;
+};
+
+#endif //__RGY_TASK_GRAPH_H__
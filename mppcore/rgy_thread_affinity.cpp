@@ -27,8 +27,13 @@
 
 #include <sstream>
 #include <vector>
+#include <map>
+#include <memory>
+#include <algorithm>
 #include "rgy_thread_affinity.h"
 #include "rgy_osdep.h"
+#include "rgy_util.h"
+#include "rgy_filesystem.h"
 #if defined(_WIN32) || defined(_WIN64)
 #include <tlhelp32.h>
 #endif //#if defined(_WIN32) || defined(_WIN64)
@@ -423,6 +428,134 @@ bool RGYParamThreads::operator!=(const RGYParamThreads&x) const {
     return !(*this == x);
 }
 
+RGYCPUTopology::RGYCPUTopology() : cores(), maskBig(0), maskLittle(0), source() {};
+
+//0x0f -> "0-3" のようにコアの番号の一覧にする
+static tstring cpu_mask_to_list(uint64_t mask) {
+    tstring str;
+    for (int i = 0; i < 64; i++) {
+        if ((mask & (1llu << i)) == 0) continue;
+        int j = i;
+        while (j + 1 < 64 && (mask & (1llu << (j + 1)))) {
+            j++;
+        }
+        str += (j > i) ? strsprintf(_T(",%d-%d"), i, j) : strsprintf(_T(",%d"), i);
+        i = j;
+    }
+    return (str.length() > 0) ? str.substr(1) : _T("-");
+}
+
+tstring RGYCPUTopology::print() const {
+    if (!heterogeneous()) {
+        return strsprintf(_T("no big.LITTLE configuration detected (%d cores)"), (int)cores.size());
+    }
+    return strsprintf(_T("big cores %s (0x%llx), little cores %s (0x%llx) from %s"),
+        cpu_mask_to_list(maskBig).c_str(), (unsigned long long)maskBig,
+        cpu_mask_to_list(maskLittle).c_str(), (unsigned long long)maskLittle,
+        source.c_str());
+}
+
+#if !(defined(_WIN32) || defined(_WIN64))
+static bool read_sysfs_int(const std::string& path, int *value) {
+    std::unique_ptr<FILE, fp_deleter> fp(fopen(path.c_str(), "r"), fp_deleter());
+    return fp && fscanf(fp.get(), "%d", value) == 1;
+}
+#endif //#if !(defined(_WIN32) || defined(_WIN64))
+
+RGYCPUTopology rgy_get_cpu_topology(const tstring& sysfsRoot) {
+    RGYCPUTopology topology;
+#if !(defined(_WIN32) || defined(_WIN64))
+    std::string root = tchar_to_string(sysfsRoot);
+    if (root.length() == 0) {
+        const char *env = getenv("RGY_SYSFS_CPU_ROOT");
+        root = (env && env[0]) ? env : "/sys/devices/system/cpu";
+    }
+    for (int cpu = 0; cpu < 64; cpu++) {
+        const auto dir = strsprintf("%s/cpu%d", root.c_str(), cpu);
+        if (!rgy_directory_exists(dir)) continue;
+        int online = 1;
+        if (read_sysfs_int(dir + "/online", &online) && online == 0) continue; //cpu0にはonlineがないことがある
+        RGYCPUTopologyCore core = { cpu, 0, -1 };
+        read_sysfs_int(dir + "/cpu_capacity", &core.capacity);
+        read_sysfs_int(dir + "/topology/cluster_id", &core.cluster);
+        topology.cores.push_back(core);
+    }
+    //同じクラスタのコアは同じ性能とみなし、クラスタ内の最大のcapacityで判定する
+    //cluster_idが取得できなければ、コアごとに判定する
+    std::map<int, int> clusterCapacity;
+    for (const auto& core : topology.cores) {
+        const int key = (core.cluster >= 0) ? core.cluster : -1 - core.cpu;
+        clusterCapacity[key] = std::max(clusterCapacity[key], core.capacity);
+    }
+    int maxCapacity = 0;
+    for (const auto& [key, capacity] : clusterCapacity) {
+        maxCapacity = std::max(maxCapacity, capacity);
+    }
+    if (maxCapacity > 0) {
+        for (const auto& core : topology.cores) {
+            const int capacity = clusterCapacity[(core.cluster >= 0) ? core.cluster : -1 - core.cpu];
+            if (capacity <= 0) continue;
+            //最大の3/4以下をLITTLEとする (A76+A55なら1024と400台)
+            //中間の性能のコアがある構成 (prime+big+little) では、中間のコアもbigとする
+            if (capacity * 4 <= maxCapacity * 3) {
+                topology.maskLittle |= 1llu << core.cpu;
+            } else {
+                topology.maskBig |= 1llu << core.cpu;
+            }
+        }
+        topology.source = strsprintf(_T("%s/cpu*/cpu_capacity"), char_to_tstring(root).c_str());
+    }
+#endif //#if !(defined(_WIN32) || defined(_WIN64))
+    if (!topology.heterogeneous()) {
+        //cpu_capacityがない場合は、cpu_infoのPcore/Ecoreの判定を使う
+        const auto cpu_info = get_cpu_info();
+        topology.maskBig = cpu_info.maskCoreP;
+        topology.maskLittle = cpu_info.maskCoreE;
+        topology.source = _T("cpu info");
+    }
+    return topology;
+}
+
+bool rgy_thread_type_prefer_big_core(RGYThreadType type) {
+    switch (type) {
+    case RGYThreadType::MAIN:
+    case RGYThreadType::DEC:
+    case RGYThreadType::ENC:
+    case RGYThreadType::CSP:
+    case RGYThreadType::INPUT:
+    case RGYThreadType::FILTER:
+    case RGYThreadType::VIDEO_QUALITY:
+        return true;
+    case RGYThreadType::OUTPUT:
+    case RGYThreadType::AUDIO:
+    case RGYThreadType::PERF_MONITOR:
+    default:
+        return false;
+    }
+}
+
+std::vector<std::pair<RGYThreadType, tstring>> RGYParamThreads::resolve_auto_affinity(const RGYCPUTopology& topology) {
+    std::vector<std::pair<RGYThreadType, tstring>> placement;
+    for (int i = (int)RGYThreadType::ALL + 1; i < (int)RGYThreadType::END; i++) {
+        const auto type = (RGYThreadType)i;
+        auto& target = get(type);
+        if (target.affinity.mode != RGYThreadAffinityMode::AUTO) {
+            continue;
+        }
+        //プロセス全体を制限すると各スレッドの設定が意味をなさなくなるので、制限しない
+        if (!topology.heterogeneous() || type == RGYThreadType::PROCESS) {
+            target.affinity = RGYThreadAffinity(RGYThreadAffinityMode::ALL);
+            placement.push_back({ type, _T("all") });
+            continue;
+        }
+        const bool big = rgy_thread_type_prefer_big_core(type);
+        const auto mask = (big) ? topology.maskBig : topology.maskLittle;
+        target.affinity = RGYThreadAffinity(RGYThreadAffinityMode::CUSTOM, mask);
+        placement.push_back({ type, strsprintf(_T("%s cores %s"), (big) ? _T("big") : _T("little"), cpu_mask_to_list(mask).c_str()) });
+    }
+    return placement;
+}
+
 #pragma warning(push)
 #pragma warning(disable: 4146) //warning C4146: 符号付きの値を代入する変数は、符号付き型にキャストしなければなりません。
 uint64_t selectMaskFromLowerBit(uint64_t mask, const int idx) {
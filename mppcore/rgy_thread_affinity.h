@@ -31,6 +31,7 @@
 
 #include <cstdint>
 #include <array>
+#include <vector>
 #include <limits>
 #include "rgy_tchar.h"
 
@@ -96,6 +97,7 @@ enum class RGYThreadAffinityMode {
     CACHEL2,
     CACHEL3,
     CUSTOM,
+    AUTO,
     END
 };
 
@@ -107,7 +109,8 @@ static const std::array<std::pair<const TCHAR *, RGYThreadAffinityMode>, (int)RG
     std::pair<const TCHAR *, RGYThreadAffinityMode>{ _T("physical"), RGYThreadAffinityMode::PHYSICAL },
     std::pair<const TCHAR *, RGYThreadAffinityMode>{ _T("cachel2"),  RGYThreadAffinityMode::CACHEL2  },
     std::pair<const TCHAR *, RGYThreadAffinityMode>{ _T("cachel3"),  RGYThreadAffinityMode::CACHEL3  },
-    std::pair<const TCHAR *, RGYThreadAffinityMode>{ _T("custom"),   RGYThreadAffinityMode::CUSTOM   }
+    std::pair<const TCHAR *, RGYThreadAffinityMode>{ _T("custom"),   RGYThreadAffinityMode::CUSTOM   },
+    std::pair<const TCHAR *, RGYThreadAffinityMode>{ _T("auto"),     RGYThreadAffinityMode::AUTO     }
 };
 
 const TCHAR *rgy_thread_affnity_mode_to_str(RGYThreadAffinityMode mode);
@@ -163,6 +166,34 @@ static const std::array<std::pair<RGYThreadType, const TCHAR *>, (int)RGYThreadT
 
 const TCHAR *rgy_thread_type_to_str(RGYThreadType type);
 
+//sysfsから取得したコアの情報
+struct RGYCPUTopologyCore {
+    int cpu;      //論理コアの番号
+    int capacity; //cpu_capacity (最も性能の高いコアが1024、取得できなければ0)
+    int cluster;  //topology/cluster_id (取得できなければ-1)
+};
+
+//big.LITTLE構成のコアの割り当て (--thread-affinity auto) に使用するCPUの構成
+struct RGYCPUTopology {
+    std::vector<RGYCPUTopologyCore> cores;
+    uint64_t maskBig;    //性能の高いコアのマスク
+    uint64_t maskLittle; //性能の低いコアのマスク
+    tstring source;      //maskBig/maskLittleの判定に使用した情報
+
+    RGYCPUTopology();
+    bool heterogeneous() const { return maskBig != 0 && maskLittle != 0; }
+    tstring print() const;
+};
+
+//CPUの構成を取得する
+//sysfsRootにはテスト用に偽のsysfsのディレクトリを指定できる
+//空の場合は、環境変数RGY_SYSFS_CPU_ROOTか/sys/devices/system/cpuを使用する
+//cpu_capacityで性能差がわからない場合は、get_cpu_info()のPcore/Ecoreの情報を使用する
+RGYCPUTopology rgy_get_cpu_topology(const tstring& sysfsRoot = tstring());
+
+//autoの場合に性能の高いコアに割り当てるスレッドの種類かどうか
+bool rgy_thread_type_prefer_big_core(RGYThreadType type);
+
 enum class RGYParamThreadType {
     all,
     affinity,
@@ -205,6 +236,8 @@ struct RGYParamThreads {
     void set(const RGYThreadPriority priority, RGYThreadType type);
     void set(const RGYThreadPowerThrottlingMode mode, RGYThreadType type);
     void apply_unset();
+    //affinityがautoのものをCPUの構成に応じて決定し、決定した割り当てを返す
+    std::vector<std::pair<RGYThreadType, tstring>> resolve_auto_affinity(const RGYCPUTopology& topology);
     tstring to_string(RGYParamThreadType type) const;
     bool operator==(const RGYParamThreads&x) const;
     bool operator!=(const RGYParamThreads&x) const;
@@ -0,0 +1,200 @@
+﻿// -----------------------------------------------------------------------------------------
+// QSVEnc/NVEnc by rigaya
+// -----------------------------------------------------------------------------------------
+// The MIT License
+//
+// Copyright (c) 2011-2016 rigaya
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// --------------------------------------------------------------------------------------------
+
+
+#include <map>
+#include <algorithm>
+#include "rgy_thread_pool.h"
+#include "rgy_osdep.h"
+#include "rgy_event.h"
+
+//現在のスレッドがワーカーとして属するプールとその番号
+static thread_local RGYThreadPool *t_pool = nullptr;
+static thread_local int t_workerId = -1;
+
+void RGYThreadTaskGroup::finish() {
+    //待機フラグの確認は減算と同じアトミック操作で行う (減算後はwait()が戻ってgroupが破棄されうる)
+    const uint32_t prev = m_pending.fetch_sub(1, std::memory_order_acq_rel);
+    if (prev == (WAITING | 1)) {
+        rgy_wake_by_address_all(&m_pending);
+    }
+}
+
+void RGYThreadTaskGroup::wait() {
+    for (;;) {
+        const uint32_t pending = m_pending.load(std::memory_order_acquire);
+        if ((pending & ~WAITING) == 0) {
+            return;
+        }
+        //ワーカーから呼ばれた場合は、待っている間にプールのタスクを実行する
+        //(ワーカーがすべて待機してデッドロックするのを防ぐ)
+        if (m_pool && t_pool == m_pool && m_pool->run_one()) {
+            continue;
+        }
+        const uint32_t expected = m_pending.fetch_or(WAITING, std::memory_order_acq_rel) | WAITING;
+        if ((expected & ~WAITING) == 0) {
+            return;
+        }
+        //ワーカーの場合は他のタスクが積まれることもあるので、短い間隔で確認しなおす
+        rgy_wait_on_address(&m_pending, expected, (t_pool) ? 1 : INFINITE);
+    }
+}
+
+RGYThreadPool::RGYThreadPool(int num_threads, const RGYParamThread& threadParam) :
+    m_workers(),
+    m_threadParam(threadParam),
+    m_stop(false),
+    m_nextWorker(0),
+    m_queued(0),
+    m_signal(0),
+    m_sleeping(0) {
+    if (num_threads == 0) num_threads = std::thread::hardware_concurrency();
+    num_threads = std::max(num_threads, 1);
+    for (int i = 0; i < num_threads; i++) {
+        m_workers.push_back(std::make_unique<worker_t>());
+    }
+    for (int i = 0; i < num_threads; i++) {
+        m_workers[i]->thread = std::thread(&RGYThreadPool::workerFunc, this, i);
+    }
+}
+
+RGYThreadPool::~RGYThreadPool() {
+    //積まれているタスクはすべて実行してから終了する
+    m_stop = true;
+    m_signal.fetch_add(1, std::memory_order_seq_cst);
+    rgy_wake_by_address_all(&m_signal);
+    for (auto& worker : m_workers) {
+        if (worker->thread.joinable()) {
+            worker->thread.join();
+        }
+    }
+}
+
+std::shared_ptr<RGYThreadPool> RGYThreadPool::shared(const RGYParamThread& threadParam) {
+    static std::mutex mtx;
+    static std::map<tstring, std::weak_ptr<RGYThreadPool>> pools;
+    const auto key = threadParam.to_string(RGYParamThreadType::all);
+    std::lock_guard<std::mutex> lock(mtx);
+    auto pool = pools[key].lock();
+    if (!pool) {
+        pool = std::make_shared<RGYThreadPool>(0, threadParam);
+        pools[key] = pool;
+    }
+    return pool;
+}
+
+void RGYThreadPool::push(RGYThreadTask&& task, int affinity) {
+    const int workers = (int)m_workers.size();
+    int target = 0;
+    if (affinity >= 0) {
+        target = affinity % workers;
+    } else if (t_pool == this) {
+        target = t_workerId; //ワーカーから追加したタスクは自分のdequeに積む
+    } else {
+        target = (int)(m_nextWorker.fetch_add(1, std::memory_order_relaxed) % workers);
+    }
+    {
+        auto& worker = m_workers[target];
+        std::lock_guard<std::mutex> lock(worker->mtx);
+        worker->tasks.push_back(std::move(task));
+    }
+    m_queued.fetch_add(1, std::memory_order_seq_cst);
+    notify();
+}
+
+void RGYThreadPool::notify() {
+    m_signal.fetch_add(1, std::memory_order_seq_cst);
+    if (m_sleeping.load(std::memory_order_seq_cst) > 0) {
+        rgy_wake_by_address_all(&m_signal);
+    }
+}
+
+bool RGYThreadPool::pop(RGYThreadTask& task, int self) {
+    if (m_queued.load(std::memory_order_acquire) == 0) {
+        return false;
+    }
+    //自分のdequeからは最後に積んだものを取り出す
+    if (self >= 0) {
+        auto& worker = m_workers[self];
+        std::lock_guard<std::mutex> lock(worker->mtx);
+        if (!worker->tasks.empty()) {
+            task = std::move(worker->tasks.back());
+            worker->tasks.pop_back();
+            m_queued.fetch_sub(1, std::memory_order_relaxed);
+            return true;
+        }
+    }
+    //他のワーカーのdequeからは最も古いものを盗む
+    const int workers = (int)m_workers.size();
+    const int start = (self >= 0) ? self + 1 : 0;
+    for (int i = 0; i < workers; i++) {
+        const int target = (start + i) % workers;
+        if (target == self) continue;
+        auto& worker = m_workers[target];
+        std::lock_guard<std::mutex> lock(worker->mtx);
+        if (!worker->tasks.empty()) {
+            task = std::move(worker->tasks.front());
+            worker->tasks.pop_front();
+            m_queued.fetch_sub(1, std::memory_order_relaxed);
+            return true;
+        }
+    }
+    return false;
+}
+
+bool RGYThreadPool::run_one() {
+    RGYThreadTask task;
+    if (!pop(task, (t_pool == this) ? t_workerId : -1)) {
+        return false;
+    }
+    task();
+    return true;
+}
+
+void RGYThreadPool::workerFunc(int id) {
+    t_pool = this;
+    t_workerId = id;
+    m_threadParam.apply(GetCurrentThread());
+    RGYThreadTask task;
+    for (;;) {
+        //m_signalを先に読んでおけば、pop後にタスクが追加された場合にfutexはすぐに戻る
+        const uint32_t signal = m_signal.load(std::memory_order_seq_cst);
+        if (pop(task, id)) {
+            task();
+            task.reset();
+            continue;
+        }
+        if (m_stop) {
+            break;
+        }
+        m_sleeping.fetch_add(1, std::memory_order_seq_cst);
+        rgy_wait_on_address(&m_signal, signal, INFINITE);
+        m_sleeping.fetch_sub(1, std::memory_order_relaxed);
+    }
+    t_pool = nullptr;
+    t_workerId = -1;
+}
@@ -25,49 +25,148 @@
 //
 // --------------------------------------------------------------------------------------------
 
+
 #pragma once
 #ifndef __RGY_THREAD_POOL_H__
 #define __RGY_THREAD_POOL_H__
 
 #include <vector>
-#include <queue>
+#include <algorithm>
+#include <deque>
 #include <thread>
 #include <mutex>
-#include <condition_variable>
+#include <atomic>
 #include <functional>
 #include <future>
 #include <memory>
+#include <new>
+#include <type_traits>
+#include "rgy_thread_affinity.h"
 
-class RGYThreadPool {
+//スレッドプールで実行するタスク
+//小さな関数オブジェクトはヒープ確保せずに内部に保持する
+class RGYThreadTask {
+    static const size_t INLINE_SIZE = 48;
+    struct ops_t {
+        void (*invoke)(void *obj);
+        void (*move)(void *dst, void *src);
+        void (*destroy)(void *obj);
+    };
+    template<typename F, bool inlined>
+    struct ops_impl {
+        static F *get(void *obj) {
+            if constexpr (inlined) {
+                return std::launder(reinterpret_cast<F *>(obj));
+            } else {
+                return *reinterpret_cast<F **>(obj);
+            }
+        }
+        static void invoke(void *obj) { (*get(obj))(); }
+        static void move(void *dst, void *src) {
+            if constexpr (inlined) {
+                new (dst) F(std::move(*get(src)));
+                get(src)->~F();
+            } else {
+                *reinterpret_cast<F **>(dst) = get(src);
+            }
+        }
+        static void destroy(void *obj) {
+            if constexpr (inlined) {
+                get(obj)->~F();
+            } else {
+                delete get(obj);
+            }
+        }
+        static constexpr ops_t ops = { invoke, move, destroy };
+    };
 public:
-    RGYThreadPool(int num_threads = 0) {
-        if (num_threads == 0) num_threads = std::thread::hardware_concurrency();
-        num_threads = std::max(num_threads, 1);
-        for (int i = 0; i < num_threads; i++) {
-            workers.emplace_back([this] {
-                while (true) {
-                    std::function<void()> task;
-                    {
-                        std::unique_lock<std::mutex> lock(queue_mutex);
-                        condition.wait(lock, [this] {
-                            return stop || !tasks.empty();
-                        });
-                        
-                        if (stop && tasks.empty()) {
-                            return;
-                        }
-                        
-                        task = std::move(tasks.front());
-                        tasks.pop();
-                    }
-                    task();
-                }
-            });
+    RGYThreadTask() : m_ops(nullptr) {};
+    template<typename F, typename = std::enable_if_t<!std::is_same_v<std::decay_t<F>, RGYThreadTask>>>
+    RGYThreadTask(F&& f) : m_ops(nullptr) {
+        using Func = std::decay_t<F>;
+        constexpr bool inlined = sizeof(Func) <= INLINE_SIZE
+            && alignof(Func) <= alignof(std::max_align_t)
+            && std::is_nothrow_move_constructible_v<Func>;
+        if constexpr (inlined) {
+            new (m_buf) Func(std::forward<F>(f));
+        } else {
+            *reinterpret_cast<Func **>(m_buf) = new Func(std::forward<F>(f));
+        }
+        m_ops = &ops_impl<Func, inlined>::ops;
+    }
+    RGYThreadTask(RGYThreadTask&& x) noexcept : m_ops(x.m_ops) {
+        if (m_ops) {
+            m_ops->move(m_buf, x.m_buf);
+            x.m_ops = nullptr;
         }
     }
+    RGYThreadTask& operator=(RGYThreadTask&& x) noexcept {
+        if (this != &x) {
+            reset();
+            m_ops = x.m_ops;
+            if (m_ops) {
+                m_ops->move(m_buf, x.m_buf);
+                x.m_ops = nullptr;
+            }
+        }
+        return *this;
+    }
+    RGYThreadTask(const RGYThreadTask&) = delete;
+    RGYThreadTask& operator=(const RGYThreadTask&) = delete;
+    ~RGYThreadTask() { reset(); }
+    void operator()() { m_ops->invoke(m_buf); }
+    explicit operator bool() const { return m_ops != nullptr; }
+    void reset() {
+        if (m_ops) {
+            m_ops->destroy(m_buf);
+            m_ops = nullptr;
+        }
+    }
+private:
+    alignas(std::max_align_t) unsigned char m_buf[INLINE_SIZE];
+    const ops_t *m_ops;
+};
 
+//待機可能なタスクのまとまり
+//wait()はタスクの完了を待つ間、スレッドプールのタスクを実行して手伝う
+class RGYThreadTaskGroup {
+public:
+    RGYThreadTaskGroup() : m_pending(0) {};
+    ~RGYThreadTaskGroup() { wait(); }
+    RGYThreadTaskGroup(const RGYThreadTaskGroup&) = delete;
+    RGYThreadTaskGroup& operator=(const RGYThreadTaskGroup&) = delete;
+    void wait();
+    bool done() const { return (m_pending.load(std::memory_order_acquire) & ~WAITING) == 0; }
+protected:
+    friend class RGYThreadPool;
+    static const uint32_t WAITING = 0x80000000u; //wait()で待機中のスレッドがいる
+    void add() { m_pending.fetch_add(1, std::memory_order_relaxed); }
+    void finish();
+
+    std::atomic<uint32_t> m_pending; //未完了のタスク数
+    class RGYThreadPool *m_pool = nullptr;
+};
+
+//ワーカーごとのタスクのdequeを持ち、空いたワーカーが他のワーカーのタスクを盗んで実行するスレッドプール
+//ワーカー自身は自分のdequeの末尾から、盗むときは先頭から取り出す
+class RGYThreadPool {
+public:
+    //num_threads = 0 の場合は論理コア数
+    //threadParamは各ワーカーで適用するスレッドの設定
+    RGYThreadPool(int num_threads = 0, const RGYParamThread& threadParam = RGYParamThread());
+    ~RGYThreadPool();
+    RGYThreadPool(const RGYThreadPool&) = delete;
+    RGYThreadPool& operator=(const RGYThreadPool&) = delete;
+
+    //同じスレッドの設定を使う箇所で共有するスレッドプールを取得する
+    //使用するすべての箇所で解放されると、プールも破棄される
+    static std::shared_ptr<RGYThreadPool> shared(const RGYParamThread& threadParam);
+
+    int size() const { return (int)m_workers.size(); }
+
+    //タスクを追加し、戻り値をstd::futureで受け取る
     template<class F, class... Args>
-    auto enqueue(F&& f, Args&&... args) 
+    auto enqueue(F&& f, Args&&... args)
         -> std::future<typename std::invoke_result<F, Args...>::type> {
         using return_type = typename std::invoke_result<F, Args...>::type;
 
@@ -76,35 +175,92 @@ public:
         );
 
         std::future<return_type> res = task->get_future();
-        {
-            std::unique_lock<std::mutex> lock(queue_mutex);
-            if (stop) {
-                throw std::runtime_error("スレッドプールは停止しています");
-            }
-            tasks.emplace([task]() { (*task)(); });
+        if (m_stop) {
+            throw std::runtime_error("スレッドプールは停止しています");
         }
-        condition.notify_one();
+        push(RGYThreadTask([task]() { (*task)(); }), -1);
         return res;
     }
 
-    ~RGYThreadPool() {
-        {
-            std::unique_lock<std::mutex> lock(queue_mutex);
-            stop = true;
+    //グループにタスクを追加する (小さなタスクはヒープ確保なし)
+    //affinityに0以上を指定すると、そのワーカーのdequeに追加する (空いていれば他のワーカーが盗む)
+    template<typename F>
+    void run(RGYThreadTaskGroup& group, F&& f, int affinity = -1) {
+        group.add();
+        group.m_pool = this;
+        push(RGYThreadTask([&group, func = std::forward<F>(f)]() mutable {
+            func();
+            group.finish();
+        }), affinity);
+    }
+
+    //[begin, end)をchunks個の範囲に分割し、func(start, end)を並列に実行して完了を待つ
+    //範囲iはワーカー(affinityBase + i)に割り当てるので、毎回同じaffinityBaseを指定すると
+    //同じ範囲(画像の同じ行など)が同じワーカーで処理される (affinityBase < 0 なら順に割り当てる)
+    //呼び出したスレッドも最初の範囲を処理し、その後まだ開始されていない範囲があれば引き取って処理する
+    //(ワーカーが長いタスクを実行中でも待たされないように)
+    template<typename F>
+    void parallel_for(int begin, int end, int chunks, F&& func, int affinityBase = -1) {
+        const int count = end - begin;
+        chunks = std::max(1, std::min({ chunks, count, 64 }));
+        if (chunks <= 1 || m_workers.size() == 0) {
+            if (count > 0) func(begin, end);
+            return;
+        }
+        if (affinityBase < 0) {
+            affinityBase = (int)(m_nextWorker.fetch_add(chunks - 1, std::memory_order_relaxed) % m_workers.size());
+        }
+        //呼び出し元がすべての範囲を引き取った場合、ワーカー側のタスクはparallel_forから戻った後に実行されうるので、
+        //範囲の管理情報はタスクと共有する (funcは範囲を取得できたときのみ参照する)
+        struct chunk_state_t {
+            std::atomic<uint64_t> claimed; //処理を開始した範囲のビットマスク
+            RGYThreadTaskGroup group;      //すべての範囲の完了待ち
+            chunk_state_t() : claimed(0), group() {};
+        };
+        auto state = std::make_shared<chunk_state_t>();
+        state->group.m_pool = this;
+        for (int i = 0; i < chunks; i++) {
+            state->group.add();
         }
-        condition.notify_all();
-        for (std::thread &worker : workers) {
-            worker.join();
+        auto runChunk = [begin, count, chunks](chunk_state_t *st, int i, F& f) {
+            const uint64_t bit = (uint64_t)1 << i;
+            if (st->claimed.fetch_or(bit, std::memory_order_acq_rel) & bit) {
+                return;
+            }
+            f(begin + (int)((int64_t)count * i / chunks), begin + (int)((int64_t)count * (i + 1) / chunks));
+            st->group.finish();
+        };
+        auto pfunc = &func;
+        for (int i = 1; i < chunks; i++) {
+            push(RGYThreadTask([state, pfunc, runChunk, i]() { runChunk(state.get(), i, *pfunc); }), affinityBase + i - 1);
+        }
+        for (int i = 0; i < chunks; i++) {
+            runChunk(state.get(), i, func);
         }
+        state->group.wait();
     }
 
-private:
-    std::vector<std::thread> workers;
-    std::queue<std::function<void()>> tasks;
-    
-    std::mutex queue_mutex;
-    std::condition_variable condition;
-    bool stop = false;
+    //タスクを1つ取り出して実行する (なければfalse)
+    bool run_one();
+protected:
+    friend class RGYThreadTaskGroup;
+    struct alignas(64) worker_t {
+        std::mutex mtx;
+        std::deque<RGYThreadTask> tasks;
+        std::thread thread;
+    };
+    void push(RGYThreadTask&& task, int affinity);
+    bool pop(RGYThreadTask& task, int self);
+    void workerFunc(int id);
+    void notify();
+
+    std::vector<std::unique_ptr<worker_t>> m_workers;
+    RGYParamThread m_threadParam;
+    std::atomic<bool> m_stop;
+    std::atomic<uint32_t> m_nextWorker; //affinity指定なしのタスクを追加するワーカー
+    alignas(64) std::atomic<uint32_t> m_queued; //dequeに積まれているタスク数
+    alignas(64) std::atomic<uint32_t> m_signal; //タスクの追加のたびに更新 (待機中のワーカーの起床用)
+    std::atomic<uint32_t> m_sleeping; //m_signalで待機中のワーカー数
 };
 
 #endif //__RGY_THREAD_POOL_H__
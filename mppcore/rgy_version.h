@@ -126,7 +126,6 @@ const char *get_encoder_version();
 
 #define ENABLE_KEYFRAME_INSERT 0
 #define ENABLE_AUTO_PICSTRUCT 1
-#define ENABLE_SM_READER          0
 
 #include "rgy_config.h"
 #define ENCODER_NAME              "rkmppenc"
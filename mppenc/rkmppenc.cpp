@@ -45,6 +45,7 @@
 #include "rgy_avutil.h"
 #include "rgy_opencl.h"
 #include "rgy_opencl_perf.h"
+#include "rgy_job_server.h"
 
 static void show_version() {
     _ftprintf(stdout, _T("%s\n"), get_encoder_version());
@@ -209,7 +210,7 @@ int parse_print_options(const TCHAR *option_name, const TCHAR *arg1, const RGYPa
 }
 
 //Ctrl + C ハンドラ
-static bool g_signal_abort = false;
+static std::atomic<bool> g_signal_abort(false);
 #pragma warning(push)
 #pragma warning(disable:4100)
 static void sigcatch(int sig) {
@@ -323,7 +324,8 @@ static int run_on_os_codepage() {
 }
 #endif //#if defined(_WIN32) || defined(_WIN64)
 
-int mpp_run(MPPParam *pParams) {
+//sharedCL: --serverで、OpenCLのコンテキストをジョブ間で共有する場合に指定する
+int mpp_run(MPPParam *pParams, std::atomic<bool> *abortFlag, std::shared_ptr<RGYOpenCLContext> *sharedCL) {
     const auto clPerfDumpDir = pParams->ctrl.clPerfDumpDir;
     const auto clPerfDisasmTool = pParams->ctrl.clPerfDisasmTool;
     const auto clPerfOclocPath = pParams->ctrl.clPerfOclocPath;
@@ -331,11 +333,12 @@ int mpp_run(MPPParam *pParams) {
     const auto pythonPath = pParams->ctrl.pythonPath;
     const bool clPerfGenerateReport = !pParams->ctrl.parallelEnc.isChild();
     auto mpp = std::make_unique<MPPCore>();
+    mpp->SetSharedOpenCLContext(sharedCL);
     if (mpp->init(pParams) != RGY_ERR_NONE) {
         return 1;
     }
     mpp->PrintEncoderParam();
-    mpp->SetAbortFlagPointer(&g_signal_abort);
+    mpp->SetAbortFlagPointer(abortFlag);
     set_signal_handler();
 
     try {
@@ -361,41 +364,7 @@ int mpp_run(MPPParam *pParams) {
     return 0;
 }
 
-int _tmain(int argc, TCHAR **argv) {
-#if defined(_WIN32) || defined(_WIN64)
-    if (check_locale_is_ja()) {
-        _tsetlocale(LC_ALL, _T("Japanese"));
-    }
-#endif //#if defined(_WIN32) || defined(_WIN64)
-
-    if (argc == 1) {
-        show_version();
-        show_help();
-        return 1;
-    }
-
-#if defined(_WIN32) || defined(_WIN64)
-    if (GetACP() == CODE_PAGE_UTF8) {
-        bool switch_to_os_cp = false;
-        for (int iarg = 1; iarg < argc; iarg++) {
-            if (iarg + 1 < argc
-                && _tcscmp(argv[iarg + 0], CODEPAGE_CMDARG) == 0) {
-                if (_tcscmp(argv[iarg + 1], _T("os")) == 0) {
-                    switch_to_os_cp = true;
-                } else if (_tcscmp(argv[iarg + 1], _T("utf8")) == 0) {
-                    switch_to_os_cp = false;
-                } else {
-                    _ftprintf(stderr, _T("Unknown option for %s.\n"), CODEPAGE_CMDARG);
-                    return 1;
-                }
-            }
-        }
-        if (switch_to_os_cp) {
-            return run_on_os_codepage();
-        }
-    }
-#endif //#if defined(_WIN32) || defined(_WIN64)
-
+static int run_cmd(int argc, const TCHAR **argv, std::atomic<bool> *abortFlag, std::shared_ptr<RGYOpenCLContext> *sharedCL) {
     RGYParamLogLevel loglevelPrint(RGY_LOG_ERROR);
     for (int iarg = 1; iarg < argc-1; iarg++) {
         if (tstring(argv[iarg]) == _T("--log-level")) {
@@ -470,10 +439,110 @@ int _tmain(int argc, TCHAR **argv) {
         _ftprintf(stderr, _T("destination file is equal to source file!"));
         return 1;
     }
+    if (sharedCL != nullptr) {
+        // --serverのジョブでは、標準入出力はクライアントとの通信に使用している
+        if (prm.common.inputFilename == _T("-") || prm.common.outputFilename == _T("-")) {
+            _ftprintf(stderr, _T("stdin/stdout could not be used in --server jobs.\n"));
+            return 1;
+        }
+        // --cl-perf-dumpはプロセス全体の計測を有効にし、後続のジョブにも影響するため使用できない
+        if (!prm.ctrl.clPerfDumpDir.empty()) {
+            _ftprintf(stderr, _T("--cl-perf-dump could not be used in --server jobs.\n"));
+            return 1;
+        }
+    }
 
-    if (mpp_run(&prm)) {
+    if (mpp_run(&prm, abortFlag, sharedCL)) {
         fprintf(stderr, "Finished with error in rkmppenc.\n");
         return 1;
     }
     return 0;
 }
+
+#if ENABLE_RGY_JOB_SERVER
+//UNIXドメインソケットで受け付けたジョブ(コマンドライン)を順に実行する
+//OpenCLのコンテキストとビルド済みのカーネルをジョブ間で共有し、2つ目以降のジョブの初期化を短縮する
+static int run_server(const tstring& socketPath) {
+    RGYJobServer server;
+    if (server.init(socketPath) != RGY_ERR_NONE) {
+        return 1;
+    }
+    set_signal_handler();
+    signal(SIGTERM, sigcatch);
+    _ftprintf(stderr, _T("rkmppenc server: listening on %s.\n"), socketPath.c_str());
+
+    //ジョブの実行中は、共有するOpenCLのコンテキストはジョブのログに出力する
+    //ジョブの終了後にジョブのログが使われないよう、サーバーのログに戻す
+    auto serverLog = std::make_shared<RGYLog>(nullptr, RGY_LOG_ERROR);
+    std::shared_ptr<RGYOpenCLContext> sharedCL;
+    const auto err = server.run([&sharedCL, &serverLog](const std::vector<tstring>& args, std::atomic<bool> *abort) {
+        std::vector<const TCHAR *> argv;
+        argv.push_back(_T("rkmppenc"));
+        for (const auto& arg : args) {
+            argv.push_back(arg.c_str());
+        }
+        const int ret = run_cmd((int)argv.size(), argv.data(), abort, &sharedCL);
+        if (sharedCL) {
+            sharedCL->setLog(serverLog);
+        }
+        return ret;
+    }, &g_signal_abort);
+    server.close();
+    sharedCL.reset();
+    _ftprintf(stderr, _T("rkmppenc server: stopped.\n"));
+    return (err != RGY_ERR_NONE) ? 1 : 0;
+}
+#endif //#if ENABLE_RGY_JOB_SERVER
+
+int _tmain(int argc, TCHAR **argv) {
+#if defined(_WIN32) || defined(_WIN64)
+    if (check_locale_is_ja()) {
+        _tsetlocale(LC_ALL, _T("Japanese"));
+    }
+#endif //#if defined(_WIN32) || defined(_WIN64)
+
+    if (argc == 1) {
+        show_version();
+        show_help();
+        return 1;
+    }
+
+#if defined(_WIN32) || defined(_WIN64)
+    if (GetACP() == CODE_PAGE_UTF8) {
+        bool switch_to_os_cp = false;
+        for (int iarg = 1; iarg < argc; iarg++) {
+            if (iarg + 1 < argc
+                && _tcscmp(argv[iarg + 0], CODEPAGE_CMDARG) == 0) {
+                if (_tcscmp(argv[iarg + 1], _T("os")) == 0) {
+                    switch_to_os_cp = true;
+                } else if (_tcscmp(argv[iarg + 1], _T("utf8")) == 0) {
+                    switch_to_os_cp = false;
+                } else {
+                    _ftprintf(stderr, _T("Unknown option for %s.\n"), CODEPAGE_CMDARG);
+                    return 1;
+                }
+            }
+        }
+        if (switch_to_os_cp) {
+            return run_on_os_codepage();
+        }
+    }
+#endif //#if defined(_WIN32) || defined(_WIN64)
+
+    for (int iarg = 1; iarg < argc; iarg++) {
+        if (tstring(argv[iarg]) == _T("--server")) {
+#if ENABLE_RGY_JOB_SERVER
+            if (iarg + 1 >= argc || argc != 3) {
+                _ftprintf(stderr, _T("--server requires a socket path, and could not be used with other options.\n"));
+                return 1;
+            }
+            return run_server(argv[iarg + 1]);
+#else
+            _ftprintf(stderr, _T("--server is not supported on this platform.\n"));
+            return 1;
+#endif //#if ENABLE_RGY_JOB_SERVER
+        }
+    }
+
+    return run_cmd(argc, (const TCHAR **)argv, &g_signal_abort, nullptr);
+}